@@ -36,7 +36,7 @@ generate_build_scripts() {
 
 build() {
     cd build
-    ninja wyverse
+    ninja wyverse wyverse-analyze
     cd ..
 }
 
@@ -0,0 +1,115 @@
+//===-- AESDFA.h - Differential fault analysis of AES-128 -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The Piret-Quisquater attack on the last round key of AES-128, from pairs of
+// correct and faulty ciphertexts of the same plaintext.
+//
+// A fault on one byte of the state between the MixColumns of rounds 8 and 9
+// makes the input of the round-9 MixColumns differ on one byte of a column,
+// so its output differs by (2e, e, e, 3e), rotated by the row of the byte,
+// and the ciphertexts differ on the four bytes that column is shifted to.
+// For each of the 4 x 255 (row, e) a key byte k at such a position must
+// satisfy
+//
+//   InvSBox[C ^ k] ^ InvSBox[C' ^ k] = MixColumns coefficient * e
+//
+// whose solutions are read from a precomputed differential table, so a pair
+// leaves about 2^8 candidates for the four key bytes of the column and two
+// pairs usually leave one.  A fault before the round-8 MixColumns spreads to
+// every column of round 9 and gives one such pair per column.
+//
+// A fault of an earlier round also changes the 16 bytes, and its pair gives
+// candidates that do not hold the key.  The pairs of a column vote for their
+// candidates instead of intersecting them: the candidates with the most
+// votes are kept, and the column is solved once one of them has the votes
+// of two pairs at least and no other ties with it.  The pairs that do not
+// vote for it are outliers.
+//
+// The four columns are independent: the pairs are queued per column and
+// solve() reduces them with one thread per column.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_AESDFA_H
+#define LLVM_EXECUTIONENGINE_AESDFA_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace llvm {
+
+class AESDFA {
+public:
+  static const int Useless = -1;
+  static const int AllColumns = 4;  // the fault hit round 8
+
+  /// Positions - The ciphertext bytes that the column of the round-9
+  /// MixColumns is shifted to, by row.
+  static const unsigned Positions[4][4];
+
+  struct Column {
+    // The pairs voting for each value of the key bytes at Positions[Col],
+    // byte i in bits 8i..8i+7.
+    std::unordered_map<uint32_t, unsigned> Votes;
+    // The values with the most votes, sorted.
+    std::vector<uint32_t> Candidates;
+    unsigned MaxVotes = 0;
+    unsigned NumPairs = 0;          // pairs that voted
+
+    struct Pair {
+      std::array<uint8_t, 4> Correct, Diff;
+    };
+    std::vector<Pair> Pending;
+  };
+
+private:
+  Column Columns[4];
+  unsigned NumUseful = 0, NumUseless = 0;
+
+  void reduce(unsigned Col);
+
+public:
+  /// getFaultedColumn - The column of round 9 whose MixColumns input the
+  /// fault changed on one byte, AllColumns for a fault of round 8, or
+  /// Useless.
+  static int getFaultedColumn(ArrayRef<uint8_t> Correct,
+                              ArrayRef<uint8_t> Faulty);
+
+  /// addPair - Queue a pair of 16-byte ciphertexts.  Returns false if the
+  /// fault cannot be used.
+  bool addPair(ArrayRef<uint8_t> Correct, ArrayRef<uint8_t> Faulty);
+
+  /// solve - Reduce the candidates of every column with its queued pairs.
+  void solve();
+
+  const Column &getColumn(unsigned Col) const { return Columns[Col]; }
+  unsigned getNumUseful() const { return NumUseful; }
+  unsigned getNumUseless() const { return NumUseless; }
+
+  /// isSolved - Whether every column has one candidate ahead.
+  bool isSolved() const;
+
+  /// getLastRoundKey - The round-10 key once solved.
+  bool getLastRoundKey(uint8_t Key[16]) const;
+
+  /// invertKeySchedule - The AES-128 key whose round-10 key is given.
+  static void invertKeySchedule(const uint8_t LastRoundKey[16],
+                                uint8_t Key[16]);
+
+  /// print - The candidates left per column and, once solved, the keys.
+  void print(raw_ostream &OS) const;
+};
+
+} // End llvm namespace
+
+#endif
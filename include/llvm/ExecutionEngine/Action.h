@@ -2,14 +2,26 @@
 #define LLVM_EXECUTIONENGINE_ACTION_H
 
 #include "llvm/ADT/APInt.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/InstructionIndex.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
 #include "llvm/IR/InstVisitor.h"
+#include "llvm/Support/Error.h"
 #include <list>
 
 namespace llvm {
 
 struct ExecutionContext;
 class Interpreter;
+class CPAEngine;
+class TVLAEngine;
+class SNREngine;
+class LookupTables;
+class TaintAction;
+class TraceSampleFilter;
+struct FaultSpec;
+struct TaintSource;
 
 
 class ECStackAccessor {
@@ -27,12 +39,23 @@ public:
 class Action: public ECStackAccessor {
 private:
   Interpreter * interpreter;
+  const InstructionIndex * instIndex = nullptr;
 public:
   Action() {}
   virtual ~Action() {}
 
   virtual void setInterpreter(Interpreter * interpreter);
   Interpreter * getInterpreter();
+  virtual void setInstructionIndex(const InstructionIndex * index) {
+    instIndex = index;
+  }
+  const InstructionIndex * getInstructionIndex() { return instIndex; }
+
+  // Batch mode: called around each run of the entry function, the record
+  // collects what the actions observe during the run.
+  virtual void beginRun(TraceRecord &Record) {}
+  virtual void endRun(TraceRecord &Record) {}
+
   virtual void beforeVisitInst(Instruction &I, ExecutionContext &SF) {}
   virtual bool skipExecuteInst(Instruction &I) {return false;}
   virtual void afterVisitInst(Instruction &I, ExecutionContext &SF) {}
@@ -41,7 +64,33 @@ public:
 
 
 class ActionFactory {
+  // Shared by the analysis actions of all the workers of a batch.
+  CPAEngine * cpaEngine = nullptr;
+  TVLAEngine * tvlaEngine = nullptr;
+  SNREngine * snrEngine = nullptr;
+  LookupTables * lookupTables = nullptr;
+  const TraceSampleFilter * traceFilter = nullptr;
+  const std::vector<FaultSpec> * faultSpecs = nullptr;
+  const std::vector<TaintSource> * taintSources = nullptr;
+  // The trace actions created after a taint action only record the values
+  // it finds tainted.
+  const TaintAction * taintAction = nullptr;
+
 public:
+  void setCPAEngine(CPAEngine * engine) { cpaEngine = engine; }
+  void setTVLAEngine(TVLAEngine * engine) { tvlaEngine = engine; }
+  void setSNREngine(SNREngine * engine) { snrEngine = engine; }
+  void setLookupTables(LookupTables * tables) { lookupTables = tables; }
+  void setTraceFilter(const TraceSampleFilter * filter) {
+    traceFilter = filter;
+  }
+  void setFaultSpecs(const std::vector<FaultSpec> * specs) {
+    faultSpecs = specs;
+  }
+  void setTaintSources(const std::vector<TaintSource> * sources) {
+    taintSources = sources;
+  }
+
   Action * createAction(const char *);
 };
 
@@ -65,6 +114,24 @@ public:
     }
   }
 
+  void setInstructionIndex(const InstructionIndex * index) override {
+    for (Action *action : actionList) {
+      action->setInstructionIndex(index);
+    }
+  }
+
+  void beginRun(TraceRecord &Record) override {
+    for (Action *action : actionList) {
+      action->beginRun(Record);
+    }
+  }
+
+  void endRun(TraceRecord &Record) override {
+    for (Action *action : actionList) {
+      action->endRun(Record);
+    }
+  }
+
   void beforeVisitInst(Instruction &I, ExecutionContext &SF) override {
     for (Action *action : actionList) {
       action->beforeVisitInst(I, SF);
@@ -114,10 +181,39 @@ public:
 
 };
 
+// The static instructions whose values the trace action records, e.g. the
+// points of interest selected by the snr action.  Matched through the
+// instruction index, so only in batch mode.
+class TraceSampleFilter {
+  BitVector insts;
+
+public:
+  void addInstruction(uint32_t ID) {
+    if (ID >= insts.size())
+      insts.resize(ID + 1);
+    insts.set(ID);
+  }
+  bool accept(uint32_t ID) const { return ID < insts.size() && insts[ID]; }
+  unsigned count() const { return insts.count(); }
+  // Keep only the instructions Other accepts too.
+  void intersect(const TraceSampleFilter &Other) { insts &= Other.insts; }
+  iterator_range<BitVector::const_set_bits_iterator> instructions() const {
+    return insts.set_bits();
+  }
+
+  // Read a POI file: one instruction ID first on each line, '#' comments.
+  static Expected<TraceSampleFilter> readFile(StringRef Path);
+};
+
 class TraceProcessor: public InstVisitor<TraceProcessor>,
 		      public ECStackAccessor {
 private:
   Action * action;
+  // batch mode: samples go to the record instead of the standard output
+  TraceRecord * record = nullptr;
+  const TraceSampleFilter * filter = nullptr;
+  const TaintAction * taint = nullptr;
+  uint32_t curInstID = InstructionIndex::InvalidID;
   void traceAPInt(APInt Val);
 
   // default visitor for most of instructions
@@ -131,6 +227,11 @@ private:
 public:
   TraceProcessor(Action * action) { this->action = action; }
 
+  void setRecord(TraceRecord * record) { this->record = record; }
+  void setFilter(const TraceSampleFilter * filter) { this->filter = filter; }
+  void setTaint(const TaintAction * taint) { this->taint = taint; }
+  void process(Instruction &I);
+
   void trace(GenericValue GV, Type *Ty);
 
   // =========== instruction visitors ============
@@ -192,12 +293,26 @@ class TraceAction : public Action, public InstVisitor<TraceAction> {
   TraceProcessor postProcessor = TraceProcessor(this);
 
 public:
+  TraceAction(const TraceSampleFilter * filter = nullptr,
+              const TaintAction * taint = nullptr) {
+    postProcessor.setFilter(filter);
+    postProcessor.setTaint(taint);
+  }
+
   void setECStack(std::vector<ExecutionContext> * ECStack) override {
     postProcessor.setECStack(ECStack);
   }
 
+  void beginRun(TraceRecord &Record) override {
+    postProcessor.setRecord(&Record);
+  }
+
+  void endRun(TraceRecord &Record) override {
+    postProcessor.setRecord(nullptr);
+  }
+
   void afterVisitInst(Instruction &I, ExecutionContext &SF) override {
-    postProcessor.visit(I);
+    postProcessor.process(I);
   }
 
   void print(raw_ostream &ROS) override;
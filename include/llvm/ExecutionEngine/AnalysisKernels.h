@@ -0,0 +1,55 @@
+//===-- AnalysisKernels.h - Inner loops of the trace analyses ---*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The hot loops shared by the analysis engines.  Each kernel has a portable
+// implementation and, on x86-64 hosts, an AVX2 one selected at runtime from
+// the CPU features, so that a single binary runs everywhere.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_ANALYSISKERNELS_H
+#define LLVM_EXECUTIONENGINE_ANALYSISKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace llvm {
+namespace kernels {
+
+/// hasAVX2 - Whether the AVX2 kernels are used.
+bool hasAVX2();
+
+/// accumulateProducts - Acc[i] += X * H[i] for i in [0, N).
+void accumulateProducts(uint32_t *Acc, const uint8_t *H, uint8_t X, size_t N);
+
+/// widenAndClear - Wide[i] += Narrow[i], Narrow[i] = 0 for i in [0, N).
+void widenAndClear(uint64_t *Wide, uint32_t *Narrow, size_t N);
+
+/// axpy - Y[i] += A * X[i] for i in [0, N), summed in double.
+void axpy(double *Y, const float *X, double A, size_t N);
+void axpy(double *Y, const double *X, double A, size_t N);
+
+/// multiply - C = A B for row-major A (M x K), B (K x N, rows LdB doubles
+/// apart) and C (M x N).
+void multiply(double *C, const float *A, const double *B, size_t M, size_t K,
+              size_t N, size_t LdB);
+
+/// xorInto - Dst[i] ^= Src[i] for i in [0, N).
+void xorInto(uint64_t *Dst, const uint64_t *Src, size_t N);
+
+/// popcount - Number of bits set in A[0, N).
+uint64_t popcount(const uint64_t *A, size_t N);
+
+/// popcountAnd - Number of bits set in A[i] & B[i] for i in [0, N).
+uint64_t popcountAnd(const uint64_t *A, const uint64_t *B, size_t N);
+
+} // End kernels namespace
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,58 @@
+//===-- BitTraces.h - Bit-level traces packed by columns --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The DCA attacks on white-boxes look at the traced values bit by bit.  A
+// BitTraceMatrix splits each byte sample in 8 bit samples and stores every
+// bit sample as a column of packed 64-bit words: trace n is bit n % 64 of word
+// n / 64.  One bit per (trace, bit sample) is 8 times smaller than the byte
+// traces, and the statistics of a column against a selection bit become
+// AND + popcount over words.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_BITTRACES_H
+#define LLVM_EXECUTIONENGINE_BITTRACES_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+class BitTraceMatrix {
+  uint64_t NumColumns = 0;
+  uint64_t Capacity = 0;          // in traces, a multiple of 64
+  uint64_t NumTraces = 0;
+  std::vector<uint64_t> Words;    // [column][word]
+
+public:
+  BitTraceMatrix() = default;
+  /// BitTraceMatrix - Room for \p MaxTraces traces of \p NumSamples byte
+  /// samples (8 x NumSamples columns).
+  BitTraceMatrix(uint64_t NumSamples, uint64_t MaxTraces);
+
+  uint64_t getNumColumns() const { return NumColumns; }
+  uint64_t getNumTraces() const { return NumTraces; }
+  uint64_t getNumWords() const { return Capacity / 64; }
+
+  /// addTrace - Append a trace, shorter ones are zero-padded.  Returns false
+  /// when the matrix is full.
+  bool addTrace(ArrayRef<uint8_t> Samples);
+
+  /// getColumn - The packed bits of column \p C (bit C % 8 of byte sample
+  /// C / 8), getNumWords() words whose bits past getNumTraces() are zero.
+  const uint64_t *getColumn(uint64_t C) const {
+    return &Words[C * getNumWords()];
+  }
+  uint64_t *getColumn(uint64_t C) { return &Words[C * getNumWords()]; }
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,206 @@
+//===-- CPAEngine.h - Streaming correlation power analysis ------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Correlation power analysis (CPA, or DCA on white-box traces) computed while
+// the traces are acquired: the CPA action adds the samples of each run to
+// running sums and drops them, so no trace has to be stored.
+//
+// For every sample s, target t and guess k the engine keeps
+//
+//   Sum x, Sum x^2            (per sample)
+//   Sum h, Sum h^2            (per target and guess)
+//   Sum x * h                 (per sample, target and guess)
+//
+// where x is the sample and h = HW(Sel_t(v, k)) the leakage predicted by the
+// selection function from the value v known for the trace.  The sums are
+// exact integers, so the accumulation is order-independent and does not lose
+// precision whatever the number of traces; the correlation is only computed,
+// in floating point, when a key ranking is asked for.
+//
+// The products are laid out sample-major, [sample][target][guess], so that a
+// sample updates one contiguous row with the SIMD kernels.  They are 32-bit
+// wide and flushed into 64-bit sums before they can overflow.
+//
+// Every batch worker owns a CPAAccumulator, rank() merges them and can be
+// called at any point of the campaign.  With checkpoints every N runs, the
+// trace of a run waits to be added until the checkpoint before it has
+// ranked, so that each ranking covers exactly the runs emitted so far
+// whatever the workers run ahead; a stop drops the waiting traces.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_CPAENGINE_H
+#define LLVM_EXECUTIONENGINE_CPAENGINE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/SelectionFunction.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace llvm {
+
+struct CPAOptions {
+  // The intermediate value whose leakage is predicted.
+  std::shared_ptr<const SelectionFunction> Selection;
+  SmallVector<unsigned, 16> TargetBytes;   // default: all the targets
+  // Window of samples analysed: [SampleBegin, SampleBegin + MaxSamples).
+  uint64_t SampleBegin = 0;
+  uint64_t MaxSamples = 0;                 // 0: up to the end of the trace
+};
+
+class CPAEngine;
+
+/// CPAAccumulator - The running sums of one worker.
+class CPAAccumulator {
+  friend class CPAEngine;
+
+  const CPAEngine &Engine;
+  sys::Mutex Lock;                // held while a trace is added or ranked
+  uint64_t NumTraces = 0;
+  uint64_t SinceWiden = 0;        // traces added to SumXH since the flush
+  size_t NumSamples = 0;
+  std::vector<uint64_t> SumX, SumX2;
+  std::vector<uint64_t> SumH, SumH2;
+  std::vector<uint32_t> SumXH;
+  std::vector<uint64_t> WideXH;   // allocated at the first flush
+  std::vector<uint8_t> Pred;      // predictions of the current trace
+
+  void resize(size_t Samples);
+  void widen();
+
+public:
+  explicit CPAAccumulator(const CPAEngine &Engine);
+
+  void addTrace(const TraceRecord &Record);
+};
+
+class CPAEngine {
+public:
+  static const uint64_t NoSample = ~0ULL;
+
+  struct Guess {
+    uint8_t Key;
+    double Score;                 // highest |correlation| over the samples
+    uint64_t Sample;              // where it is reached
+    uint64_t PairSample;          // second sample of a higher-order attack
+  };
+  struct ByteRanking {
+    unsigned Byte;
+    std::vector<Guess> Guesses;   // by decreasing score
+  };
+  struct Ranking {
+    uint64_t NumTraces = 0;
+    std::vector<ByteRanking> Bytes;
+  };
+
+private:
+  CPAOptions Opts;
+  SelectionTable Table;
+  unsigned RowSize;               // targets x guesses
+  uint64_t WidenPeriod;
+  mutable sys::Mutex Lock;
+  std::vector<std::unique_ptr<CPAAccumulator>> Accumulators;
+
+  // Checkpoints: the runs before Checked are ranked, the next ones wait.
+  uint64_t CheckPeriod = 0;
+  uint64_t Checked = 0;
+  bool Stopped = false;
+  mutable std::mutex GateLock;
+  mutable std::condition_variable GateCV;
+
+  /// admit - Wait until the trace of run Index may be added; false if the
+  /// campaign stopped before it.
+  bool admit(uint64_t Index) const;
+
+  friend class CPAAccumulator;
+
+public:
+  explicit CPAEngine(const CPAOptions &Opts);
+
+  const CPAOptions &getOptions() const { return Opts; }
+  unsigned getNumTargets() const { return Opts.TargetBytes.size(); }
+
+  /// createAccumulator - The sums of a new worker, owned by the engine.
+  CPAAccumulator &createAccumulator();
+
+  /// predict - Fill H[t * G + k] with the predicted leakage of the trace
+  /// for each target and each of the G guesses.  Returns false if the record
+  /// has too few input (output) bytes to predict from.
+  bool predict(const TraceRecord &Record, uint8_t *H) const;
+
+  /// rank - Rank the guesses of each target with the traces added so
+  /// far.  Safe to call while the workers are running.
+  Ranking rank() const;
+
+  /// setCheckPeriod - Rank every Period runs: the traces of the runs after
+  /// a checkpoint are held back until passCheckpoint or stop.
+  void setCheckPeriod(uint64_t Period) { CheckPeriod = Period; }
+  /// passCheckpoint - The runs before NumRuns are ranked, let the next
+  /// period in.
+  void passCheckpoint(uint64_t NumRuns);
+  /// stop - No trace is added any more.
+  void stop();
+
+  static void printRanking(raw_ostream &OS, const Ranking &R,
+                           unsigned Top = 4, StringRef Attack = "CPA");
+};
+
+/// CPAConvergence - Follows the rankings of a running attack from checkpoint
+/// to checkpoint.  A byte is settled once the same guess has been ranked
+/// first, ahead of the second by a relative margin
+/// (score1 - score2) / score1 of at least Margin, at Checkpoints checkpoints
+/// in a row.
+class CPAConvergence {
+  double Margin;
+  unsigned Checkpoints;
+  std::vector<int> Best;            // per byte number, -1: none yet
+  std::vector<unsigned> Streak;
+  std::vector<uint8_t> KnownKey;    // reported ranks, empty: unknown key
+
+public:
+  CPAConvergence(double Margin, unsigned Checkpoints,
+                 ArrayRef<uint8_t> KnownKey = None)
+    : Margin(Margin), Checkpoints(Checkpoints),
+      KnownKey(KnownKey.begin(), KnownKey.end()) {}
+
+  static double getMargin(const CPAEngine::ByteRanking &BR);
+
+  /// update - Take the ranking of a new checkpoint.  Returns true once every
+  /// byte is settled.
+  bool update(const CPAEngine::Ranking &R);
+
+  /// print - One line per checkpoint: best key, smallest margin, settled
+  /// bytes and the ranks of the known key.
+  void print(raw_ostream &OS, const CPAEngine::Ranking &R) const;
+};
+
+/// CPAAction - Feeds the samples collected by the trace action during a run
+/// to a CPA accumulator.
+class CPAAction : public Action {
+  CPAAccumulator &Acc;
+
+public:
+  explicit CPAAction(CPAAccumulator &Acc) : Acc(Acc) {}
+
+  void endRun(TraceRecord &Record) override { Acc.addTrace(Record); }
+
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -61,6 +61,23 @@ class ObjectFile;
 
 } // end namespace object
 
+/// RunLimits - Bounds on one run of the white-box interpreter, so that a
+/// program sent astray (by a fault, typically) ends instead of hanging its
+/// worker.  Zero means unbounded.
+struct RunLimits {
+  uint64_t MaxInsts = 0;       // dynamic instructions from the entry call
+  uint64_t MaxAllocBytes = 0;  // live heap bytes, or one alloca
+  double Timeout = 0;          // wall-clock seconds
+};
+
+/// RunAbort - Why a run was ended by its limits.
+enum class RunAbort : uint8_t {
+  None,                        // the run ended by itself
+  InstLimit,
+  AllocLimit,
+  Timeout,
+};
+
 /// Helper class for helping synchronize access to the global address map
 /// table.  Access to this class should be serialized under a mutex.
 class ExecutionEngineState {
@@ -303,6 +320,30 @@ public:
   int runFunctionAsMain(Function *Fn, const std::vector<std::string> &argv,
                         const char * const * envp);
 
+  /** white-box interpreter run control **/
+
+  /// setTrapExit - When enabled, a call to exit() from the program ends the
+  /// current run instead of the host process.  Used by batch mode, which
+  /// runs the entry function many times on the same engine.
+  virtual void setTrapExit(bool Trap) {}
+
+  /// seedRun - Seed the sources of randomness seen by the program (rand(),
+  /// random()) for the next run.
+  virtual void seedRun(uint64_t Seed) {}
+
+  /// setOutputCapture - Append what the program writes to its standard
+  /// output / error to the given buffers instead of the host streams (null
+  /// restores the host stream).
+  virtual void setOutputCapture(std::string *Stdout, std::string *Stderr) {}
+
+  /// setRunLimits - Bound the runs.  Takes effect at once: the clock of the
+  /// run in progress, if any, restarts, its instruction count goes on.
+  virtual void setRunLimits(const RunLimits &Limits) {}
+
+  /// getRunAbort - Why the last run ended early, RunAbort::None if it did
+  /// not.
+  virtual RunAbort getRunAbort() const { return RunAbort::None; }
+
 
   /// addGlobalMapping - Tell the execution engine that the specified global is
   /// at the specified location.  This is used internally as functions are JIT'd
@@ -0,0 +1,157 @@
+//===-- FaultAction.h - Instruction-level fault injection -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The fault action injects faults in the execution of the program.  A fault
+// targets one execution (occurrence) of a static instruction, identified by
+// its InstructionIndex ID, or all its executions, and applies a fault model:
+//
+//   skip              the instruction is not executed; a value it defines
+//                     keeps its previous value, or zero on its first
+//                     execution
+//   bit-flip:B        bit B of the result is flipped
+//   set-byte:N,V      byte N of the result is set to V
+//   random            the result is replaced by random bits
+//   memory:N[,M]      byte N of the memory addressed by the instruction (the
+//                     pointer operand of a load / store, or a pointer result)
+//                     is XOR-ed with M, a random non-zero mask if omitted;
+//                     before a load, so that it reads the faulty byte
+//   branch[:S]        a br / switch goes to its successor S, or to a
+//                     successor it would not have taken if S is omitted
+//
+// The result of a store is the value it writes in memory.  Faults are given
+// as ID[@OCC]:MODEL[:ARGS], OCC counting from 0 or '*' for every execution,
+// e.g. 1234@2:bit-flip:7.  A sweep of faults replaces numbers by inclusive
+// ranges, e.g. 1234@0-9:bit-flip:0-7.
+//
+// Only the targeted instructions are looked up, in a small pointer set, and
+// the action stops looking once its one-shot faults are injected, so a fault
+// run executes at the speed of a plain run.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_FAULTACTION_H
+#define LLVM_EXECUTIONENGINE_FAULTACTION_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace llvm {
+
+enum class FaultModel {
+  Skip,
+  BitFlip,
+  SetByte,
+  Random,
+  Memory,
+  Branch,
+};
+
+struct FaultSpec {
+  static const uint64_t EveryOccurrence = ~0ULL;
+
+  uint32_t Inst = InstructionIndex::InvalidID;
+  uint64_t Occurrence = 0;         // execution faulted, 0: the first
+  FaultModel Model = FaultModel::Skip;
+  unsigned Bit = 0;                // BitFlip
+  unsigned Byte = 0;               // SetByte, Memory: offset
+  uint8_t Value = 0;               // SetByte: new byte, Memory: XOR mask
+  bool RandomMask = false;         // Memory: draw the mask per injection
+  int Successor = -1;              // Branch, -1: one not taken
+
+  /// parse - Read ID[@OCC]:MODEL[:ARGS].
+  static Expected<FaultSpec> parse(StringRef Spec);
+
+  /// parseSweep - Read a fault whose numbers may be FIRST-LAST ranges, into
+  /// the faults of every combination.
+  static Expected<std::vector<FaultSpec>> parseSweep(StringRef Spec);
+
+  /// check - Why the fault cannot be injected on I, or null.
+  const char *check(Instruction &I) const;
+
+  void print(raw_ostream &OS) const;
+};
+
+class FaultAction : public Action {
+  struct Site {
+    const FaultSpec *Spec;
+    Instruction *Inst;             // null: not resolved, never injected
+    uint64_t Count;                // executions of Inst in the current run
+  };
+
+  std::vector<FaultSpec> Specs;
+  std::vector<Site> Sites;
+  SmallPtrSet<const Instruction *, 4> Targets;
+  unsigned Pending = 0;            // one-shot faults not injected yet
+  bool Persistent = false;         // some fault hits every execution
+  bool Armed = false;              // Pending || Persistent
+  SmallVector<const FaultSpec *, 2> Firing;  // on the current instruction
+  bool Skipping = false;
+  uint64_t RandomState = 0;
+  uint64_t NumInjected = 0;        // in the current run
+  std::function<void(const uint8_t *, uint64_t)> WriteHook;
+
+  void resolve();
+  void reset(uint64_t Seed);
+  void arm(Instruction &I, ExecutionContext &SF);
+  void inject(Instruction &I, ExecutionContext &SF);
+  void corruptResult(const FaultSpec &F, Instruction &I, ExecutionContext &SF);
+  void corruptMemory(const FaultSpec &F, Instruction &I, ExecutionContext &SF);
+  void forceBranch(const FaultSpec &F, Instruction &I, ExecutionContext &SF);
+  void mutate(const FaultSpec &F, MutableArrayRef<uint8_t> Bytes);
+  void mutateMemory(const FaultSpec &F, MutableArrayRef<uint8_t> Bytes,
+                    Type *Ty);
+  uint64_t nextRandom();
+
+public:
+  explicit FaultAction(ArrayRef<FaultSpec> Specs)
+    : Specs(Specs.begin(), Specs.end()) {}
+
+  uint64_t getNumInjected() const { return NumInjected; }
+
+  /// setSpecs - Replace the faults in the middle of a run, e.g. in a run
+  /// forked from a checkpoint.  The occurrences count from the next
+  /// instruction and the random draws restart from Seed.
+  void setSpecs(ArrayRef<FaultSpec> NewSpecs, uint64_t Seed);
+
+  /// setWriteHook - Called with the program memory the action corrupts,
+  /// before and after corrupting it.
+  void setWriteHook(std::function<void(const uint8_t *, uint64_t)> Hook) {
+    WriteHook = std::move(Hook);
+  }
+
+  void setInstructionIndex(const InstructionIndex * index) override;
+  void beginRun(TraceRecord &Record) override;
+
+  void beforeVisitInst(Instruction &I, ExecutionContext &SF) override {
+    if (LLVM_UNLIKELY(Armed) && LLVM_UNLIKELY(Targets.count(&I)))
+      arm(I, SF);
+  }
+
+  bool skipExecuteInst(Instruction &I) override { return Skipping; }
+
+  void afterVisitInst(Instruction &I, ExecutionContext &SF) override {
+    if (LLVM_UNLIKELY(!Firing.empty()))
+      inject(I, SF);
+  }
+
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,121 @@
+//===-- GuestFileSystem.h - Preloaded files served to the program -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// White-box programs often load multi-megabyte tables with fopen()/fread() at
+// startup.  Files registered here are memory-mapped once by the host and the
+// stdio wrappers of the interpreter (lle_X_fopen, lle_X_fread, ...) serve
+// them from memory, so repeated runs never touch the disk.
+//
+// With zero-copy enabled, the page-aligned part of a large fread() is mapped
+// copy-on-write over the destination buffer instead of being copied: the
+// program reads the host mapping directly and only the pages it writes get
+// duplicated.  This needs the buffer and the file position to share the same
+// offset within a page, other reads fall back to a memcpy().  Only the
+// buffers the file system owns are mapped over: with zero-copy enabled, the
+// large malloc / calloc of the program get anonymous mappings of their own
+// (see allocate), whereas a mapping over memory of the host allocator would
+// outlive the buffer and refill its pages from the file.
+//
+// A handle is not a host FILE: the stdio functions without a wrapper stop
+// the interpreter when they get one instead of passing it to the host libc,
+// and the writes fail as on a stream opened for reading.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_GUESTFILESYSTEM_H
+#define LLVM_EXECUTIONENGINE_GUESTFILESYSTEM_H
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+
+namespace llvm {
+
+class GuestFileSystem {
+public:
+  struct Image {
+    std::unique_ptr<MemoryBuffer> Data;
+    int FD = -1;                   // kept open for zero-copy mappings
+
+    StringRef getBuffer() const { return Data->getBuffer(); }
+  };
+
+  /// GuestFile - What the program gets as a FILE * for a preloaded file.
+  struct GuestFile {
+    const Image *Img;
+    size_t Pos = 0;
+    bool Eof = false;
+    bool Error = false;            // a write was attempted
+
+    explicit GuestFile(const Image *Img) : Img(Img) {}
+  };
+
+private:
+  StringMap<Image> Images;
+  bool ZeroCopy = false;
+
+  // Handles currently open, by any interpreter.
+  sys::Mutex HandlesLock;
+  DenseSet<const void *> Handles;
+
+  // The buffers allocated for the program, by address: their size.
+  sys::Mutex BuffersLock;
+  std::map<uintptr_t, size_t> Buffers;
+
+  bool ownsRange(const void *Addr, size_t Len);
+
+  void copyOrMap(const Image &Img, size_t Pos, uint8_t *Dst, size_t Len);
+
+public:
+  ~GuestFileSystem();
+
+  /// instance - The file system shared by all the interpreters.  It must be
+  /// filled before the programs start to run.
+  static GuestFileSystem &instance();
+
+  /// preload - Serve the host file \p HostPath when the program opens
+  /// \p GuestPath for reading.
+  Error preload(StringRef GuestPath, StringRef HostPath);
+  void setZeroCopy(bool Enable) { ZeroCopy = Enable; }
+  bool empty() const { return Images.empty(); }
+
+  /// open - A new handle on a preloaded file, or null if \p Path is not
+  /// preloaded or \p Mode is not a read-only mode.
+  GuestFile *open(StringRef Path, StringRef Mode);
+  /// isGuestFile - Whether a FILE * of the program is one of our handles.
+  bool isGuestFile(const void *Stream);
+  void close(GuestFile *File);
+
+  /// allocate - A zeroed buffer of Size bytes for the program, that large
+  /// reads can be mapped over; null if zero-copy is disabled or Size too
+  /// small to map, then the host allocator serves it.
+  void *allocate(size_t Size);
+  /// release - Free Ptr if it was allocated here.
+  bool release(void *Ptr);
+  /// getBufferSize - The size of a buffer allocated here, 0 otherwise.
+  size_t getBufferSize(const void *Ptr);
+
+  size_t read(GuestFile *File, void *Dst, size_t Size, size_t Count);
+  char *gets(GuestFile *File, char *Dst, int Size);
+  int getc(GuestFile *File);
+  /// ungetc - Push back \p C, which must be the byte just read.
+  int ungetc(GuestFile *File, int C);
+  int seek(GuestFile *File, int64_t Offset, int Whence);
+  int64_t tell(GuestFile *File) const { return File->Pos; }
+};
+
+} // End llvm namespace
+
+#endif
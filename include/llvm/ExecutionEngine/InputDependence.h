@@ -0,0 +1,123 @@
+//===-- InputDependence.h - Static input dependence -------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The input dependence analysis finds, before any run, the instructions
+// whose value may depend on the taint sources (see TaintAction.h): all the
+// others can be left out of the traces without following the taint at run
+// time.  It is the static counterpart of the taint action, with the same
+// rules, over every possible run of the entry function:
+//
+//   - a forward data flow over the SSA values of the whole module, to a
+//     fixed point, flow-insensitive;
+//   - memory is split into objects: the globals, the allocas, the blocks of
+//     each malloc / calloc / realloc call, and what the pointer arguments of
+//     the entry function point to.  A pointer value points to a set of
+//     objects; a pointer loaded from memory or made from an integer points
+//     to an unknown object, which aliases them all.  An object is tainted
+//     as a whole once a tainted value may be stored in it;
+//   - the interpreted functions bind their arguments and return values to
+//     all their call sites; the external functions are summarized: memcpy,
+//     memmove and memset move taint between objects, the allocators return
+//     a fresh object, fread taints its buffer, a few functions only read,
+//     and any other one may write in the objects of its pointer arguments
+//     from all its arguments (e.g. sscanf).
+//
+// The modules are linked by name as the interpreter links them: a call to a
+// function declared in one module and defined in another binds to the
+// definition, a global declared in several modules is one object.  Only the
+// declarations defined nowhere are external.
+//
+// The result is the set of the possibly dependent instructions, by
+// InstructionIndex ID, in the form of a TraceSampleFilter.  It is cached in
+// a sidecar file in the format of a POI file, whose first line holds a key
+// computed by the caller from the modules and the sources.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_INPUTDEPENDENCE_H
+#define LLVM_EXECUTIONENGINE_INPUTDEPENDENCE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SparseBitVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/InstructionIndex.h"
+#include "llvm/ExecutionEngine/TaintAction.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+class InputDependence {
+  typedef SparseBitVector<> ObjectSet;
+  static const unsigned UnknownObject = 0;
+
+  const InstructionIndex &Index;
+  Function &Entry;
+  std::vector<TaintSource> Sources;
+  std::vector<Module *> Modules;             // of the instructions of Index
+  // The definitions with external linkage, by name.
+  StringMap<Function *> FunctionDefs;
+  StringMap<GlobalVariable *> GlobalDefs;
+
+  // The objects by the value that allocates them, 0 is the unknown object.
+  DenseMap<const Value *, unsigned> Objects;
+  DenseMap<const Value *, ObjectSet> PointsTo;
+  DenseSet<const Value *> Tainted;
+  ObjectSet TaintedObjects;
+  // Per function: what its ret instructions return, whether a tainted
+  // value goes to its variable arguments.
+  DenseMap<const Function *, ObjectSet> ReturnedObjects;
+  DenseSet<const Function *> TaintedReturns, TaintedVarArgs;
+  std::vector<Function *> AddressTaken;
+  bool TaintFread = false;
+  bool Changed = false;
+
+  void linkModules();
+  Function *resolve(Function *F) const;
+  const Value *resolve(const Value *V) const;
+  unsigned getObject(const Value *V);
+  void addSources();
+  ObjectSet getPointsTo(const Value *V);
+  bool isTainted(const Value *V) const;
+  bool readsTainted(const ObjectSet &Objs) const;
+  void taint(const Value *V, bool Taint = true);
+  void taintObjects(const ObjectSet &Objs, bool Taint = true);
+  void addPointsTo(const Value *V, const ObjectSet &Objs);
+  void visit(Instruction &I);
+  void visitCall(CallSite CS);
+  void bindCall(CallSite CS, Function &F);
+  void visitExternalCall(CallSite CS, Function *F);
+
+public:
+  InputDependence(const InstructionIndex &Index, Function &Entry,
+                  ArrayRef<TaintSource> Sources)
+    : Index(Index), Entry(Entry), Sources(Sources.begin(), Sources.end()) {}
+
+  /// run - The instructions whose value may depend on the sources.
+  TraceSampleFilter run();
+
+  /// writeFile - Cache Dependent for Key in the sidecar file Path.
+  static Error writeFile(StringRef Path, uint64_t Key,
+                         const TraceSampleFilter &Dependent);
+
+  /// readFile - The instructions cached in Path for Key, None if the file
+  /// does not exist or was computed for another key.
+  static Expected<Optional<TraceSampleFilter>> readFile(StringRef Path,
+                                                        uint64_t Key);
+};
+
+} // End llvm namespace
+
+#endif
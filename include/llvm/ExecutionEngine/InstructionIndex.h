@@ -0,0 +1,61 @@
+//===-- InstructionIndex.h - Static instruction numbering -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Gives every instruction of a module a stable identifier: its rank in module
+// order.  Two copies of the same module (one per batch worker) number their
+// instructions identically, so the identifiers can be stored in trace files
+// and used to select instructions from the command line.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_INSTRUCTIONINDEX_H
+#define LLVM_EXECUTIONENGINE_INSTRUCTIONINDEX_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+class InstructionIndex {
+  DenseMap<const Instruction *, uint32_t> IDs;
+  std::vector<Instruction *> Insts;
+
+public:
+  static const uint32_t InvalidID = ~0U;
+
+  InstructionIndex() {}
+  explicit InstructionIndex(Module &M) { addModule(M); }
+
+  void addModule(Module &M) {
+    for (Function &F : M)
+      for (BasicBlock &BB : F)
+        for (Instruction &I : BB) {
+          IDs[&I] = Insts.size();
+          Insts.push_back(&I);
+        }
+  }
+
+  uint32_t lookup(const Instruction *I) const {
+    auto It = IDs.find(I);
+    return It == IDs.end() ? InvalidID : It->second;
+  }
+
+  Instruction *getInstruction(uint32_t ID) const {
+    return ID < Insts.size() ? Insts[ID] : nullptr;
+  }
+
+  size_t size() const { return Insts.size(); }
+};
+
+} // End llvm namespace
+
+#endif
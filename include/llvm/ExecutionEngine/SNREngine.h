@@ -0,0 +1,161 @@
+//===-- SNREngine.h - Streaming SNR and points of interest ------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Signal-to-noise ratio of the samples with respect to an intermediate value
+// known during profiling (an input byte, or an S-box output under a known
+// key).  The traces are split into the 256 classes of the value; for a
+// sample x
+//
+//   signal = Var(E[x | v]) = Sum_v n_v (mean_v - mean)^2 / n
+//   noise  = E[Var(x | v)] = Var(x) - signal
+//
+// so the engine only keeps, per sample, Sum x^2 and the per-class Sum x.
+// The class sums are 32-bit and flushed into 64-bit sums before they can
+// overflow, as in the CPA engine.
+//
+// The samples with the highest SNR are the points of interest (POI).  They
+// are mapped to the static instructions that produce them, through the
+// sample-to-instruction index of the first run, and written to a POI file
+// that a later campaign gives to the trace action (-trace-insts), which then
+// only records those instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_SNRENGINE_H
+#define LLVM_EXECUTIONENGINE_SNRENGINE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+/// SNRTarget - The intermediate value that splits the traces in classes.
+enum class SNRTarget {
+  InputByte,          // input[t]
+  OutputByte,         // output[t]
+  FirstRoundSBox,     // SBox[input[t] ^ key[t]]
+  LastRoundInvSBox,   // InvSBox[output[t] ^ key[t]]
+};
+
+struct SNROptions {
+  SNRTarget Target = SNRTarget::InputByte;
+  SmallVector<unsigned, 16> TargetBytes;   // default: bytes 0 to 15
+  std::vector<uint8_t> Key;                // known key of the S-box targets
+  // Window of samples analysed: [SampleBegin, SampleBegin + MaxSamples).
+  uint64_t SampleBegin = 0;
+  uint64_t MaxSamples = 0;                 // 0: up to the end of the trace
+};
+
+class SNREngine;
+
+/// SNRAccumulator - The class sums of one worker.
+class SNRAccumulator {
+  friend class SNREngine;
+
+  SNREngine &Engine;
+  sys::Mutex Lock;                // held while a trace is added or merged
+  uint64_t NumTraces = 0;
+  uint64_t SinceWiden = 0;
+  size_t NumSamples = 0;
+  std::vector<uint64_t> ClassCount;   // [target][class]
+  std::vector<uint64_t> SumX2;        // [sample]
+  std::vector<uint32_t> SumX;         // [sample][target][class]
+  std::vector<uint64_t> WideX;        // allocated at the first flush
+  std::vector<uint8_t> Classes;       // classes of the current trace
+
+  void resize(size_t Samples);
+  void widen();
+
+public:
+  explicit SNRAccumulator(SNREngine &Engine);
+
+  void addTrace(const TraceRecord &Record);
+};
+
+class SNREngine {
+public:
+  struct Result {
+    uint64_t NumTraces = 0;
+    uint64_t SampleBegin = 0;
+    std::vector<double> SNR;           // best over the targets, per sample
+    std::vector<unsigned> Target;      // target byte of the best SNR
+  };
+  /// PointOfInterest - A static instruction and the best SNR of its samples.
+  struct PointOfInterest {
+    uint32_t Inst;
+    double SNR;
+    unsigned NumSamples;
+  };
+
+private:
+  SNROptions Opts;
+  unsigned RowSize;               // target bytes x 256 classes
+  mutable sys::Mutex Lock;
+  std::vector<std::unique_ptr<SNRAccumulator>> Accumulators;
+  std::vector<uint32_t> SampleInsts;
+
+  friend class SNRAccumulator;
+
+public:
+  explicit SNREngine(const SNROptions &Opts);
+
+  const SNROptions &getOptions() const { return Opts; }
+  unsigned getNumTargets() const { return Opts.TargetBytes.size(); }
+
+  /// createAccumulator - The sums of a new worker, owned by the engine.
+  SNRAccumulator &createAccumulator();
+
+  /// classify - Fill C[t] with the class of the trace for each target byte.
+  /// Returns false if the record has no byte to classify it with.
+  bool classify(const TraceRecord &Record, uint8_t *C) const;
+
+  /// setSampleInsts - The static instruction of each sample of a run.
+  void setSampleInsts(ArrayRef<uint32_t> Insts);
+
+  /// compute - The SNR of the traces added so far.
+  Result compute() const;
+
+  /// selectPOI - The instructions of the samples whose SNR is at least
+  /// \p Threshold if it is positive, or else of the best \p Fraction of the
+  /// samples; by decreasing SNR.
+  Expected<std::vector<PointOfInterest>>
+  selectPOI(const Result &R, double Fraction, double Threshold) const;
+
+  /// writePOIFile - One "inst snr samples" line per instruction, the file
+  /// read by TraceSampleFilter::readFile.
+  Error writePOIFile(StringRef Path, const Result &R,
+                     ArrayRef<PointOfInterest> POI) const;
+
+  static void printSummary(raw_ostream &OS, const Result &R,
+                           ArrayRef<PointOfInterest> POI);
+};
+
+/// SNRAction - Feeds the samples collected by the trace action during a run
+/// to an SNR accumulator.
+class SNRAction : public Action {
+  SNRAccumulator &Acc;
+
+public:
+  explicit SNRAction(SNRAccumulator &Acc) : Acc(Acc) {}
+
+  void endRun(TraceRecord &Record) override { Acc.addTrace(Record); }
+
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,131 @@
+//===-- SelectionFunction.h - Predicted intermediate values -----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A selection function predicts an intermediate value of the attacked cipher,
+// Sel_t(v, k), from a value v known for every trace (computed from the input
+// or the output bytes) and a guess k of a part t of the key.  The attacks
+// (streaming CPA, offline CPA / DPA / DCA / LDA) only see the function
+// through a SelectionTable, the values of Sel_t(v, k) for every v and k, so
+// that the prediction of a trace for all the guesses is a row copy.
+//
+// The functions are looked up by name in SelectionFunctionRegistry.  The
+// built-in ones target the first-round S-box of AES, DES and SM4 and the
+// last-round inverse S-box of AES; other intermediates are added by a plugin
+// (-load) that registers its own function:
+//
+//   static SelectionFunctionRegistry::Add<MyFunction>
+//   X("my-function", "description");
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_SELECTIONFUNCTION_H
+#define LLVM_EXECUTIONENGINE_SELECTIONFUNCTION_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/CipherTables.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Registry.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+class SelectionFunction {
+public:
+  /// KnownSource - Where the known value of a trace is computed from.
+  enum KnownSource {
+    Input,
+    Output,
+  };
+
+  virtual ~SelectionFunction() {}
+
+  virtual KnownSource getSource() const = 0;
+
+  /// getNumTargets - Number of key parts attacked separately (16 key bytes
+  /// for AES, 8 6-bit subkey chunks for DES).
+  virtual unsigned getNumTargets() const = 0;
+
+  /// getNumGuesses - Number of values of a key part, at most 256.
+  virtual unsigned getNumGuesses() const { return 256; }
+
+  /// getNumBits - Width of the predicted value, at most 8.
+  virtual unsigned getNumBits() const { return 8; }
+
+  /// isUniform - Whether Sel_t does not depend on t, the targets then share
+  /// one table.
+  virtual bool isUniform() const { return false; }
+
+  /// getKnownSize - Number of input (output) bytes the known value of the
+  /// target is computed from.
+  virtual unsigned getKnownSize(unsigned Target) const = 0;
+
+  /// getKnown - The known value of the target for the input (output) Bytes.
+  virtual uint8_t getKnown(ArrayRef<uint8_t> Bytes, unsigned Target) const = 0;
+
+  /// evaluate - Sel_t(Known, Guess).  Called for every Known value, whether
+  /// getKnown can return it or not.
+  virtual uint8_t evaluate(unsigned Target, uint8_t Known,
+                           unsigned Guess) const = 0;
+};
+
+typedef Registry<SelectionFunction> SelectionFunctionRegistry;
+extern template class Registry<SelectionFunction>;
+
+/// createSelectionFunction - Instantiate the registered function Name.
+Expected<std::unique_ptr<SelectionFunction>>
+createSelectionFunction(StringRef Name);
+
+/// SelectionTable - Sel_t(v, k) and its Hamming weight for the targets of an
+/// attack, [target][v][guess].
+class SelectionTable {
+  unsigned NumGuesses;
+  unsigned NumBits;
+  unsigned NumTargets;
+  bool Uniform;
+  std::vector<uint8_t> Values;
+  std::vector<uint8_t> Weights;
+
+  size_t getOffset(unsigned T, uint8_t V) const {
+    return ((Uniform ? 0 : T) * 256 + V) * NumGuesses;
+  }
+
+public:
+  SelectionTable()
+    : NumGuesses(0), NumBits(0), NumTargets(0), Uniform(true) {}
+  /// Targets are the key parts of F attacked, in the order of the attack.
+  SelectionTable(const SelectionFunction &F, ArrayRef<unsigned> Targets);
+
+  unsigned getNumGuesses() const { return NumGuesses; }
+  unsigned getNumBits() const { return NumBits; }
+  unsigned getNumTargets() const { return NumTargets; }
+  bool isUniform() const { return Uniform; }
+
+  /// getValues - Sel_T(V, k) for every guess k.
+  const uint8_t *getValues(unsigned T, uint8_t V) const {
+    return &Values[getOffset(T, V)];
+  }
+  /// getWeights - HW(Sel_T(V, k)) for every guess k.
+  const uint8_t *getWeights(unsigned T, uint8_t V) const {
+    return &Weights[getOffset(T, V)];
+  }
+
+  /// evaluate - The rows of a batch of traces: Out[(n * T + t) * G + k] is
+  /// Sel_t(Known[n * T + t], k), or its Hamming weight, for the T targets
+  /// and the G guesses.
+  void evaluate(ArrayRef<uint8_t> Known, bool HammingWeight,
+                uint8_t *Out) const;
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,154 @@
+//===-- StateHash.h - Hash of the interpreted program state -----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The state hash action summarizes the state of the interpreted program, so
+// that two runs of the same program can tell whether they are in the same
+// state at the same dynamic instruction:
+//
+//   stack hash    the position in each frame of the call stack, the SSA
+//                 values still live at that position (a dead value cannot
+//                 influence the rest of the run) and the captured standard
+//                 output; computed on demand
+//   memory hash   the XOR of a hash of each (address, byte) written by the
+//                 program, relative to the memory when the count started;
+//                 updated around every store, so reading it is free and two
+//                 runs that wrote the same bytes agree whatever the order
+//
+// The writes of the external functions are only seen for memcpy, memmove
+// and memset.  The calls to the other external functions that may write
+// memory or keep a state of their own (rand, files...) are counted as
+// untracked instead: two states are only comparable if neither run made an
+// untracked call since they were known to be equal.
+//
+// The runs compared are forks of one process, but the host allocates on its
+// own between the forks, so the same guest allocation may have different
+// addresses in two runs.  The action follows the blocks the program
+// allocates (its allocas, and malloc, calloc and realloc) from the start of
+// the run, and an address inside one is hashed as the number of the block
+// and the offset in it; the other addresses (the globals) are hashed as they
+// are.  So are the pointers of the live values and the pointers stored to
+// memory.  The pointers copied by memcpy and memmove are only seen as bytes:
+// two runs may then fail to match where they would, never the reverse.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_STATEHASH_H
+#define LLVM_EXECUTIONENGINE_STATEHASH_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Compiler.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+class StateHashAction : public Action {
+  class FunctionLiveness;
+
+  std::vector<ExecutionContext> *Stack = nullptr;
+  DenseMap<const Function *, std::unique_ptr<FunctionLiveness>> Liveness;
+  bool Tracking = false;
+  uint64_t MemoryHash = 0;
+  uint64_t NumUntracked = 0;
+  // Memory the current instruction writes, hashed out before it executes
+  // and back in after; WritePointer if it stores a pointer.
+  const uint8_t *WriteAddr = nullptr;
+  uint64_t WriteSize = 0;
+  bool WritePointer = false;
+
+  // The blocks allocated since the start of the run, by address, numbered
+  // in allocation order.  A freed block stays until one that overlaps it is
+  // allocated.
+  struct Block {
+    uint64_t ID;
+    uint64_t Size;
+  };
+  std::map<uintptr_t, Block> Blocks;
+  uint64_t NumBlocks = 0;
+  // The call to malloc, calloc or realloc being executed.
+  const CallInst *Allocation = nullptr;
+  uint64_t AllocationSize = 0;
+
+  void noteStore(StoreInst &SI, ExecutionContext &SF);
+  void noteCall(CallInst &CI, ExecutionContext &SF);
+  void noteAlloca(AllocaInst &AI, ExecutionContext &SF);
+  void addBlock(const void *Addr, uint64_t Size);
+  void endAllocation();
+  uint64_t getKey(const void *Addr) const;
+  void toggleBytes(const uint8_t *Addr, uint64_t Size, bool Pointer);
+  hash_code hashValue(const GenericValue &GV, Type *Ty) const;
+  FunctionLiveness &getLiveness(const Function &F);
+
+public:
+  StateHashAction();
+  ~StateHashAction() override;
+
+  /// track - Start or stop following the memory writes, from a zero memory
+  /// hash and no untracked call.
+  void track(bool Enable) {
+    Tracking = Enable;
+    MemoryHash = 0;
+    NumUntracked = 0;
+  }
+
+  uint64_t getMemoryHash() const { return MemoryHash; }
+  uint64_t getNumUntracked() const { return NumUntracked; }
+
+  /// getStackHash - Hash of the call stack when the top frame is about to
+  /// execute Next, and of the captured standard output.
+  uint64_t getStackHash(const Instruction &Next);
+
+  /// toggleMemory - Hash the Size bytes at Addr out of the memory hash, or
+  /// back in: called before and after an action modifies memory itself.
+  void toggleMemory(const uint8_t *Addr, uint64_t Size);
+
+  void setECStack(std::vector<ExecutionContext> * ECStack) override {
+    Stack = ECStack;
+    Action::setECStack(ECStack);
+  }
+
+  void beginRun(TraceRecord &Record) override {
+    track(Tracking);
+    Blocks.clear();
+    NumBlocks = 0;
+  }
+
+  // The allocations are followed even when not tracking, so that a run
+  // forked later numbers its blocks as the run it is compared with.
+  void beforeVisitInst(Instruction &I, ExecutionContext &SF) override {
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      noteCall(*CI, SF);
+    else if (LLVM_UNLIKELY(Tracking) && isa<StoreInst>(I))
+      noteStore(cast<StoreInst>(I), SF);
+  }
+
+  void afterVisitInst(Instruction &I, ExecutionContext &SF) override {
+    if (LLVM_UNLIKELY(WriteSize != 0)) {
+      toggleBytes(WriteAddr, WriteSize, WritePointer);
+      WriteSize = 0;
+    }
+    if (auto *AI = dyn_cast<AllocaInst>(&I))
+      noteAlloca(*AI, SF);
+    else if (LLVM_UNLIKELY(Allocation != nullptr))
+      endAllocation();
+  }
+
+  void print(raw_ostream &ROS) override {
+    ROS << "StateHashAction => Hash the program state for comparisons.\n";
+  }
+};
+
+} // End llvm namespace
+
+#endif
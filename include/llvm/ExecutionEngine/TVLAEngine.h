@@ -0,0 +1,138 @@
+//===-- TVLAEngine.h - Streaming leakage assessment -------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Test vector leakage assessment (TVLA): the runs of a fixed-vs-random batch
+// are split by the input generator into a fixed and a random class, and a
+// Welch t-test compares the two classes sample by sample.  |t| above 4.5
+// flags a sample that depends on the input.
+//
+// Each class keeps, per sample, the mean and the central sums
+// M2, M3 and M4 updated online (Welford / Pebay), which is numerically
+// stable whatever the number of traces.  The first-order test compares the
+// means, the second-order one the means of (x - mean)^2, M2 / n, whose
+// variance is M4 / n - (M2 / n)^2.  The memory is O(samples) and no trace
+// is stored.
+//
+// Every batch worker owns a TVLAAccumulator; compute() merges them with the
+// pairwise update formulas, and the engine writes the t-statistics every
+// ReportPeriod traces.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_TVLAENGINE_H
+#define LLVM_EXECUTIONENGINE_TVLAENGINE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+struct TVLAOptions {
+  // Window of samples tested: [SampleBegin, SampleBegin + MaxSamples).
+  uint64_t SampleBegin = 0;
+  uint64_t MaxSamples = 0;         // 0: up to the end of the trace
+  uint64_t ReportPeriod = 0;       // traces between two reports, 0: none
+  std::string OutputFile;          // t-statistics, rewritten at each report
+  double Threshold = 4.5;
+};
+
+/// TVLAMoments - Running moments of one class of traces, per sample.
+struct TVLAMoments {
+  uint64_t Count = 0;
+  std::vector<double> Mean, M2, M3, M4;
+
+  size_t getNumSamples() const { return Mean.size(); }
+  /// add - Add a trace, the samples missing from a shorter trace count as 0.
+  void add(ArrayRef<uint8_t> Samples);
+  void merge(const TVLAMoments &Other);
+
+private:
+  void resize(size_t Samples);
+};
+
+class TVLAEngine;
+
+/// TVLAAccumulator - The moments of one worker.
+class TVLAAccumulator {
+  friend class TVLAEngine;
+
+  TVLAEngine &Engine;
+  sys::Mutex Lock;                 // held while a trace is added or merged
+  TVLAMoments Classes[2];          // random, fixed
+
+public:
+  explicit TVLAAccumulator(TVLAEngine &Engine) : Engine(Engine) {}
+
+  void addTrace(const TraceRecord &Record);
+};
+
+class TVLAEngine {
+public:
+  struct Result {
+    uint64_t NumFixed = 0, NumRandom = 0;
+    uint64_t SampleBegin = 0;
+    std::vector<double> T1, T2;    // first- and second-order t per sample
+  };
+
+private:
+  TVLAOptions Opts;
+  mutable sys::Mutex Lock;
+  mutable sys::Mutex ReportLock;   // one report written at a time
+  std::vector<std::unique_ptr<TVLAAccumulator>> Accumulators;
+  std::atomic<uint64_t> NumTraces;
+
+  friend class TVLAAccumulator;
+  void traceAdded();
+
+public:
+  explicit TVLAEngine(const TVLAOptions &Opts) : Opts(Opts), NumTraces(0) {}
+
+  const TVLAOptions &getOptions() const { return Opts; }
+
+  /// createAccumulator - The moments of a new worker, owned by the engine.
+  TVLAAccumulator &createAccumulator();
+
+  /// compute - The t-statistics of the traces added so far.  Safe to call
+  /// while the workers are running.
+  Result compute() const;
+
+  /// report - Compute the t-statistics, write them to the output file, if
+  /// any, and print a summary to \p OS.
+  Error report(raw_ostream &OS) const;
+
+  static Error writeResult(StringRef Path, const Result &R);
+  static void printSummary(raw_ostream &OS, const Result &R,
+                           double Threshold);
+};
+
+/// TVLAAction - Feeds the samples collected by the trace action during a run
+/// to a TVLA accumulator, in the class chosen by the input generator.
+class TVLAAction : public Action {
+  TVLAAccumulator &Acc;
+
+public:
+  explicit TVLAAction(TVLAAccumulator &Acc) : Acc(Acc) {}
+
+  void endRun(TraceRecord &Record) override { Acc.addTrace(Record); }
+
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,126 @@
+//===-- TableAction.h - Lookup-table access extraction ----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The tables action records which entries of its lookup tables a table-based
+// white-box implementation reads, instead of the values it reads: the
+// algebraic attacks (e.g. BGE) work on the tables and on the indices.
+//
+// A table access is a load whose address is a getelementptr on a global
+// variable with an index that is not constant.  A table is one access site,
+// the pair (load, global): its ID is given once in the order of the
+// InstructionIndex, its entries have the size of the loaded value and its
+// index is the offset of the load in the global divided by that size.
+//
+// In batch mode each access is one sample of the trace, the index written
+// on as many bytes as the largest index of the table takes (one byte up to
+// 256 entries), little-endian; the sample index of the trace file gives the
+// load, hence the table.  Outside batch mode the accesses are printed.
+//
+// The contents of each global are dumped once, when a run first reads one of
+// its tables, so after the static constructors and whatever the program
+// computes before, in the tables file:
+//
+//   global G NAME SIZE           then SIZE bytes in hex, 32 per line
+//   table T INST G ELEMENT WIDTH
+//
+// The table actions of all the workers of a batch share a LookupTables, so
+// that the IDs are the same in every worker.  After a taint action, only the
+// accesses whose address is tainted are recorded.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_TABLEACTION_H
+#define LLVM_EXECUTIONENGINE_TABLEACTION_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class GlobalVariable;
+
+/// LookupTables - The tables found by the table actions of a batch, and the
+/// contents of their globals.
+class LookupTables {
+public:
+  struct Global {
+    std::string Name;
+    uint64_t Size;
+    std::vector<uint8_t> Contents;           // empty until dumped
+  };
+  struct Table {
+    uint32_t Inst;                           // InstructionIndex ID
+    unsigned Global;
+    unsigned ElementSize;
+    unsigned Width;                          // bytes of an index
+  };
+
+private:
+  sys::Mutex Lock;
+  std::vector<Global> Globals;
+  StringMap<unsigned> GlobalIDs;
+  std::vector<Table> Tables;
+  DenseMap<uint32_t, unsigned> TableIDs;     // by load
+
+public:
+  /// addTable - The ID of the table read by the load Inst in the global
+  /// Name of Size bytes, entries of ElementSize bytes.
+  unsigned addTable(uint32_t Inst, StringRef Name, uint64_t Size,
+                    unsigned ElementSize);
+
+  /// getWidth - The bytes of an index of table T.
+  unsigned getWidth(unsigned T);
+
+  /// dump - Keep the contents of the global of table T, if not already.
+  void dump(unsigned T, ArrayRef<uint8_t> Contents);
+
+  /// writeFile - Write the tables and the contents of their globals.
+  Error writeFile(StringRef Path);
+  void printSummary(raw_ostream &OS);
+};
+
+class TableAction : public Action {
+  struct Access {
+    uint32_t Inst;                           // of the load
+    GetElementPtrInst *Address;
+    GlobalVariable *Base;
+    uint64_t Size;                           // of Base
+    unsigned Table;
+    unsigned ElementSize;
+    unsigned Width;
+    bool Dumped;                             // by this worker
+  };
+
+  LookupTables &Tables;
+  const TaintAction *Taint;
+  DenseMap<const Instruction *, Access> Accesses;
+  TraceRecord *Record = nullptr;
+
+public:
+  TableAction(LookupTables &Tables, const TaintAction *Taint = nullptr)
+    : Tables(Tables), Taint(Taint) {}
+
+  void setInstructionIndex(const InstructionIndex *Index) override;
+  void beginRun(TraceRecord &Record) override { this->Record = &Record; }
+  void endRun(TraceRecord &Record) override { this->Record = nullptr; }
+  void afterVisitInst(Instruction &I, ExecutionContext &SF) override;
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
@@ -0,0 +1,170 @@
+//===-- TaintAction.h - Byte-level taint tracking ---------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The taint action follows which values of the run depend on its sources:
+//
+//   arg:N[:SIZE]   the buffer an argument of the entry function points to,
+//                  SIZE bytes or the size of the input of the run
+//   global:NAME    the bytes of a global variable, e.g. a key table
+//   argv           the strings of the program arguments, argv[1..]
+//   fread          the bytes read by fread()
+//
+// Each source is one bit of a label.  Memory is labelled byte by byte in a
+// shadow memory, an SSA value carries the union of the labels of what it
+// was computed from, addresses included: a load takes the labels of its
+// pointer and of the bytes it reads, a store gives its bytes the labels of
+// its value and of its pointer.  Control dependences are not followed.
+//
+// The calls to interpreted functions pass the labels of the arguments and
+// of the returned value.  Of the external functions, memcpy, memmove and
+// memset move labels in memory, malloc, calloc and realloc start clean
+// blocks (realloc keeps the labels of what it copies), and the result of
+// the others has the labels of their arguments.
+//
+// A trace action created after the taint action by the same ActionFactory
+// only records the tainted values, so the taint action must come first in
+// the chain.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_TAINTACTION_H
+#define LLVM_EXECUTIONENGINE_TAINTACTION_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class GlobalVariable;
+
+struct TaintSource {
+  enum Kind { Argument, Global, Argv, Fread };
+
+  static const unsigned MaxSources = 8;      // one bit of a label each
+
+  Kind K = Argument;
+  unsigned ArgNo = 0;                        // Argument
+  uint64_t Size = 0;                         // Argument, 0: the input size
+  std::string GlobalName;                    // Global
+
+  /// parse - Read "arg:N[:SIZE]", "global:NAME", "argv" or "fread".
+  static Expected<TaintSource> parse(StringRef Spec);
+
+  void print(raw_ostream &OS) const;
+};
+
+/// ShadowMemory - A label per byte of the address space, in a two-level
+/// page table as the one of a 32-bit MMU: the directory and the tables are
+/// allocated on the first write of a label, the bytes never labelled read
+/// as clean without allocating anything.
+class ShadowMemory {
+  // 48 bits of user address space.
+  static const unsigned PageBits = 12, TableBits = 18, DirectoryBits = 18;
+
+  struct Page {
+    uint8_t Labels[1 << PageBits];
+  };
+  struct Table {
+    std::unique_ptr<Page> Pages[1 << TableBits];
+  };
+
+  std::unique_ptr<std::unique_ptr<Table>[]> Directory;
+  std::vector<Page *> Allocated;             // cleared between runs
+
+  Page *findPage(uintptr_t Addr) const {
+    if (!Directory || Addr >> (PageBits + TableBits + DirectoryBits))
+      return nullptr;
+    const Table *T = Directory[Addr >> (PageBits + TableBits)].get();
+    if (!T)
+      return nullptr;
+    return T->Pages[(Addr >> PageBits) & ((1 << TableBits) - 1)].get();
+  }
+  Page *getPage(uintptr_t Addr);
+
+public:
+  ShadowMemory();
+  ~ShadowMemory();
+
+  /// get - The union of the labels of the Size bytes at Addr.
+  uint8_t get(uintptr_t Addr, uint64_t Size) const;
+  /// set - Label the Size bytes at Addr.
+  void set(uintptr_t Addr, uint64_t Size, uint8_t Label);
+  /// move - The labels of memmove(Dst, Src, Size).
+  void move(uintptr_t Dst, uintptr_t Src, uint64_t Size);
+  /// clear - Every byte clean, the pages are kept for the next run.
+  void clear();
+};
+
+class TaintAction : public Action {
+  struct PendingCall {
+    Instruction *Inst;                       // a call or an invoke
+    const Function *Callee;                  // null if not known
+    size_t Depth;                            // of the caller
+  };
+
+  std::vector<TaintSource> Sources;
+  std::vector<ExecutionContext> *Stack = nullptr;
+  ShadowMemory Shadow;
+  // The labels of the SSA values of each frame, clean values left out.
+  std::vector<DenseMap<const Value *, uint8_t>> Frames;
+  std::vector<GlobalVariable *> Globals;     // of the Global sources
+  bool Resolved = false;
+  uint64_t InputSize = 0;                    // of the current run
+  uint8_t FreadLabel = 0;
+  // The ret being executed: the labels of its value and the call it
+  // returns to.
+  uint8_t ReturnLabel = 0;
+  Instruction *ReturnTo = nullptr;
+  // The call or invoke being executed, Depth 0 if none: an intrinsic call
+  // may be lowered in place and deleted by the time afterVisitInst sees it.
+  PendingCall Call = {nullptr, nullptr, 0};
+
+  void resolve();
+  void seed();
+  uint8_t getLabel(const Value *V) const;
+  void setLabel(const Value *V, uint8_t Label);
+  uint8_t getOperandsLabel(const Instruction &I) const;
+  void enterBlock(BasicBlock &From, ExecutionContext &SF);
+  void afterCall();
+  void afterExternalCall(CallSite CS, const Function *F);
+  void afterReturn();
+  void propagate(Instruction &I, ExecutionContext &SF);
+  uintptr_t getAddress(Value *Ptr, ExecutionContext &SF);
+
+public:
+  explicit TaintAction(ArrayRef<TaintSource> Sources)
+    : Sources(Sources.begin(), Sources.end()) {}
+
+  /// isTainted - Whether the value V of the current frame depends on a
+  /// source.
+  bool isTainted(const Value &V) const { return getLabel(&V) != 0; }
+
+  void setECStack(std::vector<ExecutionContext> * ECStack) override {
+    Stack = ECStack;
+    Action::setECStack(ECStack);
+  }
+
+  void beginRun(TraceRecord &Record) override;
+  void beforeVisitInst(Instruction &I, ExecutionContext &SF) override;
+  void afterVisitInst(Instruction &I, ExecutionContext &SF) override;
+  void print(raw_ostream &ROS) override;
+};
+
+} // End llvm namespace
+
+#endif
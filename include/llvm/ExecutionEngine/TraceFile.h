@@ -0,0 +1,171 @@
+//===-- TraceFile.h - Wyverse binary trace files ----------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Batch mode stores one record per run in a binary trace file:
+//
+//   TraceFileHeader
+//   NumTraces x { Seed (8 bytes) | Input | Output | Samples }
+//   NumSamples x uint32_t       (sample-to-instruction index, at IndexOffset)
+//
+// Every record has the same size so that a file can be memory-mapped and
+// addressed as a matrix.  The sizes are fixed by the first record: shorter
+// traces are zero-padded, longer ones are truncated.  A sample is one byte of
+// a traced value, the index gives the static instruction (see
+// InstructionIndex) that produced it.  All integers are in host byte order.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_TRACEFILE_H
+#define LLVM_EXECUTIONENGINE_TRACEFILE_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+
+/// TraceRecord - Everything observed during one run of the program.
+struct TraceRecord {
+  uint64_t Index = 0;              // rank of the run in the campaign
+  uint64_t Seed = 0;               // per-run seed, derived from the index
+  int ExitCode = 0;
+  bool FixedInput = false;         // fixed class of a fixed-vs-random batch
+  std::vector<uint8_t> Input;
+  std::vector<uint8_t> Output;
+  std::vector<uint8_t> Samples;
+  // Static instruction of each sample, only filled when CollectSampleInsts
+  // is set (the file stores it once, from the first record).
+  std::vector<uint32_t> SampleInsts;
+  bool CollectSampleInsts = false;
+
+  void clear() {
+    ExitCode = 0;
+    FixedInput = false;
+    Input.clear();
+    Output.clear();
+    Samples.clear();
+    SampleInsts.clear();
+  }
+};
+
+struct TraceFileHeader {
+  char     Magic[8];
+  uint32_t Version;
+  uint32_t Flags;
+  uint32_t InputSize;
+  uint32_t OutputSize;
+  uint64_t NumSamples;
+  uint64_t NumTraces;
+  uint64_t IndexOffset;
+
+  static constexpr const char *MagicString = "WYVTRACE";
+  static const uint32_t CurrentVersion = 1;
+
+  uint64_t getRecordSize() const {
+    return sizeof(uint64_t) + InputSize + OutputSize + NumSamples;
+  }
+};
+static_assert(sizeof(TraceFileHeader) == 48, "unexpected header padding");
+
+/// TraceFileWriter - Appends records to a trace file, in the order they are
+/// given.  Batch mode feeds it from the reorder buffer.
+class TraceFileWriter {
+  std::unique_ptr<raw_fd_ostream> OS;
+  TraceFileHeader Header;
+  std::vector<uint32_t> SampleIndex;
+  std::vector<uint8_t> Buffer;
+  uint64_t NumResized = 0;
+
+  TraceFileWriter(std::unique_ptr<raw_fd_ostream> OS, uint32_t InputSize,
+                  uint32_t OutputSize);
+  static void fit(const std::vector<uint8_t> &From, size_t Size,
+                  std::vector<uint8_t> &To);
+
+public:
+  /// create - A trace file whose records have InputSize input and
+  /// OutputSize output bytes, as the batch expects them: a record missing
+  /// its output must not set the size for the whole file.  The number of
+  /// samples is the one of the first record.
+  static Expected<std::unique_ptr<TraceFileWriter>>
+  create(StringRef Path, uint32_t InputSize, uint32_t OutputSize);
+
+  void write(const TraceRecord &Record);
+
+  /// finalize - Write the sample index and the final header.
+  Error finalize();
+
+  uint64_t getNumTraces() const { return Header.NumTraces; }
+
+  /// getNumResized - Number of records that did not have the expected size
+  /// (data-dependent control flow in the program, or a missing output).
+  uint64_t getNumResized() const { return NumResized; }
+};
+
+/// TraceFileReader - Read-only view of a trace file, memory-mapped.  The
+/// records are paged in on demand, so a file may be much larger than the
+/// memory as long as it is read by blocks.
+class TraceFileReader {
+  std::unique_ptr<sys::fs::mapped_file_region> Map;
+  TraceFileHeader Header;
+  const uint8_t *Records = nullptr;
+  uint64_t RecordSize = 0;
+  std::vector<uint32_t> SampleIndex;
+
+  TraceFileReader() = default;
+
+public:
+  static Expected<std::unique_ptr<TraceFileReader>> open(StringRef Path);
+
+  const TraceFileHeader &getHeader() const { return Header; }
+  uint64_t getNumTraces() const { return Header.NumTraces; }
+  uint64_t getNumSamples() const { return Header.NumSamples; }
+  unsigned getInputSize() const { return Header.InputSize; }
+  unsigned getOutputSize() const { return Header.OutputSize; }
+
+  /// getRecord - Raw record \p N: seed, input, output, samples.
+  const uint8_t *getRecord(uint64_t N) const {
+    return Records + N * RecordSize;
+  }
+  uint64_t getRecordSize() const { return RecordSize; }
+  /// Offsets of the fields in a record.
+  uint64_t getInputOffset() const { return sizeof(uint64_t); }
+  uint64_t getOutputOffset() const {
+    return getInputOffset() + Header.InputSize;
+  }
+  uint64_t getSamplesOffset() const {
+    return getOutputOffset() + Header.OutputSize;
+  }
+
+  uint64_t getSeed(uint64_t N) const;
+  ArrayRef<uint8_t> getInput(uint64_t N) const {
+    return makeArrayRef(getRecord(N) + getInputOffset(), Header.InputSize);
+  }
+  ArrayRef<uint8_t> getOutput(uint64_t N) const {
+    return makeArrayRef(getRecord(N) + getOutputOffset(), Header.OutputSize);
+  }
+  ArrayRef<uint8_t> getSamples(uint64_t N) const {
+    return makeArrayRef(getRecord(N) + getSamplesOffset(), Header.NumSamples);
+  }
+
+  /// getSampleIndex - Static instruction of each sample.
+  ArrayRef<uint32_t> getSampleIndex() const { return SampleIndex; }
+
+  /// dontNeed - Release the pages of the records [First, First + Count),
+  /// read again from the file if they are accessed later.
+  void dontNeed(uint64_t First, uint64_t Count) const;
+};
+
+} // End llvm namespace
+
+#endif
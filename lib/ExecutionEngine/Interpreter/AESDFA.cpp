@@ -0,0 +1,233 @@
+//===-- AESDFA.cpp - Differential fault analysis of AES-128 ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/AESDFA.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/CipherTables.h"
+#include <algorithm>
+#include <thread>
+
+using namespace llvm;
+
+const unsigned AESDFA::Positions[4][4] = {
+  {0, 13, 10, 7},
+  {4, 1, 14, 11},
+  {8, 5, 2, 15},
+  {12, 9, 6, 3},
+};
+
+// Coefficients of the MixColumns output difference for a fault on row r of
+// its input: [r][i] = MixColumns[i][r].
+static const uint8_t Coefficients[4][4] = {
+  {2, 1, 1, 3},
+  {3, 2, 1, 1},
+  {1, 3, 2, 1},
+  {1, 1, 3, 2},
+};
+
+static uint8_t xtime(uint8_t X) { return (X << 1) ^ ((X >> 7) * 0x1b); }
+
+static uint8_t gfMul(uint8_t A, uint8_t B) {
+  uint8_t P = 0;
+  for (; B; B >>= 1, A = xtime(A))
+    if (B & 1)
+      P ^= A;
+  return P;
+}
+
+namespace {
+
+/// DiffTable - For each input difference Din of InvSBox, the inputs x with
+/// InvSBox[x] ^ InvSBox[x ^ Din] = Dout, grouped by output difference.
+struct DiffTable {
+  uint8_t Solutions[256][256];
+  uint16_t Offsets[256][257];
+
+  DiffTable() {
+    for (unsigned Din = 0; Din != 256; ++Din) {
+      unsigned Count[256] = {0};
+      for (unsigned X = 0; X != 256; ++X)
+        ++Count[aes::InvSBox[X] ^ aes::InvSBox[X ^ Din]];
+      Offsets[Din][0] = 0;
+      for (unsigned Dout = 0; Dout != 256; ++Dout)
+        Offsets[Din][Dout + 1] = Offsets[Din][Dout] + Count[Dout];
+      uint16_t Next[256];
+      std::copy(Offsets[Din], Offsets[Din] + 256, Next);
+      for (unsigned X = 0; X != 256; ++X)
+        Solutions[Din][Next[aes::InvSBox[X] ^ aes::InvSBox[X ^ Din]]++] = X;
+    }
+  }
+
+  ArrayRef<uint8_t> get(uint8_t Din, uint8_t Dout) const {
+    return makeArrayRef(&Solutions[Din][Offsets[Din][Dout]],
+                        &Solutions[Din][0] + Offsets[Din][Dout + 1]);
+  }
+};
+
+} // end anonymous namespace
+
+static const DiffTable &getDiffTable() {
+  static const DiffTable Table;
+  return Table;
+}
+
+int AESDFA::getFaultedColumn(ArrayRef<uint8_t> Correct,
+                             ArrayRef<uint8_t> Faulty) {
+  if (Correct.size() != 16 || Faulty.size() != 16)
+    return Useless;
+  unsigned Mask = 0;
+  for (unsigned i = 0; i != 16; ++i)
+    if (Correct[i] != Faulty[i])
+      Mask |= 1 << i;
+  if (Mask == 0xffff)
+    return AllColumns;
+  for (unsigned Col = 0; Col != 4; ++Col) {
+    unsigned ColMask = 0;
+    for (unsigned Pos : Positions[Col])
+      ColMask |= 1 << Pos;
+    if (Mask == ColMask)
+      return Col;
+  }
+  return Useless;
+}
+
+bool AESDFA::addPair(ArrayRef<uint8_t> Correct, ArrayRef<uint8_t> Faulty) {
+  int Faulted = getFaultedColumn(Correct, Faulty);
+  if (Faulted == Useless) {
+    ++NumUseless;
+    return false;
+  }
+  for (unsigned Col = 0; Col != 4; ++Col) {
+    if (Faulted != AllColumns && Faulted != (int)Col)
+      continue;
+    Column::Pair P;
+    for (unsigned i = 0; i != 4; ++i) {
+      unsigned Pos = Positions[Col][i];
+      P.Correct[i] = Correct[Pos];
+      P.Diff[i] = Correct[Pos] ^ Faulty[Pos];
+    }
+    Columns[Col].Pending.push_back(P);
+  }
+  ++NumUseful;
+  return true;
+}
+
+void AESDFA::reduce(unsigned Col) {
+  const DiffTable &Table = getDiffTable();
+  Column &C = Columns[Col];
+  for (const Column::Pair &P : C.Pending) {
+    std::vector<uint32_t> Keys;
+    for (unsigned Row = 0; Row != 4; ++Row)
+      for (unsigned E = 1; E != 256; ++E) {
+        ArrayRef<uint8_t> X[4];
+        bool Empty = false;
+        for (unsigned i = 0; i != 4 && !Empty; ++i) {
+          X[i] = Table.get(P.Diff[i], gfMul(Coefficients[Row][i], E));
+          Empty = X[i].empty();
+        }
+        if (Empty)
+          continue;
+        for (uint8_t X0 : X[0])
+          for (uint8_t X1 : X[1])
+            for (uint8_t X2 : X[2])
+              for (uint8_t X3 : X[3])
+                Keys.push_back(uint32_t(X0 ^ P.Correct[0]) |
+                               uint32_t(X1 ^ P.Correct[1]) << 8 |
+                               uint32_t(X2 ^ P.Correct[2]) << 16 |
+                               uint32_t(X3 ^ P.Correct[3]) << 24);
+      }
+    // Not a single-byte fault after all.
+    if (Keys.empty())
+      continue;
+    std::sort(Keys.begin(), Keys.end());
+    Keys.erase(std::unique(Keys.begin(), Keys.end()), Keys.end());
+    for (uint32_t Key : Keys) {
+      unsigned N = ++C.Votes[Key];
+      if (N > C.MaxVotes) {
+        C.MaxVotes = N;
+        C.Candidates.clear();
+      }
+      if (N == C.MaxVotes)
+        C.Candidates.push_back(Key);
+    }
+    ++C.NumPairs;
+  }
+  std::sort(C.Candidates.begin(), C.Candidates.end());
+  C.Pending.clear();
+}
+
+void AESDFA::solve() {
+  getDiffTable();
+  std::vector<std::thread> Threads;
+  for (unsigned Col = 0; Col != 4; ++Col)
+    if (!Columns[Col].Pending.empty())
+      Threads.emplace_back([this, Col] { reduce(Col); });
+  for (std::thread &T : Threads)
+    T.join();
+}
+
+bool AESDFA::isSolved() const {
+  for (const Column &C : Columns)
+    if (C.MaxVotes < 2 || C.Candidates.size() != 1)
+      return false;
+  return true;
+}
+
+bool AESDFA::getLastRoundKey(uint8_t Key[16]) const {
+  if (!isSolved())
+    return false;
+  for (unsigned Col = 0; Col != 4; ++Col)
+    for (unsigned i = 0; i != 4; ++i)
+      Key[Positions[Col][i]] = Columns[Col].Candidates[0] >> (8 * i);
+  return true;
+}
+
+void AESDFA::invertKeySchedule(const uint8_t LastRoundKey[16],
+                               uint8_t Key[16]) {
+  uint8_t Rcon[11] = {0, 1};
+  for (unsigned r = 2; r <= 10; ++r)
+    Rcon[r] = xtime(Rcon[r - 1]);
+  uint8_t K[16];
+  std::copy(LastRoundKey, LastRoundKey + 16, K);
+  for (unsigned r = 10; r != 0; --r) {
+    // Round key r - 1 from round key r, the last word first.
+    for (unsigned i = 15; i >= 4; --i)
+      K[i] ^= K[i - 4];
+    uint8_t T[4] = {uint8_t(aes::SBox[K[13]] ^ Rcon[r]), aes::SBox[K[14]],
+                    aes::SBox[K[15]], aes::SBox[K[12]]};
+    for (unsigned i = 0; i != 4; ++i)
+      K[i] ^= T[i];
+  }
+  std::copy(K, K + 16, Key);
+}
+
+void AESDFA::print(raw_ostream &OS) const {
+  OS << "DFA: " << NumUseful << " useful faults, " << NumUseless
+     << " useless\n";
+  for (unsigned Col = 0; Col != 4; ++Col) {
+    const Column &C = Columns[Col];
+    OS << "  column " << Col << " (key bytes " << Positions[Col][0] << ','
+       << Positions[Col][1] << ',' << Positions[Col][2] << ','
+       << Positions[Col][3] << "): ";
+    if (!C.NumPairs)
+      OS << "no fault";
+    else
+      OS << C.Candidates.size() << " candidates with " << C.MaxVotes
+         << " votes of " << C.NumPairs << " faults";
+    if (C.Candidates.size() == 1 && C.NumPairs > C.MaxVotes)
+      OS << ", " << C.NumPairs - C.MaxVotes << " outliers";
+    OS << '\n';
+  }
+  uint8_t Last[16], Key[16];
+  if (!getLastRoundKey(Last))
+    return;
+  invertKeySchedule(Last, Key);
+  OS << "last round key: " << toHex(makeArrayRef(Last), /*LowerCase=*/true)
+     << "\nkey: " << toHex(makeArrayRef(Key), /*LowerCase=*/true) << '\n';
+}
@@ -1,4 +1,11 @@
 #include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/CPAEngine.h"
+#include "llvm/ExecutionEngine/FaultAction.h"
+#include "llvm/ExecutionEngine/SNREngine.h"
+#include "llvm/ExecutionEngine/TVLAEngine.h"
+#include "llvm/ExecutionEngine/TableAction.h"
+#include "llvm/ExecutionEngine/TaintAction.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "Interpreter.h"
 
 namespace llvm {
@@ -44,9 +51,30 @@ struct TraceSample {
 };
 
 
-class TraceSampleFilter {
-
-};
+Expected<TraceSampleFilter> TraceSampleFilter::readFile(StringRef Path) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+    MemoryBuffer::getFile(Path);
+  if (std::error_code EC = BufOrErr.getError())
+    return createStringError(EC, "cannot read POI file '%s'",
+                             Path.str().c_str());
+
+  TraceSampleFilter Filter;
+  SmallVector<StringRef, 0> Lines;
+  (*BufOrErr)->getBuffer().split(Lines, '\n');
+  for (unsigned i = 0, e = Lines.size(); i != e; ++i) {
+    StringRef Line = Lines[i].trim();
+    if (Line.empty() || Line.startswith("#"))
+      continue;
+    uint32_t ID;
+    if (Line.split(' ').first.getAsInteger(10, ID) ||
+        ID == InstructionIndex::InvalidID)
+      return createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "%s:%u: expected an instruction ID", Path.str().c_str(), i + 1);
+    Filter.addInstruction(ID);
+  }
+  return Filter;
+}
 
 
 unsigned getAPIntNumBytes(APInt Val) {
@@ -54,7 +82,29 @@ unsigned getAPIntNumBytes(APInt Val) {
   return Val.getBitWidth() / 8;
 }
 
+void TraceProcessor::process(Instruction &I) {
+  if (record) {
+    const InstructionIndex *index = action->getInstructionIndex();
+    curInstID = index ? index->lookup(&I) : InstructionIndex::InvalidID;
+    if (filter && !filter->accept(curInstID))
+      return;
+  }
+  visit(I);
+}
+
 void TraceProcessor::traceAPInt(APInt Val) {
+  if (record) {
+    // one sample per byte of the value, little-endian
+    unsigned NumBytes = std::max(1u, (Val.getBitWidth() + 7) / 8);
+    const uint64_t *Words = Val.getRawData();
+    for (unsigned i = 0; i != NumBytes; ++i) {
+      record->Samples.push_back((uint8_t)(Words[i / 8] >> ((i % 8) * 8)));
+      if (record->CollectSampleInsts)
+        record->SampleInsts.push_back(curInstID);
+    }
+    return;
+  }
+
   if (Val.getBitWidth() == 1) {
     outs() << Val.getBoolValue();
   } else {
@@ -84,6 +134,8 @@ GenericValue TraceProcessor::getOperandValue(Value *I, ExecutionContext &SF) {
 
 
 void TraceProcessor::defaultVisitor(Value &Val) {
+  if (taint && !taint->isTainted(Val))
+    return;
   Type *Ty  = Val.getType();
   ExecutionContext * SF = currentEC();
   GenericValue GV = getOperandValue(&Val, *SF);
@@ -111,17 +163,49 @@ void TraceProcessor::visitReturnInst(ReturnInst &I) {
   }
 }
 
-class FaultAction : public Action {
-public:
-  // TODO
-};
-
-
 Action * ActionFactory::createAction(const char * actionType) {
   if (strcmp(actionType, "helloworld") == 0) {
     return new HelloWorldAction();
   } else if (strcmp(actionType, "trace") == 0) {
-    return new TraceAction();
+    return new TraceAction(traceFilter, taintAction);
+  } else if (strcmp(actionType, "cpa") == 0) {
+    if (!cpaEngine) {
+      errs() << "cpa action needs a CPA engine, ignored!\n";
+      return NULL;
+    }
+    return new CPAAction(cpaEngine->createAccumulator());
+  } else if (strcmp(actionType, "tvla") == 0) {
+    if (!tvlaEngine) {
+      errs() << "tvla action needs a TVLA engine, ignored!\n";
+      return NULL;
+    }
+    return new TVLAAction(tvlaEngine->createAccumulator());
+  } else if (strcmp(actionType, "snr") == 0) {
+    if (!snrEngine) {
+      errs() << "snr action needs an SNR engine, ignored!\n";
+      return NULL;
+    }
+    return new SNRAction(snrEngine->createAccumulator());
+  } else if (strcmp(actionType, "tables") == 0) {
+    if (!lookupTables) {
+      errs() << "tables action needs a table store, ignored!\n";
+      return NULL;
+    }
+    return new TableAction(*lookupTables, taintAction);
+  } else if (strcmp(actionType, "fault") == 0) {
+    if (!faultSpecs || faultSpecs->empty()) {
+      errs() << "fault action needs faults to inject, ignored!\n";
+      return NULL;
+    }
+    return new FaultAction(*faultSpecs);
+  } else if (strcmp(actionType, "taint") == 0) {
+    if (!taintSources || taintSources->empty()) {
+      errs() << "taint action needs taint sources, ignored!\n";
+      return NULL;
+    }
+    TaintAction *action = new TaintAction(*taintSources);
+    taintAction = action;
+    return action;
   } else {
     errs() << "unknown action " << actionType <<  " ignored!\n";
     return NULL;
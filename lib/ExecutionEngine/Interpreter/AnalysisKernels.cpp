@@ -0,0 +1,315 @@
+//===-- AnalysisKernels.cpp - Inner loops of the trace analyses -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define WYVERSE_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#endif
+
+using namespace llvm;
+
+static bool detectAVX2() {
+#ifdef WYVERSE_X86_KERNELS
+  StringMap<bool> Features;
+  return sys::getHostCPUFeatures(Features) && Features.lookup("avx2");
+#else
+  return false;
+#endif
+}
+
+bool kernels::hasAVX2() {
+  static const bool Supported = detectAVX2();
+  return Supported;
+}
+
+//===----------------------------------------------------------------------===//
+// Portable kernels
+//===----------------------------------------------------------------------===//
+
+static void accumulateProductsGeneric(uint32_t *Acc, const uint8_t *H,
+                                      uint8_t X, size_t N) {
+  for (size_t i = 0; i != N; ++i)
+    Acc[i] += uint32_t(X) * H[i];
+}
+
+static void widenAndClearGeneric(uint64_t *Wide, uint32_t *Narrow, size_t N) {
+  for (size_t i = 0; i != N; ++i) {
+    Wide[i] += Narrow[i];
+    Narrow[i] = 0;
+  }
+}
+
+static void axpyGeneric(double *Y, const float *X, double A, size_t N) {
+  for (size_t i = 0; i != N; ++i)
+    Y[i] += A * X[i];
+}
+
+static void axpyGeneric(double *Y, const double *X, double A, size_t N) {
+  for (size_t i = 0; i != N; ++i)
+    Y[i] += A * X[i];
+}
+
+static void multiplyGeneric(double *C, const float *A, const double *B,
+                            size_t M, size_t K, size_t N, size_t LdB) {
+  for (size_t i = 0; i != M; ++i) {
+    double *Row = C + i * N;
+    std::fill(Row, Row + N, 0.0);
+    for (size_t k = 0; k != K; ++k)
+      axpyGeneric(Row, B + k * LdB, A[i * K + k], N);
+  }
+}
+
+static void xorIntoGeneric(uint64_t *Dst, const uint64_t *Src, size_t N) {
+  for (size_t i = 0; i != N; ++i)
+    Dst[i] ^= Src[i];
+}
+
+static uint64_t popcountAndGeneric(const uint64_t *A, const uint64_t *B,
+                                   size_t N) {
+  uint64_t Count = 0;
+  for (size_t i = 0; i != N; ++i)
+    Count += countPopulation(A[i] & B[i]);
+  return Count;
+}
+
+//===----------------------------------------------------------------------===//
+// AVX2 kernels
+//===----------------------------------------------------------------------===//
+
+#ifdef WYVERSE_X86_KERNELS
+
+// X * H[i] fits in 16 bits: multiply 16 lanes at a time, then widen.
+TARGET_AVX2
+static void accumulateProductsAVX2(uint32_t *Acc, const uint8_t *H,
+                                   uint8_t X, size_t N) {
+  const __m256i VX = _mm256_set1_epi16(X);
+  size_t i = 0;
+  for (; i + 16 <= N; i += 16) {
+    __m128i H8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(H + i));
+    __m256i P16 = _mm256_mullo_epi16(_mm256_cvtepu8_epi16(H8), VX);
+    __m256i Lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(P16));
+    __m256i Hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(P16, 1));
+    __m256i *A = reinterpret_cast<__m256i *>(Acc + i);
+    _mm256_storeu_si256(A, _mm256_add_epi32(_mm256_loadu_si256(A), Lo));
+    _mm256_storeu_si256(A + 1,
+                        _mm256_add_epi32(_mm256_loadu_si256(A + 1), Hi));
+  }
+  accumulateProductsGeneric(Acc + i, H + i, X, N - i);
+}
+
+TARGET_AVX2
+static void widenAndClearAVX2(uint64_t *Wide, uint32_t *Narrow, size_t N) {
+  const __m256i Zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= N; i += 8) {
+    __m256i *Src = reinterpret_cast<__m256i *>(Narrow + i);
+    __m256i *Dst = reinterpret_cast<__m256i *>(Wide + i);
+    __m256i V = _mm256_loadu_si256(Src);
+    __m256i Lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(V));
+    __m256i Hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(V, 1));
+    _mm256_storeu_si256(Dst, _mm256_add_epi64(_mm256_loadu_si256(Dst), Lo));
+    _mm256_storeu_si256(Dst + 1,
+                        _mm256_add_epi64(_mm256_loadu_si256(Dst + 1), Hi));
+    _mm256_storeu_si256(Src, Zero);
+  }
+  widenAndClearGeneric(Wide + i, Narrow + i, N - i);
+}
+
+// The floats are widened 4 at a time, the sums stay in double.
+TARGET_AVX2
+static void axpyAVX2(double *Y, const float *X, double A, size_t N) {
+  const __m256d VA = _mm256_set1_pd(A);
+  size_t i = 0;
+  for (; i + 4 <= N; i += 4) {
+    __m256d V = _mm256_mul_pd(VA, _mm256_cvtps_pd(_mm_loadu_ps(X + i)));
+    _mm256_storeu_pd(Y + i, _mm256_add_pd(_mm256_loadu_pd(Y + i), V));
+  }
+  axpyGeneric(Y + i, X + i, A, N - i);
+}
+
+TARGET_AVX2
+static void axpyAVX2(double *Y, const double *X, double A, size_t N) {
+  const __m256d VA = _mm256_set1_pd(A);
+  size_t i = 0;
+  for (; i + 4 <= N; i += 4) {
+    __m256d V = _mm256_mul_pd(VA, _mm256_loadu_pd(X + i));
+    _mm256_storeu_pd(Y + i, _mm256_add_pd(_mm256_loadu_pd(Y + i), V));
+  }
+  axpyGeneric(Y + i, X + i, A, N - i);
+}
+
+// Blocks of 4 rows x 8 columns of C are accumulated in registers, each row
+// of B is loaded once per block.
+TARGET_AVX2
+static void multiplyAVX2(double *C, const float *A, const double *B,
+                         size_t M, size_t K, size_t N, size_t LdB) {
+  size_t i = 0;
+  for (; i + 4 <= M; i += 4) {
+    const float *A0 = A + i * K, *A1 = A0 + K, *A2 = A1 + K, *A3 = A2 + K;
+    size_t j = 0;
+    for (; j + 8 <= N; j += 8) {
+      __m256d C00 = _mm256_setzero_pd(), C01 = _mm256_setzero_pd();
+      __m256d C10 = _mm256_setzero_pd(), C11 = _mm256_setzero_pd();
+      __m256d C20 = _mm256_setzero_pd(), C21 = _mm256_setzero_pd();
+      __m256d C30 = _mm256_setzero_pd(), C31 = _mm256_setzero_pd();
+      for (size_t k = 0; k != K; ++k) {
+        __m256d B0 = _mm256_loadu_pd(B + k * LdB + j);
+        __m256d B1 = _mm256_loadu_pd(B + k * LdB + j + 4);
+        __m256d V = _mm256_set1_pd(A0[k]);
+        C00 = _mm256_add_pd(C00, _mm256_mul_pd(V, B0));
+        C01 = _mm256_add_pd(C01, _mm256_mul_pd(V, B1));
+        V = _mm256_set1_pd(A1[k]);
+        C10 = _mm256_add_pd(C10, _mm256_mul_pd(V, B0));
+        C11 = _mm256_add_pd(C11, _mm256_mul_pd(V, B1));
+        V = _mm256_set1_pd(A2[k]);
+        C20 = _mm256_add_pd(C20, _mm256_mul_pd(V, B0));
+        C21 = _mm256_add_pd(C21, _mm256_mul_pd(V, B1));
+        V = _mm256_set1_pd(A3[k]);
+        C30 = _mm256_add_pd(C30, _mm256_mul_pd(V, B0));
+        C31 = _mm256_add_pd(C31, _mm256_mul_pd(V, B1));
+      }
+      double *Row = C + i * N + j;
+      _mm256_storeu_pd(Row, C00);
+      _mm256_storeu_pd(Row + 4, C01);
+      _mm256_storeu_pd(Row + N, C10);
+      _mm256_storeu_pd(Row + N + 4, C11);
+      _mm256_storeu_pd(Row + 2 * N, C20);
+      _mm256_storeu_pd(Row + 2 * N + 4, C21);
+      _mm256_storeu_pd(Row + 3 * N, C30);
+      _mm256_storeu_pd(Row + 3 * N + 4, C31);
+    }
+    // remaining columns
+    for (size_t r = i; r != i + 4; ++r) {
+      double *Row = C + r * N;
+      std::fill(Row + j, Row + N, 0.0);
+      for (size_t k = 0; k != K; ++k)
+        axpyGeneric(Row + j, B + k * LdB + j, A[r * K + k], N - j);
+    }
+  }
+  multiplyGeneric(C + i * N, A + i * K, B, M - i, K, N, LdB);
+}
+
+TARGET_AVX2
+static void xorIntoAVX2(uint64_t *Dst, const uint64_t *Src, size_t N) {
+  size_t i = 0;
+  for (; i + 4 <= N; i += 4) {
+    __m256i *D = reinterpret_cast<__m256i *>(Dst + i);
+    __m256i S = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Src + i));
+    _mm256_storeu_si256(D, _mm256_xor_si256(_mm256_loadu_si256(D), S));
+  }
+  xorIntoGeneric(Dst + i, Src + i, N - i);
+}
+
+// Nibble lookup (Mula's algorithm), the byte counts are summed into 64-bit
+// lanes with SAD.
+TARGET_AVX2
+static uint64_t popcountAndAVX2(const uint64_t *A, const uint64_t *B,
+                                size_t N) {
+  const __m256i Lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i LowMask = _mm256_set1_epi8(0x0f);
+  __m256i Total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= N; i += 4) {
+    __m256i V = _mm256_and_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(A + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(B + i)));
+    __m256i Lo = _mm256_and_si256(V, LowMask);
+    __m256i Hi = _mm256_and_si256(_mm256_srli_epi16(V, 4), LowMask);
+    __m256i Bytes = _mm256_add_epi8(_mm256_shuffle_epi8(Lookup, Lo),
+                                    _mm256_shuffle_epi8(Lookup, Hi));
+    Total = _mm256_add_epi64(Total,
+                             _mm256_sad_epu8(Bytes, _mm256_setzero_si256()));
+  }
+  uint64_t Count = _mm256_extract_epi64(Total, 0) +
+                   _mm256_extract_epi64(Total, 1) +
+                   _mm256_extract_epi64(Total, 2) +
+                   _mm256_extract_epi64(Total, 3);
+  for (; i != N; ++i)
+    Count += _mm_popcnt_u64(A[i] & B[i]);
+  return Count;
+}
+
+#endif
+
+//===----------------------------------------------------------------------===//
+// Dispatch
+//===----------------------------------------------------------------------===//
+
+void kernels::accumulateProducts(uint32_t *Acc, const uint8_t *H, uint8_t X,
+                                 size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return accumulateProductsAVX2(Acc, H, X, N);
+#endif
+  accumulateProductsGeneric(Acc, H, X, N);
+}
+
+void kernels::widenAndClear(uint64_t *Wide, uint32_t *Narrow, size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return widenAndClearAVX2(Wide, Narrow, N);
+#endif
+  widenAndClearGeneric(Wide, Narrow, N);
+}
+
+void kernels::axpy(double *Y, const float *X, double A, size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return axpyAVX2(Y, X, A, N);
+#endif
+  axpyGeneric(Y, X, A, N);
+}
+
+void kernels::axpy(double *Y, const double *X, double A, size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return axpyAVX2(Y, X, A, N);
+#endif
+  axpyGeneric(Y, X, A, N);
+}
+
+void kernels::multiply(double *C, const float *A, const double *B, size_t M,
+                       size_t K, size_t N, size_t LdB) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return multiplyAVX2(C, A, B, M, K, N, LdB);
+#endif
+  multiplyGeneric(C, A, B, M, K, N, LdB);
+}
+
+void kernels::xorInto(uint64_t *Dst, const uint64_t *Src, size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return xorIntoAVX2(Dst, Src, N);
+#endif
+  xorIntoGeneric(Dst, Src, N);
+}
+
+uint64_t kernels::popcount(const uint64_t *A, size_t N) {
+  return popcountAnd(A, A, N);
+}
+
+uint64_t kernels::popcountAnd(const uint64_t *A, const uint64_t *B,
+                              size_t N) {
+#ifdef WYVERSE_X86_KERNELS
+  if (hasAVX2())
+    return popcountAndAVX2(A, B, N);
+#endif
+  return popcountAndGeneric(A, B, N);
+}
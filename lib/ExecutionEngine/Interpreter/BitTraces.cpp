@@ -0,0 +1,32 @@
+//===-- BitTraces.cpp - Bit-level traces packed by columns ----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/BitTraces.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+using namespace llvm;
+
+BitTraceMatrix::BitTraceMatrix(uint64_t NumSamples, uint64_t MaxTraces)
+  : NumColumns(NumSamples * 8), Capacity(alignTo(MaxTraces, 64)),
+    Words(NumColumns * (Capacity / 64), 0) {}
+
+bool BitTraceMatrix::addTrace(ArrayRef<uint8_t> Samples) {
+  if (NumTraces == Capacity)
+    return false;
+  const uint64_t NumWords = getNumWords();
+  const uint64_t Word = NumTraces / 64, Bit = 1ULL << (NumTraces % 64);
+  uint64_t *Base = &Words[Word];
+  size_t NumSamples = std::min<uint64_t>(Samples.size(), NumColumns / 8);
+  for (size_t s = 0; s != NumSamples; ++s)
+    for (unsigned V = Samples[s]; V; V &= V - 1)
+      Base[(s * 8 + countTrailingZeros(V)) * NumWords] |= Bit;
+  ++NumTraces;
+  return true;
+}
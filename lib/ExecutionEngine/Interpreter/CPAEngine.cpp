@@ -0,0 +1,314 @@
+//===-- CPAEngine.cpp - Streaming correlation power analysis --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/CPAEngine.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// CPAAccumulator
+//===----------------------------------------------------------------------===//
+
+CPAAccumulator::CPAAccumulator(const CPAEngine &Engine)
+  : Engine(Engine), SumH(Engine.RowSize, 0), SumH2(Engine.RowSize, 0),
+    Pred(Engine.RowSize, 0) {}
+
+void CPAAccumulator::resize(size_t Samples) {
+  NumSamples = Samples;
+  SumX.resize(Samples, 0);
+  SumX2.resize(Samples, 0);
+  SumXH.resize(Samples * Engine.RowSize, 0);
+  if (!WideXH.empty())
+    WideXH.resize(SumXH.size(), 0);
+}
+
+void CPAAccumulator::widen() {
+  if (WideXH.empty())
+    WideXH.assign(SumXH.size(), 0);
+  kernels::widenAndClear(WideXH.data(), SumXH.data(), SumXH.size());
+  SinceWiden = 0;
+}
+
+void CPAAccumulator::addTrace(const TraceRecord &Record) {
+  const CPAOptions &Opts = Engine.getOptions();
+  const unsigned Row = Engine.RowSize;
+
+  ArrayRef<uint8_t> Samples = Record.Samples;
+  if (Samples.size() <= Opts.SampleBegin)
+    Samples = ArrayRef<uint8_t>();
+  else
+    Samples = Samples.drop_front(Opts.SampleBegin);
+  if (Opts.MaxSamples && Samples.size() > Opts.MaxSamples)
+    Samples = Samples.take_front(Opts.MaxSamples);
+
+  // Outside the lock, rank() takes it.
+  if (!Engine.admit(Record.Index))
+    return;
+  sys::ScopedLock Guard(Lock);
+  if (!Engine.predict(Record, Pred.data()))
+    return;
+  if (Samples.size() > NumSamples)
+    resize(Samples.size());
+
+  for (unsigned i = 0; i != Row; ++i) {
+    SumH[i] += Pred[i];
+    SumH2[i] += Pred[i] * Pred[i];
+  }
+  for (size_t s = 0, e = Samples.size(); s != e; ++s) {
+    uint8_t X = Samples[s];
+    if (!X)
+      continue;
+    SumX[s] += X;
+    SumX2[s] += X * X;
+    kernels::accumulateProducts(&SumXH[s * Row], Pred.data(), X, Row);
+  }
+
+  ++NumTraces;
+  if (++SinceWiden == Engine.WidenPeriod)
+    widen();
+}
+
+//===----------------------------------------------------------------------===//
+// CPAEngine
+//===----------------------------------------------------------------------===//
+
+CPAEngine::CPAEngine(const CPAOptions &Options) : Opts(Options) {
+  assert(Opts.Selection && "CPA without a selection function");
+  if (Opts.TargetBytes.empty())
+    for (unsigned i = 0, e = Opts.Selection->getNumTargets(); i != e; ++i)
+      Opts.TargetBytes.push_back(i);
+  Table = SelectionTable(*Opts.Selection, Opts.TargetBytes);
+  RowSize = Opts.TargetBytes.size() * Table.getNumGuesses();
+  // The predicted leakage is a Hamming weight, at most the number of bits.
+  WidenPeriod = UINT32_MAX / (255 * Table.getNumBits());
+}
+
+CPAAccumulator &CPAEngine::createAccumulator() {
+  sys::ScopedLock Guard(Lock);
+  Accumulators.emplace_back(new CPAAccumulator(*this));
+  return *Accumulators.back();
+}
+
+bool CPAEngine::admit(uint64_t Index) const {
+  if (!CheckPeriod)
+    return true;
+  uint64_t Begin = Index / CheckPeriod * CheckPeriod;
+  std::unique_lock<std::mutex> Guard(GateLock);
+  GateCV.wait(Guard, [&] { return Stopped || Checked >= Begin; });
+  return !Stopped || Index < Checked;
+}
+
+void CPAEngine::passCheckpoint(uint64_t NumRuns) {
+  std::lock_guard<std::mutex> Guard(GateLock);
+  Checked = NumRuns;
+  GateCV.notify_all();
+}
+
+void CPAEngine::stop() {
+  std::lock_guard<std::mutex> Guard(GateLock);
+  Stopped = true;
+  GateCV.notify_all();
+}
+
+bool CPAEngine::predict(const TraceRecord &Record, uint8_t *H) const {
+  const SelectionFunction &F = *Opts.Selection;
+  const std::vector<uint8_t> &Bytes =
+    F.getSource() == SelectionFunction::Input ? Record.Input : Record.Output;
+  const unsigned G = Table.getNumGuesses();
+
+  for (unsigned t = 0, e = Opts.TargetBytes.size(); t != e; ++t) {
+    unsigned Target = Opts.TargetBytes[t];
+    if (Bytes.size() < F.getKnownSize(Target))
+      return false;
+    memcpy(&H[t * G], Table.getWeights(t, F.getKnown(Bytes, Target)), G);
+  }
+  return true;
+}
+
+CPAEngine::Ranking CPAEngine::rank() const {
+  sys::ScopedLock Guard(Lock);
+  // A consistent snapshot: the workers wait until the ranking is done.
+  for (auto &A : Accumulators)
+    A->Lock.lock();
+
+  Ranking R;
+  size_t NumSamples = 0;
+  std::vector<uint64_t> SumH(RowSize, 0), SumH2(RowSize, 0);
+  for (auto &A : Accumulators) {
+    R.NumTraces += A->NumTraces;
+    NumSamples = std::max(NumSamples, A->NumSamples);
+    for (unsigned i = 0; i != RowSize; ++i) {
+      SumH[i] += A->SumH[i];
+      SumH2[i] += A->SumH2[i];
+    }
+  }
+
+  std::vector<double> Best(RowSize, 0.0);
+  std::vector<uint64_t> BestSample(RowSize, 0);
+  if (R.NumTraces > 1) {
+    // The sums are exact, only the centring is done in floating point:
+    //   Cov = Sum xh - Sum x * Sum h / n,  Var = Sum x^2 - (Sum x)^2 / n
+    const double N = R.NumTraces;
+    std::vector<double> VarH(RowSize);
+    for (unsigned i = 0; i != RowSize; ++i)
+      VarH[i] = SumH2[i] - double(SumH[i]) * (SumH[i] / N);
+
+    std::vector<uint64_t> XH(RowSize);
+    for (size_t s = 0; s != NumSamples; ++s) {
+      uint64_t SX = 0, SX2 = 0;
+      std::fill(XH.begin(), XH.end(), 0);
+      for (auto &A : Accumulators) {
+        if (s >= A->NumSamples)
+          continue;
+        SX += A->SumX[s];
+        SX2 += A->SumX2[s];
+        const uint32_t *Narrow = &A->SumXH[s * RowSize];
+        for (unsigned i = 0; i != RowSize; ++i)
+          XH[i] += Narrow[i];
+        if (!A->WideXH.empty()) {
+          const uint64_t *Wide = &A->WideXH[s * RowSize];
+          for (unsigned i = 0; i != RowSize; ++i)
+            XH[i] += Wide[i];
+        }
+      }
+
+      double MeanX = SX / N;
+      double VarX = SX2 - SX * MeanX;
+      if (VarX <= 0)
+        continue;                 // constant sample
+      for (unsigned i = 0; i != RowSize; ++i) {
+        if (VarH[i] <= 0)
+          continue;
+        double Cov = XH[i] - MeanX * SumH[i];
+        double Rho = std::fabs(Cov) / std::sqrt(VarX * VarH[i]);
+        if (Rho > Best[i]) {
+          Best[i] = Rho;
+          BestSample[i] = s;
+        }
+      }
+    }
+  }
+
+  for (auto &A : Accumulators)
+    A->Lock.unlock();
+
+  const unsigned G = Table.getNumGuesses();
+  for (unsigned t = 0, e = Opts.TargetBytes.size(); t != e; ++t) {
+    ByteRanking BR;
+    BR.Byte = Opts.TargetBytes[t];
+    for (unsigned k = 0; k != G; ++k)
+      BR.Guesses.push_back({uint8_t(k), Best[t * G + k],
+                            Opts.SampleBegin + BestSample[t * G + k],
+                            NoSample});
+    std::stable_sort(BR.Guesses.begin(), BR.Guesses.end(),
+                     [](const Guess &A, const Guess &B) {
+                       return A.Score > B.Score;
+                     });
+    R.Bytes.push_back(std::move(BR));
+  }
+  return R;
+}
+
+void CPAEngine::printRanking(raw_ostream &OS, const Ranking &R,
+                             unsigned Top, StringRef Attack) {
+  OS << Attack << " key ranking after " << R.NumTraces << " traces\n";
+  for (const ByteRanking &BR : R.Bytes) {
+    OS << "  byte " << format("%2u", BR.Byte) << ":";
+    for (unsigned i = 0; i != Top && i != BR.Guesses.size(); ++i) {
+      const Guess &G = BR.Guesses[i];
+      OS << "  " << format("%02x", G.Key) << " (" << format("%.4f", G.Score)
+         << " @" << G.Sample;
+      if (G.PairSample != NoSample)
+        OS << "+" << G.PairSample;
+      OS << ")";
+    }
+    OS << "\n";
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// CPAConvergence
+//===----------------------------------------------------------------------===//
+
+double CPAConvergence::getMargin(const CPAEngine::ByteRanking &BR) {
+  if (BR.Guesses.size() < 2 || BR.Guesses[0].Score <= 0)
+    return 0;
+  return (BR.Guesses[0].Score - BR.Guesses[1].Score) / BR.Guesses[0].Score;
+}
+
+bool CPAConvergence::update(const CPAEngine::Ranking &R) {
+  bool Settled = !R.Bytes.empty();
+  for (const CPAEngine::ByteRanking &BR : R.Bytes) {
+    if (BR.Byte >= Best.size()) {
+      Best.resize(BR.Byte + 1, -1);
+      Streak.resize(BR.Byte + 1, 0);
+    }
+    int First = BR.Guesses.empty() ? -1 : BR.Guesses[0].Key;
+    if (First < 0 || getMargin(BR) < Margin)
+      Streak[BR.Byte] = 0;
+    else if (First == Best[BR.Byte])
+      ++Streak[BR.Byte];
+    else
+      Streak[BR.Byte] = 1;
+    Best[BR.Byte] = First;
+    Settled &= Streak[BR.Byte] >= Checkpoints;
+  }
+  return Settled;
+}
+
+void CPAConvergence::print(raw_ostream &OS,
+                           const CPAEngine::Ranking &R) const {
+  unsigned NumSettled = 0;
+  double MinMargin = 1;
+  unsigned MinByte = 0;
+  OS << R.NumTraces << " traces: key ";
+  for (const CPAEngine::ByteRanking &BR : R.Bytes) {
+    if (BR.Guesses.empty())
+      continue;
+    OS << format("%02x", BR.Guesses[0].Key);
+    NumSettled += Streak[BR.Byte] >= Checkpoints;
+    double M = getMargin(BR);
+    if (M < MinMargin) {
+      MinMargin = M;
+      MinByte = BR.Byte;
+    }
+  }
+  OS << ", min margin " << format("%.3f", MinMargin) << " (byte " << MinByte
+     << "), " << NumSettled << "/" << R.Bytes.size() << " bytes settled\n";
+
+  if (KnownKey.empty())
+    return;
+  OS << "  ranks of the known key:";
+  for (const CPAEngine::ByteRanking &BR : R.Bytes) {
+    if (BR.Byte >= KnownKey.size())
+      continue;
+    unsigned Rank = 1;
+    while (Rank <= BR.Guesses.size() &&
+           BR.Guesses[Rank - 1].Key != KnownKey[BR.Byte])
+      ++Rank;
+    OS << " " << Rank;
+  }
+  OS << "\n";
+}
+
+//===----------------------------------------------------------------------===//
+// CPAAction
+//===----------------------------------------------------------------------===//
+
+void CPAAction::print(raw_ostream &ROS) {
+  ROS << "CPA => Correlation of the traced samples with the predicted "
+         "intermediate values, computed while the traces are acquired "
+         "(batch mode).\n";
+}
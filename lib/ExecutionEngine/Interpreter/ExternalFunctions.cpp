@@ -24,17 +24,21 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/Config/config.h" // Detect libffi
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/GuestFileSystem.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/Compiler.h"
 #include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/Mutex.h"
 #include "llvm/Support/UniqueLock.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <csignal>
@@ -69,7 +73,12 @@ typedef void (*RawFunc)();
 static ManagedStatic<std::map<const Function *, RawFunc> > RawFunctions;
 #endif
 
-static Interpreter *TheInterpreter;
+// Batch mode runs one interpreter per worker thread, each of them must see
+// its own instance from the lle_X_* wrappers.
+static LLVM_THREAD_LOCAL Interpreter *TheInterpreter;
+
+// Serializes the guest output of concurrently running interpreters.
+static ManagedStatic<sys::Mutex> OutputLock;
 
 static char getTypeID(Type *Ty) {
   switch (Ty->getTypeID()) {
@@ -263,6 +272,15 @@ static bool ffiInvoke(RawFunc Fn, Function *F, ArrayRef<GenericValue> ArgVals,
 }
 #endif // USE_LIBFFI
 
+// asGuestFile - The file preloaded in the GuestFileSystem a FILE * of the
+// program is, or null for a host stream.
+static GuestFileSystem::GuestFile *asGuestFile(const GenericValue &Stream) {
+  GuestFileSystem &GFS = GuestFileSystem::instance();
+  void *Ptr = GVTOP(Stream);
+  return GFS.isGuestFile(Ptr) ? static_cast<GuestFileSystem::GuestFile *>(Ptr)
+                              : nullptr;
+}
+
 GenericValue Interpreter::callExternalFunction(Function *F,
                                                ArrayRef<GenericValue> ArgVals) {
   TheInterpreter = this;
@@ -278,6 +296,16 @@ GenericValue Interpreter::callExternalFunction(Function *F,
     return Fn(F->getFunctionType(), ArgVals);
   }
 
+  // A preloaded file is not a host FILE: the host libc would crash on it.
+  if (LLVM_UNLIKELY(!GuestFileSystem::instance().empty())) {
+    FunctionType *FT = F->getFunctionType();
+    for (unsigned i = 0, e = FT->getNumParams(); i != e; ++i)
+      if (FT->getParamType(i)->isPointerTy() && asGuestFile(ArgVals[i]))
+        report_fatal_error("'" + F->getName() + "' is not supported on a "
+                           "preloaded file, only the stdio functions that "
+                           "read it are");
+  }
+
 #ifdef USE_LIBFFI
   std::map<const Function *, RawFunc>::iterator RF = RawFunctions->find(F);
   RawFunc RawFn;
@@ -430,6 +458,11 @@ static GenericValue lle_X_printf(FunctionType *FT,
   NewArgs.push_back(PTOGV((void*)&Buffer[0]));
   NewArgs.insert(NewArgs.end(), Args.begin(), Args.end());
   GenericValue GV = lle_X_sprintf(FT, NewArgs);
+  if (std::string *Capture = TheInterpreter->getOutputCapture(stdout)) {
+    Capture->append(Buffer);
+    return GV;
+  }
+  sys::ScopedLock Writer(*OutputLock);
   outs() << Buffer;
   return GV;
 }
@@ -474,7 +507,13 @@ static GenericValue lle_X_fprintf(FunctionType *FT,
   NewArgs.insert(NewArgs.end(), Args.begin()+1, Args.end());
   GenericValue GV = lle_X_sprintf(FT, NewArgs);
 
-  fputs(Buffer, (FILE *) GVTOP(Args[0]));
+  if (std::string *Capture = TheInterpreter->getOutputCapture(GVTOP(Args[0])))
+    Capture->append(Buffer);
+  else if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0])) {
+    File->Error = true;
+    GV.IntVal = APInt(32, -1, true);
+  } else
+    fputs(Buffer, (FILE *) GVTOP(Args[0]));
   return GV;
 }
 
@@ -502,35 +541,167 @@ static GenericValue lle_X_memcpy(FunctionType *FT,
   return GV;
 }
 
+size_t APIntTOSIZET(APInt V) {
+  return (size_t)*V.getRawData();
+}
+int APIntTOInt(APInt V) {
+  return (int)*V.getRawData();
+}
+
+// The stdio wrappers below serve the files preloaded in the GuestFileSystem
+// from memory and forward everything else to the host.
+
 // fopen for Linux and MacOS
 static GenericValue lle_X_fopen(FunctionType *FT,
                                 ArrayRef<GenericValue> Args) {
-  FILE *fp = fopen((char *)GVTOP(Args[0]), (char *)GVTOP(Args[1]));
+  const char *Path = (char *)GVTOP(Args[0]);
+  const char *Mode = (char *)GVTOP(Args[1]);
   GenericValue GV;
-  GV.PointerVal = fp;
+  if (GuestFileSystem::GuestFile *File =
+        GuestFileSystem::instance().open(Path, Mode))
+    GV.PointerVal = File;
+  else
+    GV.PointerVal = fopen(Path, Mode);
   return GV;
 }
 
-size_t APIntTOSIZET(APInt V) {
-  return (size_t)*V.getRawData();
+static GenericValue lle_X_fread(FunctionType *FT, ArrayRef<GenericValue> Args) {
+  size_t bytes;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[3]))
+    bytes = GuestFileSystem::instance().read(File, GVTOP(Args[0]),
+                                             APIntTOSIZET(Args[1].IntVal),
+                                             APIntTOSIZET(Args[2].IntVal));
+  else
+    bytes = fread(GVTOP(Args[0]), APIntTOSIZET(Args[1].IntVal),
+                  APIntTOSIZET(Args[2].IntVal), (FILE *)GVTOP(Args[3]));
+  GenericValue GV;
+  GV.IntVal = APInt(FT->getReturnType()->getIntegerBitWidth(), bytes);
+  return GV;
 }
-int APIntTOInt(APInt V) {
-  return (int)*V.getRawData();
+
+static GenericValue lle_X_fclose(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  int ret = 0;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    GuestFileSystem::instance().close(File);
+  else
+    ret = fclose((FILE *)GVTOP(Args[0]));
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret);
+  return GV;
 }
 
-static GenericValue lle_X_fread(FunctionType *FT, ArrayRef<GenericValue> Args) {
-  size_t bytes = fread(GVTOP(Args[0]), APIntTOSIZET(Args[1].IntVal),
-		       APIntTOSIZET(Args[2].IntVal), (FILE *)GVTOP(Args[3]));
+// int fseek(FILE *, long, int)
+static GenericValue lle_X_fseek(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  int64_t offset = Args[1].IntVal.getSExtValue();
+  int whence = APIntTOInt(Args[2].IntVal);
+  int ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    ret = GuestFileSystem::instance().seek(File, offset, whence);
+  else
+    ret = fseek((FILE *)GVTOP(Args[0]), offset, whence);
   GenericValue GV;
-  GV.IntVal = bytes;
+  GV.IntVal = APInt(32, ret);
   return GV;
 }
 
-static GenericValue lle_X_fclose(FunctionType *FT,
+// long ftell(FILE *)
+static GenericValue lle_X_ftell(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  int64_t ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    ret = GuestFileSystem::instance().tell(File);
+  else
+    ret = ftell((FILE *)GVTOP(Args[0]));
+  GenericValue GV;
+  GV.IntVal = APInt(FT->getReturnType()->getIntegerBitWidth(), ret, true);
+  return GV;
+}
+
+// void rewind(FILE *)
+static GenericValue lle_X_rewind(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    GuestFileSystem::instance().seek(File, 0, SEEK_SET);
+  else
+    rewind((FILE *)GVTOP(Args[0]));
+  return GenericValue();
+}
+
+// char *fgets(char *, int, FILE *)
+static GenericValue lle_X_fgets(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  char *buf = (char *)GVTOP(Args[0]);
+  int size = APIntTOInt(Args[1].IntVal);
+  GenericValue GV;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[2]))
+    GV.PointerVal = GuestFileSystem::instance().gets(File, buf, size);
+  else
+    GV.PointerVal = fgets(buf, size, (FILE *)GVTOP(Args[2]));
+  return GV;
+}
+
+// int fgetc(FILE *), int getc(FILE *)
+static GenericValue lle_X_fgetc(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  int ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    ret = GuestFileSystem::instance().getc(File);
+  else
+    ret = fgetc((FILE *)GVTOP(Args[0]));
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret, true);
+  return GV;
+}
+
+// int feof(FILE *)
+static GenericValue lle_X_feof(FunctionType *FT,
+			       ArrayRef<GenericValue> Args) {
+  int ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    ret = File->Eof;
+  else
+    ret = feof((FILE *)GVTOP(Args[0]));
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret);
+  return GV;
+}
+
+// int ferror(FILE *)
+static GenericValue lle_X_ferror(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  int ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    ret = File->Error;
+  else
+    ret = ferror((FILE *)GVTOP(Args[0]));
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret);
+  return GV;
+}
+
+// void clearerr(FILE *)
+static GenericValue lle_X_clearerr(FunctionType *FT,
+				   ArrayRef<GenericValue> Args) {
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[0]))
+    File->Eof = File->Error = false;
+  else
+    clearerr((FILE *)GVTOP(Args[0]));
+  return GenericValue();
+}
+
+// int ungetc(int, FILE *)
+static GenericValue lle_X_ungetc(FunctionType *FT,
 				 ArrayRef<GenericValue> Args) {
-  int ret = fclose((FILE *)GVTOP(Args[0]));
+  int c = APIntTOInt(Args[0].IntVal);
+  int ret;
+  if (GuestFileSystem::GuestFile *File = asGuestFile(Args[1]))
+    ret = GuestFileSystem::instance().ungetc(File, c);
+  else
+    ret = ungetc(c, (FILE *)GVTOP(Args[1]));
   GenericValue GV;
-  GV.IntVal = ret;
+  GV.IntVal = APInt(32, ret, true);
   return GV;
 }
 
@@ -547,12 +718,178 @@ static GenericValue lle_X_strtoul(FunctionType *FT,
 
 static GenericValue lle_X_putchar(FunctionType *FT,
 				  ArrayRef<GenericValue> Args) {
-  int ret = putchar(APIntTOInt(Args[0].IntVal));
+  int ret = APIntTOInt(Args[0].IntVal);
+  if (std::string *Capture = TheInterpreter->getOutputCapture(stdout))
+    Capture->push_back((char)ret);
+  else
+    ret = putchar(ret);
   GenericValue GV;
   GV.IntVal = APInt(sizeof(ret)*8, ret);
   return GV;
 }
 
+// int puts(const char *)
+static GenericValue lle_X_puts(FunctionType *FT,
+			       ArrayRef<GenericValue> Args) {
+  const char *str = (char *)GVTOP(Args[0]);
+  int ret = 1;
+  if (std::string *Capture = TheInterpreter->getOutputCapture(stdout)) {
+    Capture->append(str);
+    Capture->push_back('\n');
+  } else {
+    ret = puts(str);
+  }
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret, true);
+  return GV;
+}
+
+// int fputs(const char *, FILE *)
+static GenericValue lle_X_fputs(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  const char *str = (char *)GVTOP(Args[0]);
+  int ret = 1;
+  if (std::string *Capture = TheInterpreter->getOutputCapture(GVTOP(Args[1])))
+    Capture->append(str);
+  else if (GuestFileSystem::GuestFile *File = asGuestFile(Args[1])) {
+    File->Error = true;
+    ret = EOF;
+  } else
+    ret = fputs(str, (FILE *)GVTOP(Args[1]));
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret, true);
+  return GV;
+}
+
+// size_t fwrite(const void *, size_t, size_t, FILE *)
+static GenericValue lle_X_fwrite(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  const char *ptr = (char *)GVTOP(Args[0]);
+  size_t size = APIntTOSIZET(Args[1].IntVal);
+  size_t count = APIntTOSIZET(Args[2].IntVal);
+  size_t ret;
+  if (std::string *Capture =
+        TheInterpreter->getOutputCapture(GVTOP(Args[3]))) {
+    Capture->append(ptr, size * count);
+    ret = count;
+  } else if (GuestFileSystem::GuestFile *File = asGuestFile(Args[3])) {
+    File->Error = true;
+    ret = 0;
+  } else {
+    ret = fwrite(ptr, size, count, (FILE *)GVTOP(Args[3]));
+  }
+  GenericValue GV;
+  GV.IntVal = APInt(FT->getReturnType()->getIntegerBitWidth(), ret);
+  return GV;
+}
+
+// int fputc(int, FILE *), int putc(int, FILE *)
+static GenericValue lle_X_fputc(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  int ret = APIntTOInt(Args[0].IntVal);
+  if (std::string *Capture =
+        TheInterpreter->getOutputCapture(GVTOP(Args[1]))) {
+    Capture->push_back((char)ret);
+    ret = (unsigned char)ret;
+  } else if (GuestFileSystem::GuestFile *File = asGuestFile(Args[1])) {
+    File->Error = true;
+    ret = EOF;
+  } else {
+    ret = fputc(ret, (FILE *)GVTOP(Args[1]));
+  }
+  GenericValue GV;
+  GV.IntVal = APInt(32, ret, true);
+  return GV;
+}
+
+// int rand(void), long random(void) - served from the interpreter so that a
+// batch run is reproducible whatever the worker it is scheduled on.
+static GenericValue lle_X_rand(FunctionType *FT,
+			       ArrayRef<GenericValue> Args) {
+  GenericValue GV;
+  GV.IntVal = APInt(FT->getReturnType()->getIntegerBitWidth(),
+		    TheInterpreter->nextGuestRandom());
+  return GV;
+}
+
+// void srand(unsigned int)
+static GenericValue lle_X_srand(FunctionType *FT,
+				ArrayRef<GenericValue> Args) {
+  TheInterpreter->srandGuest(Args[0].IntVal.getZExtValue());
+  return GenericValue();
+}
+
+// void *malloc(size_t), calloc(size_t, size_t), realloc(void *, size_t) and
+// void free(void *) - the interpreter accounts for the heap of the program,
+// to bound it (see RunLimits).
+static GenericValue lle_X_malloc(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  uint64_t Size = Args[0].IntVal.getZExtValue();
+  void *Mem = nullptr;
+  if (TheInterpreter->reserveHeap(nullptr, Size)) {
+    // A large buffer preloaded files can be mapped over, if zero-copy.
+    Mem = GuestFileSystem::instance().allocate(Size);
+    if (!Mem)
+      Mem = malloc(Size);
+    if (Mem)
+      TheInterpreter->heapChanged(nullptr, Mem, Size);
+  }
+  return PTOGV(Mem);
+}
+
+static GenericValue lle_X_calloc(FunctionType *FT,
+				 ArrayRef<GenericValue> Args) {
+  uint64_t Count = Args[0].IntVal.getZExtValue();
+  uint64_t Size = Args[1].IntVal.getZExtValue();
+  uint64_t Total = SaturatingMultiply(Count, Size);
+  void *Mem = nullptr;
+  if (TheInterpreter->reserveHeap(nullptr, Total)) {
+    Mem = GuestFileSystem::instance().allocate(Total);
+    if (!Mem)
+      Mem = calloc(Count, Size);
+    if (Mem)
+      TheInterpreter->heapChanged(nullptr, Mem, Total);
+  }
+  return PTOGV(Mem);
+}
+
+static GenericValue lle_X_realloc(FunctionType *FT,
+				  ArrayRef<GenericValue> Args) {
+  void *Old = GVTOP(Args[0]);
+  uint64_t Size = Args[1].IntVal.getZExtValue();
+  void *Mem = nullptr;
+  if (TheInterpreter->reserveHeap(Old, Size)) {
+    GuestFileSystem &GFS = GuestFileSystem::instance();
+    if (size_t OldSize = GFS.getBufferSize(Old)) {
+      if (Size) {
+        Mem = GFS.allocate(Size);
+        if (!Mem)
+          Mem = malloc(Size);
+      }
+      if (Mem)
+        memcpy(Mem, Old, std::min<uint64_t>(OldSize, Size));
+      if (Mem || Size == 0)
+        GFS.release(Old);
+    } else {
+      Mem = realloc(Old, Size);
+    }
+    // realloc(p, 0) may free p and return null.
+    if (Mem || Size == 0)
+      TheInterpreter->heapChanged(Old, Mem, Mem ? Size : 0);
+  }
+  return PTOGV(Mem);
+}
+
+static GenericValue lle_X_free(FunctionType *FT,
+			       ArrayRef<GenericValue> Args) {
+  void *Mem = GVTOP(Args[0]);
+  if (!GuestFileSystem::instance().release(Mem))
+    free(Mem);
+  if (Mem)
+    TheInterpreter->heapChanged(Mem, nullptr, 0);
+  return GenericValue();
+}
+
 
 void Interpreter::initializeExternalFunctions() {
   sys::ScopedLock Writer(*FunctionsLock);
@@ -572,7 +909,34 @@ void Interpreter::initializeExternalFunctions() {
   (*FuncNames)["lle_X__fopen"]       = lle_X_fopen;
   (*FuncNames)["lle_X_fread"]        = lle_X_fread;
   (*FuncNames)["lle_X_fclose"]       = lle_X_fclose;
+  (*FuncNames)["lle_X_fseek"]        = lle_X_fseek;
+  (*FuncNames)["lle_X_ftell"]        = lle_X_ftell;
+  (*FuncNames)["lle_X_rewind"]       = lle_X_rewind;
+  (*FuncNames)["lle_X_fgets"]        = lle_X_fgets;
+  (*FuncNames)["lle_X_fgetc"]        = lle_X_fgetc;
+  (*FuncNames)["lle_X_getc"]         = lle_X_fgetc;
+  (*FuncNames)["lle_X__IO_getc"]     = lle_X_fgetc;
+  (*FuncNames)["lle_X_feof"]         = lle_X_feof;
+  (*FuncNames)["lle_X_ferror"]       = lle_X_ferror;
+  (*FuncNames)["lle_X_clearerr"]     = lle_X_clearerr;
+  (*FuncNames)["lle_X_ungetc"]       = lle_X_ungetc;
 
   (*FuncNames)["lle_X_strtoul"]      = lle_X_strtoul;
   (*FuncNames)["lle_X_putchar"]      = lle_X_putchar;
+  (*FuncNames)["lle_X_puts"]         = lle_X_puts;
+  (*FuncNames)["lle_X_fputs"]        = lle_X_fputs;
+  (*FuncNames)["lle_X_fwrite"]       = lle_X_fwrite;
+  (*FuncNames)["lle_X_fputc"]        = lle_X_fputc;
+  (*FuncNames)["lle_X_putc"]         = lle_X_fputc;
+  (*FuncNames)["lle_X__IO_putc"]     = lle_X_fputc;
+
+  (*FuncNames)["lle_X_rand"]         = lle_X_rand;
+  (*FuncNames)["lle_X_random"]       = lle_X_rand;
+  (*FuncNames)["lle_X_srand"]        = lle_X_srand;
+  (*FuncNames)["lle_X_srandom"]      = lle_X_srand;
+
+  (*FuncNames)["lle_X_malloc"]       = lle_X_malloc;
+  (*FuncNames)["lle_X_calloc"]       = lle_X_calloc;
+  (*FuncNames)["lle_X_realloc"]      = lle_X_realloc;
+  (*FuncNames)["lle_X_free"]         = lle_X_free;
 }
@@ -0,0 +1,504 @@
+//===-- FaultAction.cpp - Instruction-level fault injection ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/FaultAction.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/WithColor.h"
+#include "Interpreter.h"
+
+using namespace llvm;
+
+namespace {
+
+struct ModelInfo {
+  const char *Name;
+  FaultModel Model;
+  unsigned MinArgs, MaxArgs;
+};
+
+const ModelInfo Models[] = {
+  {"skip",     FaultModel::Skip,    0, 0},
+  {"bit-flip", FaultModel::BitFlip, 1, 1},
+  {"set-byte", FaultModel::SetByte, 2, 2},
+  {"random",   FaultModel::Random,  0, 0},
+  {"memory",   FaultModel::Memory,  1, 2},
+  {"branch",   FaultModel::Branch,  0, 1},
+};
+
+} // end anonymous namespace
+
+static const ModelInfo &getModelInfo(FaultModel Model) {
+  for (const ModelInfo &Info : Models)
+    if (Info.Model == Model)
+      return Info;
+  llvm_unreachable("unknown fault model");
+}
+
+//===----------------------------------------------------------------------===//
+// FaultSpec
+//===----------------------------------------------------------------------===//
+
+Expected<FaultSpec> FaultSpec::parse(StringRef Spec) {
+  auto Invalid = [&](const char *Why) {
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "fault '%s': %s", Spec.str().c_str(), Why);
+  };
+
+  SmallVector<StringRef, 3> Fields;
+  Spec.split(Fields, ':', 2);
+  if (Fields.size() < 2)
+    return Invalid("expected ID[@OCC]:MODEL[:ARGS]");
+
+  FaultSpec F;
+  StringRef ID, Occurrence;
+  std::tie(ID, Occurrence) = Fields[0].split('@');
+  if (ID.getAsInteger(10, F.Inst) || F.Inst == InstructionIndex::InvalidID)
+    return Invalid("expected an instruction ID");
+  if (Occurrence == "*")
+    F.Occurrence = EveryOccurrence;
+  else if (Fields[0].contains('@') &&
+           (Occurrence.getAsInteger(10, F.Occurrence) ||
+            F.Occurrence == EveryOccurrence))
+    return Invalid("expected an occurrence number or '*'");
+
+  const ModelInfo *Info = nullptr;
+  for (const ModelInfo &I : Models)
+    if (Fields[1] == I.Name)
+      Info = &I;
+  if (!Info)
+    return Invalid("unknown model, expected skip, bit-flip, set-byte, "
+                   "random, memory or branch");
+  F.Model = Info->Model;
+
+  SmallVector<StringRef, 2> Args;
+  if (Fields.size() == 3)
+    Fields[2].split(Args, ',');
+  if (Args.size() < Info->MinArgs || Args.size() > Info->MaxArgs)
+    return Invalid("wrong number of arguments for the model");
+  SmallVector<unsigned, 2> Values;
+  for (StringRef Arg : Args) {
+    Values.emplace_back();
+    if (Arg.trim().getAsInteger(0, Values.back()))
+      return Invalid("expected a number");
+  }
+
+  switch (F.Model) {
+  case FaultModel::Skip:
+  case FaultModel::Random:
+    break;
+  case FaultModel::BitFlip:
+    F.Bit = Values[0];
+    break;
+  case FaultModel::SetByte:
+    if (Values[1] > 0xff)
+      return Invalid("the byte value is above 255");
+    F.Byte = Values[0];
+    F.Value = Values[1];
+    break;
+  case FaultModel::Memory:
+    F.Byte = Values[0];
+    F.RandomMask = Values.size() == 1;
+    if (!F.RandomMask && (Values[1] == 0 || Values[1] > 0xff))
+      return Invalid("the mask is not a non-zero byte");
+    if (!F.RandomMask)
+      F.Value = Values[1];
+    break;
+  case FaultModel::Branch:
+    if (!Values.empty() && Values[0] > 0xffff)
+      return Invalid("the successor is out of range");
+    if (!Values.empty())
+      F.Successor = Values[0];
+    break;
+  }
+  return F;
+}
+
+Expected<std::vector<FaultSpec>> FaultSpec::parseSweep(StringRef Spec) {
+  // Split the numbers out of the separators, and expand every FIRST-LAST
+  // token; the model names have no digits around their dashes.
+  SmallVector<std::pair<uint64_t, uint64_t>, 4> Ranges;
+  SmallVector<StringRef, 8> Parts;   // text between the ranges
+  size_t Begin = 0, Pos = 0;
+  while (Pos <= Spec.size()) {
+    size_t End = Spec.find_first_of(":@,", Pos);
+    if (End == StringRef::npos)
+      End = Spec.size();
+    StringRef Token = Spec.slice(Pos, End);
+    StringRef First, Last;
+    std::tie(First, Last) = Token.split('-');
+    uint64_t Lo, Hi;
+    if (!Last.empty() && !First.getAsInteger(0, Lo) &&
+        !Last.getAsInteger(0, Hi)) {
+      if (Lo > Hi)
+        return createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "fault '%s': empty range '%s'", Spec.str().c_str(),
+          Token.str().c_str());
+      Parts.push_back(Spec.slice(Begin, Pos));
+      Ranges.push_back({Lo, Hi});
+      Begin = End;
+    }
+    Pos = End + 1;
+  }
+  Parts.push_back(Spec.substr(Begin));
+
+  const uint64_t MaxCount = 1 << 24;
+  uint64_t Count = 1;
+  for (auto &R : Ranges) {
+    if (R.second - R.first >= MaxCount / Count)
+      return createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "fault '%s': more than 2^24 faults", Spec.str().c_str());
+    Count *= R.second - R.first + 1;
+  }
+
+  std::vector<FaultSpec> Specs;
+  Specs.reserve(Count);
+  for (uint64_t N = 0; N != Count; ++N) {
+    std::string Text = Parts[0].str();
+    uint64_t Rest = N;
+    for (unsigned i = 0, e = Ranges.size(); i != e; ++i) {
+      uint64_t Size = Ranges[i].second - Ranges[i].first + 1;
+      Text += utostr(Ranges[i].first + Rest % Size);
+      Text += Parts[i + 1];
+      Rest /= Size;
+    }
+    Expected<FaultSpec> F = parse(Text);
+    if (!F)
+      return F.takeError();
+    Specs.push_back(*F);
+  }
+  return std::move(Specs);
+}
+
+void FaultSpec::print(raw_ostream &OS) const {
+  OS << Inst << '@';
+  if (Occurrence == EveryOccurrence)
+    OS << '*';
+  else
+    OS << Occurrence;
+  OS << ':' << getModelInfo(Model).Name;
+  switch (Model) {
+  case FaultModel::Skip:
+  case FaultModel::Random:
+    break;
+  case FaultModel::BitFlip:
+    OS << ':' << Bit;
+    break;
+  case FaultModel::SetByte:
+    OS << ':' << Byte << ',' << unsigned(Value);
+    break;
+  case FaultModel::Memory:
+    OS << ':' << Byte;
+    if (!RandomMask)
+      OS << ',' << unsigned(Value);
+    break;
+  case FaultModel::Branch:
+    if (Successor >= 0)
+      OS << ':' << Successor;
+    break;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// FaultAction
+//===----------------------------------------------------------------------===//
+
+/// isCorruptible - Whether a value of type Ty goes through Store /
+/// LoadValueFromMemory.
+static bool isCorruptible(Type *Ty) {
+  Type *ElemTy = Ty->getScalarType();
+  return Ty->isPointerTy() || ElemTy->isIntegerTy() || ElemTy->isFloatTy() ||
+         ElemTy->isDoubleTy();
+}
+
+/// getResultType - The type of the value a result fault corrupts: the value
+/// defined by I or, for a store, the value written.
+static Type *getResultType(Instruction &I) {
+  if (auto *SI = dyn_cast<StoreInst>(&I))
+    return SI->getValueOperand()->getType();
+  return I.getType();
+}
+
+const char *FaultSpec::check(Instruction &I) const {
+  // The PHI nodes are evaluated by the branches, never visited.
+  if (isa<PHINode>(I))
+    return "PHI nodes are not executed as instructions";
+  const DataLayout &DL = I.getModule()->getDataLayout();
+
+  switch (Model) {
+  case FaultModel::Skip:
+    if (I.isTerminator())
+      return "a terminator cannot be skipped, use the branch model";
+    if (!I.getType()->isVoidTy() && !isCorruptible(I.getType()))
+      return "the instruction defines an aggregate";
+    return nullptr;
+
+  case FaultModel::BitFlip:
+  case FaultModel::SetByte:
+  case FaultModel::Random: {
+    // The result of a call is only known at its return.
+    Type *Ty = getResultType(I);
+    if (Ty->isVoidTy() || isa<CallInst>(I) || I.isTerminator())
+      return "the instruction has no result to corrupt";
+    if (!isCorruptible(Ty))
+      return "the result is an aggregate";
+    uint64_t Size = DL.getTypeStoreSize(Ty);
+    uint64_t Bits = Ty->isIntegerTy() ? Ty->getIntegerBitWidth() : Size * 8;
+    if (Model == FaultModel::BitFlip && Bit >= Bits)
+      return "the bit is beyond the result";
+    if (Model == FaultModel::SetByte && Byte >= Size)
+      return "the byte is beyond the result";
+    return nullptr;
+  }
+
+  case FaultModel::Memory:
+    if (isa<LoadInst>(I) || isa<StoreInst>(I))
+      return nullptr;
+    if (!I.getType()->isPointerTy() || isa<CallInst>(I) || I.isTerminator())
+      return "the instruction neither accesses memory nor defines a pointer";
+    return nullptr;
+
+  case FaultModel::Branch:
+    if ((!isa<BranchInst>(I) || !cast<BranchInst>(I).isConditional()) &&
+        !isa<SwitchInst>(I))
+      return "not a conditional branch or a switch";
+    if (I.getNumSuccessors() < 2)
+      return "the switch has a single successor";
+    if (Successor >= (int)I.getNumSuccessors())
+      return "no such successor";
+    return nullptr;
+  }
+  llvm_unreachable("unknown fault model");
+}
+
+void FaultAction::resolve() {
+  const InstructionIndex *Index = getInstructionIndex();
+  Sites.clear();
+  Targets.clear();
+  Persistent = false;
+  for (const FaultSpec &F : Specs) {
+    Instruction *I = Index ? Index->getInstruction(F.Inst) : nullptr;
+    const char *Why = I ? F.check(*I) : "no such instruction";
+    if (Why) {
+      F.print(WithColor::warning(errs()) << "fault ");
+      errs() << ": " << Why << ", ignored!\n";
+      continue;
+    }
+    Sites.push_back({&F, I, 0});
+    Targets.insert(I);
+    Persistent |= F.Occurrence == FaultSpec::EveryOccurrence;
+  }
+}
+
+void FaultAction::reset(uint64_t Seed) {
+  Pending = 0;
+  for (Site &S : Sites) {
+    S.Count = 0;
+    Pending += S.Spec->Occurrence != FaultSpec::EveryOccurrence;
+  }
+  Armed = Pending || Persistent;
+  Firing.clear();
+  Skipping = false;
+  RandomState = Seed;
+  NumInjected = 0;
+}
+
+void FaultAction::setInstructionIndex(const InstructionIndex * index) {
+  Action::setInstructionIndex(index);
+  resolve();
+  reset(0);
+}
+
+void FaultAction::beginRun(TraceRecord &Record) {
+  reset(Record.Seed);
+}
+
+void FaultAction::setSpecs(ArrayRef<FaultSpec> NewSpecs, uint64_t Seed) {
+  Specs.assign(NewSpecs.begin(), NewSpecs.end());
+  resolve();
+  reset(Seed);
+}
+
+/// nextRandom - SplitMix64 step, as the guest rand().
+uint64_t FaultAction::nextRandom() {
+  uint64_t Z = (RandomState += 0x9E3779B97F4A7C15ULL);
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+  return Z ^ (Z >> 31);
+}
+
+void FaultAction::arm(Instruction &I, ExecutionContext &SF) {
+  for (Site &S : Sites) {
+    if (S.Inst != &I)
+      continue;
+    const FaultSpec &F = *S.Spec;
+    uint64_t N = S.Count++;
+    if (F.Occurrence != FaultSpec::EveryOccurrence) {
+      if (N != F.Occurrence)
+        continue;
+      --Pending;
+    }
+    ++NumInjected;
+    // The faulty byte must be in memory before the load reads it.
+    if (F.Model == FaultModel::Memory && isa<LoadInst>(I)) {
+      corruptMemory(F, I, SF);
+      continue;
+    }
+    if (F.Model == FaultModel::Skip || F.Model == FaultModel::Branch)
+      Skipping = true;
+    Firing.push_back(&F);
+  }
+  Armed = Pending || Persistent;
+}
+
+void FaultAction::inject(Instruction &I, ExecutionContext &SF) {
+  for (const FaultSpec *F : Firing) {
+    switch (F->Model) {
+    case FaultModel::Skip:
+      // A value never defined in the frame reads as zero.
+      if (!I.getType()->isVoidTy() && !SF.Values.count(&I)) {
+        const DataLayout &DL = getInterpreter()->getDataLayout();
+        SmallVector<uint64_t, 4> Zero(
+            (DL.getTypeStoreSize(I.getType()) + 7) / 8, 0);
+        getInterpreter()->loadValue(
+            SF.Values[&I], reinterpret_cast<GenericValue *>(Zero.data()),
+            I.getType());
+      }
+      break;
+    case FaultModel::BitFlip:
+    case FaultModel::SetByte:
+    case FaultModel::Random:
+      corruptResult(*F, I, SF);
+      break;
+    case FaultModel::Memory:
+      corruptMemory(*F, I, SF);
+      break;
+    case FaultModel::Branch:
+      forceBranch(*F, I, SF);
+      break;
+    }
+  }
+  Firing.clear();
+  Skipping = false;
+}
+
+void FaultAction::mutate(const FaultSpec &F, MutableArrayRef<uint8_t> Bytes) {
+  switch (F.Model) {
+  case FaultModel::BitFlip:
+    Bytes[F.Bit / 8] ^= 1 << (F.Bit % 8);
+    break;
+  case FaultModel::SetByte:
+    Bytes[F.Byte] = F.Value;
+    break;
+  case FaultModel::Random:
+    for (uint8_t &B : Bytes)
+      B = nextRandom();
+    break;
+  case FaultModel::Memory:
+    Bytes[F.Byte] ^= F.RandomMask ? nextRandom() % 255 + 1 : F.Value;
+    break;
+  default:
+    llvm_unreachable("not a data fault");
+  }
+}
+
+/// clearUnusedBits - Zero the bits of the stored integer beyond its width,
+/// which LoadValueFromMemory would keep in the APInt.
+static void clearUnusedBits(MutableArrayRef<uint8_t> Bytes, Type *Ty) {
+  if (!Ty->isIntegerTy())
+    return;
+  unsigned Width = Ty->getIntegerBitWidth();
+  for (unsigned i = 0, e = Bytes.size(); i != e; ++i)
+    if (i * 8 >= Width)
+      Bytes[i] = 0;
+    else if (Width - i * 8 < 8)
+      Bytes[i] &= (1 << (Width - i * 8)) - 1;
+}
+
+/// mutateMemory - mutate, on program memory holding a value of type Ty if
+/// any.
+void FaultAction::mutateMemory(const FaultSpec &F,
+                               MutableArrayRef<uint8_t> Bytes, Type *Ty) {
+  if (WriteHook)
+    WriteHook(Bytes.data(), Bytes.size());
+  mutate(F, Bytes);
+  if (Ty)
+    clearUnusedBits(Bytes, Ty);
+  if (WriteHook)
+    WriteHook(Bytes.data(), Bytes.size());
+}
+
+void FaultAction::corruptResult(const FaultSpec &F, Instruction &I,
+                                ExecutionContext &SF) {
+  Interpreter &Interp = *getInterpreter();
+  Type *Ty = getResultType(I);
+  unsigned Size = Interp.getDataLayout().getTypeStoreSize(Ty);
+
+  // The stored value is corrupted in place.
+  if (auto *SI = dyn_cast<StoreInst>(&I)) {
+    GenericValue Ptr = Interp.getOperandValue(SI->getPointerOperand(), SF);
+    mutateMemory(F, {static_cast<uint8_t *>(GVTOP(Ptr)), Size}, Ty);
+    return;
+  }
+
+  GenericValue &Val = SF.Values[&I];
+  SmallVector<uint64_t, 4> Buffer((Size + 7) / 8, 0);
+  auto *Ptr = reinterpret_cast<GenericValue *>(Buffer.data());
+  MutableArrayRef<uint8_t> Bytes(reinterpret_cast<uint8_t *>(Buffer.data()),
+                                 Size);
+  Interp.StoreValueToMemory(Val, Ptr, Ty);
+  mutate(F, Bytes);
+  clearUnusedBits(Bytes, Ty);
+  Interp.loadValue(Val, Ptr, Ty);
+}
+
+void FaultAction::corruptMemory(const FaultSpec &F, Instruction &I,
+                                ExecutionContext &SF) {
+  Value *Addr = &I;
+  if (auto *LI = dyn_cast<LoadInst>(&I))
+    Addr = LI->getPointerOperand();
+  else if (auto *SI = dyn_cast<StoreInst>(&I))
+    Addr = SI->getPointerOperand();
+  GenericValue Ptr = getInterpreter()->getOperandValue(Addr, SF);
+  mutateMemory(F, {static_cast<uint8_t *>(GVTOP(Ptr)), F.Byte + 1}, nullptr);
+}
+
+void FaultAction::forceBranch(const FaultSpec &F, Instruction &I,
+                              ExecutionContext &SF) {
+  Interpreter &Interp = *getInterpreter();
+  BasicBlock *Dest;
+  if (F.Successor >= 0) {
+    Dest = I.getSuccessor(F.Successor);
+  } else if (auto *BI = dyn_cast<BranchInst>(&I)) {
+    GenericValue Cond = Interp.getOperandValue(BI->getCondition(), SF);
+    Dest = BI->getSuccessor(Cond.IntVal.getBoolValue() ? 1 : 0);
+  } else {
+    // A switch leaves its case for the default destination, or its default
+    // destination for the first case.
+    auto &SI = cast<SwitchInst>(I);
+    GenericValue Cond = Interp.getOperandValue(SI.getCondition(), SF);
+    auto Case = SI.findCaseValue(ConstantInt::get(I.getContext(), Cond.IntVal));
+    Dest = Case == SI.case_default() ? SI.getSuccessor(1)
+                                     : SI.getDefaultDest();
+  }
+  Interp.branchTo(Dest, SF);
+}
+
+void FaultAction::print(raw_ostream &ROS) {
+  ROS << "FaultAction => Inject faults in your binary:";
+  for (const FaultSpec &F : Specs) {
+    ROS << ' ';
+    F.print(ROS);
+  }
+  ROS << "\n";
+}
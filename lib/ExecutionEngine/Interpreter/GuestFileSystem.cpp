@@ -0,0 +1,231 @@
+//===-- GuestFileSystem.cpp - Preloaded files served to the program -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/GuestFileSystem.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Process.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+static ManagedStatic<GuestFileSystem> TheGuestFileSystem;
+
+GuestFileSystem &GuestFileSystem::instance() {
+  return *TheGuestFileSystem;
+}
+
+GuestFileSystem::~GuestFileSystem() {
+#ifdef LLVM_ON_UNIX
+  for (auto &Entry : Images)
+    if (Entry.second.FD >= 0)
+      ::close(Entry.second.FD);
+#endif
+}
+
+Error GuestFileSystem::preload(StringRef GuestPath, StringRef HostPath) {
+  auto BufferOrErr = MemoryBuffer::getFile(HostPath, /*FileSize=*/-1,
+                                           /*RequiresNullTerminator=*/false);
+  if (!BufferOrErr)
+    return make_error<StringError>("cannot preload '" + HostPath + "'",
+                                   BufferOrErr.getError());
+  Image &Img = Images[GuestPath];
+  Img.Data = std::move(*BufferOrErr);
+#ifdef LLVM_ON_UNIX
+  if (Img.FD >= 0)
+    ::close(Img.FD);
+  Img.FD = ::open(HostPath.str().c_str(), O_RDONLY);
+#endif
+  return Error::success();
+}
+
+GuestFileSystem::GuestFile *GuestFileSystem::open(StringRef Path,
+                                                  StringRef Mode) {
+  if (Images.empty() || Mode.find_first_of("wa+") != StringRef::npos)
+    return nullptr;
+  auto It = Images.find(Path);
+  if (It == Images.end())
+    return nullptr;
+
+  GuestFile *File = new GuestFile(&It->second);
+  sys::ScopedLock Guard(HandlesLock);
+  Handles.insert(File);
+  return File;
+}
+
+bool GuestFileSystem::isGuestFile(const void *Stream) {
+  if (Images.empty())
+    return false;
+  sys::ScopedLock Guard(HandlesLock);
+  return Handles.count(Stream);
+}
+
+void GuestFileSystem::close(GuestFile *File) {
+  {
+    sys::ScopedLock Guard(HandlesLock);
+    Handles.erase(File);
+  }
+  delete File;
+}
+
+void *GuestFileSystem::allocate(size_t Size) {
+#ifdef LLVM_ON_UNIX
+  static const size_t PageSize = sys::Process::getPageSize();
+  if (!ZeroCopy || Size < 2 * PageSize)
+    return nullptr;
+  size_t Len = alignTo(Size, PageSize);
+  void *Mem = mmap(nullptr, Len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Mem == MAP_FAILED)
+    return nullptr;
+  sys::ScopedLock Guard(BuffersLock);
+  Buffers[reinterpret_cast<uintptr_t>(Mem)] = Len;
+  return Mem;
+#else
+  return nullptr;
+#endif
+}
+
+bool GuestFileSystem::release(void *Ptr) {
+#ifdef LLVM_ON_UNIX
+  if (!ZeroCopy || !Ptr)
+    return false;
+  size_t Len;
+  {
+    sys::ScopedLock Guard(BuffersLock);
+    auto It = Buffers.find(reinterpret_cast<uintptr_t>(Ptr));
+    if (It == Buffers.end())
+      return false;
+    Len = It->second;
+    Buffers.erase(It);
+  }
+  munmap(Ptr, Len);
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t GuestFileSystem::getBufferSize(const void *Ptr) {
+  if (!ZeroCopy || !Ptr)
+    return 0;
+  sys::ScopedLock Guard(BuffersLock);
+  auto It = Buffers.find(reinterpret_cast<uintptr_t>(Ptr));
+  return It == Buffers.end() ? 0 : It->second;
+}
+
+/// ownsRange - Whether [Addr, Addr + Len) is in a buffer allocated here.
+bool GuestFileSystem::ownsRange(const void *Addr, size_t Len) {
+  uintptr_t A = reinterpret_cast<uintptr_t>(Addr);
+  sys::ScopedLock Guard(BuffersLock);
+  auto It = Buffers.upper_bound(A);
+  if (It == Buffers.begin())
+    return false;
+  --It;
+  return A - It->first + Len <= It->second;
+}
+
+void GuestFileSystem::copyOrMap(const Image &Img, size_t Pos, uint8_t *Dst,
+                                size_t Len) {
+  const char *Src = Img.getBuffer().data() + Pos;
+#ifdef LLVM_ON_UNIX
+  static const size_t PageSize = sys::Process::getPageSize();
+  uintptr_t Addr = reinterpret_cast<uintptr_t>(Dst);
+  size_t Head = (PageSize - Addr % PageSize) % PageSize;
+  size_t Body = Len >= Head ? (Len - Head) & ~(PageSize - 1) : 0;
+  if (ZeroCopy && Img.FD >= 0 && Len >= 2 * PageSize &&
+      (Addr - Pos) % PageSize == 0 && ownsRange(Dst + Head, Body)) {
+    // Private mapping: the pages are shared with the host mapping until the
+    // program writes them.
+    void *Mapped = mmap(Dst + Head, Body, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, Img.FD, Pos + Head);
+    if (Mapped != MAP_FAILED) {
+      memcpy(Dst, Src, Head);
+      memcpy(Dst + Head + Body, Src + Head + Body, Len - Head - Body);
+      return;
+    }
+  }
+#endif
+  memcpy(Dst, Src, Len);
+}
+
+size_t GuestFileSystem::read(GuestFile *File, void *Dst, size_t Size,
+                             size_t Count) {
+  size_t FileSize = File->Img->getBuffer().size();
+  size_t Available = File->Pos < FileSize ? FileSize - File->Pos : 0;
+  if (Size == 0 || Count == 0)
+    return 0;
+  size_t Items = std::min(Count, Available / Size);
+  size_t Len = Items == Count ? Items * Size : Available;
+  if (Items != Count)
+    File->Eof = true;
+  copyOrMap(*File->Img, File->Pos, static_cast<uint8_t *>(Dst), Len);
+  File->Pos += Len;
+  return Items;
+}
+
+char *GuestFileSystem::gets(GuestFile *File, char *Dst, int Size) {
+  StringRef Data = File->Img->getBuffer();
+  if (Size <= 0 || File->Pos >= Data.size()) {
+    File->Eof = true;
+    return nullptr;
+  }
+  size_t Len = 0;
+  while (Len + 1 < (size_t)Size && File->Pos < Data.size()) {
+    char C = Data[File->Pos++];
+    Dst[Len++] = C;
+    if (C == '\n')
+      break;
+  }
+  Dst[Len] = 0;
+  return Dst;
+}
+
+int GuestFileSystem::getc(GuestFile *File) {
+  StringRef Data = File->Img->getBuffer();
+  if (File->Pos >= Data.size()) {
+    File->Eof = true;
+    return EOF;
+  }
+  return (unsigned char)Data[File->Pos++];
+}
+
+int GuestFileSystem::ungetc(GuestFile *File, int C) {
+  // The image is read-only: only the byte it holds can be pushed back.
+  StringRef Data = File->Img->getBuffer();
+  if (C == EOF || File->Pos == 0 ||
+      (unsigned char)Data[File->Pos - 1] != (unsigned char)C)
+    return EOF;
+  --File->Pos;
+  File->Eof = false;
+  return (unsigned char)C;
+}
+
+int GuestFileSystem::seek(GuestFile *File, int64_t Offset, int Whence) {
+  int64_t Base;
+  switch (Whence) {
+  case SEEK_SET: Base = 0; break;
+  case SEEK_CUR: Base = File->Pos; break;
+  case SEEK_END: Base = File->Img->getBuffer().size(); break;
+  default: return -1;
+  }
+  if (Base + Offset < 0)
+    return -1;
+  File->Pos = Base + Offset;
+  File->Eof = false;
+  return 0;
+}
@@ -0,0 +1,436 @@
+//===-- InputDependence.cpp - Static input dependence ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/InputDependence.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalAlias.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+
+void InputDependence::linkModules() {
+  for (Module *M : Modules) {
+    for (Function &F : *M)
+      if (!F.isDeclaration() && !F.hasLocalLinkage())
+        FunctionDefs.insert({F.getName(), &F});
+    for (GlobalVariable &GV : M->globals())
+      if (!GV.isDeclaration() && !GV.hasLocalLinkage())
+        GlobalDefs.insert({GV.getName(), &GV});
+  }
+}
+
+/// resolve - The definition of F in any of the modules, F itself if it has
+/// none.
+Function *InputDependence::resolve(Function *F) const {
+  if (!F->isDeclaration())
+    return F;
+  auto It = FunctionDefs.find(F->getName());
+  return It == FunctionDefs.end() ? F : It->second;
+}
+
+const Value *InputDependence::resolve(const Value *V) const {
+  auto *GV = dyn_cast<GlobalVariable>(V);
+  if (!GV || !GV->isDeclaration())
+    return V;
+  auto It = GlobalDefs.find(GV->getName());
+  return It == GlobalDefs.end() ? V : It->second;
+}
+
+unsigned InputDependence::getObject(const Value *V) {
+  return Objects.insert({resolve(V), Objects.size() + 1}).first->second;
+}
+
+void InputDependence::addSources() {
+  // The buffers the entry function is called with are objects of their own.
+  for (Argument &A : Entry.args())
+    if (A.getType()->isPointerTy()) {
+      ObjectSet Objs;
+      Objs.set(getObject(&A));
+      addPointsTo(&A, Objs);
+    }
+  // An address-taken function may be called from anywhere.
+  for (Function *F : AddressTaken)
+    for (Argument &A : F->args())
+      if (A.getType()->isPointerTy()) {
+        ObjectSet Objs;
+        Objs.set(UnknownObject);
+        addPointsTo(&A, Objs);
+      }
+
+  for (const TaintSource &S : Sources) {
+    switch (S.K) {
+    case TaintSource::Argument:
+      if (S.ArgNo < Entry.arg_size() &&
+          (Entry.arg_begin() + S.ArgNo)->getType()->isPointerTy())
+        TaintedObjects.set(getObject(Entry.arg_begin() + S.ArgNo));
+      break;
+    case TaintSource::Global:
+      for (Module *M : Modules)
+        if (GlobalVariable *GV = M->getGlobalVariable(S.GlobalName, true))
+          TaintedObjects.set(getObject(GV));
+      break;
+    case TaintSource::Argv:
+      // main(argc, argv, ...): the array and the strings are one object.
+      if (Entry.arg_size() >= 2 &&
+          Entry.arg_begin()->getType()->isIntegerTy() &&
+          (Entry.arg_begin() + 1)->getType()->isPointerTy())
+        TaintedObjects.set(getObject(Entry.arg_begin() + 1));
+      break;
+    case TaintSource::Fread:
+      TaintFread = true;
+      break;
+    }
+  }
+}
+
+InputDependence::ObjectSet InputDependence::getPointsTo(const Value *V) {
+  ObjectSet Objs;
+  if (isa<Instruction>(V) || isa<Argument>(V)) {
+    auto It = PointsTo.find(V);
+    if (It != PointsTo.end())
+      Objs = It->second;
+  } else if (isa<GlobalVariable>(V)) {
+    Objs.set(getObject(V));
+  } else if (auto *GA = dyn_cast<GlobalAlias>(V)) {
+    Objs = getPointsTo(GA->getAliasee());
+  } else if (auto *CE = dyn_cast<ConstantExpr>(V)) {
+    if (CE->isCast() && CE->getOpcode() != Instruction::IntToPtr)
+      Objs = getPointsTo(CE->getOperand(0));
+    else if (CE->getOpcode() == Instruction::GetElementPtr)
+      Objs = getPointsTo(CE->getOperand(0));
+    else if (CE->getOpcode() == Instruction::Select)
+      Objs = getPointsTo(CE->getOperand(1)) | getPointsTo(CE->getOperand(2));
+    else
+      Objs.set(UnknownObject);
+  } else if (V->getType()->isPointerTy() && !isa<Function>(V) &&
+             !isa<ConstantPointerNull>(V) && !isa<UndefValue>(V)) {
+    Objs.set(UnknownObject);
+  }
+  return Objs;
+}
+
+bool InputDependence::isTainted(const Value *V) const {
+  return (isa<Instruction>(V) || isa<Argument>(V)) && Tainted.count(V);
+}
+
+/// readsTainted - Whether memory read through a pointer to Objs may be
+/// tainted.  The unknown object aliases every object.
+bool InputDependence::readsTainted(const ObjectSet &Objs) const {
+  if (Objs.empty())
+    return false;
+  if (TaintedObjects.test(UnknownObject))
+    return true;
+  if (Objs.test(UnknownObject))
+    return !TaintedObjects.empty();
+  return TaintedObjects.intersects(Objs);
+}
+
+void InputDependence::taint(const Value *V, bool Taint) {
+  if (Taint && Tainted.insert(V).second)
+    Changed = true;
+}
+
+void InputDependence::taintObjects(const ObjectSet &Objs, bool Taint) {
+  if (Taint && (TaintedObjects |= Objs))
+    Changed = true;
+}
+
+void InputDependence::addPointsTo(const Value *V, const ObjectSet &Objs) {
+  if (PointsTo[V] |= Objs)
+    Changed = true;
+}
+
+void InputDependence::visit(Instruction &I) {
+  bool IsPointer = I.getType()->isPointerTy();
+  switch (I.getOpcode()) {
+  case Instruction::Alloca: {
+    ObjectSet Objs;
+    Objs.set(getObject(&I));
+    addPointsTo(&I, Objs);
+    return;
+  }
+  case Instruction::Load: {
+    Value *Ptr = cast<LoadInst>(I).getPointerOperand();
+    taint(&I, isTainted(Ptr) || readsTainted(getPointsTo(Ptr)));
+    break;
+  }
+  case Instruction::Store: {
+    auto &SI = cast<StoreInst>(I);
+    taintObjects(getPointsTo(SI.getPointerOperand()),
+                 isTainted(SI.getValueOperand()) ||
+                 isTainted(SI.getPointerOperand()));
+    return;
+  }
+  case Instruction::Call:
+  case Instruction::Invoke:
+    visitCall(CallSite(&I));
+    return;
+  case Instruction::Ret:
+    if (Value *V = cast<ReturnInst>(I).getReturnValue()) {
+      if (isTainted(V) && TaintedReturns.insert(I.getFunction()).second)
+        Changed = true;
+      if (V->getType()->isPointerTy()) {
+        ObjectSet Objs = getPointsTo(V);
+        if (ReturnedObjects[I.getFunction()] |= Objs)
+          Changed = true;
+      }
+    }
+    return;
+  case Instruction::VAArg:
+    taint(&I, TaintedVarArgs.count(I.getFunction()));
+    break;
+  case Instruction::GetElementPtr:
+  case Instruction::BitCast:
+  case Instruction::AddrSpaceCast:
+    taint(&I, any_of(I.operands(), [&](Value *Op) { return isTainted(Op); }));
+    if (IsPointer)
+      addPointsTo(&I, getPointsTo(I.getOperand(0)));
+    return;
+  case Instruction::Select:
+  case Instruction::PHI:
+    taint(&I, any_of(I.operands(), [&](Value *Op) { return isTainted(Op); }));
+    if (IsPointer) {
+      ObjectSet Objs;
+      for (Value *Op : I.operands())
+        if (Op->getType()->isPointerTy())
+          Objs |= getPointsTo(Op);
+      addPointsTo(&I, Objs);
+    }
+    return;
+  default:
+    if (!I.getType()->isVoidTy())
+      taint(&I,
+            any_of(I.operands(), [&](Value *Op) { return isTainted(Op); }));
+    break;
+  }
+  // A pointer from memory or from an integer.
+  if (IsPointer) {
+    ObjectSet Objs;
+    Objs.set(UnknownObject);
+    addPointsTo(&I, Objs);
+  }
+}
+
+void InputDependence::visitCall(CallSite CS) {
+  Value *Called = CS.getCalledValue()->stripPointerCasts();
+  if (auto *F = dyn_cast<Function>(Called)) {
+    F = resolve(F);
+    if (F->isDeclaration())
+      visitExternalCall(CS, F);
+    else
+      bindCall(CS, *F);
+    return;
+  }
+  // An indirect call: any function whose address is taken, or an external
+  // one.
+  for (Function *F : AddressTaken)
+    bindCall(CS, *F);
+  visitExternalCall(CS, nullptr);
+}
+
+void InputDependence::bindCall(CallSite CS, Function &F) {
+  unsigned NumArgs = CS.arg_size();
+  for (unsigned i = 0, e = std::min<unsigned>(F.arg_size(), NumArgs); i != e;
+       ++i) {
+    Argument *A = F.arg_begin() + i;
+    Value *Actual = CS.getArgument(i);
+    taint(A, isTainted(Actual));
+    if (A->getType()->isPointerTy())
+      addPointsTo(A, getPointsTo(Actual));
+  }
+  if (F.isVarArg())
+    for (unsigned i = F.arg_size(); i < NumArgs; ++i)
+      if (isTainted(CS.getArgument(i)) && TaintedVarArgs.insert(&F).second)
+        Changed = true;
+
+  Instruction *I = CS.getInstruction();
+  if (I->getType()->isVoidTy())
+    return;
+  taint(I, TaintedReturns.count(&F));
+  if (I->getType()->isPointerTy()) {
+    ObjectSet Objs = ReturnedObjects[&F];
+    addPointsTo(I, Objs);
+  }
+}
+
+void InputDependence::visitExternalCall(CallSite CS, Function *F) {
+  enum { Other, Pure, ReadOnly, Copy, Set, Allocate, Reallocate, Read };
+  static const unsigned MinArgs[] = {0, 0, 0, 3, 3, 1, 2, 4};
+  int Kind = Other;
+  if (F && F->isIntrinsic()) {
+    switch (F->getIntrinsicID()) {
+    case Intrinsic::memcpy:
+    case Intrinsic::memmove:
+      Kind = Copy;
+      break;
+    case Intrinsic::memset:
+      Kind = Set;
+      break;
+    default:
+      Kind = Pure;
+      break;
+    }
+  } else if (F) {
+    Kind = StringSwitch<int>(F->getName())
+      .Cases("memcpy", "memmove", Copy)
+      .Case("memset", Set)
+      .Cases("malloc", "calloc", Allocate)
+      .Case("realloc", Reallocate)
+      .Case("fread", Read)
+      .Cases("printf", "puts", "putchar", "fputs", "fputc", ReadOnly)
+      .Cases("fwrite", "fflush", "fclose", "free", "exit", ReadOnly)
+      .Cases("strlen", "strcmp", "strncmp", "memcmp", ReadOnly)
+      .Default(Other);
+  }
+  unsigned NumArgs = CS.arg_size();
+  if (NumArgs < MinArgs[Kind])
+    Kind = Other;
+
+  Instruction *I = CS.getInstruction();
+  bool ArgsTainted = false, ReadTainted = false;
+  for (Value *Arg : CS.args()) {
+    ArgsTainted |= isTainted(Arg);
+    if (Arg->getType()->isPointerTy())
+      ReadTainted |= readsTainted(getPointsTo(Arg));
+  }
+  ReadTainted |= ArgsTainted;
+
+  ObjectSet Result;
+  switch (Kind) {
+  case Copy:
+    taintObjects(getPointsTo(CS.getArgument(0)),
+                 isTainted(CS.getArgument(1)) ||
+                 isTainted(CS.getArgument(2)) ||
+                 readsTainted(getPointsTo(CS.getArgument(1))));
+    taint(I, isTainted(CS.getArgument(0)));
+    Result = getPointsTo(CS.getArgument(0));
+    break;
+  case Set:
+    taintObjects(getPointsTo(CS.getArgument(0)),
+                 isTainted(CS.getArgument(1)) ||
+                 isTainted(CS.getArgument(2)));
+    taint(I, isTainted(CS.getArgument(0)));
+    Result = getPointsTo(CS.getArgument(0));
+    break;
+  case Allocate:
+    Result.set(getObject(I));
+    break;
+  case Reallocate:
+    Result.set(getObject(I));
+    taintObjects(Result, readsTainted(getPointsTo(CS.getArgument(0))));
+    break;
+  case Read:
+    taintObjects(getPointsTo(CS.getArgument(0)), TaintFread);
+    break;
+  case Pure:
+    taint(I, ArgsTainted);
+    Result.set(UnknownObject);
+    break;
+  case ReadOnly:
+    taint(I, ReadTainted);
+    Result.set(UnknownObject);
+    break;
+  case Other:
+    // May write in whatever its pointer arguments point to (e.g. sscanf).
+    for (Value *Arg : CS.args())
+      if (Arg->getType()->isPointerTy())
+        taintObjects(getPointsTo(Arg), ReadTainted);
+    taint(I, ReadTainted);
+    Result.set(UnknownObject);
+    break;
+  }
+  if (I->getType()->isPointerTy())
+    addPointsTo(I, Result);
+}
+
+TraceSampleFilter InputDependence::run() {
+  SmallPtrSet<Module *, 4> Seen;
+  for (uint32_t ID = 0, e = Index.size(); ID != e; ++ID)
+    if (Seen.insert(Index.getInstruction(ID)->getModule()).second)
+      Modules.push_back(Index.getInstruction(ID)->getModule());
+  linkModules();
+  // The address may be taken in the module of a declaration.
+  SmallPtrSet<Function *, 16> Taken;
+  for (Module *M : Modules)
+    for (Function &F : *M) {
+      Function *Def = resolve(&F);
+      if (!Def->isDeclaration() && F.hasAddressTaken() &&
+          Taken.insert(Def).second)
+        AddressTaken.push_back(Def);
+    }
+  addSources();
+
+  // Round-robin in module order, which is mostly the order of the data
+  // flow.
+  do {
+    Changed = false;
+    for (uint32_t ID = 0, e = Index.size(); ID != e; ++ID)
+      visit(*Index.getInstruction(ID));
+  } while (Changed);
+
+  // The values the trace action would record.
+  TraceSampleFilter Dependent;
+  for (uint32_t ID = 0, e = Index.size(); ID != e; ++ID) {
+    Instruction &I = *Index.getInstruction(ID);
+    const Value *V = &I;
+    if (auto *SI = dyn_cast<StoreInst>(&I))
+      V = SI->getValueOperand();
+    else if (auto *RI = dyn_cast<ReturnInst>(&I))
+      V = RI->getReturnValue();
+    if (V && isTainted(V))
+      Dependent.addInstruction(ID);
+  }
+  return Dependent;
+}
+
+static const char SidecarHeader[] = "# wyverse input dependence ";
+
+Error InputDependence::writeFile(StringRef Path, uint64_t Key,
+                                 const TraceSampleFilter &Dependent) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_Text);
+  if (EC)
+    return createStringError(EC, "cannot write input dependence file '%s'",
+                             Path.str().c_str());
+  OS << SidecarHeader << format_hex_no_prefix(Key, 16) << "\n"
+     << "# " << Dependent.count() << " instructions may depend on the "
+     << "input\n";
+  for (unsigned ID : Dependent.instructions())
+    OS << ID << "\n";
+  if (OS.has_error())
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "cannot write input dependence file '%s'",
+                             Path.str().c_str());
+  return Error::success();
+}
+
+Expected<Optional<TraceSampleFilter>>
+InputDependence::readFile(StringRef Path, uint64_t Key) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+    MemoryBuffer::getFile(Path);
+  if (!BufOrErr)
+    return None;
+  std::string Header;
+  raw_string_ostream(Header) << SidecarHeader << format_hex_no_prefix(Key, 16)
+                             << "\n";
+  if (!(*BufOrErr)->getBuffer().startswith(Header))
+    return None;
+  Expected<TraceSampleFilter> Dependent = TraceSampleFilter::readFile(Path);
+  if (!Dependent)
+    return Dependent.takeError();
+  return Optional<TraceSampleFilter>(std::move(*Dependent));
+}
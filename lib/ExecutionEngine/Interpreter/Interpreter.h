@@ -23,6 +23,9 @@
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 namespace llvm {
 
 class IntrinsicLowering;
@@ -82,6 +85,12 @@ class Interpreter : public ExecutionEngine, public InstVisitor<Interpreter> {
 
 protected:
   GenericValue ExitValue;          // The return value of the called function
+  // State of the guest's rand()/random(), see seedGuestRandom().
+  uint64_t GuestRandomState = 0;
+  bool GuestRandomPinned = false;
+  // Buffers receiving the standard output / error of the program, if any.
+  std::string *CapturedStdout = nullptr;
+  std::string *CapturedStderr = nullptr;
   // The runtime stack of executing code.  The top of the stack is the current
   // function record.
   std::vector<ExecutionContext> ECStack;
@@ -175,17 +184,70 @@ public:
 
   GenericValue callExternalFunction(Function *F,
                                     ArrayRef<GenericValue> ArgVals);
-  void exitCalled(GenericValue GV);
+  virtual void exitCalled(GenericValue GV);
+
+  /// reserveHeap - Called by malloc(), calloc() and realloc() before they
+  /// allocate a block of Size bytes, replacing Old (null for a new block).
+  /// Returning false makes the allocation fail.
+  virtual bool reserveHeap(void *Old, uint64_t Size) { return true; }
+
+  /// heapChanged - The block Old (null for a new block) is now New, of Size
+  /// bytes (New is null and Size 0 after free()).
+  virtual void heapChanged(void *Old, void *New, uint64_t Size) {}
 
   void addAtExitHandler(Function *F) {
     AtExitHandlers.push_back(F);
   }
 
+  /// seedGuestRandom - Pin the state of the guest's rand() to a seed chosen
+  /// by the host, calls to srand() from the guest are then ignored so that
+  /// the run is reproducible.
+  void seedGuestRandom(uint64_t Seed) {
+    GuestRandomState = Seed;
+    GuestRandomPinned = true;
+  }
+
+  void srandGuest(uint64_t Seed) {
+    if (!GuestRandomPinned)
+      GuestRandomState = Seed;
+  }
+
+  /// nextGuestRandom - SplitMix64 step, returns a value in [0, RAND_MAX].
+  int nextGuestRandom() {
+    uint64_t Z = (GuestRandomState += 0x9E3779B97F4A7C15ULL);
+    Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+    Z ^= Z >> 31;
+    return (int)(Z % ((uint64_t)RAND_MAX + 1));
+  }
+
+  /// getOutputCapture - The buffer that replaces the host stream \p Stream,
+  /// or null if the program writes to the host stream.
+  std::string *getOutputCapture(const void *Stream) const {
+    if (Stream == stdout)
+      return CapturedStdout;
+    if (Stream == stderr)
+      return CapturedStderr;
+    return nullptr;
+  }
+
   GenericValue *getFirstVarArg () {
     return &(ECStack.back ().VarArgs[0]);
   }
 
   GenericValue getOperandValue(Value *V, ExecutionContext &SF);
+
+  /// branchTo - Continue the frame SF at the start of Dest, as a branch from
+  /// its current block would.  Used by the fault action to force the
+  /// direction of a branch it skipped.
+  void branchTo(BasicBlock *Dest, ExecutionContext &SF) {
+    SwitchToNewBasicBlock(Dest, SF);
+  }
+
+  /// loadValue - LoadValueFromMemory, for the actions.
+  void loadValue(GenericValue &Result, GenericValue *Ptr, Type *Ty) {
+    LoadValueFromMemory(Result, Ptr, Ty);
+  }
 private:  // Helper functions
   GenericValue executeGEPOperation(Value *Ptr, gep_type_iterator I,
                                    gep_type_iterator E, ExecutionContext &SF);
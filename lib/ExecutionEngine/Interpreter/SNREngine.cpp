@@ -0,0 +1,298 @@
+//===-- SNREngine.cpp - Streaming SNR and points of interest --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/SNREngine.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/ExecutionEngine/CipherTables.h"
+#include "llvm/ExecutionEngine/InstructionIndex.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace llvm;
+
+static const char *getTargetName(SNRTarget Target) {
+  switch (Target) {
+  case SNRTarget::InputByte:        return "input byte";
+  case SNRTarget::OutputByte:       return "output byte";
+  case SNRTarget::FirstRoundSBox:   return "first-round S-box output";
+  case SNRTarget::LastRoundInvSBox: return "last-round inverse S-box output";
+  }
+  llvm_unreachable("unknown SNR target");
+}
+
+//===----------------------------------------------------------------------===//
+// SNRAccumulator
+//===----------------------------------------------------------------------===//
+
+SNRAccumulator::SNRAccumulator(SNREngine &Engine)
+  : Engine(Engine), ClassCount(Engine.RowSize, 0),
+    Classes(Engine.getNumTargets(), 0) {}
+
+void SNRAccumulator::resize(size_t Samples) {
+  NumSamples = Samples;
+  SumX2.resize(Samples, 0);
+  SumX.resize(Samples * Engine.RowSize, 0);
+  if (!WideX.empty())
+    WideX.resize(SumX.size(), 0);
+}
+
+void SNRAccumulator::widen() {
+  if (WideX.empty())
+    WideX.assign(SumX.size(), 0);
+  kernels::widenAndClear(WideX.data(), SumX.data(), SumX.size());
+  SinceWiden = 0;
+}
+
+void SNRAccumulator::addTrace(const TraceRecord &Record) {
+  const SNROptions &Opts = Engine.getOptions();
+  const unsigned Row = Engine.RowSize, NumTargets = Engine.getNumTargets();
+
+  if (Record.CollectSampleInsts)
+    Engine.setSampleInsts(Record.SampleInsts);
+
+  ArrayRef<uint8_t> Samples = Record.Samples;
+  if (Samples.size() <= Opts.SampleBegin)
+    Samples = ArrayRef<uint8_t>();
+  else
+    Samples = Samples.drop_front(Opts.SampleBegin);
+  if (Opts.MaxSamples && Samples.size() > Opts.MaxSamples)
+    Samples = Samples.take_front(Opts.MaxSamples);
+
+  sys::ScopedLock Guard(Lock);
+  if (!Engine.classify(Record, Classes.data()))
+    return;
+  if (Samples.size() > NumSamples)
+    resize(Samples.size());
+
+  // Offsets of the classes of the trace in a sample row.
+  SmallVector<unsigned, 16> Offsets;
+  for (unsigned t = 0; t != NumTargets; ++t) {
+    Offsets.push_back(t * 256 + Classes[t]);
+    ++ClassCount[Offsets.back()];
+  }
+  for (size_t s = 0, e = Samples.size(); s != e; ++s) {
+    uint8_t X = Samples[s];
+    if (!X)
+      continue;
+    SumX2[s] += X * X;
+    uint32_t *Sums = &SumX[s * Row];
+    for (unsigned Offset : Offsets)
+      Sums[Offset] += X;
+  }
+
+  ++NumTraces;
+  if (++SinceWiden == UINT32_MAX / 255)
+    widen();
+}
+
+//===----------------------------------------------------------------------===//
+// SNREngine
+//===----------------------------------------------------------------------===//
+
+SNREngine::SNREngine(const SNROptions &Options) : Opts(Options) {
+  if (Opts.TargetBytes.empty())
+    for (unsigned i = 0; i != 16; ++i)
+      Opts.TargetBytes.push_back(i);
+  RowSize = Opts.TargetBytes.size() * 256;
+}
+
+SNRAccumulator &SNREngine::createAccumulator() {
+  sys::ScopedLock Guard(Lock);
+  Accumulators.emplace_back(new SNRAccumulator(*this));
+  return *Accumulators.back();
+}
+
+bool SNREngine::classify(const TraceRecord &Record, uint8_t *C) const {
+  const bool FromInput = Opts.Target == SNRTarget::InputByte ||
+                         Opts.Target == SNRTarget::FirstRoundSBox;
+  const std::vector<uint8_t> &Known = FromInput ? Record.Input
+                                                : Record.Output;
+
+  for (unsigned t = 0, e = Opts.TargetBytes.size(); t != e; ++t) {
+    unsigned Byte = Opts.TargetBytes[t];
+    if (Byte >= Known.size())
+      return false;
+    uint8_t V = Known[Byte];
+    switch (Opts.Target) {
+    case SNRTarget::InputByte:
+    case SNRTarget::OutputByte:
+      C[t] = V;
+      break;
+    case SNRTarget::FirstRoundSBox:
+      C[t] = aes::SBox[V ^ Opts.Key[Byte]];
+      break;
+    case SNRTarget::LastRoundInvSBox:
+      C[t] = aes::InvSBox[V ^ Opts.Key[Byte]];
+      break;
+    }
+  }
+  return true;
+}
+
+void SNREngine::setSampleInsts(ArrayRef<uint32_t> Insts) {
+  sys::ScopedLock Guard(Lock);
+  SampleInsts.assign(Insts.begin(), Insts.end());
+}
+
+SNREngine::Result SNREngine::compute() const {
+  sys::ScopedLock Guard(Lock);
+  // A consistent snapshot: the workers wait until the SNR is computed.
+  for (auto &A : Accumulators)
+    A->Lock.lock();
+
+  Result R;
+  R.SampleBegin = Opts.SampleBegin;
+  size_t NumSamples = 0;
+  std::vector<uint64_t> Count(RowSize, 0);
+  for (auto &A : Accumulators) {
+    R.NumTraces += A->NumTraces;
+    NumSamples = std::max(NumSamples, A->NumSamples);
+    for (unsigned i = 0; i != RowSize; ++i)
+      Count[i] += A->ClassCount[i];
+  }
+  R.SNR.assign(NumSamples, 0.0);
+  R.Target.assign(NumSamples, Opts.TargetBytes.front());
+
+  const double N = R.NumTraces;
+  std::vector<uint64_t> Sums(RowSize);
+  for (size_t s = 0; s != NumSamples && R.NumTraces > 1; ++s) {
+    // The samples an accumulator has never seen were 0 in all its traces.
+    uint64_t SumX2 = 0;
+    std::fill(Sums.begin(), Sums.end(), 0);
+    for (auto &A : Accumulators) {
+      if (s >= A->NumSamples)
+        continue;
+      SumX2 += A->SumX2[s];
+      for (unsigned i = 0; i != RowSize; ++i) {
+        size_t At = s * RowSize + i;
+        Sums[i] += A->SumX[At] + (A->WideX.empty() ? 0 : A->WideX[At]);
+      }
+    }
+
+    for (unsigned t = 0, e = getNumTargets(); t != e; ++t) {
+      double SumX = 0, Between = 0;
+      for (unsigned v = 0; v != 256; ++v) {
+        unsigned i = t * 256 + v;
+        if (!Count[i])
+          continue;
+        SumX += Sums[i];
+        Between += double(Sums[i]) * Sums[i] / Count[i];
+      }
+      double Mean = SumX / N;
+      double Total = SumX2 / N - Mean * Mean;
+      double Signal = Between / N - Mean * Mean;
+      double Noise = Total - Signal;
+      double SNR = 0;
+      if (Signal > 0)
+        SNR = Noise > Total * 1e-12 ? Signal / Noise
+                                    : std::numeric_limits<double>::infinity();
+      if (SNR > R.SNR[s]) {
+        R.SNR[s] = SNR;
+        R.Target[s] = Opts.TargetBytes[t];
+      }
+    }
+  }
+
+  for (auto &A : Accumulators)
+    A->Lock.unlock();
+  return R;
+}
+
+Expected<std::vector<SNREngine::PointOfInterest>>
+SNREngine::selectPOI(const Result &R, double Fraction,
+                     double Threshold) const {
+  std::vector<uint32_t> Insts;
+  {
+    sys::ScopedLock Guard(Lock);
+    Insts = SampleInsts;
+  }
+  if (Insts.empty())
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "no sample-to-instruction index, the first run "
+                             "was not traced");
+
+  std::vector<size_t> Order;
+  for (size_t s = 0, e = R.SNR.size(); s != e; ++s)
+    if (R.SNR[s] > 0 && R.SampleBegin + s < Insts.size())
+      Order.push_back(s);
+  // Ties go to the earlier sample, the selection is deterministic.
+  std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+    return R.SNR[A] > R.SNR[B];
+  });
+  size_t Keep;
+  if (Threshold > 0)
+    Keep = std::partition_point(Order.begin(), Order.end(), [&](size_t S) {
+             return R.SNR[S] >= Threshold;
+           }) - Order.begin();
+  else
+    Keep = std::min<size_t>(Order.size(),
+                            std::max<size_t>(1, std::ceil(Fraction *
+                                                          R.SNR.size())));
+
+  std::vector<PointOfInterest> POI;
+  DenseMap<uint32_t, size_t> Slots;
+  for (size_t i = 0; i != Keep; ++i) {
+    size_t s = Order[i];
+    uint32_t Inst = Insts[R.SampleBegin + s];
+    if (Inst == InstructionIndex::InvalidID)
+      continue;
+    auto Ins = Slots.insert({Inst, POI.size()});
+    if (Ins.second)
+      POI.push_back({Inst, R.SNR[s], 0});
+    ++POI[Ins.first->second].NumSamples;
+  }
+  return POI;
+}
+
+Error SNREngine::writePOIFile(StringRef Path, const Result &R,
+                              ArrayRef<PointOfInterest> POI) const {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_Text);
+  if (EC)
+    return createStringError(EC, "cannot write POI file '%s'",
+                             Path.str().c_str());
+  OS << "# POI, SNR of the " << getTargetName(Opts.Target) << " over "
+     << R.NumTraces << " traces\n"
+     << "# inst snr samples\n";
+  for (const PointOfInterest &P : POI)
+    OS << P.Inst << " " << format("%.4f", P.SNR) << " " << P.NumSamples
+       << "\n";
+  if (OS.has_error())
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "cannot write POI file '%s'",
+                             Path.str().c_str());
+  return Error::success();
+}
+
+void SNREngine::printSummary(raw_ostream &OS, const Result &R,
+                             ArrayRef<PointOfInterest> POI) {
+  OS << "SNR after " << R.NumTraces << " traces: ";
+  if (R.SNR.empty()) {
+    OS << "no sample\n";
+    return;
+  }
+  size_t Max = std::max_element(R.SNR.begin(), R.SNR.end()) - R.SNR.begin();
+  OS << "max " << format("%.2f", R.SNR[Max]) << " @" << R.SampleBegin + Max
+     << " (byte " << R.Target[Max] << "), " << POI.size()
+     << " instructions selected\n";
+}
+
+//===----------------------------------------------------------------------===//
+// SNRAction
+//===----------------------------------------------------------------------===//
+
+void SNRAction::print(raw_ostream &ROS) {
+  ROS << "SNR => Signal-to-noise ratio of the traced samples with respect "
+         "to a known intermediate, and the instructions of the points of "
+         "interest (batch mode).\n";
+}
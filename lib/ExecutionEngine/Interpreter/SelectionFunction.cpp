@@ -0,0 +1,142 @@
+//===-- SelectionFunction.cpp - Predicted intermediate values -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/SelectionFunction.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+using namespace llvm;
+
+LLVM_INSTANTIATE_REGISTRY(SelectionFunctionRegistry)
+
+namespace {
+
+/// AESFirstRound - SBox[input[t] ^ k].
+class AESFirstRound : public SelectionFunction {
+public:
+  KnownSource getSource() const override { return Input; }
+  unsigned getNumTargets() const override { return 16; }
+  bool isUniform() const override { return true; }
+  unsigned getKnownSize(unsigned Target) const override { return Target + 1; }
+  uint8_t getKnown(ArrayRef<uint8_t> Bytes, unsigned Target) const override {
+    return Bytes[Target];
+  }
+  uint8_t evaluate(unsigned, uint8_t Known, unsigned Guess) const override {
+    return aes::SBox[Known ^ Guess];
+  }
+};
+
+/// AESLastRound - InvSBox[output[t] ^ k], k a byte of the last round key.
+class AESLastRound : public AESFirstRound {
+public:
+  KnownSource getSource() const override { return Output; }
+  uint8_t evaluate(unsigned, uint8_t Known, unsigned Guess) const override {
+    return aes::InvSBox[Known ^ Guess];
+  }
+};
+
+/// DESFirstRound - S_t(E(R0)_t ^ k), k the 6-bit chunk t of the first
+/// subkey and E(R0)_t the 6 bits of the expanded right half of IP(input)
+/// that enter the S-box t.
+class DESFirstRound : public SelectionFunction {
+public:
+  KnownSource getSource() const override { return Input; }
+  unsigned getNumTargets() const override { return 8; }
+  unsigned getNumGuesses() const override { return 64; }
+  unsigned getNumBits() const override { return 4; }
+  unsigned getKnownSize(unsigned) const override { return 8; }
+  uint8_t getKnown(ArrayRef<uint8_t> Bytes, unsigned Target) const override {
+    // Bit j of R0 is bit 32 + j of IP(input), that is input bit IP[31 + j].
+    uint8_t V = 0;
+    for (unsigned i = 0; i != 6; ++i) {
+      unsigned Bit = des::IP[31 + des::E[Target * 6 + i]] - 1;
+      V = (V << 1) | ((Bytes[Bit / 8] >> (7 - Bit % 8)) & 1);
+    }
+    return V;
+  }
+  uint8_t evaluate(unsigned Target, uint8_t Known,
+                   unsigned Guess) const override {
+    return des::lookup(Target, (Known ^ Guess) & 63);
+  }
+};
+
+/// SM4FirstRound - SBox[(X1 ^ X2 ^ X3)_t ^ k], k the byte t of the first
+/// round key and X1..X3 the last three big-endian words of the input.
+class SM4FirstRound : public SelectionFunction {
+public:
+  KnownSource getSource() const override { return Input; }
+  unsigned getNumTargets() const override { return 4; }
+  bool isUniform() const override { return true; }
+  unsigned getKnownSize(unsigned) const override { return 16; }
+  uint8_t getKnown(ArrayRef<uint8_t> Bytes, unsigned Target) const override {
+    return Bytes[4 + Target] ^ Bytes[8 + Target] ^ Bytes[12 + Target];
+  }
+  uint8_t evaluate(unsigned, uint8_t Known, unsigned Guess) const override {
+    return sm4::SBox[Known ^ Guess];
+  }
+};
+
+} // End anonymous namespace
+
+static SelectionFunctionRegistry::Add<AESFirstRound>
+AESFirst("first-sbox", "AES SBox[input ^ key], first round");
+static SelectionFunctionRegistry::Add<AESLastRound>
+AESLast("last-sbox", "AES InvSBox[output ^ key], last round");
+static SelectionFunctionRegistry::Add<DESFirstRound>
+DESFirst("des-sbox", "DES S-box outputs, first round (6-bit subkey chunks)");
+static SelectionFunctionRegistry::Add<SM4FirstRound>
+SM4First("sm4-sbox", "SM4 S-box outputs, first round");
+
+Expected<std::unique_ptr<SelectionFunction>>
+llvm::createSelectionFunction(StringRef Name) {
+  for (const SelectionFunctionRegistry::entry &E :
+       SelectionFunctionRegistry::entries())
+    if (E.getName() == Name)
+      return E.instantiate();
+
+  std::string Msg;
+  raw_string_ostream OS(Msg);
+  OS << "unknown selection function '" << Name << "', expected one of:";
+  for (const SelectionFunctionRegistry::entry &E :
+       SelectionFunctionRegistry::entries())
+    OS << " " << E.getName();
+  return make_error<StringError>(OS.str(), inconvertibleErrorCode());
+}
+
+//===----------------------------------------------------------------------===//
+// SelectionTable
+//===----------------------------------------------------------------------===//
+
+SelectionTable::SelectionTable(const SelectionFunction &F,
+                               ArrayRef<unsigned> Targets)
+  : NumGuesses(F.getNumGuesses()), NumBits(F.getNumBits()),
+    NumTargets(Targets.size()), Uniform(F.isUniform()) {
+  unsigned NumTables = Uniform ? 1 : NumTargets;
+  Values.resize(NumTables * 256 * NumGuesses);
+  Weights.resize(Values.size());
+  for (unsigned t = 0; t != NumTables; ++t)
+    for (unsigned v = 0; v != 256; ++v) {
+      size_t Row = getOffset(t, v);
+      for (unsigned k = 0; k != NumGuesses; ++k) {
+        uint8_t S = F.evaluate(Targets[t], v, k);
+        Values[Row + k] = S;
+        Weights[Row + k] = countPopulation(S);
+      }
+    }
+}
+
+void SelectionTable::evaluate(ArrayRef<uint8_t> Known, bool HammingWeight,
+                              uint8_t *Out) const {
+  const std::vector<uint8_t> &Table = HammingWeight ? Weights : Values;
+  for (size_t i = 0, e = Known.size(); i != e; ++i) {
+    unsigned T = i % NumTargets;
+    memcpy(Out + i * NumGuesses, &Table[getOffset(T, Known[i])], NumGuesses);
+  }
+}
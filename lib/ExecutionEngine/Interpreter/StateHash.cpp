@@ -0,0 +1,352 @@
+//===-- StateHash.cpp - Hash of the interpreted program state -------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/StateHash.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/MathExtras.h"
+#include "Interpreter.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// Liveness
+//===----------------------------------------------------------------------===//
+
+/// FunctionLiveness - The SSA values (arguments and instructions) live at
+/// the end of each block of a function, by the usual backward data flow.
+/// The values are numbered; a PHI node uses its incoming values at the end
+/// of the incoming blocks.
+class StateHashAction::FunctionLiveness {
+  DenseMap<const Value *, unsigned> Numbers;
+  DenseMap<const BasicBlock *, BitVector> LiveOut;
+
+  int getNumber(const Value *V) const {
+    auto It = Numbers.find(V);
+    return It == Numbers.end() ? -1 : (int)It->second;
+  }
+
+public:
+  std::vector<Value *> Values;
+
+  explicit FunctionLiveness(const Function &F);
+
+  /// getLiveBefore - The values live when Pos is about to execute.
+  void getLiveBefore(const Instruction &Pos, BitVector &Live) const;
+};
+
+StateHashAction::FunctionLiveness::FunctionLiveness(const Function &F) {
+  auto Add = [&](const Value &V) {
+    Numbers[&V] = Values.size();
+    Values.push_back(const_cast<Value *>(&V));
+  };
+  for (const Argument &A : F.args())
+    Add(A);
+  for (const BasicBlock &BB : F)
+    for (const Instruction &I : BB)
+      if (!I.getType()->isVoidTy())
+        Add(I);
+  unsigned N = Values.size();
+
+  // Upward-exposed uses and definitions of each block.
+  DenseMap<const BasicBlock *, BitVector> Uses, Defs, LiveIn;
+  for (const BasicBlock &BB : F) {
+    BitVector &U = Uses[&BB], &D = Defs[&BB];
+    U.resize(N);
+    D.resize(N);
+    for (const Instruction &I : BB) {
+      if (!isa<PHINode>(I))
+        for (const Value *Op : I.operands()) {
+          int Num = getNumber(Op);
+          if (Num >= 0 && !D[Num])
+            U.set(Num);
+        }
+      int Num = getNumber(&I);
+      if (Num >= 0)
+        D.set(Num);
+    }
+    LiveIn[&BB].resize(N);
+    LiveOut[&BB].resize(N);
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (const BasicBlock *BB : post_order(&F)) {
+      BitVector Out(N);
+      for (const BasicBlock *Succ : successors(BB)) {
+        Out |= LiveIn[Succ];
+        for (const PHINode &PN : Succ->phis()) {
+          int Num = getNumber(PN.getIncomingValueForBlock(BB));
+          if (Num >= 0)
+            Out.set(Num);
+        }
+      }
+      BitVector In = Out;
+      In.reset(Defs[BB]);
+      In |= Uses[BB];
+      if (In != LiveIn[BB]) {
+        LiveIn[BB] = std::move(In);
+        Changed = true;
+      }
+      LiveOut[BB] = std::move(Out);
+    }
+  }
+}
+
+void StateHashAction::FunctionLiveness::getLiveBefore(const Instruction &Pos,
+                                                      BitVector &Live) const {
+  const BasicBlock *BB = Pos.getParent();
+  auto It = LiveOut.find(BB);
+  if (It != LiveOut.end())
+    Live = It->second;
+  else
+    Live.reset();
+  Live.resize(Values.size());
+  for (const Instruction &I : reverse(*BB)) {
+    int Num = getNumber(&I);
+    if (Num >= 0)
+      Live.reset(Num);
+    if (!isa<PHINode>(I))
+      for (const Value *Op : I.operands()) {
+        int OpNum = getNumber(Op);
+        if (OpNum >= 0)
+          Live.set(OpNum);
+      }
+    if (&I == &Pos)
+      break;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// StateHashAction
+//===----------------------------------------------------------------------===//
+
+StateHashAction::StateHashAction() {}
+StateHashAction::~StateHashAction() {}
+
+StateHashAction::FunctionLiveness &
+StateHashAction::getLiveness(const Function &F) {
+  std::unique_ptr<FunctionLiveness> &L = Liveness[&F];
+  if (!L)
+    L.reset(new FunctionLiveness(F));
+  return *L;
+}
+
+/// mixByte - Hash of one byte of memory at the key of its address,
+/// SplitMix64 finalizer.
+static uint64_t mixByte(uint64_t Key, uint8_t Byte) {
+  uint64_t Z = (Key << 8 | Byte) + 0x9E3779B97F4A7C15ULL;
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+  return Z ^ (Z >> 31);
+}
+
+/// getKey - The address as hashed: block number and offset for an address
+/// in a block the program allocated, marked by bit 55 that no user-space
+/// address sets (and that the shift of mixByte keeps); the address itself
+/// otherwise.
+uint64_t StateHashAction::getKey(const void *Addr) const {
+  uintptr_t A = reinterpret_cast<uintptr_t>(Addr);
+  auto It = Blocks.upper_bound(A);
+  if (It == Blocks.begin())
+    return A;
+  --It;
+  uint64_t Offset = A - It->first;
+  if (Offset >= It->second.Size)
+    return A;
+  return 1ULL << 55 | (It->second.ID & 0x7FFFFF) << 32 |
+         (Offset & 0xFFFFFFFF);
+}
+
+void StateHashAction::addBlock(const void *Addr, uint64_t Size) {
+  if (!Addr)
+    return;
+  uintptr_t A = reinterpret_cast<uintptr_t>(Addr);
+  Size = std::max<uint64_t>(Size, 1);
+  // Forget the freed blocks the new one reuses.
+  auto It = Blocks.upper_bound(A);
+  if (It != Blocks.begin() && std::prev(It)->first +
+                                  std::prev(It)->second.Size > A)
+    --It;
+  while (It != Blocks.end() && It->first < A + Size)
+    It = Blocks.erase(It);
+  Blocks[A] = {NumBlocks++, Size};
+}
+
+void StateHashAction::toggleBytes(const uint8_t *Addr, uint64_t Size,
+                                  bool Pointer) {
+  // One lookup: a write stays in its block.
+  uint64_t Key = getKey(Addr);
+  uint64_t H = 0;
+  if (Pointer) {
+    uint64_t Value = getKey(*reinterpret_cast<void *const *>(Addr));
+    for (uint64_t i = 0; i != Size; ++i)
+      H ^= mixByte(Key + i, uint8_t(Value >> (8 * (i % 8))));
+  } else {
+    for (uint64_t i = 0; i != Size; ++i)
+      H ^= mixByte(Key + i, Addr[i]);
+  }
+  MemoryHash ^= H;
+}
+
+void StateHashAction::toggleMemory(const uint8_t *Addr, uint64_t Size) {
+  toggleBytes(Addr, Size, false);
+}
+
+void StateHashAction::noteStore(StoreInst &SI, ExecutionContext &SF) {
+  Interpreter &Interp = *getInterpreter();
+  GenericValue Ptr = Interp.getOperandValue(SI.getPointerOperand(), SF);
+  Type *Ty = SI.getValueOperand()->getType();
+  WriteAddr = static_cast<const uint8_t *>(GVTOP(Ptr));
+  WriteSize = Interp.getDataLayout().getTypeStoreSize(Ty);
+  WritePointer = Ty->isPointerTy() && WriteSize == sizeof(void *);
+  toggleBytes(WriteAddr, WriteSize, WritePointer);
+}
+
+void StateHashAction::noteAlloca(AllocaInst &AI, ExecutionContext &SF) {
+  Interpreter &Interp = *getInterpreter();
+  auto It = SF.Values.find(&AI);
+  if (It == SF.Values.end())
+    return;
+  uint64_t Count =
+    Interp.getOperandValue(AI.getArraySize(), SF).IntVal.getZExtValue();
+  addBlock(GVTOP(It->second),
+           Count * Interp.getDataLayout().getTypeAllocSize(
+                       AI.getAllocatedType()));
+}
+
+void StateHashAction::endAllocation() {
+  ExecutionContext &SF = Stack->back();
+  auto It = SF.Values.find(const_cast<CallInst *>(Allocation));
+  if (It != SF.Values.end())
+    addBlock(GVTOP(It->second), AllocationSize);
+  Allocation = nullptr;
+}
+
+void StateHashAction::noteCall(CallInst &CI, ExecutionContext &SF) {
+  Interpreter &Interp = *getInterpreter();
+  Value *Called = CI.getCalledValue();
+  const Function *F = dyn_cast<Function>(Called->stripPointerCasts());
+  if (!F)
+    F = dyn_cast_or_null<Function>(Interp.getGlobalValueAtAddress(
+        GVTOP(Interp.getOperandValue(Called, SF))));
+  if (!F) {
+    if (Tracking)
+      ++NumUntracked;
+    return;
+  }
+  // The interpreted functions are followed instruction by instruction.
+  if (!F->isDeclaration())
+    return;
+  // The interpreter lowers most intrinsics into new instructions of the
+  // caller, whose liveness must be computed again.
+  if (F->isIntrinsic()) {
+    Liveness.erase(CI.getFunction());
+    return;
+  }
+
+  auto getInt = [&](unsigned i) {
+    return Interp.getOperandValue(CI.getArgOperand(i), SF).IntVal
+             .getZExtValue();
+  };
+  StringRef Name = F->getName();
+  unsigned NumArgs = CI.getNumArgOperands();
+  if (CI.getType()->isPointerTy()) {
+    if (Name == "malloc" && NumArgs == 1) {
+      Allocation = &CI;
+      AllocationSize = getInt(0);
+    } else if ((Name == "calloc" || Name == "realloc") && NumArgs == 2) {
+      Allocation = &CI;
+      AllocationSize = Name == "calloc" ? getInt(0) * getInt(1) : getInt(1);
+    }
+  }
+  if (!Tracking)
+    return;
+
+  enum { ReadOnly, Writes, Untracked };
+  int Kind = StringSwitch<int>(Name)
+    .Cases("memcpy", "memmove", "memset", Writes)
+    .Cases("printf", "puts", "putchar", ReadOnly)
+    .Cases("strlen", "strcmp", "strncmp", "memcmp", ReadOnly)
+    // calloc writes its zeroes unseen: untracked.
+    .Cases("malloc", "free", ReadOnly)
+    .Default(Untracked);
+  if (Kind == Untracked) {
+    ++NumUntracked;
+  } else if (Kind == Writes && NumArgs == 3) {
+    WriteAddr = static_cast<const uint8_t *>(
+        GVTOP(Interp.getOperandValue(CI.getArgOperand(0), SF)));
+    WriteSize = getInt(2);
+    WritePointer = false;
+    toggleBytes(WriteAddr, WriteSize, false);
+  }
+}
+
+hash_code StateHashAction::hashValue(const GenericValue &GV, Type *Ty) const {
+  switch (Ty->getTypeID()) {
+  case Type::FloatTyID:
+    return hash_value(FloatToBits(GV.FloatVal));
+  case Type::DoubleTyID:
+    return hash_value(DoubleToBits(GV.DoubleVal));
+  case Type::PointerTyID:
+    return hash_value(getKey(GV.PointerVal));
+  case Type::VectorTyID:
+  case Type::ArrayTyID:
+  case Type::StructTyID: {
+    hash_code H = hash_value(GV.AggregateVal.size());
+    for (unsigned i = 0, e = GV.AggregateVal.size(); i != e; ++i) {
+      Type *ElemTy = Ty->isStructTy() ? Ty->getStructElementType(i)
+                                      : Ty->getSequentialElementType();
+      H = hash_combine(H, hashValue(GV.AggregateVal[i], ElemTy));
+    }
+    return H;
+  }
+  default:
+    // Integers, and the long doubles the interpreter keeps as integers.
+    return hash_value(GV.IntVal);
+  }
+}
+
+uint64_t StateHashAction::getStackHash(const Instruction &Next) {
+  hash_code H = hash_value(Stack->size());
+  BitVector Live;
+  for (unsigned i = 0, e = Stack->size(); i != e; ++i) {
+    ExecutionContext &SF = (*Stack)[i];
+    // A caller resumes after its call, whose value is not defined yet.
+    bool Top = i + 1 == e;
+    const Instruction &Pos = Top ? Next : *SF.CurInst;
+    const Instruction *Call = Top ? nullptr : SF.Caller.getInstruction();
+    FunctionLiveness &L = getLiveness(*SF.CurFunction);
+    L.getLiveBefore(Pos, Live);
+    H = hash_combine(H, SF.CurFunction, &Pos);
+    for (unsigned Num : Live.set_bits()) {
+      Value *V = L.Values[Num];
+      if (V == Call)
+        continue;
+      auto It = SF.Values.find(V);
+      if (It == SF.Values.end())
+        H = hash_combine(H, Num);
+      else
+        H = hash_combine(H, Num, hashValue(It->second, V->getType()));
+    }
+  }
+  if (const std::string *Out = getInterpreter()->getOutputCapture(stdout))
+    H = hash_combine(H, hash_value(StringRef(*Out)));
+  return H;
+}
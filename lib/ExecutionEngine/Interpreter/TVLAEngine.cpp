@@ -0,0 +1,225 @@
+//===-- TVLAEngine.cpp - Streaming leakage assessment ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/TVLAEngine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// TVLAMoments
+//===----------------------------------------------------------------------===//
+
+void TVLAMoments::resize(size_t Samples) {
+  // The earlier traces had 0 there: mean 0, no spread.
+  Mean.resize(Samples, 0.0);
+  M2.resize(Samples, 0.0);
+  M3.resize(Samples, 0.0);
+  M4.resize(Samples, 0.0);
+}
+
+void TVLAMoments::add(ArrayRef<uint8_t> Samples) {
+  if (Samples.size() > getNumSamples())
+    resize(Samples.size());
+
+  const double N = ++Count;
+  const double A = (N - 1) * (N * N - 3 * N + 3), B = N - 2;
+  for (size_t s = 0, e = getNumSamples(); s != e; ++s) {
+    double X = s < Samples.size() ? Samples[s] : 0;
+    double Delta = X - Mean[s];
+    double DeltaN = Delta / N, DeltaN2 = DeltaN * DeltaN;
+    double Term = Delta * DeltaN * (N - 1);
+    Mean[s] += DeltaN;
+    M4[s] += DeltaN2 * DeltaN * Delta * A + 6 * DeltaN2 * M2[s] -
+             4 * DeltaN * M3[s];
+    M3[s] += Term * DeltaN * B - 3 * DeltaN * M2[s];
+    M2[s] += Term;
+  }
+}
+
+void TVLAMoments::merge(const TVLAMoments &Other) {
+  if (!Other.Count)
+    return;
+  if (Other.getNumSamples() > getNumSamples())
+    resize(Other.getNumSamples());
+
+  const double NA = Count, NB = Other.Count, N = NA + NB;
+  for (size_t s = 0, e = getNumSamples(); s != e; ++s) {
+    bool InOther = s < Other.getNumSamples();
+    double MeanB = InOther ? Other.Mean[s] : 0;
+    double M2B = InOther ? Other.M2[s] : 0;
+    double M3B = InOther ? Other.M3[s] : 0;
+    double M4B = InOther ? Other.M4[s] : 0;
+    double D = MeanB - Mean[s], D2 = D * D;
+
+    M4[s] += M4B + D2 * D2 * NA * NB * (NA * NA - NA * NB + NB * NB) /
+                     (N * N * N) +
+             6 * D2 * (NA * NA * M2B + NB * NB * M2[s]) / (N * N) +
+             4 * D * (NA * M3B - NB * M3[s]) / N;
+    M3[s] += M3B + D2 * D * NA * NB * (NA - NB) / (N * N) +
+             3 * D * (NA * M2B - NB * M2[s]) / N;
+    M2[s] += M2B + D2 * NA * NB / N;
+    Mean[s] += D * NB / N;
+  }
+  Count += Other.Count;
+}
+
+//===----------------------------------------------------------------------===//
+// TVLAAccumulator
+//===----------------------------------------------------------------------===//
+
+void TVLAAccumulator::addTrace(const TraceRecord &Record) {
+  const TVLAOptions &Opts = Engine.getOptions();
+  ArrayRef<uint8_t> Samples = Record.Samples;
+  if (Samples.size() <= Opts.SampleBegin)
+    Samples = ArrayRef<uint8_t>();
+  else
+    Samples = Samples.drop_front(Opts.SampleBegin);
+  if (Opts.MaxSamples && Samples.size() > Opts.MaxSamples)
+    Samples = Samples.take_front(Opts.MaxSamples);
+
+  {
+    sys::ScopedLock Guard(Lock);
+    Classes[Record.FixedInput].add(Samples);
+  }
+  Engine.traceAdded();
+}
+
+//===----------------------------------------------------------------------===//
+// TVLAEngine
+//===----------------------------------------------------------------------===//
+
+TVLAAccumulator &TVLAEngine::createAccumulator() {
+  sys::ScopedLock Guard(Lock);
+  Accumulators.emplace_back(new TVLAAccumulator(*this));
+  return *Accumulators.back();
+}
+
+void TVLAEngine::traceAdded() {
+  uint64_t N = ++NumTraces;
+  if (!Opts.ReportPeriod || N % Opts.ReportPeriod)
+    return;
+  if (Error E = report(errs()))
+    logAllUnhandledErrors(std::move(E), errs(), "tvla: ");
+}
+
+TVLAEngine::Result TVLAEngine::compute() const {
+  TVLAMoments Classes[2];
+  {
+    sys::ScopedLock Guard(Lock);
+    for (auto &A : Accumulators) {
+      sys::ScopedLock AccGuard(A->Lock);
+      Classes[0].merge(A->Classes[0]);
+      Classes[1].merge(A->Classes[1]);
+    }
+  }
+
+  Result R;
+  R.NumRandom = Classes[0].Count;
+  R.NumFixed = Classes[1].Count;
+  R.SampleBegin = Opts.SampleBegin;
+  size_t NumSamples = std::max(Classes[0].getNumSamples(),
+                               Classes[1].getNumSamples());
+  R.T1.assign(NumSamples, 0.0);
+  R.T2.assign(NumSamples, 0.0);
+  if (R.NumRandom < 2 || R.NumFixed < 2)
+    return R;
+
+  // The samples a class has never seen were 0 in all its traces.
+  auto get = [](const std::vector<double> &V, size_t S) {
+    return S < V.size() ? V[S] : 0.0;
+  };
+  const double NR = R.NumRandom, NF = R.NumFixed;
+  for (size_t s = 0; s != NumSamples; ++s) {
+    double MeanR = get(Classes[0].Mean, s), MeanF = get(Classes[1].Mean, s);
+    double M2R = get(Classes[0].M2, s), M2F = get(Classes[1].M2, s);
+    double M4R = get(Classes[0].M4, s), M4F = get(Classes[1].M4, s);
+
+    double Den1 = M2R / (NR - 1) / NR + M2F / (NF - 1) / NF;
+    if (Den1 > 0)
+      R.T1[s] = (MeanF - MeanR) / std::sqrt(Den1);
+
+    // second order: y = (x - mean)^2, E y = M2 / n, Var y = M4 / n - (E y)^2
+    double YR = M2R / NR, YF = M2F / NF;
+    double Den2 = (M4R / NR - YR * YR) / NR + (M4F / NF - YF * YF) / NF;
+    if (Den2 > 0)
+      R.T2[s] = (YF - YR) / std::sqrt(Den2);
+  }
+  return R;
+}
+
+Error TVLAEngine::report(raw_ostream &OS) const {
+  sys::ScopedLock Guard(ReportLock);
+  Result R = compute();
+  printSummary(OS, R, Opts.Threshold);
+  if (Opts.OutputFile.empty())
+    return Error::success();
+  return writeResult(Opts.OutputFile, R);
+}
+
+Error TVLAEngine::writeResult(StringRef Path, const Result &R) {
+  // Written aside and renamed, a reader never sees a partial file.
+  std::string Temp = (Path + ".tmp").str();
+  {
+    std::error_code EC;
+    raw_fd_ostream OS(Temp, EC, sys::fs::F_Text);
+    if (EC)
+      return createStringError(EC, "cannot write TVLA file '%s'",
+                               Temp.c_str());
+    OS << "# TVLA, " << R.NumFixed << " fixed and " << R.NumRandom
+       << " random traces\n"
+       << "# sample t1 t2\n";
+    for (size_t s = 0, e = R.T1.size(); s != e; ++s)
+      OS << R.SampleBegin + s << " " << format("%.4f", R.T1[s]) << " "
+         << format("%.4f", R.T2[s]) << "\n";
+    if (OS.has_error())
+      return createStringError(std::make_error_code(std::errc::io_error),
+                               "cannot write TVLA file '%s'", Temp.c_str());
+  }
+  if (std::error_code EC = sys::fs::rename(Temp, Path))
+    return createStringError(EC, "cannot rename TVLA file '%s'",
+                             Temp.c_str());
+  return Error::success();
+}
+
+void TVLAEngine::printSummary(raw_ostream &OS, const Result &R,
+                              double Threshold) {
+  OS << "TVLA after " << R.NumFixed + R.NumRandom << " traces ("
+     << R.NumFixed << " fixed, " << R.NumRandom << " random)\n";
+  const std::vector<double> *Stats[] = {&R.T1, &R.T2};
+  for (unsigned Order = 1; Order <= 2; ++Order) {
+    const std::vector<double> &T = *Stats[Order - 1];
+    size_t Max = 0, Over = 0;
+    for (size_t s = 0, e = T.size(); s != e; ++s) {
+      if (std::fabs(T[s]) > std::fabs(T[Max]))
+        Max = s;
+      Over += std::fabs(T[s]) > Threshold;
+    }
+    OS << "  order " << Order << ": ";
+    if (T.empty()) {
+      OS << "no sample\n";
+      continue;
+    }
+    OS << Over << " samples over " << format("%.1f", Threshold)
+       << ", max |t| = " << format("%.2f", std::fabs(T[Max])) << " @"
+       << R.SampleBegin + Max << "\n";
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// TVLAAction
+//===----------------------------------------------------------------------===//
+
+void TVLAAction::print(raw_ostream &ROS) {
+  ROS << "TVLA => Fixed-vs-random Welch t-test of the traced samples, "
+         "computed while the traces are acquired (batch mode).\n";
+}
@@ -0,0 +1,165 @@
+//===-- TableAction.cpp - Lookup-table access extraction ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/TableAction.h"
+#include "llvm/ExecutionEngine/TaintAction.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "Interpreter.h"
+#include <algorithm>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// LookupTables
+//===----------------------------------------------------------------------===//
+
+unsigned LookupTables::addTable(uint32_t Inst, StringRef Name, uint64_t Size,
+                                unsigned ElementSize) {
+  sys::ScopedLock Guard(Lock);
+  auto It = TableIDs.find(Inst);
+  if (It != TableIDs.end())
+    return It->second;
+
+  auto G = GlobalIDs.insert({Name, Globals.size()});
+  if (G.second)
+    Globals.push_back({Name.str(), Size, {}});
+  // The bytes of the largest index.
+  uint64_t MaxIndex = std::max<uint64_t>(Size / ElementSize, 1) - 1;
+  unsigned Width = 1;
+  while (Width < 8 && MaxIndex >> (8 * Width))
+    ++Width;
+  Tables.push_back({Inst, G.first->second, ElementSize, Width});
+  TableIDs[Inst] = Tables.size() - 1;
+  return Tables.size() - 1;
+}
+
+unsigned LookupTables::getWidth(unsigned T) {
+  sys::ScopedLock Guard(Lock);
+  return Tables[T].Width;
+}
+
+void LookupTables::dump(unsigned T, ArrayRef<uint8_t> Contents) {
+  sys::ScopedLock Guard(Lock);
+  Global &G = Globals[Tables[T].Global];
+  if (G.Contents.empty())
+    G.Contents.assign(Contents.begin(), Contents.end());
+}
+
+Error LookupTables::writeFile(StringRef Path) {
+  sys::ScopedLock Guard(Lock);
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_Text);
+  if (EC)
+    return createStringError(EC, "cannot write tables file '%s'",
+                             Path.str().c_str());
+  OS << "# lookup tables, the indices are in the trace file\n"
+     << "# global G name size, then the contents (none if never read)\n";
+  for (unsigned i = 0, e = Globals.size(); i != e; ++i) {
+    const Global &G = Globals[i];
+    OS << "global " << i << " " << G.Name << " " << G.Size << "\n";
+    for (size_t j = 0, n = G.Contents.size(); j != n; ++j)
+      OS << format("%02x", G.Contents[j])
+         << ((j % 32 == 31 || j + 1 == n) ? "\n" : "");
+  }
+  OS << "# table T inst global element width\n";
+  for (unsigned i = 0, e = Tables.size(); i != e; ++i) {
+    const Table &T = Tables[i];
+    OS << "table " << i << " " << T.Inst << " " << T.Global << " "
+       << T.ElementSize << " " << T.Width << "\n";
+  }
+  if (OS.has_error())
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "cannot write tables file '%s'",
+                             Path.str().c_str());
+  return Error::success();
+}
+
+void LookupTables::printSummary(raw_ostream &OS) {
+  sys::ScopedLock Guard(Lock);
+  unsigned Dumped = count_if(Globals, [](const Global &G) {
+    return !G.Contents.empty();
+  });
+  OS << "Lookup tables: " << Tables.size() << " access sites in "
+     << Globals.size() << " globals, " << Dumped << " read\n";
+}
+
+//===----------------------------------------------------------------------===//
+// TableAction
+//===----------------------------------------------------------------------===//
+
+void TableAction::setInstructionIndex(const InstructionIndex *Index) {
+  Action::setInstructionIndex(Index);
+  Accesses.clear();
+  if (!Index)
+    return;
+  for (uint32_t ID = 0, e = Index->size(); ID != e; ++ID) {
+    auto *LI = dyn_cast<LoadInst>(Index->getInstruction(ID));
+    if (!LI)
+      continue;
+    auto *GEP = dyn_cast<GetElementPtrInst>(
+        LI->getPointerOperand()->stripPointerCasts());
+    if (!GEP || GEP->hasAllConstantIndices())
+      continue;
+    auto *GV = dyn_cast<GlobalVariable>(
+        GEP->getPointerOperand()->stripInBoundsOffsets());
+    if (!GV || GV->isDeclaration())
+      continue;
+    const DataLayout &DL = LI->getModule()->getDataLayout();
+    uint64_t Size = DL.getTypeAllocSize(GV->getValueType());
+    unsigned ElementSize = DL.getTypeStoreSize(LI->getType());
+    if (!Size || !ElementSize)
+      continue;
+    unsigned T = Tables.addTable(ID, GV->getName(), Size, ElementSize);
+    Accesses[LI] = {ID, GEP, GV, Size, T, ElementSize, Tables.getWidth(T),
+                    false};
+  }
+}
+
+void TableAction::afterVisitInst(Instruction &I, ExecutionContext &SF) {
+  if (Accesses.empty())
+    return;
+  auto It = Accesses.find(&I);
+  if (It == Accesses.end())
+    return;
+  Access &A = It->second;
+  if (Taint && !Taint->isTainted(*A.Address))
+    return;
+
+  Interpreter &Interp = *getInterpreter();
+  auto *Base = static_cast<const uint8_t *>(Interp.getPointerToGlobal(A.Base));
+  auto *Addr = static_cast<const uint8_t *>(
+      GVTOP(Interp.getOperandValue(A.Address, SF)));
+  // Out of the global, e.g. through a negative index: not a table read.
+  if (Addr < Base || uint64_t(Addr - Base) + A.ElementSize > A.Size)
+    return;
+  uint64_t Index = uint64_t(Addr - Base) / A.ElementSize;
+
+  if (!A.Dumped) {
+    Tables.dump(A.Table, makeArrayRef(Base, A.Size));
+    A.Dumped = true;
+  }
+  if (!Record) {
+    outs() << "(tables) table " << A.Table << " [" << Index << "]\n";
+    return;
+  }
+  for (unsigned i = 0; i != A.Width; ++i) {
+    Record->Samples.push_back(uint8_t(Index >> (8 * i)));
+    if (Record->CollectSampleInsts)
+      Record->SampleInsts.push_back(A.Inst);
+  }
+}
+
+void TableAction::print(raw_ostream &ROS) {
+  ROS << "TableAction => Record the entries of the lookup tables read.\n";
+}
@@ -0,0 +1,452 @@
+//===-- TaintAction.cpp - Byte-level taint tracking -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/TaintAction.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/WithColor.h"
+#include "Interpreter.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+//===----------------------------------------------------------------------===//
+// TaintSource
+//===----------------------------------------------------------------------===//
+
+Expected<TaintSource> TaintSource::parse(StringRef Spec) {
+  auto Invalid = [&](const char *Why) {
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "taint source '%s': %s", Spec.str().c_str(),
+                             Why);
+  };
+
+  TaintSource S;
+  StringRef Kind, Args;
+  std::tie(Kind, Args) = Spec.split(':');
+  if (Kind == "arg") {
+    S.K = Argument;
+    StringRef ArgNo, Size;
+    std::tie(ArgNo, Size) = Args.split(':');
+    if (ArgNo.getAsInteger(10, S.ArgNo))
+      return Invalid("expected arg:N[:SIZE]");
+    if (Args.contains(':') && (Size.getAsInteger(10, S.Size) || !S.Size))
+      return Invalid("expected a size in bytes");
+  } else if (Kind == "global") {
+    S.K = Global;
+    S.GlobalName = Args;
+    if (S.GlobalName.empty())
+      return Invalid("expected global:NAME");
+  } else if (Kind == "argv" || Kind == "fread") {
+    S.K = Kind == "argv" ? Argv : Fread;
+    if (Spec.contains(':'))
+      return Invalid("takes no argument");
+  } else {
+    return Invalid("expected arg:N[:SIZE], global:NAME, argv or fread");
+  }
+  return S;
+}
+
+void TaintSource::print(raw_ostream &OS) const {
+  switch (K) {
+  case Argument:
+    OS << "arg:" << ArgNo;
+    if (Size)
+      OS << ':' << Size;
+    break;
+  case Global:
+    OS << "global:" << GlobalName;
+    break;
+  case Argv:
+    OS << "argv";
+    break;
+  case Fread:
+    OS << "fread";
+    break;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// ShadowMemory
+//===----------------------------------------------------------------------===//
+
+ShadowMemory::ShadowMemory() {}
+ShadowMemory::~ShadowMemory() {}
+
+ShadowMemory::Page *ShadowMemory::getPage(uintptr_t Addr) {
+  if (Addr >> (PageBits + TableBits + DirectoryBits))
+    return nullptr;
+  if (!Directory)
+    Directory.reset(new std::unique_ptr<Table>[1 << DirectoryBits]());
+  std::unique_ptr<Table> &T = Directory[Addr >> (PageBits + TableBits)];
+  if (!T)
+    T.reset(new Table());
+  std::unique_ptr<Page> &P =
+    T->Pages[(Addr >> PageBits) & ((1 << TableBits) - 1)];
+  if (!P) {
+    P.reset(new Page());
+    Allocated.push_back(P.get());
+  }
+  return P.get();
+}
+
+uint8_t ShadowMemory::get(uintptr_t Addr, uint64_t Size) const {
+  uint8_t Label = 0;
+  while (Size) {
+    uint64_t Offset = Addr & ((1 << PageBits) - 1);
+    uint64_t N = std::min<uint64_t>(Size, (1 << PageBits) - Offset);
+    if (const Page *P = findPage(Addr))
+      for (uint64_t i = 0; i != N; ++i)
+        Label |= P->Labels[Offset + i];
+    Addr += N;
+    Size -= N;
+  }
+  return Label;
+}
+
+void ShadowMemory::set(uintptr_t Addr, uint64_t Size, uint8_t Label) {
+  while (Size) {
+    uint64_t Offset = Addr & ((1 << PageBits) - 1);
+    uint64_t N = std::min<uint64_t>(Size, (1 << PageBits) - Offset);
+    // Clean bytes need no page.
+    if (Page *P = Label ? getPage(Addr) : findPage(Addr))
+      memset(P->Labels + Offset, Label, N);
+    Addr += N;
+    Size -= N;
+  }
+}
+
+void ShadowMemory::move(uintptr_t Dst, uintptr_t Src, uint64_t Size) {
+  if (Dst == Src || !Size)
+    return;
+  std::vector<uint8_t> Labels(Size);
+  for (uint64_t Done = 0; Done != Size;) {
+    uint64_t Offset = (Src + Done) & ((1 << PageBits) - 1);
+    uint64_t N = std::min<uint64_t>(Size - Done, (1 << PageBits) - Offset);
+    if (const Page *P = findPage(Src + Done))
+      memcpy(&Labels[Done], P->Labels + Offset, N);
+    Done += N;
+  }
+  for (uint64_t Done = 0; Done != Size;) {
+    uint64_t Offset = (Dst + Done) & ((1 << PageBits) - 1);
+    uint64_t N = std::min<uint64_t>(Size - Done, (1 << PageBits) - Offset);
+    bool Clean = std::all_of(&Labels[Done], &Labels[Done] + N,
+                             [](uint8_t L) { return L == 0; });
+    if (Page *P = Clean ? findPage(Dst + Done) : getPage(Dst + Done))
+      memcpy(P->Labels + Offset, &Labels[Done], N);
+    Done += N;
+  }
+}
+
+void ShadowMemory::clear() {
+  for (Page *P : Allocated)
+    memset(P->Labels, 0, sizeof(P->Labels));
+}
+
+//===----------------------------------------------------------------------===//
+// TaintAction
+//===----------------------------------------------------------------------===//
+
+static Argument *getArg(Function &F, unsigned ArgNo) {
+  return F.arg_begin() + ArgNo;
+}
+
+void TaintAction::resolve() {
+  Resolved = true;
+  Globals.assign(Sources.size(), nullptr);
+  for (unsigned i = 0, e = Sources.size(); i != e; ++i) {
+    const TaintSource &S = Sources[i];
+    if (S.K == TaintSource::Fread)
+      FreadLabel |= 1 << i;
+    if (S.K != TaintSource::Global)
+      continue;
+    Globals[i] = getInterpreter()->FindGlobalVariableNamed(
+        S.GlobalName, /*AllowInternal=*/true);
+    if (!Globals[i]) {
+      S.print(WithColor::warning(errs()) << "taint source ");
+      errs() << ": no such global, ignored!\n";
+    }
+  }
+}
+
+/// seed - Label the sources at the first instruction of a run, the entry
+/// function being the only frame.
+void TaintAction::seed() {
+  if (!Resolved)
+    resolve();
+  Frames.clear();
+  Frames.resize(Stack->size());
+  Interpreter &Interp = *getInterpreter();
+  ExecutionContext &Entry = Stack->front();
+  Function &F = *Entry.CurFunction;
+  for (unsigned i = 0, e = Sources.size(); i != e; ++i) {
+    const TaintSource &S = Sources[i];
+    uint8_t Label = 1 << i;
+    switch (S.K) {
+    case TaintSource::Argument:
+      if (S.ArgNo < F.arg_size() &&
+          getArg(F, S.ArgNo)->getType()->isPointerTy())
+        Shadow.set(getAddress(getArg(F, S.ArgNo), Entry),
+                   S.Size ? S.Size : InputSize, Label);
+      break;
+    case TaintSource::Global:
+      if (GlobalVariable *GV = Globals[i])
+        Shadow.set(reinterpret_cast<uintptr_t>(Interp.getPointerToGlobal(GV)),
+                   Interp.getDataLayout().getTypeAllocSize(GV->getValueType()),
+                   Label);
+      break;
+    case TaintSource::Argv: {
+      // main(argc, argv, ...)
+      if (F.arg_size() < 2 || !getArg(F, 0)->getType()->isIntegerTy() ||
+          !getArg(F, 1)->getType()->isPointerTy())
+        break;
+      uint64_t Argc =
+        Interp.getOperandValue(getArg(F, 0), Entry).IntVal.getZExtValue();
+      char **Argv = static_cast<char **>(
+          GVTOP(Interp.getOperandValue(getArg(F, 1), Entry)));
+      for (uint64_t Arg = 1; Arg < Argc; ++Arg)
+        Shadow.set(reinterpret_cast<uintptr_t>(Argv[Arg]), strlen(Argv[Arg]),
+                   Label);
+      break;
+    }
+    case TaintSource::Fread:
+      break;
+    }
+  }
+}
+
+uintptr_t TaintAction::getAddress(Value *Ptr, ExecutionContext &SF) {
+  return reinterpret_cast<uintptr_t>(
+      GVTOP(getInterpreter()->getOperandValue(Ptr, SF)));
+}
+
+uint8_t TaintAction::getLabel(const Value *V) const {
+  if (Frames.empty() || Frames.back().empty())
+    return 0;
+  auto It = Frames.back().find(V);
+  return It == Frames.back().end() ? 0 : It->second;
+}
+
+void TaintAction::setLabel(const Value *V, uint8_t Label) {
+  if (Label)
+    Frames.back()[V] = Label;
+  else if (!Frames.back().empty())
+    Frames.back().erase(V);
+}
+
+uint8_t TaintAction::getOperandsLabel(const Instruction &I) const {
+  uint8_t Label = 0;
+  for (const Value *Op : I.operands())
+    Label |= getLabel(Op);
+  return Label;
+}
+
+void TaintAction::beginRun(TraceRecord &Record) {
+  Shadow.clear();
+  Frames.clear();
+  InputSize = Record.Input.size();
+  Call.Depth = 0;
+}
+
+void TaintAction::beforeVisitInst(Instruction &I, ExecutionContext &SF) {
+  if (LLVM_UNLIKELY(Frames.empty()))
+    seed();
+  if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+    Value *V = RI->getReturnValue();
+    ReturnLabel = V ? getLabel(V) : 0;
+    ReturnTo = Stack->size() < 2 ? nullptr
+               : (*Stack)[Stack->size() - 2].Caller.getInstruction();
+  } else if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+    Value *Called = CallSite(&I).getCalledValue();
+    const Function *F = dyn_cast<Function>(Called->stripPointerCasts());
+    if (!F)
+      F = dyn_cast_or_null<Function>(getInterpreter()->getGlobalValueAtAddress(
+          GVTOP(getInterpreter()->getOperandValue(Called, SF))));
+    Call = {&I, F, Stack->size()};
+  }
+}
+
+void TaintAction::afterVisitInst(Instruction &I, ExecutionContext &SF) {
+  // Do not look at I or SF after a call, I may be gone and SF may no longer
+  // be the top frame.
+  if (Call.Depth) {
+    afterCall();
+  } else if (isa<ReturnInst>(I)) {
+    afterReturn();
+  } else {
+    // A run the interpreter unwound.
+    if (LLVM_UNLIKELY(Frames.size() != Stack->size()))
+      Frames.resize(Stack->size());
+    if (!Frames.empty())
+      propagate(I, SF);
+  }
+}
+
+void TaintAction::afterCall() {
+  PendingCall C = Call;
+  Call.Depth = 0;
+  // A lowered intrinsic goes on with the instructions that replace it.
+  if (C.Callee && C.Callee->isIntrinsic())
+    return;
+  CallSite CS(C.Inst);
+  if (Stack->size() <= C.Depth) {
+    afterExternalCall(CS, C.Callee);
+    // An invoke went on to its normal destination.
+    if (auto *II = dyn_cast<InvokeInst>(C.Inst))
+      enterBlock(*II->getParent(), Stack->back());
+    return;
+  }
+  // Entered an interpreted function: its arguments in a new frame.
+  DenseMap<const Value *, uint8_t> Args;
+  Function &F = *Stack->back().CurFunction;
+  for (unsigned i = 0, e = std::min<unsigned>(F.arg_size(), CS.arg_size());
+       i != e; ++i)
+    if (uint8_t Label = getLabel(CS.getArgument(i)))
+      Args[getArg(F, i)] = Label;
+  Frames.resize(Stack->size());
+  Frames.back() = std::move(Args);
+}
+
+void TaintAction::afterExternalCall(CallSite CS, const Function *F) {
+  enum { Other, Copy, Set, Allocate, Reallocate, Read };
+  static const unsigned MinArgs[] = {0, 3, 3, 1, 2, 4};
+  int Kind = !F ? Other : StringSwitch<int>(F->getName())
+    .Cases("memcpy", "memmove", Copy)
+    .Case("memset", Set)
+    .Cases("malloc", "calloc", Allocate)
+    .Case("realloc", Reallocate)
+    .Case("fread", Read)
+    .Default(Other);
+  Instruction &I = *CS.getInstruction();
+  unsigned NumArgs = CS.arg_size();
+  if (Kind == Other || NumArgs < MinArgs[Kind]) {
+    if (!I.getType()->isVoidTy())
+      setLabel(&I, getOperandsLabel(I));
+    return;
+  }
+
+  ExecutionContext &SF = Stack->back();
+  Interpreter &Interp = *getInterpreter();
+  auto getInt = [&](unsigned i) {
+    return Interp.getOperandValue(CS.getArgument(i), SF).IntVal
+             .getZExtValue();
+  };
+  uintptr_t Result = I.getType()->isPointerTy() ? getAddress(&I, SF) : 0;
+  switch (Kind) {
+  case Copy:
+    Shadow.move(getAddress(CS.getArgument(0), SF),
+                getAddress(CS.getArgument(1), SF), getInt(2));
+    setLabel(&I, getLabel(CS.getArgument(0)));
+    return;
+  case Set:
+    Shadow.set(getAddress(CS.getArgument(0), SF), getInt(2),
+               getLabel(CS.getArgument(1)));
+    setLabel(&I, getLabel(CS.getArgument(0)));
+    return;
+  case Allocate:
+    if (Result)
+      Shadow.set(Result, NumArgs == 2 ? getInt(0) * getInt(1) : getInt(0), 0);
+    break;
+  case Reallocate: {
+    uintptr_t Old = getAddress(CS.getArgument(0), SF);
+    if (Result && Old)
+      Shadow.move(Result, Old, getInt(1));
+    else if (Result)
+      Shadow.set(Result, getInt(1), 0);
+    break;
+  }
+  case Read: {
+    uint64_t Count =
+      Interp.getOperandValue(&I, SF).IntVal.getZExtValue() * getInt(1);
+    Shadow.set(getAddress(CS.getArgument(0), SF), Count, FreadLabel);
+    break;
+  }
+  }
+  setLabel(&I, 0);
+}
+
+void TaintAction::afterReturn() {
+  Frames.resize(Stack->size());
+  if (Frames.empty() || !ReturnTo)
+    return;
+  if (!ReturnTo->getType()->isVoidTy())
+    setLabel(ReturnTo, ReturnLabel);
+  // An invoke went on to its normal destination.
+  if (isa<InvokeInst>(ReturnTo))
+    enterBlock(*ReturnTo->getParent(), Stack->back());
+}
+
+/// enterBlock - The PHI nodes of the block a terminator of From went to,
+/// evaluated together as the interpreter does.
+void TaintAction::enterBlock(BasicBlock &From, ExecutionContext &SF) {
+  // A skipped terminator went nowhere.
+  if (SF.CurInst == SF.CurBB->end())
+    return;
+  SmallVector<std::pair<PHINode *, uint8_t>, 8> Labels;
+  for (PHINode &PN : SF.CurBB->phis())
+    Labels.push_back({&PN, getLabel(PN.getIncomingValueForBlock(&From))});
+  for (auto &L : Labels)
+    setLabel(L.first, L.second);
+}
+
+void TaintAction::propagate(Instruction &I, ExecutionContext &SF) {
+  const DataLayout &DL = getInterpreter()->getDataLayout();
+  switch (I.getOpcode()) {
+  case Instruction::Br:
+  case Instruction::Switch:
+  case Instruction::IndirectBr:
+    enterBlock(*I.getParent(), SF);
+    return;
+  case Instruction::Alloca: {
+    // The interpreter reuses freed memory: the new block starts clean.
+    auto &AI = cast<AllocaInst>(I);
+    uint64_t NumElements = getInterpreter()->getOperandValue(
+        AI.getArraySize(), SF).IntVal.getZExtValue();
+    Shadow.set(getAddress(&AI, SF),
+               std::max<uint64_t>(1, NumElements *
+                                     DL.getTypeAllocSize(
+                                         AI.getAllocatedType())),
+               0);
+    setLabel(&AI, 0);
+    return;
+  }
+  case Instruction::Load: {
+    auto &LI = cast<LoadInst>(I);
+    setLabel(&LI, getLabel(LI.getPointerOperand()) |
+                  Shadow.get(getAddress(LI.getPointerOperand(), SF),
+                             DL.getTypeStoreSize(LI.getType())));
+    return;
+  }
+  case Instruction::Store: {
+    auto &SI = cast<StoreInst>(I);
+    Value *V = SI.getValueOperand();
+    Shadow.set(getAddress(SI.getPointerOperand(), SF),
+               DL.getTypeStoreSize(V->getType()),
+               getLabel(V) | getLabel(SI.getPointerOperand()));
+    return;
+  }
+  default:
+    if (!I.getType()->isVoidTy())
+      setLabel(&I, getOperandsLabel(I));
+    return;
+  }
+}
+
+void TaintAction::print(raw_ostream &ROS) {
+  ROS << "TaintAction => Follow the values depending on:";
+  for (const TaintSource &S : Sources) {
+    ROS << ' ';
+    S.print(ROS);
+  }
+  ROS << "\n";
+}
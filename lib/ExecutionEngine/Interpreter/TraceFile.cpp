@@ -0,0 +1,164 @@
+//===-- TraceFile.cpp - Wyverse binary trace files ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/mman.h>
+#endif
+
+using namespace llvm;
+
+TraceFileWriter::TraceFileWriter(std::unique_ptr<raw_fd_ostream> OS,
+                                 uint32_t InputSize, uint32_t OutputSize)
+  : OS(std::move(OS)) {
+  memset(&Header, 0, sizeof(Header));
+  memcpy(Header.Magic, TraceFileHeader::MagicString, sizeof(Header.Magic));
+  Header.Version = TraceFileHeader::CurrentVersion;
+  Header.InputSize = InputSize;
+  Header.OutputSize = OutputSize;
+  // Reserve room for the header, rewritten by finalize().
+  this->OS->write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+}
+
+Expected<std::unique_ptr<TraceFileWriter>>
+TraceFileWriter::create(StringRef Path, uint32_t InputSize,
+                        uint32_t OutputSize) {
+  std::error_code EC;
+  auto OS = llvm::make_unique<raw_fd_ostream>(Path, EC, sys::fs::F_None);
+  if (EC)
+    return createStringError(EC, "cannot open trace file '%s'",
+                             Path.str().c_str());
+  if (!OS->supportsSeeking())
+    return createStringError(std::make_error_code(std::errc::invalid_argument),
+                             "trace file '%s' is not seekable",
+                             Path.str().c_str());
+  return std::unique_ptr<TraceFileWriter>(
+      new TraceFileWriter(std::move(OS), InputSize, OutputSize));
+}
+
+void TraceFileWriter::fit(const std::vector<uint8_t> &From, size_t Size,
+                          std::vector<uint8_t> &To) {
+  To.assign(From.begin(), From.begin() + std::min(From.size(), Size));
+  To.resize(Size, 0);
+}
+
+void TraceFileWriter::write(const TraceRecord &Record) {
+  if (Header.NumTraces == 0) {
+    Header.NumSamples = Record.Samples.size();
+    SampleIndex = Record.SampleInsts;
+    SampleIndex.resize(Header.NumSamples, ~0U);
+  }
+
+  if (Record.Input.size() != Header.InputSize ||
+      Record.Output.size() != Header.OutputSize ||
+      Record.Samples.size() != Header.NumSamples)
+    ++NumResized;
+
+  OS->write(reinterpret_cast<const char *>(&Record.Seed), sizeof(uint64_t));
+  fit(Record.Input, Header.InputSize, Buffer);
+  OS->write(reinterpret_cast<const char *>(Buffer.data()), Buffer.size());
+  fit(Record.Output, Header.OutputSize, Buffer);
+  OS->write(reinterpret_cast<const char *>(Buffer.data()), Buffer.size());
+  fit(Record.Samples, Header.NumSamples, Buffer);
+  OS->write(reinterpret_cast<const char *>(Buffer.data()), Buffer.size());
+  ++Header.NumTraces;
+}
+
+Error TraceFileWriter::finalize() {
+  Header.IndexOffset = OS->tell();
+  OS->write(reinterpret_cast<const char *>(SampleIndex.data()),
+            SampleIndex.size() * sizeof(uint32_t));
+  OS->pwrite(reinterpret_cast<const char *>(&Header), sizeof(Header), 0);
+  OS->close();
+  if (OS->has_error()) {
+    OS->clear_error();
+    return createStringError(std::make_error_code(std::errc::io_error),
+                             "failed to write the trace file");
+  }
+  return Error::success();
+}
+
+static Error makeFormatError(StringRef Path, const char *Why) {
+  return createStringError(std::make_error_code(std::errc::invalid_argument),
+                           "'%s' is not a valid trace file: %s",
+                           Path.str().c_str(), Why);
+}
+
+Expected<std::unique_ptr<TraceFileReader>>
+TraceFileReader::open(StringRef Path) {
+  int FD;
+  if (std::error_code EC = sys::fs::openFileForRead(Path, FD))
+    return createStringError(EC, "cannot open trace file '%s'",
+                             Path.str().c_str());
+  uint64_t FileSize;
+  std::error_code EC = sys::fs::file_size(Path, FileSize);
+  if (EC) {
+    sys::Process::SafelyCloseFileDescriptor(FD);
+    return createStringError(EC, "cannot stat trace file '%s'",
+                             Path.str().c_str());
+  }
+  if (FileSize < sizeof(TraceFileHeader)) {
+    sys::Process::SafelyCloseFileDescriptor(FD);
+    return makeFormatError(Path, "truncated header");
+  }
+
+  std::unique_ptr<TraceFileReader> Reader(new TraceFileReader());
+  Reader->Map = llvm::make_unique<sys::fs::mapped_file_region>(
+      FD, sys::fs::mapped_file_region::readonly, FileSize, 0, EC);
+  sys::Process::SafelyCloseFileDescriptor(FD);
+  if (EC)
+    return createStringError(EC, "cannot map trace file '%s'",
+                             Path.str().c_str());
+
+  const char *Data = Reader->Map->const_data();
+  TraceFileHeader &Header = Reader->Header;
+  memcpy(&Header, Data, sizeof(Header));
+  if (memcmp(Header.Magic, TraceFileHeader::MagicString,
+             sizeof(Header.Magic)))
+    return makeFormatError(Path, "bad magic");
+  if (Header.Version != TraceFileHeader::CurrentVersion)
+    return makeFormatError(Path, "unsupported version");
+
+  Reader->RecordSize = Header.getRecordSize();
+  uint64_t RecordsEnd = sizeof(Header) + Header.NumTraces * Reader->RecordSize;
+  if (Header.IndexOffset != RecordsEnd ||
+      FileSize < RecordsEnd + Header.NumSamples * sizeof(uint32_t))
+    return makeFormatError(Path, "truncated file, or not finalized");
+
+  Reader->Records = reinterpret_cast<const uint8_t *>(Data) + sizeof(Header);
+  // The index is not necessarily aligned, copy it.
+  Reader->SampleIndex.resize(Header.NumSamples);
+  memcpy(Reader->SampleIndex.data(), Data + Header.IndexOffset,
+         Header.NumSamples * sizeof(uint32_t));
+  return std::move(Reader);
+}
+
+uint64_t TraceFileReader::getSeed(uint64_t N) const {
+  uint64_t Seed;
+  memcpy(&Seed, getRecord(N), sizeof(Seed));
+  return Seed;
+}
+
+void TraceFileReader::dontNeed(uint64_t First, uint64_t Count) const {
+#ifdef LLVM_ON_UNIX
+  First = std::min(First, getNumTraces());
+  Count = std::min(Count, getNumTraces() - First);
+  uintptr_t PageSize = sys::Process::getPageSize();
+  uintptr_t Begin = reinterpret_cast<uintptr_t>(getRecord(First));
+  uintptr_t End = reinterpret_cast<uintptr_t>(getRecord(First + Count));
+  Begin &= ~(PageSize - 1);
+  if (End > Begin)
+    ::madvise(reinterpret_cast<void *>(Begin), End - Begin, MADV_DONTNEED);
+#endif
+}
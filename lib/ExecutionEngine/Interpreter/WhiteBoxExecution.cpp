@@ -59,6 +59,12 @@ GenericValue WhiteBoxInterpreter::runFunction(Function *F,
       ArgValues.slice(0, std::min(ArgValues.size(), ArgCount));
 
   // Set up the function call.
+  exitRequested = false;
+  abortReason = RunAbort::None;
+  runInsts = 0;
+  heapBytes = 0;
+  heapBlocks.clear();
+  armLimits();
   callFunction(F, ActualArgs);
 
   // Start executing the function.
@@ -78,6 +84,16 @@ void WhiteBoxInterpreter::run() {
     // Track the number of dynamic instructions executed.
     ++NumDynamicInsts;
 
+    // Stop a run out of its limits before the next instruction.  A single
+    // compare on the common path; an alloca is checked before it allocates.
+    if ((LLVM_UNLIKELY(runInsts >= nextCheck) && !checkLimits()) ||
+        (LLVM_UNLIKELY(limits.MaxAllocBytes != 0) && isa<AllocaInst>(I) &&
+         !checkAlloca(cast<AllocaInst>(I), SF))) {
+      ECStack.clear();
+      break;
+    }
+    ++runInsts;
+
     LLVM_DEBUG(dbgs() << "About to interpret: " << I);
     action->beforeVisitInst(I, SF);
     if (!action->skipExecuteInst(I)) {
@@ -85,7 +101,111 @@ void WhiteBoxInterpreter::run() {
       visit(I);   // Dispatch to one of the visit* methods...
     }
     action->afterVisitInst(I, SF);
+
+    // The program called exit() and we are asked to survive it, or the run
+    // went out of its limits: unwind the whole stack, the exit code is
+    // already in ExitValue.
+    if (exitRequested) {
+      ECStack.clear();
+      break;
+    }
+  }
+}
+
+void WhiteBoxInterpreter::exitCalled(GenericValue GV) {
+  if (!trapExit) {
+    base_type::exitCalled(GV);
+    return;
+  }
+  // The frames are left in place: the call to exit() is still being
+  // interpreted, run() unwinds them once it returns.
+  ExitValue = GV;
+  exitRequested = true;
+}
+
+//===----------------------------------------------------------------------===//
+// run limits
+//===----------------------------------------------------------------------===//
+
+// Dynamic instructions between two polls of the clock, a few milliseconds.
+static const uint64_t ClockPeriod = 1 << 16;
+
+void WhiteBoxInterpreter::armLimits() {
+  deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(limits.Timeout, 0.0)));
+  scheduleCheck();
+}
+
+void WhiteBoxInterpreter::scheduleCheck() {
+  nextCheck = limits.MaxInsts ? limits.MaxInsts : ~0ULL;
+  if (limits.Timeout > 0)
+    nextCheck = std::min(nextCheck, runInsts + ClockPeriod);
+}
+
+/// checkLimits - Whether the run may go on, at the threshold of the
+/// instruction count.
+bool WhiteBoxInterpreter::checkLimits() {
+  if (limits.MaxInsts && runInsts >= limits.MaxInsts) {
+    abortRun(RunAbort::InstLimit);
+    return false;
+  }
+  if (limits.Timeout > 0 && std::chrono::steady_clock::now() >= deadline) {
+    abortRun(RunAbort::Timeout);
+    return false;
   }
+  scheduleCheck();
+  return true;
+}
+
+/// checkAlloca - Whether the stack allocation fits in what the heap leaves
+/// of the allocation limit.  The stack is not accounted for, it is freed with
+/// its frame and its depth is bounded by the instruction budget; this only
+/// stops the allocations that the host could not serve.
+bool WhiteBoxInterpreter::checkAlloca(AllocaInst &I, ExecutionContext &SF) {
+  uint64_t Count =
+    getOperandValue(I.getArraySize(), SF).IntVal.getZExtValue();
+  uint64_t Size = SaturatingMultiply<uint64_t>(
+      Count, getDataLayout().getTypeAllocSize(I.getAllocatedType()));
+  if (Size <= limits.MaxAllocBytes - std::min(heapBytes, limits.MaxAllocBytes))
+    return true;
+  abortRun(RunAbort::AllocLimit);
+  return false;
+}
+
+bool WhiteBoxInterpreter::reserveHeap(void *Old, uint64_t Size) {
+  if (!limits.MaxAllocBytes)
+    return true;
+  uint64_t Live = heapBytes - (Old ? heapBlocks.lookup(Old) : 0);
+  if (Size <= limits.MaxAllocBytes && Live <= limits.MaxAllocBytes - Size)
+    return true;
+  // The allocation fails and the run ends as soon as the call returns.
+  abortRun(RunAbort::AllocLimit);
+  return false;
+}
+
+void WhiteBoxInterpreter::heapChanged(void *Old, void *New, uint64_t Size) {
+  if (!limits.MaxAllocBytes)
+    return;
+  // The blocks left by the previous runs are not accounted for.
+  if (Old) {
+    auto It = heapBlocks.find(Old);
+    if (It != heapBlocks.end()) {
+      heapBytes -= It->second;
+      heapBlocks.erase(It);
+    }
+  }
+  if (New) {
+    heapBlocks[New] = Size;
+    heapBytes += Size;
+  }
+}
+
+/// abortRun - End the current run early, run() unwinds it.
+void WhiteBoxInterpreter::abortRun(RunAbort Reason) {
+  abortReason = Reason;
+  ExitValue = GenericValue();
+  exitRequested = true;
 }
 
 
@@ -101,7 +221,7 @@ void WhiteBoxInterpreter::run() {
 // ex: br label %14   (unconditional branch)
 // ex: br i1 %cond, label %IfEqual, label %IfUnequal (conditional branch)
 // TraceAction: neither type is to be traced
-// FaultAction: FIXME
+// FaultAction: a conditional branch is skipped and redirected with branchTo
 // visitBranchInst(BranchInst &I);
 
 // switch instruction
@@ -109,7 +229,7 @@ void WhiteBoxInterpreter::run() {
 //       i32 10, label %11
 //     ]
 // TraceAction: not act
-// FaultAction: TODO
+// FaultAction: as a conditional branch
 // visitSwitchInst(SwitchInst &I);
 
 // FIXME: to finish the implementation
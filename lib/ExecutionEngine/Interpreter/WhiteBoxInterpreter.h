@@ -1,14 +1,35 @@
 #ifndef LLVM_LIB_EXECUTIONENGINE_INTERPRETER_WHITEBOXINTERPRETER_H
 #define LLVM_LIB_EXECUTIONENGINE_INTERPRETER_WHITEBOXINTERPRETER_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ExecutionEngine/Action.h"
 #include "Interpreter.h"
+#include <chrono>
 
 namespace llvm {
 
 class WhiteBoxInterpreter : public Interpreter {
   using base_type = Interpreter;
   Action * action;
+  bool trapExit = false;       // exit() ends the run, not the host
+  bool exitRequested = false;  // exit() was called during the current run
+
+  // Limits of the runs.  The instruction count is compared to a single
+  // threshold, the next point where a limit must be checked: the budget, or
+  // the next poll of the clock.
+  RunLimits limits;
+  RunAbort abortReason = RunAbort::None;
+  uint64_t runInsts = 0;       // dynamic instructions of the current run
+  uint64_t nextCheck = ~0ULL;
+  std::chrono::steady_clock::time_point deadline;
+  uint64_t heapBytes = 0;      // live heap of the program, with a limit
+  DenseMap<void *, uint64_t> heapBlocks;
+
+  void armLimits();
+  void scheduleCheck();
+  bool checkLimits();
+  bool checkAlloca(AllocaInst &I, ExecutionContext &SF);
+  void abortRun(RunAbort Reason);
 
 public:
   explicit WhiteBoxInterpreter(std::unique_ptr<Module> M, Action *action);
@@ -27,6 +48,22 @@ public:
                            ArrayRef<GenericValue> ArgValues) override;
   void run() ;
 
+  void exitCalled(GenericValue GV) override;
+  bool reserveHeap(void *Old, uint64_t Size) override;
+  void heapChanged(void *Old, void *New, uint64_t Size) override;
+
+  void setTrapExit(bool Trap) override { trapExit = Trap; }
+  void seedRun(uint64_t Seed) override { seedGuestRandom(Seed); }
+  void setOutputCapture(std::string *Stdout, std::string *Stderr) override {
+    CapturedStdout = Stdout;
+    CapturedStderr = Stderr;
+  }
+  void setRunLimits(const RunLimits &Limits) override {
+    limits = Limits;
+    armLimits();
+  }
+  RunAbort getRunAbort() const override { return abortReason; }
+
 };
 
 } // End llvm namespace
@@ -0,0 +1,181 @@
+//===-- BitslicedDCA.cpp - Difference of means on packed bit traces -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "BitslicedDCA.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/ExecutionEngine/BitTraces.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <unordered_map>
+
+using namespace llvm;
+
+namespace wyverse {
+
+// Sample columns evaluated together against each selection column, so that
+// they stay in cache while the guesses of a target bit go by.
+static const unsigned ColumnBlock = 32;
+
+namespace {
+
+/// Selection - The packed selection bits of all the traces.
+struct Selection {
+  unsigned NumTargets;
+  unsigned NumGuesses;
+  SmallVector<unsigned, 8> Bits;
+  BitTraceMatrix Columns;            // column (t * G + k) * 8 + b
+  std::vector<uint64_t> Ones;
+
+  const uint64_t *getColumn(unsigned T, unsigned K, unsigned B) const {
+    return Columns.getColumn((T * NumGuesses + K) * 8 + B);
+  }
+  uint64_t getOnes(unsigned T, unsigned K, unsigned B) const {
+    return Ones[(T * NumGuesses + K) * 8 + B];
+  }
+};
+
+} // End anonymous namespace
+
+static void buildSelection(const TraceFileReader &Reader,
+                           const AnalyzerOptions &Opts,
+                           const AnalysisScope &Scope, Selection &Sel) {
+  const SelectionTable &Table = Scope.Table;
+  Sel.NumTargets = Scope.Targets.size();
+  Sel.NumGuesses = Table.getNumGuesses();
+  for (unsigned b = 0; b != Table.getNumBits(); ++b)
+    if (Opts.DPABit < 0 || unsigned(Opts.DPABit) == b)
+      Sel.Bits.push_back(b);
+
+  std::vector<uint8_t> Known = getKnownBytes(Reader, Opts, Scope);
+  std::vector<uint8_t> Outputs(Sel.NumTargets * Sel.NumGuesses);
+  Sel.Columns = BitTraceMatrix(Outputs.size(), Scope.NumTraces);
+  for (uint64_t n = 0; n != Scope.NumTraces; ++n) {
+    Table.evaluate(makeArrayRef(&Known[n * Sel.NumTargets], Sel.NumTargets),
+                   /*HammingWeight=*/false, Outputs.data());
+    Sel.Columns.addTrace(Outputs);
+  }
+
+  const uint64_t NumWords = Sel.Columns.getNumWords();
+  Sel.Ones.resize(Sel.Columns.getNumColumns());
+  for (uint64_t c = 0, e = Sel.Ones.size(); c != e; ++c)
+    Sel.Ones[c] = kernels::popcount(Sel.Columns.getColumn(c), NumWords);
+}
+
+/// analyzeColumns - Transpose the byte samples [Begin, End) and score their
+/// bit columns.
+static void analyzeColumns(const TraceFileReader &Reader,
+                           const Selection &Sel, uint64_t NumTraces,
+                           uint64_t Begin, uint64_t End, BestScores &Best,
+                           uint64_t &NumDistinct) {
+  BitTraceMatrix X(End - Begin, NumTraces);
+  for (uint64_t n = 0; n != NumTraces; ++n)
+    X.addTrace(Reader.getSamples(n).slice(Begin, End - Begin));
+  const uint64_t NumWords = X.getNumWords();
+
+  // The non-constant columns, without the duplicates of an earlier one.
+  std::vector<uint64_t> Active, Ones;
+  std::unordered_map<uint64_t, SmallVector<uint64_t, 1>> SeenByHash;
+  for (uint64_t c = 0, e = X.getNumColumns(); c != e; ++c) {
+    const uint64_t *Col = X.getColumn(c);
+    uint64_t Count = kernels::popcount(Col, NumWords);
+    if (Count == 0 || Count == NumTraces)
+      continue;
+    uint64_t Hash = hash_combine_range(Col, Col + NumWords);
+    SmallVector<uint64_t, 1> &Same = SeenByHash[Hash];
+    if (any_of(Same, [&](uint64_t Other) {
+          return std::equal(Col, Col + NumWords, X.getColumn(Other));
+        }))
+      continue;
+    Same.push_back(c);
+    Active.push_back(c);
+    Ones.push_back(Count);
+  }
+  NumDistinct = Active.size();
+
+  const double N = NumTraces;
+  for (size_t B = 0; B < Active.size(); B += ColumnBlock) {
+    size_t BE = std::min<size_t>(B + ColumnBlock, Active.size());
+    for (unsigned t = 0; t != Sel.NumTargets; ++t)
+      for (unsigned b : Sel.Bits)
+        for (unsigned k = 0; k != Sel.NumGuesses; ++k) {
+          uint64_t N1 = Sel.getOnes(t, k, b);
+          if (N1 == 0 || N1 == NumTraces)
+            continue;
+          double N0 = N - N1;
+          const uint64_t *S = Sel.getColumn(t, k, b);
+          for (size_t j = B; j != BE; ++j) {
+            uint64_t A = kernels::popcountAnd(X.getColumn(Active[j]), S,
+                                              NumWords);
+            double Score = std::fabs(double(A) / N1 - (Ones[j] - A) / N0);
+            Best.update(t * Sel.NumGuesses + k, Score,
+                        Begin + Active[j] / 8);
+          }
+        }
+  }
+}
+
+Expected<CPAEngine::Ranking>
+analyzeBitsliced(const TraceFileReader &Reader, const AnalyzerOptions &Opts) {
+  auto ScopeOrErr = resolveScope(Reader, Opts);
+  if (!ScopeOrErr)
+    return ScopeOrErr.takeError();
+  const AnalysisScope &Scope = *ScopeOrErr;
+  const uint64_t NumTraces = Scope.NumTraces;
+  const uint64_t Begin = Scope.SampleBegin, End = Scope.SampleEnd;
+
+  Selection Sel;
+  buildSelection(Reader, Opts, Scope, Sel);
+
+  // A byte sample takes 8 columns of NumWords words.
+  uint64_t BytesPerSample = 8 * Sel.Columns.getNumWords() * sizeof(uint64_t);
+  uint64_t TileSamples =
+    std::max<uint64_t>(Opts.MemoryBudget / BytesPerSample, ColumnBlock);
+  uint64_t NumTiles = (End - Begin + TileSamples - 1) / TileSamples;
+
+  BestScores Best(Scope.Targets.size() * Sel.NumGuesses);
+  for (uint64_t TB = Begin, Tile = 0; TB < End; TB += TileSamples, ++Tile) {
+    uint64_t TE = std::min(TB + TileSamples, End);
+    uint64_t PerThread = (TE - TB + Scope.NumThreads - 1) / Scope.NumThreads;
+    std::vector<BestScores> ThreadBest;
+    std::vector<uint64_t> ThreadDistinct;
+    std::vector<std::thread> Threads;
+    for (uint64_t B = TB; B < TE; B += PerThread)
+      ThreadBest.emplace_back(Best.Score.size());
+    ThreadDistinct.resize(ThreadBest.size());
+    for (unsigned i = 0; i != ThreadBest.size(); ++i) {
+      uint64_t B = TB + i * PerThread, E = std::min(B + PerThread, TE);
+      Threads.emplace_back([&, B, E, i] {
+        analyzeColumns(Reader, Sel, NumTraces, B, E, ThreadBest[i],
+                       ThreadDistinct[i]);
+      });
+    }
+    for (std::thread &T : Threads)
+      T.join();
+    for (const BestScores &TBest : ThreadBest)
+      Best.merge(TBest);
+
+    if (Opts.Progress) {
+      uint64_t Distinct = 0;
+      for (uint64_t D : ThreadDistinct)
+        Distinct += D;
+      *Opts.Progress << "tile " << Tile + 1 << "/" << NumTiles
+                     << ": samples " << TB << "-" << TE << ", " << Distinct
+                     << " distinct bit columns out of " << (TE - TB) * 8
+                     << "\n";
+    }
+    if (NumTiles > 1)
+      Reader.dontNeed(0, NumTraces);
+  }
+
+  return makeRanking(Scope, Best);
+}
+
+} // End wyverse namespace
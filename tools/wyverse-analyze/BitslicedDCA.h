@@ -0,0 +1,39 @@
+//===-- BitslicedDCA.h - Difference of means on packed bit traces -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The classical DCA of white-boxes: every bit of the traced bytes is a 1-bit
+// sample, every bit of the S-box output a 1-bit selection function.  With
+// both packed by columns (see BitTraceMatrix) the difference of means of a
+// sample column X under a selection column S only needs
+//
+//   n1 = popcount(S), ones = popcount(X), a = popcount(X & S)
+//   DoM = |a / n1 - (ones - a) / (n - n1)|
+//
+// The sample columns are transposed per thread from the mapped trace file, by
+// tiles that fit in the memory budget.  Constant columns and duplicates of an
+// earlier column cannot change the ranking and are skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_ANALYZE_BITSLICEDDCA_H
+#define LLVM_TOOLS_WYVERSE_ANALYZE_BITSLICEDDCA_H
+
+#include "CorrelationAnalyzer.h"
+
+namespace wyverse {
+
+/// analyzeBitsliced - Rank the key guesses with the DoM of the bit samples;
+/// -dpa-bit restricts the selection to one bit of the S-box output.
+llvm::Expected<llvm::CPAEngine::Ranking>
+analyzeBitsliced(const llvm::TraceFileReader &Reader,
+                 const AnalyzerOptions &Opts);
+
+} // End wyverse namespace
+
+#endif
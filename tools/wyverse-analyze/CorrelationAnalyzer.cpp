@@ -0,0 +1,366 @@
+//===-- CorrelationAnalyzer.cpp - Tiled CPA / DPA over a trace file -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CorrelationAnalyzer.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using namespace llvm;
+
+namespace wyverse {
+
+// A worker updates ChunkSamples samples (ChunkSamples x RowSize accumulators,
+// a few hundred KB) for BlockTraces traces before moving to the next chunk.
+static const uint64_t ChunkSamples = 16;
+static const uint64_t BlockTraces = 1024;
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+namespace {
+
+/// Model - Predictions of all the traces.
+struct Model {
+  Distinguisher Kind;
+  unsigned NumTargets;
+  unsigned NumComponents;
+  unsigned NumGuesses;
+  unsigned RowSize;                  // targets x components x guesses
+  unsigned MaxPrediction;
+  bool Uniform;                      // one table for all the targets
+  std::vector<uint8_t> Tables;       // [target][component][known][guess]
+  std::vector<uint8_t> Known;        // [trace][target]
+  std::vector<uint64_t> SumH, SumH2; // [target][component][guess]
+
+  const uint8_t *getRow(unsigned T, unsigned C, uint8_t V) const {
+    unsigned Table = Uniform ? 0 : T;
+    return &Tables[((Table * NumComponents + C) * 256 + V) * NumGuesses];
+  }
+};
+
+} // End anonymous namespace
+
+static void buildModel(const TraceFileReader &Reader,
+                       const AnalyzerOptions &Opts,
+                       const AnalysisScope &Scope, Model &M) {
+  const SelectionTable &Table = Scope.Table;
+  const unsigned G = Table.getNumGuesses();
+  M.Kind = Opts.Kind;
+  M.NumTargets = Scope.Targets.size();
+  M.NumGuesses = G;
+  SmallVector<unsigned, 8> Bits;
+  if (Opts.Kind == Distinguisher::DPA) {
+    for (unsigned b = 0; b != Table.getNumBits(); ++b)
+      if (Opts.DPABit < 0 || unsigned(Opts.DPABit) == b)
+        Bits.push_back(b);
+    M.NumComponents = Bits.size();
+    M.MaxPrediction = 1;
+  } else {
+    M.NumComponents = 1;
+    M.MaxPrediction = Table.getNumBits();
+  }
+  M.RowSize = M.NumTargets * M.NumComponents * G;
+
+  M.Uniform = Table.isUniform();
+  const unsigned NumTables = M.Uniform ? 1 : M.NumTargets;
+  M.Tables.resize(NumTables * M.NumComponents * 256 * G);
+  for (unsigned t = 0; t != NumTables; ++t)
+    for (unsigned c = 0; c != M.NumComponents; ++c)
+      for (unsigned v = 0; v != 256; ++v) {
+        const uint8_t *S = Table.getValues(t, v);
+        const uint8_t *W = Table.getWeights(t, v);
+        uint8_t *H = &M.Tables[((t * M.NumComponents + c) * 256 + v) * G];
+        for (unsigned k = 0; k != G; ++k)
+          H[k] = Opts.Kind == Distinguisher::DPA ? (S[k] >> Bits[c]) & 1
+                                                 : W[k];
+      }
+
+  // The sums of the predictions, from the histogram of the known bytes.
+  M.Known = getKnownBytes(Reader, Opts, Scope);
+  std::vector<uint64_t> Histogram(M.NumTargets * 256, 0);
+  for (uint64_t i = 0, e = M.Known.size(); i != e; ++i)
+    ++Histogram[(i % M.NumTargets) * 256 + M.Known[i]];
+
+  M.SumH.assign(M.RowSize, 0);
+  M.SumH2.assign(M.RowSize, 0);
+  for (unsigned t = 0; t != M.NumTargets; ++t)
+    for (unsigned c = 0; c != M.NumComponents; ++c)
+      for (unsigned v = 0; v != 256; ++v) {
+        uint64_t Count = Histogram[t * 256 + v];
+        if (!Count)
+          continue;
+        const uint8_t *H = M.getRow(t, c, v);
+        uint64_t *SumH = &M.SumH[(t * M.NumComponents + c) * G];
+        uint64_t *SumH2 = &M.SumH2[(t * M.NumComponents + c) * G];
+        for (unsigned k = 0; k != G; ++k) {
+          SumH[k] += Count * H[k];
+          SumH2[k] += Count * H[k] * H[k];
+        }
+      }
+}
+
+/// analyzeSamples - Accumulate the samples [Begin, End) over all the traces
+/// and score them.
+static void analyzeSamples(const TraceFileReader &Reader, const Model &M,
+                           uint64_t NumTraces, uint64_t Begin, uint64_t End,
+                           BestScores &Best) {
+  const unsigned Row = M.RowSize, G = M.NumGuesses;
+  const uint64_t Width = End - Begin;
+  const uint64_t WidenPeriod = UINT32_MAX / (255 * M.MaxPrediction);
+  const bool NeedWide = NumTraces > WidenPeriod;
+
+  std::vector<uint64_t> SumX(Width, 0), SumX2(Width, 0);
+  std::vector<uint32_t> SumXH(Width * Row, 0);
+  std::vector<uint64_t> WideXH(NeedWide ? SumXH.size() : 0, 0);
+  uint64_t SinceWiden = 0;
+
+  const uint64_t Offset = Reader.getSamplesOffset() + Begin;
+  for (uint64_t B = 0; B < NumTraces; B += BlockTraces) {
+    uint64_t BE = std::min(B + BlockTraces, NumTraces);
+    if (NeedWide && SinceWiden + (BE - B) > WidenPeriod) {
+      kernels::widenAndClear(WideXH.data(), SumXH.data(), SumXH.size());
+      SinceWiden = 0;
+    }
+    for (uint64_t C = 0; C < Width; C += ChunkSamples) {
+      uint64_t CE = std::min(C + ChunkSamples, Width);
+      for (uint64_t n = B; n != BE; ++n) {
+        const uint8_t *X = Reader.getRecord(n) + Offset;
+        const uint8_t *Known = &M.Known[n * M.NumTargets];
+        for (uint64_t s = C; s != CE; ++s) {
+          uint8_t V = X[s];
+          if (!V)
+            continue;
+          SumX[s] += V;
+          SumX2[s] += V * V;
+          uint32_t *Acc = &SumXH[s * Row];
+          for (unsigned t = 0; t != M.NumTargets; ++t)
+            for (unsigned c = 0; c != M.NumComponents; ++c, Acc += G)
+              kernels::accumulateProducts(Acc, M.getRow(t, c, Known[t]), V,
+                                          G);
+        }
+      }
+    }
+    SinceWiden += BE - B;
+  }
+
+  const double N = NumTraces;
+  std::vector<double> VarH(Row);
+  for (unsigned i = 0; i != Row; ++i)
+    VarH[i] = M.SumH2[i] - double(M.SumH[i]) * (M.SumH[i] / N);
+
+  for (uint64_t s = 0; s != Width; ++s) {
+    const uint32_t *Narrow = &SumXH[s * Row];
+    const uint64_t *Wide = NeedWide ? &WideXH[s * Row] : nullptr;
+    double MeanX = SumX[s] / N;
+    double VarX = SumX2[s] - SumX[s] * MeanX;
+    if (VarX <= 0)
+      continue;                       // constant sample
+
+    for (unsigned i = 0; i != Row; ++i) {
+      double XH = Narrow[i] + (Wide ? Wide[i] : 0);
+      double Score;
+      if (M.Kind == Distinguisher::CPA) {
+        if (VarH[i] <= 0)
+          continue;
+        Score = std::fabs(XH - MeanX * M.SumH[i]) / std::sqrt(VarX * VarH[i]);
+      } else {
+        // the predictions are bits: Sum h counts the traces of the 1 class
+        uint64_t N1 = M.SumH[i], N0 = NumTraces - N1;
+        if (!N1 || !N0)
+          continue;
+        Score = std::fabs(XH / N1 - (SumX[s] - XH) / N0);
+      }
+      // best over the components of the target
+      unsigned Target = i / (M.NumComponents * G), Guess = i % G;
+      Best.update(Target * G + Guess, Score, Begin + s);
+    }
+  }
+}
+
+Expected<AnalysisScope> resolveScope(const TraceFileReader &Reader,
+                                     const AnalyzerOptions &Opts) {
+  if (!Opts.Selection)
+    return makeError("no selection function");
+  const SelectionFunction &F = *Opts.Selection;
+  AnalysisScope Scope;
+  Scope.Targets.assign(Opts.TargetBytes.begin(), Opts.TargetBytes.end());
+  if (Scope.Targets.empty())
+    for (unsigned i = 0; i != F.getNumTargets(); ++i)
+      Scope.Targets.push_back(i);
+
+  const bool FromInput = F.getSource() == SelectionFunction::Input;
+  unsigned KnownSize =
+    FromInput ? Reader.getInputSize() : Reader.getOutputSize();
+  for (unsigned Target : Scope.Targets) {
+    if (Target >= F.getNumTargets())
+      return makeError("target " + Twine(Target) + " is out of the " +
+                       Twine(F.getNumTargets()) +
+                       " targets of the selection function");
+    if (F.getKnownSize(Target) > KnownSize)
+      return makeError("target " + Twine(Target) + " needs " +
+                       Twine(F.getKnownSize(Target)) + " bytes of the " +
+                       (FromInput ? "inputs" : "outputs") + ", they have " +
+                       Twine(KnownSize));
+  }
+  if (Opts.Kind != Distinguisher::CPA &&
+      Opts.DPABit >= int(F.getNumBits()))
+    return makeError("-dpa-bit must be between 0 and " +
+                     Twine(F.getNumBits() - 1));
+  Scope.Table = SelectionTable(F, Scope.Targets);
+
+  Scope.NumTraces = Reader.getNumTraces();
+  if (Opts.TraceCount)
+    Scope.NumTraces = std::min(Scope.NumTraces, Opts.TraceCount);
+  if (Scope.NumTraces < 2)
+    return makeError("at least two traces are needed");
+
+  Scope.SampleBegin = std::min(Opts.SampleBegin, Reader.getNumSamples());
+  Scope.SampleEnd = Reader.getNumSamples();
+  if (Opts.SampleCount)
+    Scope.SampleEnd = std::min(Scope.SampleEnd,
+                               Scope.SampleBegin + Opts.SampleCount);
+
+  Scope.NumThreads = Opts.NumThreads;
+  if (Scope.NumThreads == 0)
+    Scope.NumThreads = std::max(1u, std::thread::hardware_concurrency());
+  return Scope;
+}
+
+Expected<SampleWindow> parseSampleWindow(StringRef Spec) {
+  SampleWindow W;
+  StringRef Range = Spec;
+  W.ByInstruction = Range.consume_front("inst:");
+  StringRef First, Last;
+  std::tie(First, Last) = Range.split('-');
+  if (Last.empty())
+    Last = First;
+  uint64_t F, L;
+  if (First.getAsInteger(0, F) || Last.getAsInteger(0, L) || F > L)
+    return makeError("invalid window '" + Spec +
+                     "', expected FIRST-LAST or inst:FIRST-LAST");
+  W.Begin = F;
+  W.End = L + 1;
+  return W;
+}
+
+Expected<std::vector<uint64_t>>
+resolveWindow(const TraceFileReader &Reader, const AnalysisScope &Scope,
+              const SampleWindow &W) {
+  std::vector<uint64_t> Samples;
+  ArrayRef<uint32_t> Index = Reader.getSampleIndex();
+  for (uint64_t s = Scope.SampleBegin; s != Scope.SampleEnd; ++s) {
+    uint64_t Key = W.ByInstruction ? Index[s] : s;
+    if (Key >= W.Begin && Key < W.End)
+      Samples.push_back(s);
+  }
+  if (Samples.empty())
+    return makeError(Twine("no sample in the window ") +
+                     (W.ByInstruction ? "inst:" : "") + Twine(W.Begin) + "-" +
+                     Twine(W.End - 1));
+  return Samples;
+}
+
+std::vector<uint8_t> getKnownBytes(const TraceFileReader &Reader,
+                                   const AnalyzerOptions &Opts,
+                                   const AnalysisScope &Scope) {
+  const SelectionFunction &F = *Opts.Selection;
+  const bool FromInput = F.getSource() == SelectionFunction::Input;
+  const unsigned NumTargets = Scope.Targets.size();
+  std::vector<uint8_t> Known(Scope.NumTraces * NumTargets);
+  for (uint64_t n = 0; n != Scope.NumTraces; ++n) {
+    ArrayRef<uint8_t> Bytes =
+      FromInput ? Reader.getInput(n) : Reader.getOutput(n);
+    for (unsigned t = 0; t != NumTargets; ++t)
+      Known[n * NumTargets + t] = F.getKnown(Bytes, Scope.Targets[t]);
+  }
+  return Known;
+}
+
+CPAEngine::Ranking makeRanking(const AnalysisScope &Scope,
+                               const BestScores &Best) {
+  const unsigned G = Scope.Table.getNumGuesses();
+  CPAEngine::Ranking R;
+  R.NumTraces = Scope.NumTraces;
+  for (unsigned t = 0; t != Scope.Targets.size(); ++t) {
+    CPAEngine::ByteRanking BR;
+    BR.Byte = Scope.Targets[t];
+    for (unsigned k = 0; k != G; ++k)
+      BR.Guesses.push_back({uint8_t(k), Best.Score[t * G + k],
+                            Best.Sample[t * G + k],
+                            Best.PairSample[t * G + k]});
+    std::stable_sort(BR.Guesses.begin(), BR.Guesses.end(),
+                     [](const CPAEngine::Guess &A, const CPAEngine::Guess &B) {
+                       return A.Score > B.Score;
+                     });
+    R.Bytes.push_back(std::move(BR));
+  }
+  return R;
+}
+
+Expected<CPAEngine::Ranking>
+analyzeTraceFile(const TraceFileReader &Reader, const AnalyzerOptions &Opts) {
+  auto ScopeOrErr = resolveScope(Reader, Opts);
+  if (!ScopeOrErr)
+    return ScopeOrErr.takeError();
+  const AnalysisScope &Scope = *ScopeOrErr;
+  const uint64_t NumTraces = Scope.NumTraces;
+  const uint64_t Begin = Scope.SampleBegin, End = Scope.SampleEnd;
+  const unsigned NumThreads = Scope.NumThreads;
+
+  Model M;
+  buildModel(Reader, Opts, Scope, M);
+
+  // Tiles of samples whose accumulators fit in the memory budget.
+  bool NeedWide = NumTraces > UINT32_MAX / (255 * M.MaxPrediction);
+  uint64_t BytesPerSample =
+    M.RowSize * (sizeof(uint32_t) + (NeedWide ? sizeof(uint64_t) : 0)) +
+    2 * sizeof(uint64_t);
+  uint64_t TileSamples = alignTo(
+      std::max<uint64_t>(Opts.MemoryBudget / BytesPerSample, ChunkSamples),
+      ChunkSamples);
+  uint64_t NumTiles = (End - Begin + TileSamples - 1) / TileSamples;
+
+  BestScores Best(Scope.Targets.size() * M.NumGuesses);
+  for (uint64_t TB = Begin, Tile = 0; TB < End; TB += TileSamples, ++Tile) {
+    uint64_t TE = std::min(TB + TileSamples, End);
+    if (Opts.Progress)
+      *Opts.Progress << "tile " << Tile + 1 << "/" << NumTiles
+                     << ": samples " << TB << "-" << TE << "\n";
+
+    // Contiguous blocks of whole chunks, one per thread.
+    uint64_t PerThread =
+      alignTo((TE - TB + NumThreads - 1) / NumThreads, ChunkSamples);
+    std::vector<BestScores> ThreadBest;
+    std::vector<std::thread> Threads;
+    for (uint64_t B = TB; B < TE; B += PerThread)
+      ThreadBest.emplace_back(Best.Score.size());
+    for (unsigned i = 0; i != ThreadBest.size(); ++i) {
+      uint64_t B = TB + i * PerThread, E = std::min(B + PerThread, TE);
+      Threads.emplace_back([&, B, E, i] {
+        analyzeSamples(Reader, M, NumTraces, B, E, ThreadBest[i]);
+      });
+    }
+    for (std::thread &T : Threads)
+      T.join();
+    for (const BestScores &TBest : ThreadBest)
+      Best.merge(TBest);
+
+    // The columns of this tile will not be read again.
+    if (NumTiles > 1)
+      Reader.dontNeed(0, NumTraces);
+  }
+
+  return makeRanking(Scope, Best);
+}
+
+} // End wyverse namespace
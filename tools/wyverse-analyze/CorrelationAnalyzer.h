@@ -0,0 +1,138 @@
+//===-- CorrelationAnalyzer.h - Tiled CPA / DPA over a trace file -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Offline correlation (CPA) and difference-of-means (DPA) attacks on a stored
+// trace file.  The samples are processed by tiles whose accumulators fit in
+// the memory budget; for each tile, every thread owns a contiguous block of
+// samples and streams all the traces over it, by blocks of traces.  The file
+// is memory-mapped and only the columns of the current tile are touched, so
+// it is read once whatever its size.
+//
+// Accumulators of a sample: Sum x, Sum x^2 and, for every target, prediction
+// component and guess, Sum x * h.  A CPA prediction has a single component,
+// the Hamming weight of the selected value; a DPA prediction has one
+// component per attacked bit of the value.  The prediction of a trace only
+// depends on its known value, so the rows of h come from the selection table
+// instead of being computed per trace.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_ANALYZE_CORRELATIONANALYZER_H
+#define LLVM_TOOLS_WYVERSE_ANALYZE_CORRELATIONANALYZER_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/CPAEngine.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace wyverse {
+
+enum class Distinguisher {
+  CPA,                             // correlation with HW(selected value)
+  DPA,                             // difference of means, selected bits
+  DCA,                             // same on bit samples, bitsliced
+  CPA2,                            // CPA on centered products of sample pairs
+  DCA2,                            // DCA on XORs of bit sample pairs
+  LDA,                             // linear decoding of the bit samples
+};
+
+/// SampleWindow - Samples combined by a second-order attack or decoded by
+/// LDA: a range of samples or the samples of a range of static instructions,
+/// [Begin, End).
+struct SampleWindow {
+  bool ByInstruction = false;
+  uint64_t Begin = 0, End = 0;
+};
+
+struct AnalyzerOptions {
+  Distinguisher Kind = Distinguisher::CPA;
+  std::shared_ptr<const llvm::SelectionFunction> Selection;
+  llvm::SmallVector<unsigned, 16> TargetBytes;   // default: all the targets
+  int DPABit = -1;                 // bit of the selected value, -1: all
+  uint64_t SampleBegin = 0;
+  uint64_t SampleCount = 0;        // 0: up to the end of the traces
+  uint64_t TraceCount = 0;         // 0: all the traces
+  unsigned NumThreads = 0;         // 0: number of cores
+  uint64_t MemoryBudget = 4ULL << 30;
+  llvm::SmallVector<SampleWindow, 2> Windows;  // second-order attacks, LDA
+  llvm::raw_ostream *Progress = nullptr;
+};
+
+/// AnalysisScope - The part of the trace file an attack covers.
+struct AnalysisScope {
+  llvm::SmallVector<unsigned, 16> Targets;
+  llvm::SelectionTable Table;      // of the targets
+  uint64_t NumTraces;
+  uint64_t SampleBegin, SampleEnd;
+  unsigned NumThreads;
+};
+
+llvm::Expected<AnalysisScope> resolveScope(const llvm::TraceFileReader &Reader,
+                                           const AnalyzerOptions &Opts);
+
+/// parseSampleWindow - Parse "FIRST-LAST" (samples) or "inst:FIRST-LAST"
+/// (static instructions), both inclusive.
+llvm::Expected<SampleWindow> parseSampleWindow(llvm::StringRef Spec);
+
+/// resolveWindow - The samples of the scope that are in the window.
+llvm::Expected<std::vector<uint64_t>>
+resolveWindow(const llvm::TraceFileReader &Reader, const AnalysisScope &Scope,
+              const SampleWindow &W);
+
+/// getKnownBytes - The known value of each target, computed from the input or
+/// the output of the trace, [trace][target].
+std::vector<uint8_t> getKnownBytes(const llvm::TraceFileReader &Reader,
+                                   const AnalyzerOptions &Opts,
+                                   const AnalysisScope &Scope);
+
+/// BestScores - Highest score of each (target, guess) and where it is, a
+/// sample or a pair of samples.  Ties go to the first sample, so the result
+/// does not depend on the order of the updates.
+struct BestScores {
+  std::vector<double> Score;
+  std::vector<uint64_t> Sample, PairSample;
+
+  explicit BestScores(unsigned Size)
+    : Score(Size, 0.0), Sample(Size, 0),
+      PairSample(Size, llvm::CPAEngine::NoSample) {}
+
+  void update(unsigned I, double S, uint64_t At,
+              uint64_t PairAt = llvm::CPAEngine::NoSample) {
+    if (S > Score[I] ||
+        (S == Score[I] && std::make_pair(At, PairAt) <
+                          std::make_pair(Sample[I], PairSample[I]))) {
+      Score[I] = S;
+      Sample[I] = At;
+      PairSample[I] = PairAt;
+    }
+  }
+  void merge(const BestScores &Other) {
+    for (unsigned i = 0, e = Score.size(); i != e; ++i)
+      update(i, Other.Score[i], Other.Sample[i], Other.PairSample[i]);
+  }
+};
+
+llvm::CPAEngine::Ranking makeRanking(const AnalysisScope &Scope,
+                                     const BestScores &Best);
+
+/// analyzeTraceFile - Rank the key guesses of each target.  The score
+/// of a guess is its highest |correlation| (CPA) or |difference of means|
+/// (DPA) over the samples and the predicted bits.
+llvm::Expected<llvm::CPAEngine::Ranking>
+analyzeTraceFile(const llvm::TraceFileReader &Reader,
+                 const AnalyzerOptions &Opts);
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,244 @@
+//===-- IntermediateLocator.cpp - Known-key intermediate search -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "IntermediateLocator.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ExecutionEngine/CipherTables.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <tuple>
+
+using namespace llvm;
+
+namespace wyverse {
+
+static const unsigned NumRounds = 10;
+static const unsigned NumStateBytes = (NumRounds + 1) * 16;
+// Enough traces for a wrong column to have no chance to match, few enough
+// for the columns of a block to stay in cache.
+static const uint64_t DefaultTraces = 256;
+// Columns transposed at once by a thread.
+static const uint64_t ColumnBlock = 4096;
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+//===----------------------------------------------------------------------===//
+// AES-128 states
+//===----------------------------------------------------------------------===//
+
+static uint8_t xtime(uint8_t X) { return (X << 1) ^ ((X >> 7) * 0x1b); }
+
+static void expandKey(ArrayRef<uint8_t> Key, uint8_t RoundKeys[][16]) {
+  std::memcpy(RoundKeys[0], Key.data(), 16);
+  uint8_t Rcon = 1;
+  for (unsigned r = 1; r <= NumRounds; ++r) {
+    const uint8_t *P = RoundKeys[r - 1];
+    uint8_t *K = RoundKeys[r];
+    uint8_t T[4] = {uint8_t(aes::SBox[P[13]] ^ Rcon), aes::SBox[P[14]],
+                    aes::SBox[P[15]], aes::SBox[P[12]]};
+    for (unsigned i = 0; i != 16; ++i)
+      K[i] = P[i] ^ (i < 4 ? T[i] : K[i - 4]);
+    Rcon = xtime(Rcon);
+  }
+}
+
+/// encryptStates - The state after each round of the encryption of \p In.
+static void encryptStates(const uint8_t *In, const uint8_t RoundKeys[][16],
+                          uint8_t States[][16]) {
+  uint8_t S[16];
+  for (unsigned i = 0; i != 16; ++i)
+    S[i] = In[i] ^ RoundKeys[0][i];
+  std::memcpy(States[0], S, 16);
+
+  for (unsigned r = 1; r <= NumRounds; ++r) {
+    // SubBytes and ShiftRows: row i % 4 rotates left by i % 4 columns.
+    uint8_t T[16];
+    for (unsigned i = 0; i != 16; ++i)
+      T[i] = aes::SBox[S[(i + 4 * (i % 4)) % 16]];
+    if (r != NumRounds)
+      for (unsigned c = 0; c != 4; ++c) {
+        uint8_t *A = &T[4 * c];
+        uint8_t A0 = A[0], A1 = A[1], A2 = A[2], A3 = A[3];
+        uint8_t X = A0 ^ A1 ^ A2 ^ A3;
+        A[0] ^= X ^ xtime(A0 ^ A1);
+        A[1] ^= X ^ xtime(A1 ^ A2);
+        A[2] ^= X ^ xtime(A2 ^ A3);
+        A[3] ^= X ^ xtime(A3 ^ A0);
+      }
+    for (unsigned i = 0; i != 16; ++i)
+      S[i] = T[i] ^ RoundKeys[r][i];
+    std::memcpy(States[r], S, 16);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Canonical forms
+//===----------------------------------------------------------------------===//
+
+/// canonicalize - Relabel the N values of \p X in order of first appearance
+/// into \p Form, and return the hash of the form.  \p Distinct receives the
+/// number of distinct values.
+static uint64_t canonicalize(const uint8_t *X, uint64_t N, uint8_t *Form,
+                             unsigned &Distinct) {
+  int16_t Label[256];
+  std::fill(std::begin(Label), std::end(Label), -1);
+  unsigned Next = 0;
+  uint64_t Hash = 0xcbf29ce484222325ULL;          // FNV-1a
+  for (uint64_t n = 0; n != N; ++n) {
+    int16_t &L = Label[X[n]];
+    if (L < 0)
+      L = Next++;
+    Form[n] = L;
+    Hash = (Hash ^ uint8_t(L)) * 0x100000001b3ULL;
+  }
+  Distinct = Next;
+  // The two highest keys are reserved by DenseMap.
+  return Hash >> 1;
+}
+
+Expected<std::vector<IntermediateMatch>>
+locateIntermediates(const TraceFileReader &Reader,
+                    const AnalyzerOptions &Opts, ArrayRef<uint8_t> Key) {
+  if (Key.size() != 16)
+    return makeError("the key must have 16 bytes (AES-128)");
+  // The whole state is known from 16 input (output) bytes.
+  AnalyzerOptions StateOpts = Opts;
+  StateOpts.TargetBytes.clear();
+  auto ScopeOrErr = resolveScope(Reader, StateOpts);
+  if (!ScopeOrErr)
+    return ScopeOrErr.takeError();
+  AnalysisScope Scope = *ScopeOrErr;
+  if (!Opts.TraceCount)
+    Scope.NumTraces = std::min(Scope.NumTraces, DefaultTraces);
+  const uint64_t N = Scope.NumTraces;
+
+  // The expected sequences, [state byte][trace], and their canonical forms.
+  uint8_t RoundKeys[NumRounds + 1][16];
+  expandKey(Key, RoundKeys);
+  const bool FromInput =
+    Opts.Selection->getSource() == SelectionFunction::Input;
+  if ((FromInput ? Reader.getInputSize() : Reader.getOutputSize()) < 16)
+    return makeError(Twine("the ") + (FromInput ? "inputs" : "outputs") +
+                     " are not AES blocks");
+  std::vector<uint8_t> Values(NumStateBytes * N);
+  for (uint64_t n = 0; n != N; ++n) {
+    ArrayRef<uint8_t> In = FromInput ? Reader.getInput(n)
+                                     : Reader.getOutput(n);
+    uint8_t States[NumRounds + 1][16];
+    encryptStates(In.data(), RoundKeys, States);
+    for (unsigned j = 0; j != NumStateBytes; ++j)
+      Values[j * N + n] = States[j / 16][j % 16];
+  }
+
+  std::vector<uint8_t> Forms(Values.size());
+  DenseMap<uint64_t, SmallVector<unsigned, 1>> Index;
+  for (unsigned j = 0; j != NumStateBytes; ++j) {
+    unsigned Distinct;
+    uint64_t Hash = canonicalize(&Values[j * N], N, &Forms[j * N], Distinct);
+    if (Distinct > 1)                // a constant would match any constant
+      Index[Hash].push_back(j);
+  }
+  if (Index.empty())
+    return makeError("the state is constant over the " + Twine(N) +
+                     " traces, the inputs do not vary");
+
+  // The threads take blocks of columns, transpose them, and look every
+  // column up.
+  const uint64_t Begin = Scope.SampleBegin, End = Scope.SampleEnd;
+  const uint64_t NumBlocks = (End - Begin + ColumnBlock - 1) / ColumnBlock;
+  const unsigned NumThreads =
+    std::max<uint64_t>(1, std::min<uint64_t>(Scope.NumThreads, NumBlocks));
+  std::atomic<uint64_t> NextBlock(0);
+  std::vector<std::vector<IntermediateMatch>> ThreadMatches(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned i = 0; i != NumThreads; ++i)
+    Threads.emplace_back([&, i] {
+      std::vector<uint8_t> Tile(ColumnBlock * N), Form(N);
+      for (uint64_t B; (B = NextBlock++) < NumBlocks;) {
+        uint64_t CB = Begin + B * ColumnBlock;
+        uint64_t Width = std::min(ColumnBlock, End - CB);
+        for (uint64_t n = 0; n != N; ++n) {
+          const uint8_t *X = Reader.getSamples(n).data() + CB;
+          for (uint64_t c = 0; c != Width; ++c)
+            Tile[c * N + n] = X[c];
+        }
+        for (uint64_t c = 0; c != Width; ++c) {
+          unsigned Distinct;
+          uint64_t Hash = canonicalize(&Tile[c * N], N, Form.data(),
+                                       Distinct);
+          auto It = Index.find(Hash);
+          if (It == Index.end())
+            continue;
+          for (unsigned j : It->second)
+            if (!std::memcmp(Form.data(), &Forms[j * N], N))
+              ThreadMatches[i].push_back({j / 16, j % 16, CB + c});
+        }
+      }
+    });
+  for (std::thread &T : Threads)
+    T.join();
+
+  std::vector<IntermediateMatch> Matches;
+  for (const auto &TMatches : ThreadMatches)
+    Matches.insert(Matches.end(), TMatches.begin(), TMatches.end());
+  std::sort(Matches.begin(), Matches.end(),
+            [](const IntermediateMatch &A, const IntermediateMatch &B) {
+              return std::make_tuple(A.Round, A.Byte, A.Sample) <
+                     std::make_tuple(B.Round, B.Byte, B.Sample);
+            });
+  if (Opts.Progress)
+    *Opts.Progress << End - Begin << " columns checked over " << N
+                   << " traces\n";
+  return Matches;
+}
+
+void printMatches(raw_ostream &OS, const TraceFileReader &Reader,
+                  ArrayRef<IntermediateMatch> Matches) {
+  ArrayRef<uint32_t> SampleIndex = Reader.getSampleIndex();
+  unsigned Found = 0;
+  for (size_t i = 0, e = Matches.size(); i != e;) {
+    const IntermediateMatch &M = Matches[i];
+    ++Found;
+    // The samples of the state byte, grouped by static instruction.
+    SmallVector<std::pair<uint32_t, uint64_t>, 8> Samples;
+    size_t Next = i;
+    for (; Next != e && Matches[Next].Round == M.Round &&
+           Matches[Next].Byte == M.Byte; ++Next) {
+      uint64_t S = Matches[Next].Sample;
+      Samples.push_back({S < SampleIndex.size() ? SampleIndex[S] : ~0U, S});
+    }
+    std::stable_sort(Samples.begin(), Samples.end(),
+                     [](const std::pair<uint32_t, uint64_t> &A,
+                        const std::pair<uint32_t, uint64_t> &B) {
+                       return A.first < B.first;
+                     });
+    for (size_t j = 0, je = Samples.size(); j != je;) {
+      size_t Same = j;
+      while (Same != je && Samples[Same].first == Samples[j].first)
+        ++Same;
+      OS << "round " << M.Round << " byte " << M.Byte << ": ";
+      if (Samples[j].first == ~0U)
+        OS << "unindexed";
+      else
+        OS << "inst " << Samples[j].first;
+      OS << ", " << Same - j << " sample" << (Same - j > 1 ? "s" : "")
+         << " from @" << Samples[j].second << "\n";
+      j = Same;
+    }
+    i = Next;
+  }
+  OS << Matches.size() << " samples in bijection with " << Found << " of the "
+     << NumStateBytes << " state bytes\n";
+}
+
+} // End wyverse namespace
@@ -0,0 +1,57 @@
+//===-- IntermediateLocator.h - Known-key intermediate search ---*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// With the key known, every byte of the AES-128 state is known in every
+// trace.  A white-box stores the state under byte encodings, so a sample
+// column computes a state byte when its sequence over the traces is equal to
+// the expected one up to a fixed bijection of the byte values.
+//
+// Two sequences are in bijection iff they have the same canonical form: the
+// values relabeled 0, 1, 2, ... in order of first appearance.  The canonical
+// forms of the expected state bytes are hashed into an index, then every
+// column is relabeled, hashed and looked up once, which is linear in the
+// number of columns.  A hit is confirmed by comparing the canonical forms.
+//
+// A bijection hides AddRoundKey, SubBytes and the xtime multiplications, so
+// a state byte stands for the input of the SubBytes of the next round, its
+// output and the output of the MixColumns that precedes it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_ANALYZE_INTERMEDIATELOCATOR_H
+#define LLVM_TOOLS_WYVERSE_ANALYZE_INTERMEDIATELOCATOR_H
+
+#include "CorrelationAnalyzer.h"
+
+namespace wyverse {
+
+/// IntermediateMatch - A sample in bijection with the byte Byte of the AES
+/// state after round Round (0: after the initial AddRoundKey).
+struct IntermediateMatch {
+  unsigned Round, Byte;
+  uint64_t Sample;
+};
+
+/// locateIntermediates - The samples of the scope in bijection with a byte
+/// of the AES-128 state under \p Key, by round, byte and sample.  The states
+/// are those of the encryption of the inputs, or of the outputs when the
+/// selection function predicts from the outputs, as -target=last-sbox does
+/// (the program decrypts).  Without -traces, 256 traces are used.
+llvm::Expected<std::vector<IntermediateMatch>>
+locateIntermediates(const llvm::TraceFileReader &Reader,
+                    const AnalyzerOptions &Opts,
+                    llvm::ArrayRef<uint8_t> Key);
+
+/// printMatches - One line per state byte and static instruction.
+void printMatches(llvm::raw_ostream &OS, const llvm::TraceFileReader &Reader,
+                  llvm::ArrayRef<IntermediateMatch> Matches);
+
+} // End wyverse namespace
+
+#endif
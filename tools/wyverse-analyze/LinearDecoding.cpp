@@ -0,0 +1,226 @@
+//===-- LinearDecoding.cpp - Linear decoding analysis over GF(2) ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "LinearDecoding.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <thread>
+
+using namespace llvm;
+
+namespace wyverse {
+
+// Kernel vectors wanted beyond the number of columns: a wrong guess passes
+// each of them with probability 1/2.
+static const uint64_t KernelMargin = 64;
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+namespace {
+
+/// GF2System - [M | I] bit-packed by rows, reduced in place.  Column 0 of M
+/// is the constant 1, column 1 + c the bit c % 8 of the window sample c / 8;
+/// the identity part starts at a word boundary so that its rows can be
+/// matched against packed prediction vectors.
+class GF2System {
+  uint64_t NumRows, NumColumns;      // columns of M
+  uint64_t IdentityWord, RowWords;
+  std::vector<uint64_t> Bits;
+  std::vector<uint64_t> PivotColumn; // of the first Rank rows
+  uint64_t Rank = 0;
+
+public:
+  GF2System(uint64_t NumRows, uint64_t NumColumns)
+    : NumRows(NumRows), NumColumns(NumColumns),
+      IdentityWord(alignTo(NumColumns, 64) / 64),
+      RowWords(IdentityWord + alignTo(NumRows, 64) / 64),
+      Bits(NumRows * RowWords, 0) {
+    for (uint64_t r = 0; r != NumRows; ++r)
+      set(r, IdentityWord * 64 + r);
+  }
+
+  static uint64_t getSize(uint64_t NumRows, uint64_t NumColumns) {
+    return NumRows * (alignTo(NumColumns, 64) + alignTo(NumRows, 64)) / 8;
+  }
+
+  uint64_t *getRow(uint64_t R) { return &Bits[R * RowWords]; }
+  const uint64_t *getRow(uint64_t R) const { return &Bits[R * RowWords]; }
+  void set(uint64_t R, uint64_t C) {
+    getRow(R)[C / 64] |= uint64_t(1) << (C % 64);
+  }
+  bool test(uint64_t R, uint64_t C) const {
+    return (getRow(R)[C / 64] >> (C % 64)) & 1;
+  }
+
+  /// reduce - Gauss-Jordan elimination of the M part.
+  void reduce(raw_ostream *Progress);
+
+  uint64_t getRank() const { return Rank; }
+  uint64_t getPivotColumn(uint64_t R) const { return PivotColumn[R]; }
+  uint64_t getNumKernelRows() const { return NumRows - Rank; }
+  uint64_t getIdentityWords() const { return RowWords - IdentityWord; }
+  /// getTransform - Combination of the traces that gives the reduced row R.
+  const uint64_t *getTransform(uint64_t R) const {
+    return getRow(R) + IdentityWord;
+  }
+};
+
+} // End anonymous namespace
+
+void GF2System::reduce(raw_ostream *Progress) {
+  for (uint64_t c = 0; c != NumColumns && Rank != NumRows; ++c) {
+    uint64_t Pivot = Rank;
+    while (Pivot != NumRows && !test(Pivot, c))
+      ++Pivot;
+    if (Pivot == NumRows)
+      continue;
+    if (Pivot != Rank)
+      std::swap_ranges(getRow(Pivot), getRow(Pivot) + RowWords, getRow(Rank));
+
+    // The pivot row is 0 before column c, the XORs start at its word.
+    const uint64_t First = c / 64;
+    const uint64_t *Src = getRow(Rank) + First;
+    for (uint64_t r = 0; r != NumRows; ++r)
+      if (r != Rank && test(r, c))
+        kernels::xorInto(getRow(r) + First, Src, RowWords - First);
+    PivotColumn.push_back(c);
+    ++Rank;
+
+    if (Progress && (c + 1) * 10 / NumColumns != c * 10 / NumColumns)
+      *Progress << "elimination: " << c + 1 << "/" << NumColumns
+                << " columns, rank " << Rank << "\n";
+  }
+}
+
+Expected<CPAEngine::Ranking>
+analyzeLinearDecoding(const TraceFileReader &Reader,
+                      const AnalyzerOptions &Opts) {
+  auto ScopeOrErr = resolveScope(Reader, Opts);
+  if (!ScopeOrErr)
+    return ScopeOrErr.takeError();
+  AnalysisScope Scope = *ScopeOrErr;
+  if (Opts.Windows.size() > 1)
+    return makeError("LDA takes a single window");
+
+  std::vector<uint64_t> Samples;
+  if (Opts.Windows.empty()) {
+    for (uint64_t s = Scope.SampleBegin; s != Scope.SampleEnd; ++s)
+      Samples.push_back(s);
+  } else {
+    auto SamplesOrErr = resolveWindow(Reader, Scope, Opts.Windows[0]);
+    if (!SamplesOrErr)
+      return SamplesOrErr.takeError();
+    Samples = std::move(*SamplesOrErr);
+  }
+  const uint64_t NumColumns = 1 + 8 * Samples.size();
+  if (!Opts.TraceCount)
+    Scope.NumTraces =
+      std::min(Scope.NumTraces, NumColumns + KernelMargin);
+  const uint64_t NumTraces = Scope.NumTraces;
+
+  const SelectionTable &Table = Scope.Table;
+  const unsigned G = Table.getNumGuesses();
+  SmallVector<unsigned, 8> Bits;
+  for (unsigned b = 0; b != Table.getNumBits(); ++b)
+    if (Opts.DPABit < 0 || unsigned(Opts.DPABit) == b)
+      Bits.push_back(b);
+  const unsigned NumTargets = Scope.Targets.size();
+
+  // The system, and a packed prediction vector per (target, guess, bit).
+  const uint64_t Words = alignTo(NumTraces, 64) / 64; // identity words
+  uint64_t Size = GF2System::getSize(NumTraces, NumColumns) +
+                  uint64_t(NumTargets) * G * Bits.size() * Words * 8;
+  if (Size > Opts.MemoryBudget)
+    return makeError("the system and the predictions take " +
+                     Twine(Size >> 20) + " MB, more than the memory "
+                     "budget; use a smaller window, fewer traces or fewer "
+                     "target bytes");
+
+  GF2System System(NumTraces, NumColumns);
+  for (uint64_t n = 0; n != NumTraces; ++n) {
+    ArrayRef<uint8_t> S = Reader.getSamples(n);
+    System.set(n, 0);
+    for (uint64_t i = 0, e = Samples.size(); i != e; ++i)
+      for (unsigned b = 0; b != 8; ++b)
+        if ((S[Samples[i]] >> b) & 1)
+          System.set(n, 1 + i * 8 + b);
+  }
+  System.reduce(Opts.Progress);
+
+  const uint64_t NumChecks = System.getNumKernelRows();
+  if (Opts.Progress)
+    *Opts.Progress << NumTraces << " traces, " << NumColumns
+                   << " columns, rank " << System.getRank() << ", "
+                   << NumChecks << " kernel vectors\n";
+  if (NumChecks == 0)
+    return makeError("the " + Twine(NumTraces) + " traces are linearly "
+                     "independent, every guess is consistent; use more "
+                     "traces");
+
+  // The predicted bits of each (target, guess, bit), packed like the
+  // identity part of the rows.
+  std::vector<uint8_t> Known = getKnownBytes(Reader, Opts, Scope);
+  std::vector<uint64_t> Predictions(NumTargets * G * Bits.size() * Words, 0);
+  for (uint64_t n = 0; n != NumTraces; ++n)
+    for (unsigned t = 0; t != NumTargets; ++t) {
+      const uint8_t *S = Table.getValues(t, Known[n * NumTargets + t]);
+      for (unsigned k = 0; k != G; ++k)
+        for (unsigned i = 0, e = Bits.size(); i != e; ++i)
+          if ((S[k] >> Bits[i]) & 1)
+            Predictions[((t * G + k) * e + i) * Words + n / 64] |=
+              uint64_t(1) << (n % 64);
+    }
+
+  // The checks of the guesses are independent, the threads take
+  // contiguous ranges of them.
+  const uint64_t NumGuesses = NumTargets * G;
+  const unsigned NumThreads =
+    std::min<uint64_t>(Scope.NumThreads, NumGuesses);
+  std::vector<BestScores> ThreadBest(NumThreads, BestScores(NumGuesses));
+  std::vector<std::thread> Threads;
+  for (unsigned i = 0; i != NumThreads; ++i)
+    Threads.emplace_back([&, i] {
+      uint64_t Begin = NumGuesses * i / NumThreads;
+      uint64_t End = NumGuesses * (i + 1) / NumThreads;
+      for (uint64_t g = Begin; g != End; ++g)
+        for (unsigned j = 0, e = Bits.size(); j != e; ++j) {
+          const uint64_t *S = &Predictions[(g * e + j) * Words];
+          uint64_t Satisfied = 0;
+          for (uint64_t r = System.getRank(); r != NumTraces; ++r)
+            Satisfied += !(kernels::popcountAnd(System.getTransform(r), S,
+                                                Words) & 1);
+          double Score = double(Satisfied) / NumChecks;
+
+          // For a solution, the first sample of the combination.
+          uint64_t At = Samples.front();
+          if (Satisfied == NumChecks)
+            for (uint64_t r = 0; r != System.getRank(); ++r) {
+              uint64_t C = System.getPivotColumn(r);
+              if (C != 0 && (kernels::popcountAnd(System.getTransform(r), S,
+                                                  Words) & 1)) {
+                At = Samples[(C - 1) / 8];
+                break;
+              }
+            }
+          ThreadBest[i].update(g, Score, At);
+        }
+    });
+  for (std::thread &T : Threads)
+    T.join();
+
+  BestScores Best(NumGuesses);
+  for (const BestScores &TBest : ThreadBest)
+    Best.merge(TBest);
+  return makeRanking(Scope, Best);
+}
+
+} // End wyverse namespace
@@ -0,0 +1,43 @@
+//===-- LinearDecoding.h - Linear decoding analysis over GF(2) --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Linear decoding analysis (LDA) defeats the linear internal encodings of
+// white-boxes: it looks for a linear combination of the bit samples, plus a
+// constant, that is equal to a predicted bit in every trace.  With M the
+// traces x (1 | bit samples) matrix over GF(2) and s the predicted bits of a
+// guess, the guess is consistent iff M x = s has a solution, that is iff
+// y . s = 0 for every y of the left kernel of M.
+//
+// The elimination does not depend on the guess: [M | I] is reduced once,
+// bit-packed by rows, and the rows whose M part vanishes give the left
+// kernel.  Every (guess, predicted bit) is then checked with a few parities
+// of packed vectors.  A guess scores the fraction of kernel vectors it
+// satisfies, so the right guess scores 1 and the wrong ones about 1/2.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_ANALYZE_LINEARDECODING_H
+#define LLVM_TOOLS_WYVERSE_ANALYZE_LINEARDECODING_H
+
+#include "CorrelationAnalyzer.h"
+
+namespace wyverse {
+
+/// analyzeLinearDecoding - Rank the key guesses with LDA on the bit samples
+/// of a window (default: the samples of the scope).  Without -traces, as
+/// many traces are used as there are bit columns plus a margin of kernel
+/// vectors.  -dpa-bit restricts the prediction to one bit of the S-box
+/// output.
+llvm::Expected<llvm::CPAEngine::Ranking>
+analyzeLinearDecoding(const llvm::TraceFileReader &Reader,
+                      const AnalyzerOptions &Opts);
+
+} // End wyverse namespace
+
+#endif
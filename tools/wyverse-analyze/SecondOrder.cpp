@@ -0,0 +1,407 @@
+//===-- SecondOrder.cpp - Second-order attacks on sample pairs ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SecondOrder.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/Support/Mutex.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+using namespace llvm;
+
+namespace wyverse {
+
+// Columns of each side of a pair tile: the 256 Gram matrices of a tile take
+// 256 x 64 x 64 doubles (8 MB).
+static const unsigned PairBlock = 64;
+// Pairs whose 256 group sums are combined with the predictions together.
+static const unsigned PairChunk = 256;
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+namespace {
+
+/// WindowData - The samples of a window for all the traces, [trace][column].
+/// A column is a centered byte sample (CPA2) or a bit of a byte sample (DCA2).
+struct WindowData {
+  std::vector<uint64_t> Samples;     // byte samples of the window
+  unsigned ColumnsPerSample;
+  unsigned NumColumns;
+  std::vector<float> X;
+  std::vector<double> X2;            // X2 = X^2, for the variance (CPA2)
+
+  const float *getRow(uint64_t N) const { return &X[N * NumColumns]; }
+  const double *getSquares(uint64_t N) const { return &X2[N * NumColumns]; }
+  uint64_t getSample(unsigned C) const {
+    return Samples[C / ColumnsPerSample];
+  }
+  /// getColumnId - Identifies the column across windows.
+  uint64_t getColumnId(unsigned C) const {
+    return getSample(C) * ColumnsPerSample + C % ColumnsPerSample;
+  }
+};
+
+/// Model2 - What the second-order attack of all the targets shares.
+struct Model2 {
+  Distinguisher Kind;
+  uint64_t NumTraces;
+  unsigned NumTargets;
+  const SelectionTable *Table;
+  std::vector<uint8_t> Known;        // [trace][target]
+  SmallVector<unsigned, 8> Bits;     // selected bits (DCA2)
+  WindowData A, B;
+  bool SameWindow;
+};
+
+/// TargetGroups - The traces grouped by the known byte of a target.
+struct TargetGroups {
+  unsigned Target;
+  std::vector<uint32_t> Order;
+  uint64_t GroupBegin[257];
+  std::vector<double> SumA, SumB;    // [v][column] (DCA2), exact counts
+  // A prediction row per (guess, component): h(v), Sum_n h, Sum_n h^2.
+  std::vector<float> Rows;
+  std::vector<double> RowSum, RowSum2;
+  std::vector<uint8_t> RowGuess;
+};
+
+/// TileBuffers - Per thread accumulators of a pair tile.  The sums run over
+/// all the traces, they are kept in double.
+struct TileBuffers {
+  std::vector<double> Gram;          // [v][a][b]
+  std::vector<double> Total, Squares;
+  std::vector<float> Norm;
+  std::vector<double> Num;           // [prediction row][pair of the chunk]
+
+  TileBuffers(unsigned NumRows)
+    : Gram(256 * PairBlock * PairBlock), Total(PairBlock * PairBlock),
+      Squares(PairBlock * PairBlock), Norm(PairBlock * PairBlock),
+      Num(NumRows * PairChunk) {}
+};
+
+struct PairTile {
+  unsigned A0, B0;
+};
+
+} // End anonymous namespace
+
+static void loadWindow(const TraceFileReader &Reader, Distinguisher Kind,
+                       uint64_t NumTraces, WindowData &W) {
+  const bool Bits = Kind == Distinguisher::DCA2;
+  const unsigned NumSamples = W.Samples.size();
+  W.ColumnsPerSample = Bits ? 8 : 1;
+  W.NumColumns = NumSamples * W.ColumnsPerSample;
+  W.X.resize(NumTraces * W.NumColumns);
+
+  if (Bits) {
+    for (uint64_t n = 0; n != NumTraces; ++n) {
+      ArrayRef<uint8_t> S = Reader.getSamples(n);
+      float *Row = &W.X[n * W.NumColumns];
+      for (unsigned i = 0; i != NumSamples; ++i)
+        for (unsigned b = 0; b != 8; ++b)
+          Row[i * 8 + b] = (S[W.Samples[i]] >> b) & 1;
+    }
+    return;
+  }
+
+  std::vector<uint64_t> Sum(NumSamples, 0);
+  for (uint64_t n = 0; n != NumTraces; ++n) {
+    ArrayRef<uint8_t> S = Reader.getSamples(n);
+    for (unsigned i = 0; i != NumSamples; ++i)
+      Sum[i] += S[W.Samples[i]];
+  }
+  std::vector<float> Mean(NumSamples);
+  for (unsigned i = 0; i != NumSamples; ++i)
+    Mean[i] = double(Sum[i]) / NumTraces;
+
+  W.X2.resize(W.X.size());
+  for (uint64_t n = 0; n != NumTraces; ++n) {
+    ArrayRef<uint8_t> S = Reader.getSamples(n);
+    float *Row = &W.X[n * NumSamples];
+    double *Row2 = &W.X2[n * NumSamples];
+    for (unsigned i = 0; i != NumSamples; ++i) {
+      Row[i] = S[W.Samples[i]] - Mean[i];
+      Row2[i] = double(Row[i]) * Row[i];
+    }
+  }
+}
+
+static void groupTraces(const Model2 &M, unsigned T, TargetGroups &G) {
+  G.Target = T;
+  uint64_t Count[256] = {};
+  for (uint64_t n = 0; n != M.NumTraces; ++n)
+    ++Count[M.Known[n * M.NumTargets + T]];
+  G.GroupBegin[0] = 0;
+  for (unsigned v = 0; v != 256; ++v)
+    G.GroupBegin[v + 1] = G.GroupBegin[v] + Count[v];
+  uint64_t Next[256];
+  std::copy(G.GroupBegin, G.GroupBegin + 256, Next);
+  G.Order.resize(M.NumTraces);
+  for (uint64_t n = 0; n != M.NumTraces; ++n)
+    G.Order[Next[M.Known[n * M.NumTargets + T]]++] = n;
+
+  if (M.Kind == Distinguisher::DCA2) {
+    auto SumColumns = [&](const WindowData &W, std::vector<double> &Sum) {
+      Sum.assign(256 * W.NumColumns, 0);
+      for (unsigned v = 0; v != 256; ++v)
+        for (uint64_t i = G.GroupBegin[v]; i != G.GroupBegin[v + 1]; ++i)
+          kernels::axpy(&Sum[v * W.NumColumns], W.getRow(G.Order[i]), 1.0,
+                        W.NumColumns);
+    };
+    SumColumns(M.A, G.SumA);
+    if (!M.SameWindow)
+      SumColumns(M.B, G.SumB);
+  }
+
+  G.Rows.clear();
+  G.RowSum.clear();
+  G.RowSum2.clear();
+  G.RowGuess.clear();
+  const unsigned NumComponents =
+    M.Kind == Distinguisher::DCA2 ? M.Bits.size() : 1;
+  for (unsigned k = 0, e = M.Table->getNumGuesses(); k != e; ++k)
+    for (unsigned c = 0; c != NumComponents; ++c) {
+      double Sum = 0, Sum2 = 0;
+      for (unsigned v = 0; v != 256; ++v) {
+        float H = M.Kind == Distinguisher::DCA2
+                    ? (M.Table->getValues(T, v)[k] >> M.Bits[c]) & 1
+                    : M.Table->getWeights(T, v)[k];
+        G.Rows.push_back(H);
+        Sum += double(Count[v]) * H;
+        Sum2 += double(Count[v]) * H * H;
+      }
+      G.RowSum.push_back(Sum);
+      G.RowSum2.push_back(Sum2);
+      G.RowGuess.push_back(k);
+    }
+}
+
+/// scoreTile - Score the pairs of columns [A0, A0 + PairBlock) x
+/// [B0, B0 + PairBlock) for the target of G.
+static void scoreTile(const Model2 &M, const TargetGroups &G, PairTile Tile,
+                      TileBuffers &Buf, BestScores &Best) {
+  const WindowData &A = M.A, &B = M.SameWindow ? M.A : M.B;
+  const unsigned NA = std::min(PairBlock, A.NumColumns - Tile.A0);
+  const unsigned NB = std::min(PairBlock, B.NumColumns - Tile.B0);
+  const unsigned P = NA * NB;
+  const bool Product = M.Kind == Distinguisher::CPA2;
+
+  // The Gram matrix of each group, and Sum x_i^2 x_j^2 over all the traces.
+  std::fill(Buf.Squares.begin(), Buf.Squares.begin() + P, 0.0);
+  for (unsigned v = 0; v != 256; ++v) {
+    double *Gram = &Buf.Gram[v * P];
+    std::fill(Gram, Gram + P, 0.0);
+    for (uint64_t i = G.GroupBegin[v]; i != G.GroupBegin[v + 1]; ++i) {
+      uint64_t n = G.Order[i];
+      const float *XA = A.getRow(n) + Tile.A0, *XB = B.getRow(n) + Tile.B0;
+      for (unsigned a = 0; a != NA; ++a)
+        if (XA[a] != 0)
+          kernels::axpy(Gram + a * NB, XB, XA[a], NB);
+      if (Product) {
+        const double *SA = A.getSquares(n) + Tile.A0;
+        const double *SB = B.getSquares(n) + Tile.B0;
+        for (unsigned a = 0; a != NA; ++a)
+          kernels::axpy(&Buf.Squares[a * NB], SB, SA[a], NB);
+      }
+    }
+  }
+
+  // C_v, the sum of the combined samples of each group, replaces the Gram
+  // matrix for XOR; Total is their sum over the groups.
+  std::fill(Buf.Total.begin(), Buf.Total.begin() + P, 0.0);
+  for (unsigned v = 0; v != 256; ++v) {
+    double *C = &Buf.Gram[v * P];
+    if (!Product) {
+      const unsigned NumA = A.NumColumns, NumB = B.NumColumns;
+      const double *SumA = &G.SumA[v * NumA + Tile.A0];
+      const double *SumB =
+        &(M.SameWindow ? G.SumA : G.SumB)[v * NumB + Tile.B0];
+      for (unsigned a = 0; a != NA; ++a)
+        for (unsigned b = 0; b != NB; ++b)
+          C[a * NB + b] = SumA[a] + SumB[b] - 2 * C[a * NB + b];
+    }
+    kernels::axpy(Buf.Total.data(), C, 1.0, P);
+  }
+
+  // Per pair normalization, 1 / sqrt(Var c) for CPA2 and 1 for DCA2; 0 for
+  // the pairs that are skipped (same column, constant combination).
+  float *Norm = Buf.Norm.data();
+  const double N = M.NumTraces;
+  for (unsigned a = 0; a != NA; ++a)
+    for (unsigned b = 0; b != NB; ++b) {
+      const unsigned p = a * NB + b;
+      double Total = Buf.Total[p];
+      Norm[p] = 0;
+      if (M.SameWindow ? Tile.B0 + b <= Tile.A0 + a
+                       : B.getColumnId(Tile.B0 + b) ==
+                           A.getColumnId(Tile.A0 + a))
+        continue;
+      if (Product) {
+        double VarC = Buf.Squares[p] - Total * (Total / N);
+        if (VarC > 0)
+          Norm[p] = 1 / std::sqrt(VarC);
+      } else if (Total != 0 && Total != N) {
+        Norm[p] = 1;
+      }
+    }
+
+  // Sum_v h(v) C_v for all the prediction rows, by chunks of pairs so that
+  // the 256 group sums of a chunk stay in L2.
+  const unsigned NumRows = G.RowGuess.size();
+  for (unsigned P0 = 0; P0 < P; P0 += PairChunk) {
+    const unsigned Width = std::min(PairChunk, P - P0);
+    kernels::multiply(Buf.Num.data(), G.Rows.data(), &Buf.Gram[P0], NumRows,
+                      256, Width, P);
+
+    for (unsigned r = 0; r != NumRows; ++r) {
+      const double SumH = G.RowSum[r];
+      const double VarH = G.RowSum2[r] - SumH * (SumH / N);
+      const double N1 = SumH, N0 = N - N1;
+      if (Product ? VarH <= 0 : (N1 == 0 || N0 == 0))
+        continue;
+      const double *Num = &Buf.Num[r * Width];
+      const double MeanH = SumH / N, InvStdH = 1 / std::sqrt(VarH);
+
+      // the first best pair of the chunk, then one update
+      double BestScore = 0;
+      unsigned BestPair = 0;
+      for (unsigned i = 0; i != Width; ++i) {
+        const unsigned p = P0 + i;
+        if (Norm[p] == 0)
+          continue;
+        double Score;
+        if (Product) {
+          Score = std::fabs(Num[i] - Buf.Total[p] * MeanH) * Norm[p];
+        } else {
+          double Ones = Buf.Total[p];
+          Score = std::fabs(Num[i] / N1 - (Ones - Num[i]) / N0);
+        }
+        if (Score > BestScore) {
+          BestScore = Score;
+          BestPair = p;
+        }
+      }
+      if (BestScore == 0)
+        continue;
+      if (Product)
+        BestScore *= InvStdH;
+      unsigned a = BestPair / NB, b = BestPair % NB;
+      Best.update(G.Target * M.Table->getNumGuesses() + G.RowGuess[r],
+                  BestScore, A.getSample(Tile.A0 + a),
+                  B.getSample(Tile.B0 + b));
+    }
+  }
+}
+
+Expected<CPAEngine::Ranking>
+analyzeSecondOrder(const TraceFileReader &Reader, const AnalyzerOptions &Opts) {
+  auto ScopeOrErr = resolveScope(Reader, Opts);
+  if (!ScopeOrErr)
+    return ScopeOrErr.takeError();
+  const AnalysisScope &Scope = *ScopeOrErr;
+  if (Opts.Windows.size() > 2)
+    return makeError("a second-order attack takes one or two windows");
+
+  Model2 M;
+  M.Kind = Opts.Kind;
+  M.NumTraces = Scope.NumTraces;
+  M.NumTargets = Scope.Targets.size();
+  M.Table = &Scope.Table;
+  for (unsigned b = 0; b != Scope.Table.getNumBits(); ++b)
+    if (Opts.DPABit < 0 || unsigned(Opts.DPABit) == b)
+      M.Bits.push_back(b);
+
+  SmallVector<SampleWindow, 2> Windows(Opts.Windows.begin(),
+                                       Opts.Windows.end());
+  if (Windows.empty()) {
+    SampleWindow W;
+    W.Begin = Scope.SampleBegin;
+    W.End = Scope.SampleEnd;
+    Windows.push_back(W);
+  }
+  M.SameWindow = Windows.size() == 1;
+  for (unsigned i = 0; i != Windows.size(); ++i) {
+    auto SamplesOrErr = resolveWindow(Reader, Scope, Windows[i]);
+    if (!SamplesOrErr)
+      return SamplesOrErr.takeError();
+    (i ? M.B : M.A).Samples = std::move(*SamplesOrErr);
+  }
+
+  // The windows are loaded whole, the pairs need random access to them.
+  uint64_t NumSamples = M.A.Samples.size() + M.B.Samples.size();
+  uint64_t WindowBytes = M.Kind == Distinguisher::DCA2
+                           ? NumSamples * 8 * sizeof(float)
+                           : NumSamples * (sizeof(float) + sizeof(double));
+  WindowBytes *= M.NumTraces;
+  if (WindowBytes > Opts.MemoryBudget)
+    return makeError("the windows take " + Twine(WindowBytes >> 20) +
+                     " MB, more than the memory budget; use smaller "
+                     "windows or fewer traces");
+
+  M.Known = getKnownBytes(Reader, Opts, Scope);
+  loadWindow(Reader, M.Kind, M.NumTraces, M.A);
+  if (!M.SameWindow)
+    loadWindow(Reader, M.Kind, M.NumTraces, M.B);
+  const WindowData &B = M.SameWindow ? M.A : M.B;
+
+  std::vector<PairTile> Tiles;
+  for (unsigned A0 = 0; A0 < M.A.NumColumns; A0 += PairBlock)
+    for (unsigned B0 = M.SameWindow ? A0 : 0; B0 < B.NumColumns;
+         B0 += PairBlock)
+      Tiles.push_back({A0, B0});
+  uint64_t NumPairs =
+    M.SameWindow ? uint64_t(M.A.NumColumns) * (M.A.NumColumns - 1) / 2
+                 : uint64_t(M.A.NumColumns) * B.NumColumns;
+  if (Opts.Progress)
+    *Opts.Progress << NumPairs << " pairs of "
+                   << (M.Kind == Distinguisher::DCA2 ? "bit columns"
+                                                     : "samples")
+                   << " in " << Tiles.size() << " tiles\n";
+
+  BestScores Best(M.NumTargets * Scope.Table.getNumGuesses());
+  const unsigned NumThreads =
+    std::min<uint64_t>(Scope.NumThreads, Tiles.size());
+  for (unsigned t = 0; t != M.NumTargets; ++t) {
+    TargetGroups G;
+    groupTraces(M, t, G);
+
+    std::atomic<size_t> NextTile(0), DoneTiles(0);
+    sys::Mutex ProgressLock;
+    std::vector<BestScores> ThreadBest(NumThreads,
+                                       BestScores(Best.Score.size()));
+    std::vector<std::thread> Threads;
+    for (unsigned i = 0; i != NumThreads; ++i)
+      Threads.emplace_back([&, i] {
+        TileBuffers Buf(G.RowGuess.size());
+        for (size_t j; (j = NextTile++) < Tiles.size();) {
+          scoreTile(M, G, Tiles[j], Buf, ThreadBest[i]);
+          size_t Done = ++DoneTiles;
+          // about 20 lines per target byte
+          if (Opts.Progress &&
+              Done * 20 / Tiles.size() != (Done - 1) * 20 / Tiles.size()) {
+            sys::ScopedLock Guard(ProgressLock);
+            *Opts.Progress << "byte " << Scope.Targets[t] << ": " << Done
+                           << "/" << Tiles.size() << " tiles\n";
+          }
+        }
+      });
+    for (std::thread &T : Threads)
+      T.join();
+    for (const BestScores &TBest : ThreadBest)
+      Best.merge(TBest);
+  }
+
+  return makeRanking(Scope, Best);
+}
+
+} // End wyverse namespace
@@ -0,0 +1,48 @@
+//===-- SecondOrder.h - Second-order attacks on sample pairs ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A masked implementation splits every sensitive value into shares that are
+// each independent of the key, so first-order attacks see nothing.  A
+// second-order attack combines the samples of a pair, c = x_i ^ x_j for the
+// bits of the samples (DCA2) or c = (x_i - E x_i) (x_j - E x_j) for their
+// values (CPA2), and attacks the combined samples.  The number of pairs is
+// quadratic in the length of the window, so the windows are restricted to a
+// range of samples or to the samples of a range of instructions.
+//
+// The prediction of a trace only depends on its known byte v.  With the
+// traces grouped by v, the sum of the combined samples of each group is
+// enough to score all the guesses:
+//
+//   Sum_n c_n h_k(v_n) = Sum_v h_k(v) C_v,   C_v = Sum_{n : v_n = v} c_n
+//
+// and C_v derives from the per-group Gram matrix of the window samples,
+// P_v(i, j) = Sum_{n : v_n = v} x_i x_j (x_i ^ x_j = x_i + x_j - 2 x_i x_j
+// for bits).  The pairs are evaluated by tiles of PairBlock x PairBlock
+// columns whose 256 Gram matrices stay in cache; the tiles are shared by the
+// threads.  Then Sum_v h_k(v) C_v is a 256 x 256 by 256 x tile product.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_ANALYZE_SECONDORDER_H
+#define LLVM_TOOLS_WYVERSE_ANALYZE_SECONDORDER_H
+
+#include "CorrelationAnalyzer.h"
+
+namespace wyverse {
+
+/// analyzeSecondOrder - Rank the key guesses with the pairs of samples of
+/// one window (all the pairs inside it) or two windows (one sample of each).
+/// Without a window, the samples of the scope form the window.
+llvm::Expected<llvm::CPAEngine::Ranking>
+analyzeSecondOrder(const llvm::TraceFileReader &Reader,
+                   const AnalyzerOptions &Opts);
+
+} // End wyverse namespace
+
+#endif
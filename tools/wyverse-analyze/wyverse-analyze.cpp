@@ -0,0 +1,180 @@
+//===- wyverse-analyze.cpp - Offline attacks on Wyverse trace files -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This utility runs side-channel attacks on the trace files written by the
+// batch mode of wyverse.  The file is memory-mapped and processed by tiles,
+// so campaigns larger than the memory of the machine can be analysed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "BitslicedDCA.h"
+#include "CorrelationAnalyzer.h"
+#include "IntermediateLocator.h"
+#include "LinearDecoding.h"
+#include "SecondOrder.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/AnalysisKernels.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/PluginLoader.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+
+using namespace llvm;
+using namespace wyverse;
+
+namespace {
+
+  cl::opt<std::string>
+  TraceFile(cl::desc("<trace file>"), cl::Positional, cl::Required);
+
+  cl::opt<Distinguisher>
+  Attack("attack",
+	 cl::desc("Attack to run:"),
+	 cl::init(Distinguisher::CPA),
+	 cl::values(clEnumValN(Distinguisher::CPA, "cpa",
+			       "Correlation with the Hamming weight"),
+		    clEnumValN(Distinguisher::DPA, "dpa",
+			       "Difference of means on the bits"),
+		    clEnumValN(Distinguisher::DCA, "dca",
+			       "Difference of means on the bits of the "
+			       "samples (bitsliced)"),
+		    clEnumValN(Distinguisher::CPA2, "cpa2",
+			       "Second-order CPA on the centered products "
+			       "of sample pairs"),
+		    clEnumValN(Distinguisher::DCA2, "dca2",
+			       "Second-order DCA on the XORs of bit sample "
+			       "pairs"),
+		    clEnumValN(Distinguisher::LDA, "lda",
+			       "Linear decoding analysis of the bit samples "
+			       "over GF(2)")));
+  cl::opt<std::string>
+  Target("target",
+	 cl::desc("Selection function of the intermediate value attacked: "
+		  "first-sbox, last-sbox (AES), des-sbox, sm4-sbox, or one "
+		  "registered by a plugin (-load)"),
+	 cl::value_desc("name"),
+	 cl::init("first-sbox"));
+  cl::list<unsigned>
+  Bytes("bytes",
+	cl::desc("Targets attacked, the key bytes for AES (default = all)"),
+	cl::CommaSeparated);
+  cl::opt<int>
+  DPABit("dpa-bit",
+	 cl::desc("Bit of the selected value used by the DPA / DCA "
+		  "(default = all bits)"),
+	 cl::init(-1));
+  cl::opt<unsigned long long>
+  SampleBegin("sample-begin",
+	      cl::desc("First sample analysed"),
+	      cl::init(0));
+  cl::opt<unsigned long long>
+  SampleCount("sample-count",
+	      cl::desc("Number of samples analysed (default = all)"),
+	      cl::init(0));
+  cl::list<std::string>
+  Windows("window",
+	  cl::desc("Samples combined by a second-order attack or decoded by "
+		   "LDA, FIRST-LAST or inst:FIRST-LAST; one window pairs its "
+		   "samples, two windows pair a sample of each"),
+	  cl::ZeroOrMore);
+  cl::opt<unsigned long long>
+  TraceCount("traces",
+	     cl::desc("Number of traces analysed (default = all)"),
+	     cl::init(0));
+  cl::opt<unsigned>
+  NumThreads("threads",
+	     cl::desc("Number of worker threads (default = number of cores)"),
+	     cl::init(0));
+  cl::opt<unsigned>
+  MemoryMB("memory",
+	   cl::desc("Memory used by the accumulators, the samples are "
+		    "processed by tiles that fit in it"),
+	   cl::value_desc("MB"),
+	   cl::init(4096));
+  cl::opt<unsigned>
+  Top("top",
+      cl::desc("Number of guesses printed per key byte"),
+      cl::init(4));
+  cl::opt<std::string>
+  LocateKey("locate-key",
+	    cl::desc("Instead of attacking, locate the samples in bijection "
+		     "with the AES-128 state bytes under this known key"),
+	    cl::value_desc("hex"));
+
+  ExitOnError ExitOnErr;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+  cl::ParseCommandLineOptions(argc, argv, "Wyverse trace analyzer\n");
+
+  std::unique_ptr<TraceFileReader> Reader =
+    ExitOnErr(TraceFileReader::open(TraceFile));
+  outs() << TraceFile << ": " << Reader->getNumTraces() << " traces of "
+         << Reader->getNumSamples() << " samples ("
+         << (kernels::hasAVX2() ? "AVX2" : "generic") << " kernels)\n";
+
+  AnalyzerOptions Opts;
+  Opts.Kind = Attack;
+  Opts.Selection = ExitOnErr(createSelectionFunction(Target));
+  for (unsigned Byte : Bytes)
+    Opts.TargetBytes.push_back(Byte);
+  Opts.DPABit = DPABit;
+  Opts.SampleBegin = SampleBegin;
+  Opts.SampleCount = SampleCount;
+  for (const std::string &W : Windows)
+    Opts.Windows.push_back(ExitOnErr(parseSampleWindow(W)));
+  Opts.TraceCount = TraceCount;
+  Opts.NumThreads = NumThreads;
+  Opts.MemoryBudget = uint64_t(MemoryMB) << 20;
+  Opts.Progress = &errs();
+
+  auto Start = std::chrono::steady_clock::now();
+  if (!LocateKey.empty()) {
+    if (LocateKey.size() % 2 || !all_of(LocateKey, isHexDigit))
+      ExitOnErr(make_error<StringError>("-locate-key is not an hex string",
+                                        inconvertibleErrorCode()));
+    std::string Key = fromHex(LocateKey);
+    std::vector<IntermediateMatch> Matches = ExitOnErr(
+        locateIntermediates(*Reader, Opts, arrayRefFromStringRef(Key)));
+    std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+    printMatches(outs(), *Reader, Matches);
+    outs() << format("done in %.2fs\n", Elapsed.count());
+    return 0;
+  }
+  Expected<CPAEngine::Ranking> RankingOrErr = [&] {
+    switch (Attack) {
+    case Distinguisher::DCA:
+      return analyzeBitsliced(*Reader, Opts);
+    case Distinguisher::CPA2:
+    case Distinguisher::DCA2:
+      return analyzeSecondOrder(*Reader, Opts);
+    case Distinguisher::LDA:
+      return analyzeLinearDecoding(*Reader, Opts);
+    default:
+      return analyzeTraceFile(*Reader, Opts);
+    }
+  }();
+  CPAEngine::Ranking R = ExitOnErr(std::move(RankingOrErr));
+  std::chrono::duration<double> Elapsed =
+    std::chrono::steady_clock::now() - Start;
+
+  static const char *const AttackNames[] = {"CPA", "DPA", "DCA",
+                                               "CPA2", "DCA2", "LDA"};
+  CPAEngine::printRanking(outs(), R, Top,
+                          AttackNames[static_cast<unsigned>(Attack.getValue())]);
+  outs() << format("done in %.2fs\n", Elapsed.count());
+  return 0;
+}
@@ -0,0 +1,268 @@
+//===-- BatchMode.cpp - Run the program many times in parallel ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "BatchMode.h"
+#include "JobScheduler.h"
+#include "WorkerPool.h"
+#include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+using namespace llvm;
+
+namespace wyverse {
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+static Expected<std::unique_ptr<Module>>
+loadModule(StringRef Path, LLVMContext &Context, StringRef ProgName) {
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(Path, Err, Context);
+  if (!M) {
+    std::string Msg;
+    raw_string_ostream OS(Msg);
+    Err.print(ProgName.data(), OS);
+    return makeError(OS.str());
+  }
+  return std::move(M);
+}
+
+Error BatchWorker::init(const BatchOptions &Opts) {
+  auto MainOrErr = loadModule(Opts.InputFile, Context, Opts.ProgramName);
+  if (!MainOrErr)
+    return MainOrErr.takeError();
+  std::unique_ptr<Module> Owner = std::move(*MainOrErr);
+  Module *Mod = Owner.get();
+  std::vector<Module *> Modules(1, Mod);
+  Index.addModule(*Mod);
+
+  Actions.reset(Opts.CreateActions());
+
+  std::string ErrorMsg;
+  EngineBuilder builder(std::move(Owner));
+  builder.setErrorStr(&ErrorMsg);
+  builder.setEngineKind(EngineKind::WhiteBoxInterpreter);
+  builder.setAction(Actions.get());
+  EE.reset(builder.create());
+  if (!EE)
+    return makeError("error creating EE: " +
+                     (ErrorMsg.empty() ? "unknown error" : ErrorMsg));
+
+  for (const std::string &Path : Opts.ExtraModules) {
+    auto XModOrErr = loadModule(Path, Context, Opts.ProgramName);
+    if (!XModOrErr)
+      return XModOrErr.takeError();
+    Modules.push_back(XModOrErr->get());
+    Index.addModule(**XModOrErr);
+    EE->addModule(std::move(*XModOrErr));
+  }
+
+  EntryFn = Mod->getFunction(Opts.EntryFunc);
+  if (!EntryFn)
+    return makeError("'" + Opts.EntryFunc + "' function not found in module");
+
+  Actions->setInstructionIndex(&Index);
+  EE->setTrapExit(true);
+  EE->setOutputCapture(&Stdout, &Stderr);
+  EE->runStaticConstructorsDestructors(false);
+  (void)EE->getPointerToFunction(EntryFn);
+  EE->setRunLimits(Opts.Limits);
+
+  size_t InputSize = Opts.Generator ? Opts.Generator->getInputSize() : 0;
+  if (Error E = TheHarness.bind(*EE, *EntryFn, Opts.InputBinding, InputSize,
+                                Opts.OutputBinding, Opts.OutputSize))
+    return E;
+
+  for (Module *M : Modules)
+    snapshotGlobals(*M);
+  return Error::success();
+}
+
+void BatchWorker::snapshotGlobals(Module &M) {
+  const DataLayout &DL = EE->getDataLayout();
+  for (GlobalVariable &GV : M.globals()) {
+    if (GV.isDeclaration() || GV.isConstant())
+      continue;
+    GlobalImage Image;
+    Image.Addr = EE->getPointerToGlobal(&GV);
+    const char *Begin = static_cast<const char *>(Image.Addr);
+    Image.Data.assign(Begin, Begin + DL.getTypeAllocSize(GV.getValueType()));
+    Globals.push_back(std::move(Image));
+  }
+}
+
+void BatchWorker::restoreGlobals() {
+  for (GlobalImage &Image : Globals)
+    memcpy(Image.Addr, Image.Data.data(), Image.Data.size());
+}
+
+RunAbort BatchWorker::run(const BatchOptions &Opts, TraceRecord &Record) {
+  std::vector<std::string> Argv;
+  Argv.push_back(Opts.ProgramName);
+  if (Opts.Generator) {
+    Record.Input.resize(Opts.Generator->getInputSize());
+    Record.FixedInput =
+      Opts.Generator->generate(Record.Index, Record.Input.data());
+    // Without an input binding the bytes go through argv, as in build.sh.
+    static const char Digits[] = "0123456789abcdef";
+    if (!TheHarness.hasInput())
+      for (uint8_t Byte : Record.Input)
+        Argv.push_back({Digits[Byte >> 4], Digits[Byte & 0xf]});
+  } else {
+    const std::vector<std::string> &Args = Opts.Inputs[Record.Index];
+    Argv.insert(Argv.end(), Args.begin(), Args.end());
+  }
+
+  restoreGlobals();
+  TheHarness.writeInput(Record.Input);
+  EE->seedRun(Record.Seed);
+  Stdout.clear();
+  Stderr.clear();
+  errno = 0;
+
+  Actions->beginRun(Record);
+  if (TheHarness.callsEntryDirectly()) {
+    GenericValue Result = EE->runFunction(EntryFn, TheHarness.getArguments());
+    if (EntryFn->getReturnType()->isIntegerTy())
+      Record.ExitCode = Result.IntVal.getSExtValue();
+  } else {
+    Record.ExitCode = EE->runFunctionAsMain(EntryFn, Argv, Opts.Envp);
+  }
+  if (TheHarness.hasOutput())
+    TheHarness.readOutput(Record.Output);
+  else if (Opts.Capture.isEnabled() &&
+           !Opts.Capture.extract(Stdout, Opts.OutputSize, Record.Output))
+    // Left empty: the batch counts the runs without an output.
+    Record.Output.clear();
+  Actions->endRun(Record);
+  return EE->getRunAbort();
+}
+
+Error checkBatchOptions(const BatchOptions &Opts) {
+  uint64_t NumJobs = Opts.Generator ? Opts.NumRuns : Opts.Inputs.size();
+  if (NumJobs == 0)
+    return makeError("batch mode: no input to run");
+  if (Opts.InputBinding.isBound() && !Opts.Generator)
+    return makeError("-harness-input needs generated inputs");
+  if (Opts.OutputBinding.isBound() && Opts.Capture.isEnabled())
+    return makeError("-harness-output and -capture-output are exclusive");
+  if (Opts.Isolate && Opts.Checkpoint)
+    return makeError("isolated runs cannot stop the batch early");
+  return Error::success();
+}
+
+Error runBatch(const BatchOptions &Opts) {
+  if (Error E = checkBatchOptions(Opts))
+    return E;
+  uint64_t NumJobs = Opts.Generator ? Opts.NumRuns : Opts.Inputs.size();
+
+  std::unique_ptr<TraceFileWriter> Writer;
+  if (!Opts.TraceFile.empty()) {
+    uint32_t InputSize = Opts.Generator ? Opts.Generator->getInputSize() : 0;
+    uint32_t OutputSize =
+      Opts.OutputBinding.isBound() || Opts.Capture.isEnabled()
+        ? Opts.OutputSize : 0;
+    auto WriterOrErr =
+      TraceFileWriter::create(Opts.TraceFile, InputSize, OutputSize);
+    if (!WriterOrErr)
+      return WriterOrErr.takeError();
+    Writer = std::move(*WriterOrErr);
+  }
+
+  unsigned NumWorkers = Opts.NumThreads;
+  if (NumWorkers == 0)
+    NumWorkers = std::max(1u, std::thread::hardware_concurrency());
+  NumWorkers = std::min<uint64_t>(NumWorkers, NumJobs);
+
+  uint64_t NumEmitted = 0, NumNoOutput = 0;
+  bool Stopped = false;
+  auto Emit = [&](TraceRecord &Record) {
+    if (Opts.Capture.isEnabled() && Record.Output.empty())
+      ++NumNoOutput;
+    if (Writer)
+      Writer->write(Record);
+    ++NumEmitted;
+    Stopped = Opts.CheckPeriod && NumEmitted % Opts.CheckPeriod == 0 &&
+              NumEmitted != NumJobs && Opts.Checkpoint &&
+              Opts.Checkpoint(NumEmitted);
+    return Stopped;
+  };
+
+  WorkerPoolStats Stats;
+  if (Opts.Isolate) {
+    if (Error E = runWorkerPool(Opts, NumJobs, NumWorkers, Emit, Stats))
+      return E;
+  } else {
+    std::vector<std::unique_ptr<BatchWorker>> Workers;
+    for (unsigned i = 0; i != NumWorkers; ++i) {
+      Workers.emplace_back(new BatchWorker());
+      if (Error E = Workers.back()->init(Opts))
+        return E;
+    }
+
+    JobScheduler<TraceRecord> Scheduler(NumWorkers, NumWorkers * 64);
+    std::atomic<uint64_t> NumAborted(0);
+    Scheduler.run(
+        NumJobs,
+        [&](unsigned Worker, uint64_t Job, TraceRecord &Record) {
+          Record.Index = Job;
+          Record.Seed = deriveJobSeed(Opts.Seed, Job);
+          Record.CollectSampleInsts = Job == 0;
+          if (Workers[Worker]->run(Opts, Record) != RunAbort::None)
+            ++NumAborted;
+        },
+        [&](TraceRecord &Record) {
+          if (Emit(Record))
+            Scheduler.stop();
+        });
+    Stats.NumAborted = NumAborted;
+  }
+
+  if (Stopped)
+    outs() << "stopped after " << NumEmitted << " of " << NumJobs
+           << " runs\n";
+  if (Stats.NumAborted)
+    errs() << "warning: " << Stats.NumAborted
+           << " runs were ended by the run limits, their traces are "
+              "truncated\n";
+  if (NumNoOutput)
+    errs() << "warning: " << NumNoOutput
+           << " runs printed no output for -capture-output, it is zeroes "
+              "in their traces\n";
+  if (Stats.NumCrashed)
+    errs() << "warning: " << Stats.NumCrashed << " runs crashed ("
+           << Stats.NumKilled << " killed past the timeout), they have no "
+              "trace\n";
+  if (!Writer) {
+    outs() << NumEmitted << " runs (" << NumWorkers << " workers)\n";
+    return Error::success();
+  }
+  if (Error E = Writer->finalize())
+    return E;
+
+  outs() << Writer->getNumTraces() << " traces written to " << Opts.TraceFile
+         << " (" << NumWorkers << " workers)\n";
+  if (Writer->getNumResized())
+    errs() << "warning: " << Writer->getNumResized()
+           << " traces did not have the expected length and were padded "
+              "or truncated\n";
+  return Error::success();
+}
+
+} // End wyverse namespace
@@ -0,0 +1,121 @@
+//===-- BatchMode.h - Run the program many times in parallel ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Batch mode runs the entry function once per input and writes one trace
+// record per run.  Each worker thread owns a private copy of the module and
+// of the execution engine, the runs are distributed by the JobScheduler.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_BATCHMODE_H
+#define LLVM_TOOLS_WYVERSE_BATCHMODE_H
+
+#include "Harness.h"
+#include "InputGenerator.h"
+#include "OutputCapture.h"
+#include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/InstructionIndex.h"
+#include "llvm/ExecutionEngine/TraceFile.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Error.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wyverse {
+
+struct BatchOptions {
+  std::string InputFile;                    // bitcode of the program
+  std::vector<std::string> ExtraModules;
+  std::string EntryFunc;
+  std::string ProgramName;                  // argv[0] seen by the program
+  const char * const *Envp = nullptr;
+
+  std::string TraceFile;                    // empty: traces not stored
+  unsigned NumThreads = 1;
+  uint64_t Seed = 0;
+
+  // Program arguments of each run (argv[1..]), when the inputs are not
+  // generated.
+  std::vector<std::vector<std::string>> Inputs;
+
+  // Built-in generator: NumRuns inputs, passed to the program through the
+  // harness or else as one hex byte per argument.
+  std::shared_ptr<InputGenerator> Generator;
+  uint64_t NumRuns = 0;
+
+  // Direct binding of the input / output buffers.
+  HarnessBinding InputBinding, OutputBinding;
+  size_t OutputSize = 0;
+
+  // Extraction of the output from the captured stdout, when the output
+  // buffer is not bound.
+  CaptureRule Capture;
+
+  // Bounds of each run, against the runs a fault sends astray.
+  llvm::RunLimits Limits;
+
+  // Run in worker processes instead of threads, so that a run that crashes
+  // only loses its trace (see WorkerPool.h).  The actions then run in the
+  // workers, they cannot feed shared analysis engines.
+  bool Isolate = false;
+
+  // Builds the action chain of one worker.
+  std::function<llvm::ChainedAction *()> CreateActions;
+
+  // Called with the number of runs emitted so far, every CheckPeriod runs;
+  // returning true ends the campaign there (early stopping).
+  uint64_t CheckPeriod = 0;
+  std::function<bool(uint64_t)> Checkpoint;
+};
+
+/// BatchWorker - One interpreter, with its own context, module and actions.
+class BatchWorker {
+  llvm::LLVMContext Context;
+  std::unique_ptr<llvm::ExecutionEngine> EE;
+  std::unique_ptr<llvm::ChainedAction> Actions;
+  llvm::InstructionIndex Index;
+  llvm::Function *EntryFn = nullptr;
+  Harness TheHarness;
+
+  // Standard output / error of the current run.
+  std::string Stdout, Stderr;
+
+  // Content of the writable globals after the static constructors, restored
+  // before each run so that a run never depends on the previous ones.
+  struct GlobalImage {
+    void *Addr;
+    std::vector<char> Data;
+  };
+  std::vector<GlobalImage> Globals;
+
+  void snapshotGlobals(llvm::Module &M);
+  void restoreGlobals();
+
+public:
+  llvm::Error init(const BatchOptions &Opts);
+
+  /// run - Run the entry function on the input of Record.  Returns why the
+  /// run was ended by its limits, if it was.
+  llvm::RunAbort run(const BatchOptions &Opts, llvm::TraceRecord &Record);
+
+  llvm::ExecutionEngine &getEngine() { return *EE; }
+};
+
+/// checkBatchOptions - Reject the inconsistent options before any run.
+llvm::Error checkBatchOptions(const BatchOptions &Opts);
+
+/// runBatch - Run the whole campaign and write the trace file.
+llvm::Error runBatch(const BatchOptions &Opts);
+
+} // End wyverse namespace
+
+#endif
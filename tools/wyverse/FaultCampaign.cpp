@@ -0,0 +1,917 @@
+//===-- FaultCampaign.cpp - Checkpointed fault injection campaign ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "FaultCampaign.h"
+#include "JobScheduler.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ExecutionEngine/AESDFA.h"
+#include "llvm/ExecutionEngine/StateHash.h"
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <thread>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace wyverse {
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+const char *getOutcomeName(FaultOutcome Outcome) {
+  switch (Outcome) {
+  case FaultOutcome::Pending:     return "pending";
+  case FaultOutcome::Masked:      return "masked";
+  case FaultOutcome::Faulty:      return "faulty";
+  case FaultOutcome::Crash:       return "crash";
+  case FaultOutcome::Timeout:     return "timeout";
+  case FaultOutcome::NotInjected: return "not-injected";
+  case FaultOutcome::Skipped:     return "skipped";
+  }
+  llvm_unreachable("unknown fault outcome");
+}
+
+#ifdef LLVM_ON_UNIX
+
+namespace {
+
+/// CampaignMemory - Memory shared with the forked runs.  The golden run
+/// writes a GoldenHeader followed by its output, the injection point of
+/// each fault and the state hashes at its checkpoints; each faulty run
+/// writes a FaultSlot followed by its output, and publishes its states in
+/// the state table.
+class CampaignMemory {
+public:
+  struct GoldenHeader {
+    uint8_t Done;                  // written last by the golden run
+    uint8_t Aborted;               // RunAbort
+    int32_t ExitCode;
+    uint64_t NumInsts;
+    uint64_t NumHashes;
+    uint32_t OutputSize;
+  };
+
+  struct CheckpointHash {
+    uint64_t Stack;
+    uint64_t Memory;               // from the start of the run
+    uint64_t Untracked;            // calls from the start of the run
+  };
+
+  struct FaultSlot {
+    uint8_t Done;                  // written last by the faulty run
+    uint8_t Injected;
+    uint8_t Converged;             // stopped on the golden state
+    uint8_t Aborted;               // RunAbort
+    int32_t ExitCode;
+    uint32_t SameAs;               // 1 + the run whose state it reached
+    uint64_t Executed;             // instructions from the checkpoint
+    uint32_t OutputSize;
+  };
+
+  /// StateKey - The state of a faulty run at a checkpoint, comparable with
+  /// the other faulty runs.
+  struct StateKey {
+    uint64_t Checkpoint;
+    uint64_t Stack;
+    uint64_t Memory;               // from the start of the run
+    uint64_t Untracked;            // of the golden run at the fork
+
+    bool operator==(const StateKey &RHS) const {
+      return Checkpoint == RHS.Checkpoint && Stack == RHS.Stack &&
+             Memory == RHS.Memory && Untracked == RHS.Untracked;
+    }
+  };
+
+  // 24 MB of address space, only the pages written are allocated.
+  static const uint64_t MaxHashes = 1 << 20;
+  // 48 MB of address space for the state table.
+  static const uint64_t MaxStates = 1 << 20;
+
+private:
+  uint8_t *Base = nullptr;
+  size_t Size = 0;
+  size_t OutputSize = 0, SlotSize = 0;
+  size_t PositionsOffset = 0, HashesOffset = 0, StatesOffset = 0;
+  size_t SlotsOffset = 0;
+
+  // Open addressing, filled concurrently by the faulty runs: an entry is
+  // claimed by its tag, then its owner is published once its key is written.
+  struct StateEntry {
+    std::atomic<uint64_t> Tag;     // 0: free
+    StateKey Key;
+    std::atomic<uint32_t> Owner;   // 1 + the run, 0 until published
+  };
+  static const unsigned MaxProbes = 64;
+
+  StateEntry *getStates() {
+    return reinterpret_cast<StateEntry *>(Base + StatesOffset);
+  }
+
+public:
+  ~CampaignMemory() {
+    if (Base)
+      ::munmap(Base, Size);
+  }
+
+  Error allocate(size_t NumFaults, size_t OutSize) {
+    OutputSize = OutSize;
+    PositionsOffset = alignTo(sizeof(GoldenHeader) + OutputSize, 8);
+    HashesOffset = PositionsOffset + NumFaults * sizeof(uint64_t);
+    StatesOffset = HashesOffset + MaxHashes * sizeof(CheckpointHash);
+    SlotsOffset = StatesOffset + MaxStates * sizeof(StateEntry);
+    SlotSize = alignTo(sizeof(FaultSlot) + OutputSize, 8);
+    Size = SlotsOffset + NumFaults * SlotSize;
+    void *Mem = ::mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (Mem == MAP_FAILED)
+      return errorCodeToError(std::error_code(errno, std::generic_category()));
+    Base = static_cast<uint8_t *>(Mem);
+    return Error::success();
+  }
+
+  size_t getOutputSize() const { return OutputSize; }
+
+  GoldenHeader &getGolden() {
+    return *reinterpret_cast<GoldenHeader *>(Base);
+  }
+  uint8_t *getGoldenOutput() { return Base + sizeof(GoldenHeader); }
+  uint64_t *getPositions() {
+    return reinterpret_cast<uint64_t *>(Base + PositionsOffset);
+  }
+  CheckpointHash *getHashes() {
+    return reinterpret_cast<CheckpointHash *>(Base + HashesOffset);
+  }
+  FaultSlot &getSlot(unsigned F) {
+    return *reinterpret_cast<FaultSlot *>(Base + SlotsOffset + F * SlotSize);
+  }
+  uint8_t *getOutput(unsigned F) {
+    return Base + SlotsOffset + F * SlotSize + sizeof(FaultSlot);
+  }
+
+  /// findOrAddState - The run that published the state Key, or else
+  /// publish it for F.  Returns -1 if Key is new (or the table is full).
+  int findOrAddState(const StateKey &Key, unsigned F) {
+    uint64_t Tag = static_cast<size_t>(hash_combine(
+                       Key.Checkpoint, Key.Stack, Key.Memory, Key.Untracked)) |
+                   1;
+    StateEntry *States = getStates();
+    for (unsigned i = 0; i != MaxProbes; ++i) {
+      StateEntry &E = States[(Tag + i) & (MaxStates - 1)];
+      uint64_t Current = E.Tag.load(std::memory_order_acquire);
+      if (Current == 0) {
+        if (E.Tag.compare_exchange_strong(Current, Tag)) {
+          E.Key = Key;
+          E.Owner.store(F + 1, std::memory_order_release);
+          return -1;
+        }
+        // Claimed by another run in the meantime, Current is its tag.
+      }
+      if (Current != Tag)
+        continue;
+      uint32_t Owner = E.Owner.load(std::memory_order_acquire);
+      if (Owner && E.Key == Key)
+        return Owner - 1;
+    }
+    return -1;
+  }
+};
+
+/// CampaignAction - Counts the dynamic instructions and the executions of
+/// the faulted instructions, forks the golden run and the faulty runs at
+/// the checkpoints, and stops the faulty runs back on the golden state.
+/// First in the action chain, so that a run forked before an instruction
+/// injects its fault on that instruction.
+class CampaignAction : public Action {
+public:
+  enum Phase {
+    Start,                         // fork the golden run
+    Golden,                        // in a child, locate the injection points
+    Replay,                        // fork the faulty runs
+    Faulty,                        // in a child, after the fork
+  };
+  static const uint64_t NoCheckpoint = ~0ULL;
+
+private:
+  const FaultCampaignOptions &FOpts;
+  const RunLimits &Limits;         // of the batch
+  FaultAction &Injector;
+  StateHashAction &Hasher;
+  CampaignMemory &Memory;
+  AESDFA *DFA;                     // fed with the faulty outputs, if any
+  ExecutionEngine *Engine = nullptr;
+  uint64_t Seed;
+  unsigned MaxChildren;
+  uint64_t Interval;
+
+  Phase CurPhase = Start;
+  uint64_t NumInsts = 0;           // dynamic instructions of the run
+  uint64_t NextCheckpoint = NoCheckpoint;
+
+  // Executions of the faulted instructions in the run.
+  struct Target {
+    uint32_t ID;
+    uint64_t Count;
+  };
+  DenseMap<const Instruction *, Target> Targets;
+  // Dynamic instruction of each (ID, occurrence) faulted, NoCheckpoint
+  // until the golden run reaches it.
+  DenseMap<std::pair<uint32_t, uint64_t>, uint64_t> Positions;
+
+  // The faults by injection point, and the next one to fork.
+  std::vector<unsigned> Schedule;
+  std::vector<uint64_t> Checkpoints;
+  size_t Cursor = 0;
+  bool Stopped = false;            // the DFA has recovered the key
+
+  DenseMap<pid_t, unsigned> Children;
+  unsigned Current = 0;            // fault of a child
+  uint64_t Forked = 0;             // NumInsts at the fork
+
+  // The faults that do not apply to their instruction.
+  std::vector<bool> Invalid;
+
+  // The output classes by (exit code, output).
+  std::map<std::pair<int32_t, std::string>, unsigned> ClassIndex;
+
+  void checkpoint(const Instruction &I);
+  void scout();
+  void startReplay();
+  void recordHash(const Instruction &I);
+  void compareHash(const Instruction &I);
+  void forkRuns();
+  bool forkRun(unsigned F);
+  void limitRun();
+  void reap();
+  void classify(unsigned F);
+  void addToClass(unsigned F);
+  void analyze(unsigned F);
+  void reportGolden(TraceRecord &Record);
+  void report(TraceRecord &Record);
+
+public:
+  static const unsigned NoFault = ~0U;
+
+  std::vector<FaultOutcome> Outcomes;
+  // The output class of each faulty run, and the first run and the size of
+  // each class.
+  std::vector<unsigned> ClassOf;
+  std::vector<unsigned> Classes;
+  std::vector<unsigned> ClassSizes;
+  // The run whose state each run reached, NoFault if none; finish() follows
+  // the chains to a run that did not stop so.
+  std::vector<unsigned> SameAs;
+  unsigned NumSameAs = 0;
+  unsigned NumBeforeWindow = 0;    // faulty outputs kept from the DFA
+  uint64_t ReplayedInsts = 0;      // by all the faulty runs
+  unsigned NumConverged = 0;
+  unsigned NumInvalid = 0;
+  std::pair<unsigned, const char *> FirstInvalid;
+
+  CampaignAction(const FaultCampaignOptions &FOpts, const RunLimits &Limits,
+                 FaultAction &Injector, StateHashAction &Hasher,
+                 CampaignMemory &Memory, AESDFA *DFA, uint64_t Seed,
+                 unsigned MaxChildren)
+    : FOpts(FOpts), Limits(Limits), Injector(Injector), Hasher(Hasher),
+      Memory(Memory), DFA(DFA), Seed(Seed), MaxChildren(MaxChildren),
+      Interval(std::max<uint64_t>(1, FOpts.CheckpointInterval)),
+      Outcomes(FOpts.Faults.size(), FaultOutcome::Pending),
+      ClassOf(FOpts.Faults.size(), NoFault),
+      SameAs(FOpts.Faults.size(), NoFault) {}
+
+  uint64_t getNumInsts() const { return NumInsts; }
+
+  /// setEngine - The engine of the runs, whose limits the faulty runs set.
+  void setEngine(ExecutionEngine *EE) { Engine = EE; }
+
+  void setInstructionIndex(const InstructionIndex * index) override;
+
+  /// finish - Give their outcome to the runs stopped on the state of
+  /// another, and classify the faults never run.
+  void finish();
+
+  void beginRun(TraceRecord &Record) override {
+    CurPhase = Start;
+    NumInsts = 0;
+    NextCheckpoint = 0;
+    for (auto &Entry : Targets)
+      Entry.second.Count = 0;
+  }
+
+  void endRun(TraceRecord &Record) override;
+
+  void beforeVisitInst(Instruction &I, ExecutionContext &SF) override {
+    if (LLVM_UNLIKELY(NumInsts == NextCheckpoint))
+      checkpoint(I);
+    ++NumInsts;
+    if (CurPhase == Faulty)
+      return;
+    auto It = Targets.find(&I);
+    if (It == Targets.end())
+      return;
+    uint64_t N = It->second.Count++;
+    if (CurPhase == Golden) {
+      auto Pos = Positions.find({It->second.ID, N});
+      if (Pos != Positions.end())
+        Pos->second = NumInsts - 1;
+    }
+  }
+
+  void print(raw_ostream &ROS) override {
+    ROS << "CampaignAction => Fork the runs of a fault campaign.\n";
+  }
+};
+
+} // end anonymous namespace
+
+/// getInjectionPoint - The faulted execution, the first one for a fault on
+/// every execution.
+static std::pair<uint32_t, uint64_t> getInjectionPoint(const FaultSpec &F) {
+  return {F.Inst,
+          F.Occurrence == FaultSpec::EveryOccurrence ? 0 : F.Occurrence};
+}
+
+/// forkOrDie - fork(), flushing first what both processes would write.
+static pid_t forkOrDie() {
+  outs().flush();
+  errs().flush();
+  pid_t Pid = ::fork();
+  if (Pid == -1)
+    report_fatal_error(Twine("fault campaign: cannot fork: ") +
+                       sys::StrError());
+  return Pid;
+}
+
+void CampaignAction::setInstructionIndex(const InstructionIndex * index) {
+  Action::setInstructionIndex(index);
+  Invalid.assign(FOpts.Faults.size(), false);
+  for (unsigned F = 0, e = FOpts.Faults.size(); F != e; ++F) {
+    const FaultSpec &Spec = FOpts.Faults[F];
+    Instruction *I = index->getInstruction(Spec.Inst);
+    const char *Why = I ? Spec.check(*I) : "no such instruction";
+    if (Why) {
+      Invalid[F] = true;
+      if (!NumInvalid++)
+        FirstInvalid = {F, Why};
+      continue;
+    }
+    Positions[getInjectionPoint(Spec)] = NoCheckpoint;
+    Targets[I] = {Spec.Inst, 0};
+  }
+}
+
+void CampaignAction::checkpoint(const Instruction &I) {
+  switch (CurPhase) {
+  case Start:
+    scout();
+    if (CurPhase == Golden)
+      recordHash(I);
+    else
+      forkRuns();
+    break;
+  case Golden:
+    recordHash(I);
+    break;
+  case Replay:
+    forkRuns();
+    break;
+  case Faulty:
+    compareHash(I);
+    break;
+  }
+}
+
+/// scout - Fork the golden run and wait for it.  Forked at the first
+/// instruction, it numbers the program allocations as the replay the faulty
+/// runs are forked from, so its state hashes hold for them whatever the
+/// host allocated since.
+void CampaignAction::scout() {
+  pid_t Pid = forkOrDie();
+  if (Pid == 0) {
+    CurPhase = Golden;
+    Hasher.track(FOpts.EarlyStop || FOpts.Dedup);
+    return;
+  }
+  int Status;
+  while (::waitpid(Pid, &Status, 0) == -1)
+    if (errno != EINTR)
+      report_fatal_error(Twine("fault campaign: waitpid failed: ") +
+                         sys::StrError());
+  if (!WIFEXITED(Status) || WEXITSTATUS(Status) != 0 ||
+      !Memory.getGolden().Done)
+    report_fatal_error("fault campaign: the golden run did not complete");
+  if (Memory.getGolden().Aborted)
+    report_fatal_error("fault campaign: the golden run went out of the run "
+                       "limits");
+  if (!Memory.getGolden().OutputSize)
+    report_fatal_error("fault campaign: the golden run has no output to "
+                       "compare the faulty runs with");
+  startReplay();
+}
+
+/// startReplay - Schedule the forks from the injection points found by the
+/// golden run.
+void CampaignAction::startReplay() {
+  const uint64_t *GoldenPositions = Memory.getPositions();
+  for (unsigned F = 0, e = FOpts.Faults.size(); F != e; ++F) {
+    uint64_t Pos = GoldenPositions[F];
+    if (Pos == NoCheckpoint) {
+      Outcomes[F] = FaultOutcome::NotInjected;
+      continue;
+    }
+    Schedule.push_back(F);
+    Checkpoints.push_back(Pos - Pos % Interval);
+  }
+  std::vector<unsigned> Order(Schedule.size());
+  for (unsigned i = 0, e = Order.size(); i != e; ++i)
+    Order[i] = i;
+  std::stable_sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+    return Checkpoints[A] < Checkpoints[B];
+  });
+  std::vector<unsigned> SortedSchedule;
+  std::vector<uint64_t> SortedCheckpoints;
+  for (unsigned i : Order) {
+    SortedSchedule.push_back(Schedule[i]);
+    SortedCheckpoints.push_back(Checkpoints[i]);
+  }
+  Schedule.swap(SortedSchedule);
+  Checkpoints.swap(SortedCheckpoints);
+  Cursor = 0;
+  CurPhase = Replay;
+}
+
+void CampaignAction::recordHash(const Instruction &I) {
+  uint64_t K = NumInsts / Interval;
+  if ((!FOpts.EarlyStop && !FOpts.Dedup) || K >= CampaignMemory::MaxHashes) {
+    NextCheckpoint = NoCheckpoint;
+    return;
+  }
+  Memory.getHashes()[K] = {Hasher.getStackHash(I), Hasher.getMemoryHash(),
+                           Hasher.getNumUntracked()};
+  Memory.getGolden().NumHashes = K + 1;
+  NextCheckpoint = NumInsts + Interval;
+}
+
+/// compareHash - End the faulty run as masked if it is back in the state of
+/// the golden run at the same instruction, or as the run whose state it
+/// reached.  The memory hash of the faulty run counts from the fork, the one
+/// of the golden run from the start.
+void CampaignAction::compareHash(const Instruction &I) {
+  uint64_t K = NumInsts / Interval;
+  const CampaignMemory::CheckpointHash *Hashes = Memory.getHashes();
+  const CampaignMemory::CheckpointHash &AtFork = Hashes[Forked / Interval];
+  // Past the end of the golden run, or after an untracked call, it cannot
+  // be compared any more; the other faulty runs only need the fork.
+  bool WithGolden = FOpts.EarlyStop && K < Memory.getGolden().NumHashes &&
+                    Hashes[K].Untracked == AtFork.Untracked;
+  if (Hasher.getNumUntracked() || (!WithGolden && !FOpts.Dedup)) {
+    NextCheckpoint = NoCheckpoint;
+    return;
+  }
+  NextCheckpoint = NumInsts + Interval;
+  if (!Injector.getNumInjected())
+    return;
+
+  CampaignMemory::FaultSlot &Slot = Memory.getSlot(Current);
+  uint64_t MemoryHash = AtFork.Memory ^ Hasher.getMemoryHash();
+  if (WithGolden && Hashes[K].Memory == MemoryHash &&
+      Hashes[K].Stack == Hasher.getStackHash(I)) {
+    Slot.Converged = 1;
+  } else if (FOpts.Dedup) {
+    CampaignMemory::StateKey Key = {K, Hasher.getStackHash(I), MemoryHash,
+                                    AtFork.Untracked};
+    int Other = Memory.findOrAddState(Key, Current);
+    if (Other < 0)
+      return;
+    Slot.SameAs = Other + 1;
+  } else {
+    return;
+  }
+  Slot.Injected = 1;
+  Slot.Executed = NumInsts - Forked;
+  Slot.Done = 1;
+  ::_exit(0);
+}
+
+void CampaignAction::forkRuns() {
+  while (!Stopped && Cursor != Schedule.size() &&
+         Checkpoints[Cursor] == NumInsts) {
+    if (forkRun(Schedule[Cursor]))
+      return;
+    ++Cursor;
+  }
+  NextCheckpoint = Stopped || Cursor == Schedule.size() ? NoCheckpoint
+                                                        : Checkpoints[Cursor];
+}
+
+bool CampaignAction::forkRun(unsigned F) {
+  while (Children.size() >= MaxChildren)
+    reap();
+  if (Stopped)
+    return false;
+  pid_t Pid = forkOrDie();
+  if (Pid != 0) {
+    Children[Pid] = F;
+    return false;
+  }
+
+  // The faulty run: its occurrences count from the checkpoint.
+  CurPhase = Faulty;
+  Current = F;
+  Forked = NumInsts;
+  FaultSpec Spec = FOpts.Faults[F];
+  if (Spec.Occurrence != FaultSpec::EveryOccurrence) {
+    Instruction *I = getInstructionIndex()->getInstruction(Spec.Inst);
+    Spec.Occurrence -= Targets[I].Count;
+  }
+  Injector.setSpecs(Spec, deriveJobSeed(Seed, F + 1));
+
+  // A fault on every execution keeps the run away from the golden state,
+  // and its state does not tell the rest of the run.
+  bool Compare = (FOpts.EarlyStop || FOpts.Dedup) &&
+                 Spec.Occurrence != FaultSpec::EveryOccurrence &&
+                 Forked / Interval < Memory.getGolden().NumHashes;
+  Hasher.track(Compare);
+  NextCheckpoint = Compare ? Forked + Interval : NoCheckpoint;
+  limitRun();
+  return true;
+}
+
+/// limitRun - Bound the faulty run: the instruction budget counts from the
+/// start of the run, as the golden run, and the clock restarts at the fork.
+void CampaignAction::limitRun() {
+  RunLimits Faulty = Limits;
+  if (FOpts.BudgetFactor > 0) {
+    double Budget = FOpts.BudgetFactor * Memory.getGolden().NumInsts;
+    uint64_t MaxInsts = Budget >= (double)~0ULL ? ~0ULL : (uint64_t)Budget;
+    if (!Faulty.MaxInsts || MaxInsts < Faulty.MaxInsts)
+      Faulty.MaxInsts = MaxInsts;
+  }
+  Engine->setRunLimits(Faulty);
+  // The interpreter cannot stop a run blocked in an external call: the
+  // alarm kills the child shortly after its timeout.
+  if (Faulty.Timeout > 0)
+    ::alarm((unsigned)std::min(std::ceil(Faulty.Timeout) + 1, 1e9));
+}
+
+void CampaignAction::reap() {
+  int Status;
+  pid_t Pid = ::waitpid(-1, &Status, 0);
+  if (Pid == -1) {
+    if (errno == EINTR)
+      return;
+    report_fatal_error(Twine("fault campaign: waitpid failed: ") +
+                       sys::StrError());
+  }
+  auto It = Children.find(Pid);
+  if (It == Children.end())
+    return;
+  unsigned F = It->second;
+  Children.erase(It);
+  bool Clean = WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+  if (WIFSIGNALED(Status) && WTERMSIG(Status) == SIGALRM)
+    Outcomes[F] = FaultOutcome::Timeout;
+  else if (!Clean || !Memory.getSlot(F).Done)
+    Outcomes[F] = FaultOutcome::Crash;
+  classify(F);
+  // A class of outputs goes once to the DFA.
+  if (DFA && Outcomes[F] == FaultOutcome::Faulty && Classes[ClassOf[F]] == F)
+    analyze(F);
+}
+
+/// analyze - Give the faulty output of F to the DFA, and stop forking once
+/// it recovers the key.
+void CampaignAction::analyze(unsigned F) {
+  const CampaignMemory::GoldenHeader &Golden = Memory.getGolden();
+  if (Memory.getPositions()[F] < (1 - FOpts.DFAWindow) * Golden.NumInsts) {
+    ++NumBeforeWindow;
+    return;
+  }
+  const CampaignMemory::FaultSlot &Slot = Memory.getSlot(F);
+  ArrayRef<uint8_t> Correct(Memory.getGoldenOutput(), Golden.OutputSize);
+  if (Slot.ExitCode != Golden.ExitCode ||
+      !DFA->addPair(Correct, makeArrayRef(Memory.getOutput(F),
+                                          Slot.OutputSize)))
+    return;
+  DFA->solve();
+  Stopped = DFA->isSolved();
+}
+
+/// classify - The outcome of a faulty run that exited.
+void CampaignAction::classify(unsigned F) {
+  if (Outcomes[F] != FaultOutcome::Pending)
+    return;
+  const CampaignMemory::GoldenHeader &Golden = Memory.getGolden();
+  CampaignMemory::FaultSlot &Slot = Memory.getSlot(F);
+  ReplayedInsts += Slot.Executed;
+  if (Slot.SameAs) {
+    // Decided once every run has ended.
+    SameAs[F] = Slot.SameAs - 1;
+    ++NumSameAs;
+  } else if (!Slot.Injected) {
+    Outcomes[F] = FaultOutcome::NotInjected;
+  } else if (Slot.Aborted) {
+    // A run the host could not have allocated for would have crashed.
+    Outcomes[F] = static_cast<RunAbort>(Slot.Aborted) == RunAbort::AllocLimit
+                    ? FaultOutcome::Crash
+                    : FaultOutcome::Timeout;
+  } else if (Slot.Converged) {
+    Outcomes[F] = FaultOutcome::Masked;
+    ++NumConverged;
+  } else if (Slot.ExitCode == Golden.ExitCode &&
+             makeArrayRef(Memory.getOutput(F), Slot.OutputSize) ==
+               makeArrayRef(Memory.getGoldenOutput(), Golden.OutputSize)) {
+    Outcomes[F] = FaultOutcome::Masked;
+  } else {
+    Outcomes[F] = FaultOutcome::Faulty;
+    addToClass(F);
+  }
+}
+
+void CampaignAction::addToClass(unsigned F) {
+  const CampaignMemory::FaultSlot &Slot = Memory.getSlot(F);
+  std::string Output(reinterpret_cast<const char *>(Memory.getOutput(F)),
+                     Slot.OutputSize);
+  auto Inserted = ClassIndex.insert(
+      {{Slot.ExitCode, std::move(Output)}, (unsigned)Classes.size()});
+  if (Inserted.second) {
+    Classes.push_back(F);
+    ClassSizes.push_back(0);
+  }
+  ClassOf[F] = Inserted.first->second;
+  ++ClassSizes[ClassOf[F]];
+}
+
+void CampaignAction::finish() {
+  // A chain ends on a run that stopped later, so it has no cycle.
+  for (unsigned F = 0, e = Outcomes.size(); F != e; ++F) {
+    if (SameAs[F] == NoFault)
+      continue;
+    unsigned Root = SameAs[F];
+    while (SameAs[Root] != NoFault)
+      Root = SameAs[Root];
+    SameAs[F] = Root;
+    Outcomes[F] = Outcomes[Root];
+    if (Outcomes[F] == FaultOutcome::Faulty) {
+      ClassOf[F] = ClassOf[Root];
+      ++ClassSizes[ClassOf[F]];
+    }
+  }
+  for (FaultOutcome &Outcome : Outcomes)
+    if (Outcome == FaultOutcome::Pending)
+      Outcome = FaultOutcome::Skipped;
+}
+
+void CampaignAction::reportGolden(TraceRecord &Record) {
+  CampaignMemory::GoldenHeader &Golden = Memory.getGolden();
+  Golden.Aborted = static_cast<uint8_t>(Engine->getRunAbort());
+  Golden.ExitCode = Record.ExitCode;
+  Golden.NumInsts = NumInsts;
+  Golden.OutputSize = std::min(Record.Output.size(), Memory.getOutputSize());
+  memcpy(Memory.getGoldenOutput(), Record.Output.data(), Golden.OutputSize);
+  uint64_t *GoldenPositions = Memory.getPositions();
+  for (unsigned F = 0, e = FOpts.Faults.size(); F != e; ++F)
+    GoldenPositions[F] = Invalid[F] ? NoCheckpoint :
+      Positions.lookup(getInjectionPoint(FOpts.Faults[F]));
+  Golden.Done = 1;
+}
+
+void CampaignAction::report(TraceRecord &Record) {
+  CampaignMemory::FaultSlot &Slot = Memory.getSlot(Current);
+  Slot.Injected = Injector.getNumInjected() != 0;
+  Slot.Aborted = static_cast<uint8_t>(Engine->getRunAbort());
+  Slot.ExitCode = Record.ExitCode;
+  Slot.Executed = NumInsts - Forked;
+  Slot.OutputSize = std::min(Record.Output.size(), Memory.getOutputSize());
+  memcpy(Memory.getOutput(Current), Record.Output.data(), Slot.OutputSize);
+  Slot.Done = 1;
+}
+
+void CampaignAction::endRun(TraceRecord &Record) {
+  // Nothing of the parent may run in a child: no destructor, no flush.
+  if (CurPhase == Golden) {
+    reportGolden(Record);
+    ::_exit(0);
+  }
+  if (CurPhase == Faulty) {
+    report(Record);
+    ::_exit(0);
+  }
+  while (!Children.empty())
+    reap();
+}
+
+static const char *getLimitName(RunAbort Abort) {
+  switch (Abort) {
+  case RunAbort::None:       return "none";
+  case RunAbort::InstLimit:  return "instructions";
+  case RunAbort::AllocLimit: return "allocation";
+  case RunAbort::Timeout:    return "clock";
+  }
+  llvm_unreachable("unknown run abort");
+}
+
+static Error writeResults(StringRef Path, const FaultCampaignOptions &FOpts,
+                          const CampaignAction &Campaign,
+                          CampaignMemory &Memory) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::F_Text);
+  if (EC)
+    return errorCodeToError(EC);
+  const CampaignMemory::GoldenHeader &Golden = Memory.getGolden();
+  OS << "# wyverse fault campaign: " << FOpts.Faults.size() << " faults\n"
+     << "# golden: exit " << Golden.ExitCode << " output "
+     << toHex(makeArrayRef(Memory.getGoldenOutput(), Golden.OutputSize),
+              /*LowerCase=*/true)
+     << " (" << Golden.NumInsts << " instructions)\n";
+  for (unsigned F = 0, e = FOpts.Faults.size(); F != e; ++F) {
+    FaultOutcome Outcome = Campaign.Outcomes[F];
+    FOpts.Faults[F].print(OS);
+    OS << ' ' << getOutcomeName(Outcome);
+    // A run stopped on the state of another ends as that one.
+    unsigned Root = Campaign.SameAs[F];
+    CampaignMemory::FaultSlot &Slot =
+      Memory.getSlot(Root == CampaignAction::NoFault ? F : Root);
+    if (Outcome == FaultOutcome::Masked && Slot.Converged)
+      OS << " converged";
+    else if (Slot.Done && Slot.Aborted)
+      OS << " limit " << getLimitName(static_cast<RunAbort>(Slot.Aborted));
+    else if (Outcome == FaultOutcome::Timeout)
+      OS << " limit alarm";
+    else if (Outcome == FaultOutcome::Faulty)
+      OS << " class " << Campaign.ClassOf[F];
+    if (Root != CampaignAction::NoFault)
+      OS << " same-state " << Root;
+    OS << '\n';
+  }
+  // The faulty outputs, once per class.
+  for (unsigned C = 0, e = Campaign.Classes.size(); C != e; ++C) {
+    unsigned F = Campaign.Classes[C];
+    CampaignMemory::FaultSlot &Slot = Memory.getSlot(F);
+    OS << "class " << C << ' ' << Campaign.ClassSizes[C] << " faults exit "
+       << Slot.ExitCode << " output "
+       << toHex(makeArrayRef(Memory.getOutput(F), Slot.OutputSize),
+                /*LowerCase=*/true)
+       << '\n';
+  }
+  if (OS.has_error())
+    return makeError("cannot write " + Path);
+  return Error::success();
+}
+
+Error runFaultCampaign(const BatchOptions &Opts,
+                       const FaultCampaignOptions &FOpts) {
+  if (Error E = checkBatchOptions(Opts))
+    return E;
+  if (FOpts.Faults.empty())
+    return makeError("fault campaign: no fault to inject");
+  // Without an output, every fault that keeps the exit code would look
+  // masked.
+  if (!Opts.OutputBinding.isBound() && !Opts.Capture.isEnabled())
+    return makeError("fault campaign: the faulty outputs need "
+                     "-harness-output or -capture-output");
+  if (FOpts.SolveAES && Opts.OutputSize != 16)
+    return makeError("fault campaign: the AES DFA needs a 16-byte output");
+  if (FOpts.SolveAES && !(FOpts.DFAWindow > 0 && FOpts.DFAWindow <= 1))
+    return makeError("fault campaign: the DFA window is a fraction of the "
+                     "golden run");
+  if (FOpts.BudgetFactor != 0 && !(FOpts.BudgetFactor >= 1))
+    return makeError("fault campaign: the instruction budget of a faulty "
+                     "run must be at least the golden run");
+
+  unsigned MaxChildren = Opts.NumThreads;
+  if (MaxChildren == 0)
+    MaxChildren = std::max(1u, std::thread::hardware_concurrency());
+
+  CampaignMemory Memory;
+  if (Error E = Memory.allocate(FOpts.Faults.size(), Opts.OutputSize))
+    return E;
+  FaultAction Injector(None);
+  StateHashAction Hasher;
+  // The memory faults are written by the injector, not by the program.
+  Injector.setWriteHook([&](const uint8_t *Addr, uint64_t Size) {
+    Hasher.toggleMemory(Addr, Size);
+  });
+  AESDFA DFA;
+  CampaignAction Campaign(FOpts, Opts.Limits, Injector, Hasher, Memory,
+                          FOpts.SolveAES ? &DFA : nullptr, Opts.Seed,
+                          MaxChildren);
+
+  BatchOptions CampaignOpts = Opts;
+  CampaignOpts.CreateActions = [&] {
+    ChainedAction *Chain = new ChainedAction();
+    Chain->addAction(&Campaign);
+    Chain->addAction(&Hasher);
+    Chain->addAction(&Injector);
+    return Chain;
+  };
+  BatchWorker Worker;
+  if (Error E = Worker.init(CampaignOpts))
+    return E;
+  Campaign.setEngine(&Worker.getEngine());
+  if (Campaign.NumInvalid) {
+    errs() << "warning: " << Campaign.NumInvalid
+           << " faults cannot be injected, e.g. ";
+    FOpts.Faults[Campaign.FirstInvalid.first].print(errs());
+    errs() << ": " << Campaign.FirstInvalid.second << "\n";
+  }
+
+  // The golden run is forked at the first instruction of the replay; only
+  // the parent returns from it, the children exit at their end.
+  auto Start = std::chrono::steady_clock::now();
+  TraceRecord Replay;
+  Replay.Seed = deriveJobSeed(Opts.Seed, 0);
+  Worker.run(CampaignOpts, Replay);
+  const CampaignMemory::GoldenHeader &Golden = Memory.getGolden();
+  if (!Golden.Done)
+    return makeError("fault campaign: the program executes no instruction");
+  if (Campaign.getNumInsts() != Golden.NumInsts ||
+      Replay.ExitCode != Golden.ExitCode ||
+      makeArrayRef(Replay.Output).take_front(Memory.getOutputSize()) !=
+        makeArrayRef(Memory.getGoldenOutput(), Golden.OutputSize))
+    return makeError("fault campaign: the golden run is not reproducible, "
+                     "the faults were injected at the wrong places");
+
+  Campaign.finish();
+  unsigned Counts[7] = {0, 0, 0, 0, 0, 0, 0};
+  for (FaultOutcome Outcome : Campaign.Outcomes)
+    ++Counts[static_cast<unsigned>(Outcome)];
+  std::chrono::duration<double> Elapsed =
+    std::chrono::steady_clock::now() - Start;
+
+  if (!FOpts.OutputFile.empty())
+    if (Error E = writeResults(FOpts.OutputFile, FOpts, Campaign, Memory))
+      return E;
+
+  uint64_t NumRuns = FOpts.Faults.size() -
+    Counts[static_cast<unsigned>(FaultOutcome::NotInjected)] -
+    Counts[static_cast<unsigned>(FaultOutcome::Skipped)];
+  outs() << FOpts.Faults.size() << " faults: "
+         << Counts[static_cast<unsigned>(FaultOutcome::Masked)] << " masked ("
+         << Campaign.NumConverged << " stopped early), "
+         << Counts[static_cast<unsigned>(FaultOutcome::Faulty)] << " faulty ("
+         << Campaign.Classes.size() << " classes), "
+         << Counts[static_cast<unsigned>(FaultOutcome::Crash)] << " crashed, "
+         << Counts[static_cast<unsigned>(FaultOutcome::Timeout)]
+         << " timed out, "
+         << Counts[static_cast<unsigned>(FaultOutcome::NotInjected)]
+         << " not injected";
+  if (Counts[static_cast<unsigned>(FaultOutcome::Skipped)])
+    outs() << ", " << Counts[static_cast<unsigned>(FaultOutcome::Skipped)]
+           << " skipped";
+  outs() << "\n";
+  if (Campaign.NumSameAs)
+    outs() << Campaign.NumSameAs
+           << " faulty runs stopped on the state of another run\n";
+  outs() << format("golden run of %llu instructions, a faulty run executes "
+                   "%.0f of them on average; done in %.2fs\n",
+                   (unsigned long long)Golden.NumInsts,
+                   NumRuns ? double(Campaign.ReplayedInsts) / NumRuns : 0.0,
+                   Elapsed.count());
+  if (!FOpts.OutputFile.empty())
+    outs() << "outcomes written to " << FOpts.OutputFile << "\n";
+  if (FOpts.SolveAES) {
+    if (Campaign.NumBeforeWindow)
+      outs() << Campaign.NumBeforeWindow << " faulty outputs injected before "
+             << "the last " << format("%g", FOpts.DFAWindow * 100)
+             << "% of the golden run, not given to the DFA\n";
+    DFA.print(outs());
+  }
+  return Error::success();
+}
+
+#else
+
+Error runFaultCampaign(const BatchOptions &Opts,
+                       const FaultCampaignOptions &FOpts) {
+  return makeError("fault campaigns need fork()");
+}
+
+#endif
+
+} // End wyverse namespace
@@ -0,0 +1,102 @@
+//===-- FaultCampaign.h - Checkpointed fault injection campaign -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A fault campaign runs the first input of the batch once per fault and
+// classifies each faulty run against the golden (fault-free) run.
+//
+// The golden run is executed twice.  The first execution, forked at the
+// first instruction of the second one, counts the dynamic instructions and
+// locates the injection point of every fault.  The second one stops at
+// checkpoints, every CheckpointInterval dynamic instructions, and forks a
+// faulty run from the checkpoint that precedes each injection point: the
+// child process arms its fault action and executes the rest of the run, the
+// parent resumes the golden run.  A fault in the last rounds of a cipher
+// then costs the tail of the execution instead of the whole run.
+//
+// The program heap is host memory that the interpreter does not track, so a
+// checkpoint cannot be restored in place; the fork gives a copy-on-write
+// image of the whole process at the checkpoint instead.  The faulty runs
+// write their output in shared memory, and a crash only kills its child.
+//
+// Most faults are masked.  The first golden execution records a hash of the
+// program state at each checkpoint (see StateHash.h), and with EarlyStop a
+// faulty run compares its state at the next checkpoints: back on the golden
+// state, it is masked and stops there.  The host allocates between the
+// forks, so the runs may not have the same memory layout: the hashes take
+// the pointers into the blocks the program allocated relative to their
+// block, numbered the same in every run.
+//
+// Different faults often have the same effect: with Dedup, a faulty run
+// also publishes its state hash at each checkpoint after the injection, in
+// a table shared by the runs, and stops as soon as it reaches a state that
+// another faulty run published at the same checkpoint; it takes the outcome
+// of that run.  The faulty outputs are then grouped in classes of identical
+// (exit code, output): the DFA gets each class once, and the result file
+// gives the class of each faulty run and the output of each class once.
+//
+// A fault easily sends the program into an endless loop.  A faulty run gets
+// a budget of BudgetFactor times the instructions of the golden run, on top
+// of the run limits of the batch; it ends as a timeout once out of it or of
+// the clock (the child is also killed by an alarm shortly after, should it
+// block in an external call).
+//
+// With SolveAES the output is an AES-128 ciphertext: the faulty outputs go
+// to the differential fault analysis (see AESDFA.h) as the runs end, and no
+// run is forked any more once the key is recovered.  Only the faults
+// injected in the last DFAWindow of the golden run go to it: those of the
+// earlier rounds change the whole ciphertext too, and only add noise.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_FAULTCAMPAIGN_H
+#define LLVM_TOOLS_WYVERSE_FAULTCAMPAIGN_H
+
+#include "BatchMode.h"
+#include "llvm/ExecutionEngine/FaultAction.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wyverse {
+
+enum class FaultOutcome : uint8_t {
+  Pending,
+  Masked,          // same output and exit code as the golden run
+  Faulty,          // different output or exit code
+  Crash,           // the run died, or went out of the allocation limit
+  Timeout,         // out of the instruction budget or of the clock
+  NotInjected,     // the faulted execution never happens
+  Skipped,         // not run, the DFA had recovered the key
+};
+
+const char *getOutcomeName(FaultOutcome Outcome);
+
+struct FaultCampaignOptions {
+  std::vector<llvm::FaultSpec> Faults;       // one run each
+  uint64_t CheckpointInterval = 10000;       // dynamic instructions
+  bool EarlyStop = true;                     // on the golden state
+  bool Dedup = true;                         // on the state of another run
+  bool SolveAES = false;                     // AES DFA on the outputs
+  double DFAWindow = 0.25;                   // of the golden run, at its end
+  // Instruction budget of a faulty run, as a multiple of the golden run (0:
+  // only the limits of the batch).
+  double BudgetFactor = 4;
+  std::string OutputFile;                    // one line per fault
+};
+
+/// runFaultCampaign - Inject each fault in its own run of the first input of
+/// the batch, and write the outcomes.  Opts.NumThreads bounds the number of
+/// faulty runs alive at a time.
+llvm::Error runFaultCampaign(const BatchOptions &Opts,
+                             const FaultCampaignOptions &FOpts);
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,131 @@
+//===-- Harness.cpp - Direct input/output binding of the program ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Harness.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+namespace wyverse {
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+Expected<HarnessBinding> HarnessBinding::parse(StringRef Spec) {
+  HarnessBinding Binding;
+  if (Spec.empty())
+    return Binding;
+
+  StringRef Kind, Target;
+  std::tie(Kind, Target) = Spec.split(':');
+  if (Kind == "arg" && !Target.getAsInteger(10, Binding.ArgNo)) {
+    Binding.K = Argument;
+    return Binding;
+  }
+  if (Kind == "global" && !Target.empty()) {
+    Binding.K = Global;
+    Binding.GlobalName = Target;
+    return Binding;
+  }
+  return makeError("invalid harness binding '" + Spec +
+                   "', expected arg:N or global:NAME");
+}
+
+Expected<uint8_t *> Harness::resolve(ExecutionEngine &EE, Function &Entry,
+                                     const HarnessBinding &Binding,
+                                     size_t Size,
+                                     std::vector<uint8_t> &Buffer) {
+  switch (Binding.K) {
+  case HarnessBinding::None:
+    return nullptr;
+
+  case HarnessBinding::Argument: {
+    FunctionType *FTy = Entry.getFunctionType();
+    if (Binding.ArgNo >= FTy->getNumParams() ||
+        !FTy->getParamType(Binding.ArgNo)->isPointerTy())
+      return makeError("argument " + Twine(Binding.ArgNo) + " of '" +
+                       Entry.getName() + "' is not a pointer");
+    Buffer.assign(Size, 0);
+    Args[Binding.ArgNo] = PTOGV(Buffer.data());
+    return Buffer.data();
+  }
+
+  case HarnessBinding::Global: {
+    GlobalVariable *GV =
+      EE.FindGlobalVariableNamed(Binding.GlobalName, /*AllowInternal=*/true);
+    if (!GV || GV->isDeclaration())
+      return makeError("global '" + Binding.GlobalName + "' not found");
+    if (EE.getDataLayout().getTypeAllocSize(GV->getValueType()) < Size)
+      return makeError("global '" + Binding.GlobalName + "' is smaller than " +
+                       Twine(Size) + " bytes");
+    return static_cast<uint8_t *>(EE.getPointerToGlobal(GV));
+  }
+  }
+  llvm_unreachable("unknown binding kind");
+}
+
+Error Harness::bind(ExecutionEngine &EE, Function &Entry,
+                    const HarnessBinding &In, size_t InSize,
+                    const HarnessBinding &Out, size_t OutSize) {
+  InputBinding = In;
+  OutputBinding = Out;
+  InputSize = InSize;
+  OutputSize = OutSize;
+
+  // The unbound arguments are zero / null.
+  FunctionType *FTy = Entry.getFunctionType();
+  Args.assign(FTy->getNumParams(), GenericValue());
+  for (unsigned i = 0; i != FTy->getNumParams(); ++i) {
+    Type *Ty = FTy->getParamType(i);
+    if (Ty->isIntegerTy())
+      Args[i].IntVal = APInt(Ty->getIntegerBitWidth(), 0);
+    else
+      Args[i].PointerVal = nullptr;
+  }
+
+  auto InOrErr = resolve(EE, Entry, In, InSize, InputBuffer);
+  if (!InOrErr)
+    return InOrErr.takeError();
+  Input = *InOrErr;
+
+  auto OutOrErr = resolve(EE, Entry, Out, OutSize, OutputBuffer);
+  if (!OutOrErr)
+    return OutOrErr.takeError();
+  Output = *OutOrErr;
+
+  if (In.K == HarnessBinding::Argument && Out.K == HarnessBinding::Argument &&
+      In.ArgNo == Out.ArgNo) {
+    // in-place transformation: a single buffer, large enough for both
+    OutputBuffer.clear();
+    InputBuffer.resize(std::max(InSize, OutSize), 0);
+    Input = Output = InputBuffer.data();
+    Args[In.ArgNo] = PTOGV(Input);
+  }
+  return Error::success();
+}
+
+void Harness::writeInput(ArrayRef<uint8_t> Bytes) {
+  if (!OutputBuffer.empty())
+    memset(OutputBuffer.data(), 0, OutputBuffer.size());
+  if (Input)
+    memcpy(Input, Bytes.data(), std::min(Bytes.size(), InputSize));
+}
+
+void Harness::readOutput(std::vector<uint8_t> &Bytes) const {
+  if (!Output)
+    return;
+  Bytes.assign(Output, Output + OutputSize);
+}
+
+} // End wyverse namespace
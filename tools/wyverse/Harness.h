@@ -0,0 +1,89 @@
+//===-- Harness.h - Direct input/output binding of the program --*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A harness binds the input and the output buffers of a run to places in the
+// program, so that batch mode can call e.g.
+//
+//   void encrypt(uint8_t *in, uint8_t *out);
+//
+// with -entry-function=encrypt -harness-input=arg:0 -harness-output=arg:1,
+// instead of going through argv, sscanf() and printf().  A buffer is either
+// a pointer argument of the entry function (arg:N), in which case the buffer
+// is owned by the harness, or a global variable of the program (global:NAME).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_HARNESS_H
+#define LLVM_TOOLS_WYVERSE_HARNESS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wyverse {
+
+struct HarnessBinding {
+  enum Kind { None, Argument, Global };
+
+  Kind K = None;
+  unsigned ArgNo = 0;
+  std::string GlobalName;
+
+  bool isBound() const { return K != None; }
+
+  /// parse - "arg:N", "global:NAME" or "" (not bound).
+  static llvm::Expected<HarnessBinding> parse(llvm::StringRef Spec);
+};
+
+/// Harness - The binding of one worker, resolved against its module.
+class Harness {
+  HarnessBinding InputBinding, OutputBinding;
+  size_t InputSize = 0, OutputSize = 0;
+
+  std::vector<uint8_t> InputBuffer, OutputBuffer;  // for argument bindings
+  uint8_t *Input = nullptr;
+  uint8_t *Output = nullptr;
+  std::vector<llvm::GenericValue> Args;
+
+  llvm::Expected<uint8_t *> resolve(llvm::ExecutionEngine &EE,
+                                    llvm::Function &Entry,
+                                    const HarnessBinding &Binding,
+                                    size_t Size, std::vector<uint8_t> &Buffer);
+
+public:
+  llvm::Error bind(llvm::ExecutionEngine &EE, llvm::Function &Entry,
+                   const HarnessBinding &In, size_t InSize,
+                   const HarnessBinding &Out, size_t OutSize);
+
+  /// callsEntryDirectly - The entry function takes bound arguments and is
+  /// called with getArguments() instead of the argv of main().
+  bool callsEntryDirectly() const {
+    return InputBinding.K == HarnessBinding::Argument ||
+           OutputBinding.K == HarnessBinding::Argument;
+  }
+  bool hasInput() const { return InputBinding.isBound(); }
+  bool hasOutput() const { return OutputBinding.isBound(); }
+
+  /// writeInput - Store the input of the next run in the program memory.
+  void writeInput(llvm::ArrayRef<uint8_t> Bytes);
+  /// readOutput - Fetch the output of the last run.
+  void readOutput(std::vector<uint8_t> &Bytes) const;
+
+  llvm::ArrayRef<llvm::GenericValue> getArguments() const { return Args; }
+};
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,127 @@
+//===-- InputGenerator.cpp - Inputs of batch campaigns --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "InputGenerator.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+namespace wyverse {
+
+void philox4x32(const uint32_t Counter[4], uint64_t Key, uint32_t Out[4]) {
+  uint32_t C0 = Counter[0], C1 = Counter[1], C2 = Counter[2], C3 = Counter[3];
+  uint32_t K0 = (uint32_t)Key, K1 = (uint32_t)(Key >> 32);
+  for (unsigned Round = 0; Round != 10; ++Round) {
+    uint64_t P0 = (uint64_t)0xD2511F53U * C0;
+    uint64_t P1 = (uint64_t)0xCD9E8D57U * C2;
+    uint32_t N0 = (uint32_t)(P1 >> 32) ^ C1 ^ K0;
+    uint32_t N2 = (uint32_t)(P0 >> 32) ^ C3 ^ K1;
+    C0 = N0;
+    C1 = (uint32_t)P1;
+    C2 = N2;
+    C3 = (uint32_t)P0;
+    K0 += 0x9E3779B9U;
+    K1 += 0xBB67AE85U;
+  }
+  Out[0] = C0;
+  Out[1] = C1;
+  Out[2] = C2;
+  Out[3] = C3;
+}
+
+// Random stream numbers, part of the Philox counter.
+enum : uint32_t {
+  InputStream = 0,
+  ClassStream = 1,
+};
+
+void InputGenerator::random(uint64_t Index, uint32_t Stream,
+                            uint8_t *Bytes) const {
+  uint32_t Counter[4] = {(uint32_t)Index, (uint32_t)(Index >> 32), 0, Stream};
+  uint32_t Block[4];
+  for (size_t Offset = 0; Offset < InputSize; Offset += sizeof(Block)) {
+    philox4x32(Counter, Key, Block);
+    memcpy(Bytes + Offset, Block,
+           std::min(sizeof(Block), InputSize - Offset));
+    ++Counter[2];
+  }
+}
+
+Expected<std::unique_ptr<InputGenerator>>
+InputGenerator::create(InputMode Mode, size_t InputSize, uint64_t Seed,
+                       ArrayRef<uint8_t> Fixed, StringRef ReplayFile) {
+  if (InputSize == 0)
+    return make_error<StringError>("the input size must not be zero",
+                                   inconvertibleErrorCode());
+
+  std::unique_ptr<InputGenerator> Gen(
+      new InputGenerator(Mode, InputSize, Seed));
+
+  if (Mode == InputMode::FixedVsRandom) {
+    if (!Fixed.empty() && Fixed.size() != InputSize)
+      return make_error<StringError>(
+          "the fixed input must be " + Twine(InputSize) + " bytes long",
+          inconvertibleErrorCode());
+    Gen->Fixed.assign(Fixed.begin(), Fixed.end());
+    Gen->Fixed.resize(InputSize, 0);
+  }
+
+  if (Mode == InputMode::Replay) {
+    // Large files are memory-mapped, runs only touch their own input.
+    auto BufferOrErr = MemoryBuffer::getFile(ReplayFile, /*FileSize=*/-1,
+                                             /*RequiresNullTerminator=*/false);
+    if (!BufferOrErr)
+      return make_error<StringError>("cannot open input file '" + ReplayFile +
+                                         "'",
+                                     BufferOrErr.getError());
+    Gen->ReplayBuffer = std::move(*BufferOrErr);
+    if (Gen->ReplayBuffer->getBufferSize() % InputSize != 0)
+      return make_error<StringError>(
+          "the size of '" + ReplayFile + "' is not a multiple of the input "
+          "size (" + Twine(InputSize) + " bytes)",
+          inconvertibleErrorCode());
+  }
+
+  return std::move(Gen);
+}
+
+uint64_t InputGenerator::getNumInputs() const {
+  if (Mode == InputMode::Replay)
+    return ReplayBuffer->getBufferSize() / InputSize;
+  return ~0ULL;
+}
+
+bool InputGenerator::generate(uint64_t Index, uint8_t *Bytes) const {
+  switch (Mode) {
+  case InputMode::Replay:
+    memcpy(Bytes, ReplayBuffer->getBufferStart() + Index * InputSize,
+           InputSize);
+    return false;
+  case InputMode::FixedVsRandom: {
+    uint32_t Counter[4] = {(uint32_t)Index, (uint32_t)(Index >> 32), 0,
+                           ClassStream};
+    uint32_t Block[4];
+    philox4x32(Counter, Key, Block);
+    if (Block[0] & 1) {
+      memcpy(Bytes, Fixed.data(), InputSize);
+      return true;
+    }
+    random(Index, InputStream, Bytes);
+    return false;
+  }
+  case InputMode::Random:
+  case InputMode::None:
+    break;
+  }
+  random(Index, InputStream, Bytes);
+  return false;
+}
+
+} // End wyverse namespace
@@ -0,0 +1,73 @@
+//===-- InputGenerator.h - Inputs of batch campaigns ------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Produces the input bytes of each run of a batch.  The generator is
+// stateless: the input of run i is a function of the campaign seed and of i
+// only (Philox4x32-10 in counter mode), so the workers can draw their inputs
+// in any order and the campaign is still reproducible.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_INPUTGENERATOR_H
+#define LLVM_TOOLS_WYVERSE_INPUTGENERATOR_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace wyverse {
+
+enum class InputMode {
+  None,           // inputs come from -batch-inputs
+  Random,         // uniformly random inputs
+  FixedVsRandom,  // TVLA: each run draws the fixed input or a random one
+  Replay,         // inputs read from a binary file, back to back
+};
+
+/// Philox4x32-10 block: 128 random bits from a 128-bit counter and a 64-bit
+/// key (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+void philox4x32(const uint32_t Counter[4], uint64_t Key, uint32_t Out[4]);
+
+class InputGenerator {
+  InputMode Mode;
+  size_t InputSize;
+  uint64_t Key;
+  std::vector<uint8_t> Fixed;
+  std::unique_ptr<llvm::MemoryBuffer> ReplayBuffer;
+
+  InputGenerator(InputMode Mode, size_t InputSize, uint64_t Seed)
+    : Mode(Mode), InputSize(InputSize), Key(Seed) {}
+
+  void random(uint64_t Index, uint32_t Stream, uint8_t *Bytes) const;
+
+public:
+  /// create - \p Fixed is the fixed input of a fixed-vs-random campaign (all
+  /// zeros when empty), \p ReplayFile the input file of a replay.
+  static llvm::Expected<std::unique_ptr<InputGenerator>>
+  create(InputMode Mode, size_t InputSize, uint64_t Seed,
+         llvm::ArrayRef<uint8_t> Fixed, llvm::StringRef ReplayFile);
+
+  size_t getInputSize() const { return InputSize; }
+
+  /// getNumInputs - Number of inputs available, unbounded (~0) unless the
+  /// inputs are replayed from a file.
+  uint64_t getNumInputs() const;
+
+  /// generate - Write the input of run \p Index to \p Bytes (getInputSize()
+  /// bytes).  Returns true if the run belongs to the fixed class.
+  bool generate(uint64_t Index, uint8_t *Bytes) const;
+};
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,169 @@
+//===-- JobScheduler.h - Work-stealing scheduler for batch runs -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs a list of jobs on a fixed set of workers.  Each worker owns a deque of
+// jobs: it pops its own jobs from the front and, once it runs dry, steals from
+// the back of the other deques, so that a few slow runs do not leave the other
+// cores idle at the end of a campaign.
+//
+// The results go through a reorder buffer and are emitted strictly in job
+// order, whatever the order they complete in.  Together with the per-job seed
+// (derived from the job index only), the emitted stream does not depend on
+// the number of workers nor on the scheduling.
+//
+// stop() ends a campaign early: no job is started any more and the results
+// after the one being emitted are dropped, so the emitted stream is still a
+// prefix of the campaign.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_JOBSCHEDULER_H
+#define LLVM_TOOLS_WYVERSE_JOBSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wyverse {
+
+/// deriveJobSeed - Seed of the job \p Index of a campaign (SplitMix64 of the
+/// campaign seed and of the index).
+inline uint64_t deriveJobSeed(uint64_t CampaignSeed, uint64_t Index) {
+  uint64_t Z = CampaignSeed + (Index + 1) * 0x9E3779B97F4A7C15ULL;
+  Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+  return Z ^ (Z >> 31);
+}
+
+template <typename ResultT>
+class JobScheduler {
+public:
+  /// Execute(Worker, JobIndex, Result) runs one job on the given worker.
+  using ExecuteFn = std::function<void(unsigned, uint64_t, ResultT &)>;
+  /// Emit(Result) receives the results in job order, one call at a time.
+  using EmitFn = std::function<void(ResultT &)>;
+
+private:
+  struct WorkerQueue {
+    std::mutex Lock;
+    std::deque<uint64_t> Jobs;
+  };
+
+  std::vector<WorkerQueue> Queues;
+  uint64_t Window;
+  std::atomic<bool> Stopped;
+
+  // reorder buffer
+  std::mutex ReorderLock;
+  std::condition_variable WindowCV;
+  std::map<uint64_t, ResultT> Pending;
+  uint64_t NextEmit = 0;
+  bool Draining = false;
+
+  bool popOwn(unsigned Worker, uint64_t &Job) {
+    WorkerQueue &Q = Queues[Worker];
+    std::lock_guard<std::mutex> Guard(Q.Lock);
+    if (Q.Jobs.empty())
+      return false;
+    Job = Q.Jobs.front();
+    Q.Jobs.pop_front();
+    return true;
+  }
+
+  bool steal(unsigned Thief, uint64_t &Job) {
+    for (unsigned i = 1; i < Queues.size(); ++i) {
+      WorkerQueue &Q = Queues[(Thief + i) % Queues.size()];
+      std::lock_guard<std::mutex> Guard(Q.Lock);
+      if (Q.Jobs.empty())
+        continue;
+      Job = Q.Jobs.back();
+      Q.Jobs.pop_back();
+      return true;
+    }
+    return false;
+  }
+
+  // Do not run too far ahead of the emitted results, the reorder buffer
+  // would grow without bound behind a slow job.
+  void waitForWindow(uint64_t Job) {
+    std::unique_lock<std::mutex> Guard(ReorderLock);
+    WindowCV.wait(Guard,
+                  [&] { return Stopped || Job < NextEmit + Window; });
+  }
+
+  void complete(uint64_t Job, ResultT &&Result, EmitFn &Emit) {
+    std::unique_lock<std::mutex> Guard(ReorderLock);
+    Pending.emplace(Job, std::move(Result));
+    // A single worker drains the buffer at a time, the others just leave
+    // their result behind.
+    if (Draining)
+      return;
+    Draining = true;
+    while (!Stopped) {
+      auto It = Pending.find(NextEmit);
+      if (It == Pending.end())
+        break;
+      ResultT Ready = std::move(It->second);
+      Pending.erase(It);
+      Guard.unlock();
+      Emit(Ready);
+      Guard.lock();
+      ++NextEmit;
+      WindowCV.notify_all();
+    }
+    Draining = false;
+  }
+
+public:
+  /// \p Window bounds the number of jobs that can be started ahead of the
+  /// oldest job whose result was not emitted yet.
+  JobScheduler(unsigned NumWorkers, uint64_t Window)
+    : Queues(NumWorkers ? NumWorkers : 1), Window(Window ? Window : 1),
+      Stopped(false) {}
+
+  /// stop - Called from Emit, the result being emitted is the last one.
+  void stop() {
+    std::lock_guard<std::mutex> Guard(ReorderLock);
+    Stopped = true;
+    WindowCV.notify_all();
+  }
+
+  void run(uint64_t NumJobs, ExecuteFn Execute, EmitFn Emit) {
+    // Deal the jobs round-robin, so that every worker starts close to the
+    // head of the campaign.
+    for (uint64_t Job = 0; Job != NumJobs; ++Job)
+      Queues[Job % Queues.size()].Jobs.push_back(Job);
+
+    std::vector<std::thread> Threads;
+    for (unsigned Worker = 0; Worker != Queues.size(); ++Worker)
+      Threads.emplace_back([this, Worker, &Execute, &Emit] {
+        uint64_t Job;
+        while (!Stopped && (popOwn(Worker, Job) || steal(Worker, Job))) {
+          waitForWindow(Job);
+          if (Stopped)
+            break;
+          ResultT Result;
+          Execute(Worker, Job, Result);
+          complete(Job, std::move(Result), Emit);
+        }
+      });
+    for (std::thread &T : Threads)
+      T.join();
+  }
+};
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,70 @@
+//===-- OutputCapture.cpp - Extract the output from the program text ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "OutputCapture.h"
+#include "llvm/ADT/StringExtras.h"
+#include <cctype>
+
+using namespace llvm;
+
+namespace wyverse {
+
+Expected<CaptureRule> CaptureRule::parse(StringRef Spec) {
+  CaptureRule Rule;
+  if (Spec.empty())
+    return Rule;
+  if (Spec == "raw") {
+    Rule.K = Raw;
+    return Rule;
+  }
+  if (Spec == "hex" || Spec.startswith("hex:")) {
+    Rule.K = Hex;
+    Rule.Marker = Spec.size() > 3 ? Spec.drop_front(4) : "";
+    return Rule;
+  }
+  return make_error<StringError>("invalid capture rule '" + Spec +
+                                     "', expected hex, hex:MARKER or raw",
+                                 inconvertibleErrorCode());
+}
+
+bool CaptureRule::extract(StringRef Text, size_t Size,
+                          std::vector<uint8_t> &Bytes) const {
+  Bytes.clear();
+  if (K == Raw) {
+    Text = Text.take_front(Size);
+    Bytes.assign(Text.bytes_begin(), Text.bytes_end());
+    return true;
+  }
+
+  if (!Marker.empty()) {
+    size_t Pos = Text.find(Marker);
+    if (Pos == StringRef::npos)
+      return false;
+    Text = Text.drop_front(Pos + Marker.size());
+  }
+
+  while (Bytes.size() < Size && !Text.empty()) {
+    if (Text.startswith("0x") || Text.startswith("0X")) {
+      if (Text.size() > 3 && isHexDigit(Text[2]) && isHexDigit(Text[3]))
+        Text = Text.drop_front(2);
+    }
+    if (Text.size() >= 2 && isHexDigit(Text[0]) && isHexDigit(Text[1])) {
+      Bytes.push_back(hexDigitValue(Text[0]) << 4 | hexDigitValue(Text[1]));
+      Text = Text.drop_front(2);
+      continue;
+    }
+    char C = Text.front();
+    if (!isspace((unsigned char)C) && C != ':' && C != ',')
+      break;
+    Text = Text.drop_front();
+  }
+  return true;
+}
+
+} // End wyverse namespace
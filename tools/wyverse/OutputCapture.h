@@ -0,0 +1,51 @@
+//===-- OutputCapture.h - Extract the output from the program text -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// In batch mode the standard output / error of the program are captured in
+// per-run buffers.  A capture rule turns the captured text into the binary
+// output field of the trace record:
+//
+//   hex             the first hex bytes printed on stdout
+//   hex:MARKER      the hex bytes printed after the first occurrence of MARKER
+//   raw             the first bytes of stdout, as they are
+//
+// Separators (blanks, ':', ',', "0x" prefixes) between hex bytes are skipped.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_OUTPUTCAPTURE_H
+#define LLVM_TOOLS_WYVERSE_OUTPUTCAPTURE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wyverse {
+
+struct CaptureRule {
+  enum Kind { None, Hex, Raw };
+
+  Kind K = None;
+  std::string Marker;
+
+  bool isEnabled() const { return K != None; }
+
+  static llvm::Expected<CaptureRule> parse(llvm::StringRef Spec);
+
+  /// extract - Decode up to \p Size bytes from \p Text into \p Bytes.
+  /// Returns false if the marker was not found.
+  bool extract(llvm::StringRef Text, size_t Size,
+               std::vector<uint8_t> &Bytes) const;
+};
+
+} // End wyverse namespace
+
+#endif
@@ -0,0 +1,425 @@
+//===-- WorkerPool.cpp - Batch runs in crash-isolated processes -----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "WorkerPool.h"
+#include "JobScheduler.h"
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <csignal>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace wyverse {
+
+static Error makeError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+#ifdef LLVM_ON_UNIX
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+namespace {
+
+/// RecordHeader - A trace record in a slot is this header followed by the
+/// sample instructions, the input, the output and the samples.
+struct RecordHeader {
+  uint64_t Index;
+  uint64_t Seed;
+  int32_t ExitCode;
+  uint8_t FixedInput;
+  uint8_t Abort;                   // RunAbort
+  uint64_t InputSize;
+  uint64_t OutputSize;
+  uint64_t NumSamples;
+  uint64_t NumSampleInsts;
+};
+
+/// JobMessage - Sent by the parent to start a run.
+struct JobMessage {
+  uint64_t Index;
+  uint64_t CollectSampleInsts;
+};
+
+// Address space of the slot of a worker, only the pages written are
+// allocated.
+const size_t SlotCapacity = size_t(1) << 30;
+
+/// Worker - A worker process, seen from the parent.
+struct Worker {
+  pid_t Pid = -1;
+  int ToChild = -1;                // JobMessage
+  int FromChild = -1;              // size of the record, 0 if it did not fit
+  uint8_t *Slot = nullptr;
+  bool Busy = false;
+  bool Killed = false;             // past the timeout
+  uint64_t Job = 0;
+  std::chrono::steady_clock::time_point Started;
+};
+
+class WorkerPool {
+  const BatchOptions &Opts;
+  BatchWorker &Template;
+  std::vector<Worker> Workers;
+  struct sigaction OldSigPipe;
+
+  Error spawn(Worker &W);
+  void reap(Worker &W);
+
+public:
+  WorkerPool(const BatchOptions &Opts, BatchWorker &Template)
+    : Opts(Opts), Template(Template) {}
+  ~WorkerPool() { shutdown(); }
+
+  Error start(unsigned NumWorkers);
+  void shutdown();
+  Error run(uint64_t NumJobs,
+            const std::function<bool(TraceRecord &)> &Emit,
+            WorkerPoolStats &Stats);
+};
+
+} // end anonymous namespace
+
+static bool readAll(int FD, void *Buf, size_t Size) {
+  uint8_t *P = static_cast<uint8_t *>(Buf);
+  while (Size) {
+    ssize_t N = ::read(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+static bool writeAll(int FD, const void *Buf, size_t Size) {
+  const uint8_t *P = static_cast<const uint8_t *>(Buf);
+  while (Size) {
+    ssize_t N = ::write(FD, P, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    P += N;
+    Size -= N;
+  }
+  return true;
+}
+
+/// storeRecord - Write Record in Slot, returns its size or 0 if it does not
+/// fit.
+static uint64_t storeRecord(const TraceRecord &Record, RunAbort Abort,
+                            uint8_t *Slot) {
+  RecordHeader H;
+  memset(&H, 0, sizeof(H));
+  H.Index = Record.Index;
+  H.Seed = Record.Seed;
+  H.ExitCode = Record.ExitCode;
+  H.FixedInput = Record.FixedInput;
+  H.Abort = static_cast<uint8_t>(Abort);
+  H.InputSize = Record.Input.size();
+  H.OutputSize = Record.Output.size();
+  H.NumSamples = Record.Samples.size();
+  H.NumSampleInsts = Record.SampleInsts.size();
+  uint64_t Size = sizeof(H) + H.NumSampleInsts * sizeof(uint32_t) +
+                  H.InputSize + H.OutputSize + H.NumSamples;
+  if (Size > SlotCapacity)
+    return 0;
+
+  uint8_t *P = Slot;
+  auto Put = [&](const void *Data, size_t N) {
+    if (N)
+      memcpy(P, Data, N);
+    P += N;
+  };
+  Put(&H, sizeof(H));
+  Put(Record.SampleInsts.data(), H.NumSampleInsts * sizeof(uint32_t));
+  Put(Record.Input.data(), H.InputSize);
+  Put(Record.Output.data(), H.OutputSize);
+  Put(Record.Samples.data(), H.NumSamples);
+  return Size;
+}
+
+static RunAbort loadRecord(const uint8_t *Slot, TraceRecord &Record) {
+  RecordHeader H;
+  memcpy(&H, Slot, sizeof(H));
+  const uint8_t *P = Slot + sizeof(H);
+  auto Get = [&](void *Data, size_t N) {
+    if (N)
+      memcpy(Data, P, N);
+    P += N;
+  };
+  Record.Index = H.Index;
+  Record.Seed = H.Seed;
+  Record.ExitCode = H.ExitCode;
+  Record.FixedInput = H.FixedInput;
+  Record.SampleInsts.resize(H.NumSampleInsts);
+  Get(Record.SampleInsts.data(), H.NumSampleInsts * sizeof(uint32_t));
+  Record.Input.resize(H.InputSize);
+  Get(Record.Input.data(), H.InputSize);
+  Record.Output.resize(H.OutputSize);
+  Get(Record.Output.data(), H.OutputSize);
+  Record.Samples.resize(H.NumSamples);
+  Get(Record.Samples.data(), H.NumSamples);
+  return static_cast<RunAbort>(H.Abort);
+}
+
+/// serveJobs - Main loop of a worker process: run the jobs until the parent
+/// closes the pipe.
+LLVM_ATTRIBUTE_NORETURN static void serveJobs(BatchWorker &W,
+                                              const BatchOptions &Opts,
+                                              int In, int Out,
+                                              uint8_t *Slot) {
+  JobMessage Msg;
+  while (readAll(In, &Msg, sizeof(Msg))) {
+    TraceRecord Record;
+    Record.Index = Msg.Index;
+    Record.Seed = deriveJobSeed(Opts.Seed, Msg.Index);
+    Record.CollectSampleInsts = Msg.CollectSampleInsts != 0;
+    RunAbort Abort = W.run(Opts, Record);
+    uint64_t Size = storeRecord(Record, Abort, Slot);
+    if (!writeAll(Out, &Size, sizeof(Size)))
+      break;
+  }
+  // Nothing of the parent may run in a child: no destructor, no flush.
+  ::_exit(0);
+}
+
+Error WorkerPool::spawn(Worker &W) {
+  int ToChild[2], FromChild[2];
+  if (::pipe(ToChild) == -1)
+    return makeError(Twine("worker pool: cannot create a pipe: ") +
+                     sys::StrError());
+  if (::pipe(FromChild) == -1) {
+    ::close(ToChild[0]);
+    ::close(ToChild[1]);
+    return makeError(Twine("worker pool: cannot create a pipe: ") +
+                     sys::StrError());
+  }
+  outs().flush();
+  errs().flush();
+  pid_t Pid = ::fork();
+  if (Pid == -1) {
+    for (int FD : {ToChild[0], ToChild[1], FromChild[0], FromChild[1]})
+      ::close(FD);
+    return makeError(Twine("worker pool: cannot fork: ") + sys::StrError());
+  }
+  if (Pid == 0) {
+    // Only the parent talks to the other workers.
+    for (Worker &Other : Workers) {
+      if (Other.ToChild != -1)
+        ::close(Other.ToChild);
+      if (Other.FromChild != -1)
+        ::close(Other.FromChild);
+    }
+    ::close(ToChild[1]);
+    ::close(FromChild[0]);
+    ::sigaction(SIGPIPE, &OldSigPipe, nullptr);
+    serveJobs(Template, Opts, ToChild[0], FromChild[1], W.Slot);
+  }
+  ::close(ToChild[0]);
+  ::close(FromChild[1]);
+  W.Pid = Pid;
+  W.ToChild = ToChild[1];
+  W.FromChild = FromChild[0];
+  W.Busy = false;
+  W.Killed = false;
+  return Error::success();
+}
+
+void WorkerPool::reap(Worker &W) {
+  ::close(W.ToChild);
+  ::close(W.FromChild);
+  W.ToChild = W.FromChild = -1;
+  int Status;
+  while (::waitpid(W.Pid, &Status, 0) == -1 && errno == EINTR)
+    ;
+  W.Pid = -1;
+}
+
+Error WorkerPool::start(unsigned NumWorkers) {
+  // A worker that dies while the parent writes to it must not take the
+  // parent along.
+  struct sigaction Ignore;
+  memset(&Ignore, 0, sizeof(Ignore));
+  Ignore.sa_handler = SIG_IGN;
+  ::sigaction(SIGPIPE, &Ignore, &OldSigPipe);
+
+  Workers.resize(NumWorkers);
+  for (Worker &W : Workers) {
+    void *Mem = ::mmap(nullptr, SlotCapacity, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (Mem == MAP_FAILED)
+      return errorCodeToError(
+          std::error_code(errno, std::generic_category()));
+    W.Slot = static_cast<uint8_t *>(Mem);
+  }
+  for (Worker &W : Workers)
+    if (Error E = spawn(W))
+      return E;
+  return Error::success();
+}
+
+void WorkerPool::shutdown() {
+  if (Workers.empty())
+    return;
+  for (Worker &W : Workers) {
+    if (W.Pid == -1)
+      continue;
+    // An idle worker exits on the end of its pipe, a busy one is not
+    // waited for.
+    if (W.Busy)
+      ::kill(W.Pid, SIGKILL);
+    reap(W);
+  }
+  for (Worker &W : Workers)
+    if (W.Slot)
+      ::munmap(W.Slot, SlotCapacity);
+  Workers.clear();
+  ::sigaction(SIGPIPE, &OldSigPipe, nullptr);
+}
+
+Error WorkerPool::run(uint64_t NumJobs,
+                      const std::function<bool(TraceRecord &)> &Emit,
+                      WorkerPoolStats &Stats) {
+  using Clock = std::chrono::steady_clock;
+  // As the JobScheduler, do not run too far ahead of the emitted records.
+  uint64_t Window = Workers.size() * 64;
+  uint64_t NextJob = 0, NextEmit = 0;
+  bool EmittedAny = false;
+  std::map<uint64_t, TraceRecord> Pending;
+  std::set<uint64_t> Crashed;
+  // A worker stuck in an external call is killed a second past the timeout.
+  bool Watchdog = Opts.Limits.Timeout > 0;
+  auto Grace = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(Opts.Limits.Timeout + 1));
+
+  std::vector<pollfd> FDs(Workers.size());
+  while (NextEmit != NumJobs) {
+    for (Worker &W : Workers) {
+      if (W.Busy || NextJob == NumJobs || NextJob >= NextEmit + Window)
+        continue;
+      // The file stores the sample instructions of its first record, which
+      // cannot be known while a run may crash.
+      JobMessage Msg = {NextJob, !EmittedAny};
+      W.Busy = true;
+      W.Job = NextJob++;
+      W.Started = Clock::now();
+      // On failure the worker is dead, and its pipe tells it below.
+      writeAll(W.ToChild, &Msg, sizeof(Msg));
+    }
+
+    for (unsigned i = 0, e = Workers.size(); i != e; ++i)
+      FDs[i] = {Workers[i].FromChild, POLLIN, 0};
+    int N = ::poll(FDs.data(), FDs.size(), Watchdog ? 100 : -1);
+    if (N == -1) {
+      if (errno == EINTR)
+        continue;
+      return makeError(Twine("worker pool: poll failed: ") + sys::StrError());
+    }
+
+    for (unsigned i = 0, e = Workers.size(); i != e; ++i) {
+      if (!FDs[i].revents)
+        continue;
+      Worker &W = Workers[i];
+      uint64_t Size;
+      if (readAll(W.FromChild, &Size, sizeof(Size))) {
+        if (Size == 0)
+          return makeError("worker pool: the trace record of run " +
+                           Twine(W.Job) + " does not fit in shared memory");
+        TraceRecord Record;
+        if (loadRecord(W.Slot, Record) != RunAbort::None)
+          ++Stats.NumAborted;
+        Pending.emplace(W.Job, std::move(Record));
+        W.Busy = false;
+        continue;
+      }
+      // The worker died: drop its run and replace it.
+      if (W.Busy) {
+        Crashed.insert(W.Job);
+        ++Stats.NumCrashed;
+        if (W.Killed)
+          ++Stats.NumKilled;
+      }
+      reap(W);
+      if (Error E = spawn(W))
+        return E;
+    }
+
+    if (Watchdog) {
+      Clock::time_point Now = Clock::now();
+      for (Worker &W : Workers)
+        if (W.Busy && !W.Killed && Now - W.Started > Grace) {
+          ::kill(W.Pid, SIGKILL);
+          W.Killed = true;
+        }
+    }
+
+    for (;;) {
+      auto It = Pending.find(NextEmit);
+      if (It != Pending.end()) {
+        bool Stop = Emit(It->second);
+        Pending.erase(It);
+        ++NextEmit;
+        EmittedAny = true;
+        if (Stop)
+          return Error::success();
+      } else if (Crashed.erase(NextEmit)) {
+        ++NextEmit;
+      } else {
+        break;
+      }
+    }
+  }
+  return Error::success();
+}
+
+Error runWorkerPool(const BatchOptions &Opts, uint64_t NumJobs,
+                    unsigned NumWorkers,
+                    const std::function<bool(TraceRecord &)> &Emit,
+                    WorkerPoolStats &Stats) {
+  // The program is loaded once, every worker is forked from it.
+  BatchWorker Template;
+  if (Error E = Template.init(Opts))
+    return E;
+  WorkerPool Pool(Opts, Template);
+  if (Error E = Pool.start(NumWorkers))
+    return E;
+  return Pool.run(NumJobs, Emit, Stats);
+}
+
+#else
+
+Error runWorkerPool(const BatchOptions &Opts, uint64_t NumJobs,
+                    unsigned NumWorkers,
+                    const std::function<bool(TraceRecord &)> &Emit,
+                    WorkerPoolStats &Stats) {
+  return makeError("isolated runs need fork()");
+}
+
+#endif
+
+} // End wyverse namespace
@@ -0,0 +1,55 @@
+//===-- WorkerPool.h - Batch runs in crash-isolated processes ---*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A faulty run easily dereferences a corrupted pointer, in the interpreter
+// or in an external function such as memcpy, and a batch run by threads dies
+// with it.  The worker pool runs the batch in processes instead.
+//
+// The parent loads the program once into a BatchWorker that it never runs,
+// and forks the worker processes from it.  It keeps the job queue and the
+// trace writer.  It hands out one job at a time to each worker over a pipe,
+// and the worker writes its trace record in a shared-memory slot, then
+// answers on a pipe of its own.  A worker that dies closes its pipe: the
+// parent drops its job as crashed and forks a replacement from the pristine
+// BatchWorker, which costs a fork, not a module load.  With a run timeout,
+// the parent also kills a worker stuck past it, e.g. blocked in an external
+// call.
+//
+// The records are emitted in job order, as with the JobScheduler; the runs
+// that crashed are missing from the stream.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_WYVERSE_WORKERPOOL_H
+#define LLVM_TOOLS_WYVERSE_WORKERPOOL_H
+
+#include "BatchMode.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <functional>
+
+namespace wyverse {
+
+struct WorkerPoolStats {
+  uint64_t NumCrashed = 0;         // workers that died during a run
+  uint64_t NumKilled = 0;          // of which killed past the timeout
+  uint64_t NumAborted = 0;         // runs ended by the run limits
+};
+
+/// runWorkerPool - Run the jobs of the batch in NumWorkers processes.
+/// Emit receives the records in job order, and returns true to end the
+/// batch there.
+llvm::Error runWorkerPool(const BatchOptions &Opts, uint64_t NumJobs,
+                          unsigned NumWorkers,
+                          const std::function<bool(llvm::TraceRecord &)> &Emit,
+                          WorkerPoolStats &Stats);
+
+} // End wyverse namespace
+
+#endif
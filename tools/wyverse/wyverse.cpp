@@ -12,15 +12,30 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "BatchMode.h"
+#include "FaultCampaign.h"
 #include "llvm/Config/llvm-config.h"
 #include "llvm/ExecutionEngine/Action.h"
+#include "llvm/ExecutionEngine/CPAEngine.h"
+#include "llvm/ExecutionEngine/FaultAction.h"
+#include "llvm/ExecutionEngine/SNREngine.h"
+#include "llvm/ExecutionEngine/TVLAEngine.h"
+#include "llvm/ExecutionEngine/TableAction.h"
+#include "llvm/ExecutionEngine/TaintAction.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/GuestFileSystem.h"
+#include "llvm/ExecutionEngine/InputDependence.h"
 #include "llvm/ExecutionEngine/Interpreter.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/PluginLoader.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/WithColor.h"
+#include "llvm/Support/xxhash.h"
 #include "logo-ascii.inc"
+#include <algorithm>
 #include <cerrno>
 
 #ifdef __CYGWIN__
@@ -55,18 +70,45 @@ namespace {
          cl::desc("Extra modules to be loaded"),
          cl::value_desc("input bitcode"));
 
+  cl::list<std::string>
+  PreloadFiles("preload-file",
+	       cl::desc("Serve a file opened by the program from memory "
+			"(PATH, or GUESTPATH=HOSTPATH)"),
+	       cl::value_desc("path"));
+
+  cl::opt<bool>
+  PreloadZeroCopy("preload-zero-copy",
+		  cl::desc("Map large reads of preloaded files over the "
+			   "program buffer instead of copying them, if it is "
+			   "a large malloc"),
+		  cl::init(false));
+
   cl::opt<std::string>
   FakeArgv0("fake-argv0",
             cl::desc("Override the 'argv[0]' value passed into the executing"
                      " program"), cl::value_desc("executable"));
 
   enum ActionType {
-		helloworld, trace
+		helloworld, trace, cpa, tvla, snr, fault, taint, tables
   };
   cl::list<ActionType>
   ActionList(cl::desc("Available Actions:"),
 	     cl::values(clEnumVal(helloworld, "An example of action"),
-			clEnumVal(trace,      "Tracing memory / register")));
+			clEnumVal(trace,      "Tracing memory / register"),
+			clEnumVal(cpa,        "Correlation power analysis on the "
+					      "fly (batch mode)"),
+			clEnumVal(tvla,       "Fixed-vs-random t-test on the fly "
+					      "(batch mode)"),
+			clEnumVal(snr,        "Signal-to-noise ratio and points "
+					      "of interest (batch mode)"),
+			clEnumVal(fault,      "Fault injection, enabled by -fault"),
+			clEnumVal(taint,      "Taint tracking, enabled by "
+					      "-taint-source; the trace action "
+					      "then only records tainted "
+					      "values"),
+			clEnumVal(tables,     "Indices of the lookup tables read, "
+					      "instead of the values (batch "
+					      "mode: -tables-output)")));
 
   cl::opt<int>
   MemoryRead("memory-read",
@@ -92,9 +134,330 @@ namespace {
 		      "(trace action only): -1 disable, 0 all "),
 	     cl::value_desc("bytes"),
 	     cl::init(0));
+  cl::opt<std::string>
+  TraceInsts("trace-insts",
+	     cl::desc("Only trace the instructions listed in the file, e.g. "
+		      "the POI file of the snr action (batch mode)"),
+	     cl::value_desc("filename"));
+  cl::list<std::string>
+  TaintSources("taint-source",
+	       cl::desc("Follow the values depending on: input (the input "
+			"of the run), arg:N[:SIZE], global:NAME, argv or "
+			"fread"),
+	       cl::value_desc("source"),
+	       cl::ZeroOrMore);
+  cl::opt<bool>
+  StaticTaint("static-taint",
+	      cl::desc("Find the instructions depending on -taint-source "
+		       "before the batch and only trace those, instead of "
+		       "following the taint at run time (batch mode)"),
+	      cl::init(false));
+  cl::opt<std::string>
+  StaticTaintCache("static-taint-cache",
+		   cl::desc("Cache of -static-taint (default = "
+			    "<input bitcode>.deps)"),
+		   cl::value_desc("filename"));
+
+  // Batch mode
+  cl::opt<std::string>
+  BatchInputs("batch-inputs",
+	      cl::desc("Run the program once per line of the file, each line "
+		       "holding the program arguments (batch mode)"),
+	      cl::value_desc("filename"));
+  cl::opt<std::string>
+  TraceFile("trace-file",
+	    cl::desc("Binary trace file written in batch mode"),
+	    cl::value_desc("filename"),
+	    cl::init("wyverse.trace"));
+  cl::opt<bool>
+  NoTraceFile("no-trace-file",
+	      cl::desc("Do not store the traces, only feed the analyses "
+		       "(batch mode)"),
+	      cl::init(false));
+  cl::opt<unsigned>
+  NumThreads("threads",
+	     cl::desc("Number of worker threads in batch mode "
+		      "(default = number of cores)"),
+	     cl::init(0));
+  cl::opt<unsigned long long>
+  CampaignSeed("seed",
+	       cl::desc("Campaign seed, each run of a batch gets a seed "
+			"derived from it and from the rank of the run"),
+	       cl::init(0));
+  cl::opt<bool>
+  IsolateRuns("isolate-runs",
+	      cl::desc("Run the batch in worker processes, so that a run that "
+		       "crashes only loses its trace (default = on when "
+		       "injecting faults without analysis action)"),
+	      cl::init(false));
+  cl::opt<unsigned long long>
+  MaxInsts("max-insts",
+	   cl::desc("End a run after this many dynamic instructions "
+		    "(batch mode, default = no limit)"),
+	   cl::init(0));
+  cl::opt<unsigned long long>
+  MaxAlloc("max-alloc",
+	   cl::desc("End a run whose live heap, or a single stack "
+		    "allocation, would exceed this many bytes (batch mode, "
+		    "default = no limit)"),
+	   cl::init(0));
+  cl::opt<double>
+  RunTimeout("run-timeout",
+	     cl::desc("End a run after this many seconds (batch mode, "
+		      "default = no limit)"),
+	     cl::init(0));
+
+  // Built-in input generator (batch mode)
+  cl::opt<wyverse::InputMode>
+  GenerateInputs("generate-inputs",
+		 cl::desc("Generate the inputs of a batch:"),
+		 cl::init(wyverse::InputMode::None),
+		 cl::values(clEnumValN(wyverse::InputMode::Random, "random",
+				       "Uniformly random inputs"),
+			    clEnumValN(wyverse::InputMode::FixedVsRandom,
+				       "fixed-vs-random",
+				       "Fixed or random input, drawn per run "
+				       "(TVLA)"),
+			    clEnumValN(wyverse::InputMode::Replay, "replay",
+				       "Inputs read from -replay-file")));
+  cl::opt<unsigned long long>
+  NumRuns("num-runs",
+	  cl::desc("Number of runs of a batch with generated inputs "
+		   "(default = whole replay file)"),
+	  cl::init(0));
+  cl::opt<unsigned>
+  InputSize("input-size",
+	    cl::desc("Size of the generated inputs"),
+	    cl::value_desc("bytes"),
+	    cl::init(16));
+  cl::opt<std::string>
+  FixedInput("fixed-input",
+	     cl::desc("Fixed input of a fixed-vs-random batch, in hex "
+		      "(default = all zeros)"),
+	     cl::value_desc("hex"));
+  cl::opt<std::string>
+  ReplayFile("replay-file",
+	     cl::desc("Binary file of inputs, stored back to back"),
+	     cl::value_desc("filename"));
+
+  // Harness (batch mode)
+  cl::opt<std::string>
+  HarnessInput("harness-input",
+	       cl::desc("Write the input of each run directly in the program: "
+			"arg:N (pointer argument N of the entry function) or "
+			"global:NAME"),
+	       cl::value_desc("binding"));
+  cl::opt<std::string>
+  HarnessOutput("harness-output",
+		cl::desc("Read the output of each run directly from the "
+			 "program: arg:N or global:NAME"),
+		cl::value_desc("binding"));
+  cl::opt<std::string>
+  CaptureOutput("capture-output",
+		cl::desc("Extract the output of each run from the captured "
+			 "stdout: hex, hex:MARKER (hex bytes after MARKER) "
+			 "or raw"),
+		cl::value_desc("rule"));
+  cl::opt<unsigned>
+  OutputSize("output-size",
+	     cl::desc("Size of the output read through -harness-output or "
+		      "-capture-output"),
+	     cl::value_desc("bytes"),
+	     cl::init(16));
+
+  // Streaming CPA (cpa action)
+  cl::opt<std::string>
+  CPATargetOpt("cpa-target",
+	       cl::desc("Selection function of the intermediate value "
+			"attacked by the cpa action: first-sbox, last-sbox "
+			"(AES), des-sbox, sm4-sbox, or one registered by a "
+			"plugin (-load)"),
+	       cl::value_desc("name"),
+	       cl::init("first-sbox"));
+  cl::list<unsigned>
+  CPABytes("cpa-bytes",
+	   cl::desc("Targets attacked by the cpa action, the key bytes for "
+		    "AES (default = all)"),
+	   cl::CommaSeparated);
+  cl::opt<unsigned long long>
+  CPASampleBegin("cpa-sample-begin",
+		 cl::desc("First sample analysed by the cpa action"),
+		 cl::init(0));
+  cl::opt<unsigned long long>
+  CPAMaxSamples("cpa-max-samples",
+		cl::desc("Number of samples analysed by the cpa action "
+			 "(default = up to the end of the trace)"),
+		cl::init(0));
+  cl::opt<unsigned long long>
+  CPACheckPeriod("cpa-check-period",
+		 cl::desc("Number of runs between two key rankings of the cpa "
+			  "action (0 = only at the end)"),
+		 cl::init(0));
+  cl::opt<double>
+  CPAStopMargin("cpa-stop-margin",
+		cl::desc("Relative margin of the best guess over the second "
+			 "one for a key byte to be settled"),
+		cl::init(0.1));
+  cl::opt<unsigned>
+  CPAStopChecks("cpa-stop-checks",
+		cl::desc("Stop the campaign once every key byte has been "
+			 "settled on the same guess for this many checks in a "
+			 "row (0 = never stop)"),
+		cl::init(3));
+  cl::opt<std::string>
+  CPAKnownKey("cpa-known-key",
+	      cl::desc("Key of the program, in hex, whose ranks are reported "
+		       "at each check"),
+	      cl::value_desc("hex"));
+
+  // Streaming leakage assessment (tvla action)
+  cl::opt<std::string>
+  TVLAOutput("tvla-output",
+	     cl::desc("File of the t-statistics of the tvla action, "
+		      "rewritten at each report"),
+	     cl::value_desc("filename"),
+	     cl::init("wyverse.tvla"));
+  cl::opt<unsigned long long>
+  TVLAPeriod("tvla-period",
+	     cl::desc("Number of traces between two reports of the tvla "
+		      "action (0 = only at the end)"),
+	     cl::init(10000));
+  cl::opt<double>
+  TVLAThreshold("tvla-threshold",
+		cl::desc("|t| above which a sample leaks"),
+		cl::init(4.5));
+  cl::opt<unsigned long long>
+  TVLASampleBegin("tvla-sample-begin",
+		  cl::desc("First sample tested by the tvla action"),
+		  cl::init(0));
+  cl::opt<unsigned long long>
+  TVLAMaxSamples("tvla-max-samples",
+		 cl::desc("Number of samples tested by the tvla action "
+			  "(default = up to the end of the trace)"),
+		 cl::init(0));
+
+  // Points of interest (snr action)
+  cl::opt<SNRTarget>
+  SNRTargetOpt("snr-target",
+	       cl::desc("Intermediate value that splits the traces of the "
+			"snr action:"),
+	       cl::init(SNRTarget::InputByte),
+	       cl::values(clEnumValN(SNRTarget::InputByte, "input",
+				     "input byte"),
+			  clEnumValN(SNRTarget::OutputByte, "output",
+				     "output byte"),
+			  clEnumValN(SNRTarget::FirstRoundSBox, "first-sbox",
+				     "SBox[input ^ key], known key"),
+			  clEnumValN(SNRTarget::LastRoundInvSBox, "last-sbox",
+				     "InvSBox[output ^ key], known key")));
+  cl::list<unsigned>
+  SNRBytes("snr-bytes",
+	   cl::desc("Bytes of the intermediate value (default = 0-15)"),
+	   cl::CommaSeparated);
+  cl::opt<std::string>
+  SNRKey("snr-key",
+	 cl::desc("Known key of the S-box targets of the snr action, in hex"),
+	 cl::value_desc("hex"));
+  cl::opt<unsigned long long>
+  SNRSampleBegin("snr-sample-begin",
+		 cl::desc("First sample analysed by the snr action"),
+		 cl::init(0));
+  cl::opt<unsigned long long>
+  SNRMaxSamples("snr-max-samples",
+		cl::desc("Number of samples analysed by the snr action "
+			 "(default = up to the end of the trace)"),
+		cl::init(0));
+  cl::opt<std::string>
+  POIOutput("poi-output",
+	    cl::desc("File of the instructions selected by the snr action"),
+	    cl::value_desc("filename"),
+	    cl::init("wyverse.poi"));
+  cl::opt<double>
+  POIFraction("poi-fraction",
+	      cl::desc("Fraction of the samples, by decreasing SNR, whose "
+		       "instructions are selected"),
+	      cl::init(0.01));
+  cl::opt<double>
+  POIThreshold("poi-threshold",
+	       cl::desc("Select the samples whose SNR is at least this, "
+			"instead of a fraction (0 = unused)"),
+	       cl::init(0));
+
+  // Lookup tables (tables action)
+  cl::opt<std::string>
+  TablesOutput("tables-output",
+	       cl::desc("File of the lookup tables found by the tables "
+			"action, and of their contents"),
+	       cl::value_desc("filename"),
+	       cl::init("wyverse.tables"));
 
+  // Fault injection (fault action)
+  cl::list<std::string>
+  Faults("fault",
+	 cl::desc("Inject a fault, ID[@OCC]:MODEL[:ARGS]: the execution OCC "
+		  "(0 = first, * = all) of the instruction ID is faulted by "
+		  "skip, bit-flip:BIT, set-byte:BYTE,VALUE, random, "
+		  "memory:OFFSET[,MASK] or branch[:SUCCESSOR]; the numbers "
+		  "can be FIRST-LAST ranges"),
+	 cl::value_desc("fault"),
+	 cl::ZeroOrMore);
+  cl::opt<bool>
+  FaultCampaignOpt("fault-campaign",
+		   cl::desc("Inject each -fault in its own run of the first "
+			    "input, forked from the golden run (batch mode)"),
+		   cl::init(false));
+  cl::opt<unsigned long long>
+  FaultCheckpointInterval("fault-checkpoint-interval",
+			  cl::desc("Dynamic instructions between two "
+				   "checkpoints of the golden run of a fault "
+				   "campaign"),
+			  cl::init(10000));
+  cl::opt<bool>
+  FaultEarlyStop("fault-early-stop",
+		 cl::desc("Stop a faulty run of a fault campaign as masked "
+			  "once its state hash matches the golden run at a "
+			  "checkpoint"),
+		 cl::init(true));
+  cl::opt<bool>
+  FaultDedup("fault-dedup",
+	     cl::desc("Stop a faulty run of a fault campaign once its state "
+		      "hash matches another faulty run at a checkpoint, and "
+		      "give it the outcome of that run"),
+	     cl::init(true));
+  cl::opt<bool>
+  FaultDFA("fault-dfa",
+	   cl::desc("Run the AES-128 differential fault analysis on the "
+		    "faulty outputs of a fault campaign, and stop it once "
+		    "the key is recovered"),
+	   cl::init(false));
+  cl::opt<double>
+  FaultDFAWindow("fault-dfa-window",
+		 cl::desc("Only give the DFA the faults injected in this "
+			  "last fraction of the golden run (its last rounds)"),
+		 cl::init(0.25));
+  cl::opt<double>
+  FaultBudget("fault-budget",
+	      cl::desc("Instruction budget of a faulty run of a fault "
+		       "campaign, as a multiple of the golden run "
+		       "(0 = only -max-insts)"),
+	      cl::init(4));
+  cl::opt<std::string>
+  FaultOutput("fault-output",
+	      cl::desc("File of the outcomes of a fault campaign"),
+	      cl::value_desc("filename"),
+	      cl::init("wyverse.faults"));
 
   ExitOnError ExitOnErr;
+
+  // Shared by the actions of all the batch workers.
+  std::unique_ptr<CPAEngine> TheCPAEngine;
+  std::unique_ptr<TVLAEngine> TheTVLAEngine;
+  std::unique_ptr<SNREngine> TheSNREngine;
+  std::unique_ptr<LookupTables> TheLookupTables;
+  std::unique_ptr<TraceSampleFilter> TheTraceFilter;
+  std::vector<FaultSpec> TheFaultSpecs;
+  std::vector<FaultSpec> TheCampaignFaults;
+  std::vector<TaintSource> TheTaintSources;
 }
 
 LLVM_ATTRIBUTE_NORETURN
@@ -108,11 +471,350 @@ inline const char* ActionTypeToString(ActionType at)
   switch (at) {
   case helloworld:   return "helloworld";
   case trace:        return "trace";
+  case cpa:          return "cpa";
+  case tvla:         return "tvla";
+  case snr:          return "snr";
+  case fault:        return "fault";
+  case taint:        return "taint";
+  case tables:       return "tables";
   // default:           return "[Unknown ActionType]";
   }
 }
 
 
+static bool isActionEnabled(ActionType at) {
+  return std::find(ActionList.begin(), ActionList.end(), at) !=
+         ActionList.end();
+}
+
+static void createAnalysisEngines() {
+  if (isActionEnabled(cpa)) {
+    CPAOptions Opts;
+    Opts.Selection = ExitOnErr(createSelectionFunction(CPATargetOpt));
+    for (unsigned Byte : CPABytes) {
+      if (Byte >= Opts.Selection->getNumTargets()) {
+        WithColor::error(errs()) << "-cpa-bytes: " << CPATargetOpt
+                                 << " has no target " << Byte << "\n";
+        exit(1);
+      }
+      Opts.TargetBytes.push_back(Byte);
+    }
+    Opts.SampleBegin = CPASampleBegin;
+    Opts.MaxSamples = CPAMaxSamples;
+    TheCPAEngine.reset(new CPAEngine(Opts));
+  }
+  if (isActionEnabled(tvla)) {
+    TVLAOptions Opts;
+    Opts.ReportPeriod = TVLAPeriod;
+    Opts.OutputFile = TVLAOutput;
+    Opts.Threshold = TVLAThreshold;
+    Opts.SampleBegin = TVLASampleBegin;
+    Opts.MaxSamples = TVLAMaxSamples;
+    TheTVLAEngine.reset(new TVLAEngine(Opts));
+  }
+  if (isActionEnabled(snr)) {
+    SNROptions Opts;
+    Opts.Target = SNRTargetOpt;
+    for (unsigned Byte : SNRBytes)
+      Opts.TargetBytes.push_back(Byte);
+    if (SNRKey.size() % 2 || !all_of(SNRKey, isHexDigit)) {
+      WithColor::error(errs()) << "-snr-key is not an hex string\n";
+      exit(1);
+    }
+    std::string Key = fromHex(SNRKey);
+    Opts.Key.assign(Key.begin(), Key.end());
+    Opts.SampleBegin = SNRSampleBegin;
+    Opts.MaxSamples = SNRMaxSamples;
+    TheSNREngine.reset(new SNREngine(Opts));
+
+    bool NeedsKey = Opts.Target == SNRTarget::FirstRoundSBox ||
+                    Opts.Target == SNRTarget::LastRoundInvSBox;
+    for (unsigned Byte : TheSNREngine->getOptions().TargetBytes)
+      if (NeedsKey && Byte >= Opts.Key.size()) {
+        WithColor::error(errs()) << "-snr-key has no byte " << Byte << "\n";
+        exit(1);
+      }
+  }
+  if (isActionEnabled(tables)) {
+    // Both would record the loads of the tables, in the same samples.
+    if (isActionEnabled(trace)) {
+      WithColor::error(errs()) << "the tables action replaces the trace "
+                                  "action\n";
+      exit(1);
+    }
+    TheLookupTables.reset(new LookupTables());
+  }
+  if (!TraceInsts.empty())
+    TheTraceFilter.reset(new TraceSampleFilter(
+        ExitOnErr(TraceSampleFilter::readFile(TraceInsts))));
+  // A campaign injects its faults one by one, not with the fault action.
+  std::vector<FaultSpec> &Specs =
+    FaultCampaignOpt ? TheCampaignFaults : TheFaultSpecs;
+  for (StringRef Spec : Faults) {
+    std::vector<FaultSpec> Sweep = ExitOnErr(FaultSpec::parseSweep(Spec));
+    Specs.insert(Specs.end(), Sweep.begin(), Sweep.end());
+  }
+  // The input is wherever the harness writes it, else in argv.
+  for (StringRef Spec : TaintSources) {
+    if (Spec == "input" && HarnessInput.empty())
+      Spec = "argv";
+    else if (Spec == "input")
+      Spec = HarnessInput;
+    TheTaintSources.push_back(ExitOnErr(TaintSource::parse(Spec)));
+  }
+  if (TheTaintSources.size() > TaintSource::MaxSources) {
+    WithColor::error(errs()) << "at most " << TaintSource::MaxSources
+                             << " -taint-source\n";
+    exit(1);
+  }
+}
+
+// With -static-taint the taint is only followed at run time on request.
+static bool useTaintAction() {
+  return !TheTaintSources.empty() && (!StaticTaint || isActionEnabled(taint));
+}
+
+static ChainedAction *createActions() {
+  ChainedAction *actionList = new ChainedAction();
+  ActionFactory actionFactory;
+  actionFactory.setCPAEngine(TheCPAEngine.get());
+  actionFactory.setTVLAEngine(TheTVLAEngine.get());
+  actionFactory.setSNREngine(TheSNREngine.get());
+  actionFactory.setLookupTables(TheLookupTables.get());
+  actionFactory.setTraceFilter(TheTraceFilter.get());
+  actionFactory.setFaultSpecs(&TheFaultSpecs);
+  actionFactory.setTaintSources(&TheTaintSources);
+  // The faults come first, so that the other actions observe the faulty
+  // values, then the taint, so that the trace action sees the labels of
+  // the current instruction.
+  if (!TheFaultSpecs.empty())
+    actionList->addAction(actionFactory.createAction("fault"));
+  if (useTaintAction())
+    actionList->addAction(actionFactory.createAction("taint"));
+  // The analyses work on the samples collected by the trace action, or on
+  // the table indices.
+  if ((TheCPAEngine || TheTVLAEngine || TheSNREngine) &&
+      !isActionEnabled(trace) && !TheLookupTables)
+    actionList->addAction(actionFactory.createAction("trace"));
+  for (unsigned i = 0; i != ActionList.size(); ++i) {
+    if ((ActionList[i] == fault && !TheFaultSpecs.empty()) ||
+        (ActionList[i] == taint && useTaintAction()))
+      continue;
+    const char * actionType = ActionTypeToString(ActionList[i]);
+    Action *action = actionFactory.createAction(actionType);
+    if (action)
+      actionList->addAction(action);
+  }
+  return actionList;
+}
+
+static std::vector<std::vector<std::string>> readBatchInputs(StringRef Path) {
+  std::unique_ptr<MemoryBuffer> Buffer =
+    ExitOnErr(errorOrToExpected(MemoryBuffer::getFile(Path)));
+  SmallVector<StringRef, 0> Lines;
+  Buffer->getBuffer().split(Lines, '\n', -1, false);
+
+  std::vector<std::vector<std::string>> Inputs;
+  for (StringRef Line : Lines) {
+    SmallVector<StringRef, 16> Args;
+    Line.split(Args, ' ', -1, false);
+    Inputs.emplace_back();
+    for (StringRef Arg : Args) {
+      Arg = Arg.trim();
+      if (!Arg.empty())
+        Inputs.back().push_back(Arg);
+    }
+    if (Inputs.back().empty())
+      Inputs.pop_back();
+  }
+  return Inputs;
+}
+
+// Restrict the trace filter to the instructions that may depend on the
+// taint sources, computed on a private copy of the modules: the workers
+// number their instructions the same way.
+static void applyStaticTaint(const wyverse::BatchOptions &Opts) {
+  LLVMContext Context;
+  InstructionIndex Index;
+  std::vector<std::unique_ptr<Module>> Modules;
+  std::string KeyData;
+  std::vector<std::string> Paths(1, Opts.InputFile);
+  Paths.insert(Paths.end(), Opts.ExtraModules.begin(),
+               Opts.ExtraModules.end());
+  for (const std::string &Path : Paths) {
+    SMDiagnostic Err;
+    Modules.push_back(parseIRFile(Path, Err, Context));
+    if (!Modules.back())
+      reportError(Err, Opts.ProgramName.c_str());
+    Index.addModule(*Modules.back());
+    std::unique_ptr<MemoryBuffer> Buffer =
+      ExitOnErr(errorOrToExpected(MemoryBuffer::getFile(Path)));
+    KeyData += Buffer->getBuffer();
+  }
+  Function *Entry = Modules.front()->getFunction(Opts.EntryFunc);
+  if (!Entry) {
+    WithColor::error(errs()) << "'" << Opts.EntryFunc
+                             << "' function not found in module\n";
+    exit(1);
+  }
+  raw_string_ostream KeyOS(KeyData);
+  KeyOS << Opts.EntryFunc;
+  for (const TaintSource &S : TheTaintSources) {
+    KeyOS << ' ';
+    S.print(KeyOS);
+  }
+  uint64_t Key = xxHash64(KeyOS.str());
+
+  std::string Cache = StaticTaintCache.empty() ? Opts.InputFile + ".deps"
+                                               : std::string(StaticTaintCache);
+  Optional<TraceSampleFilter> Dependent =
+    ExitOnErr(InputDependence::readFile(Cache, Key));
+  bool Cached = Dependent.hasValue();
+  if (!Cached) {
+    Dependent = InputDependence(Index, *Entry, TheTaintSources).run();
+    ExitOnErr(InputDependence::writeFile(Cache, Key, *Dependent));
+  }
+  outs() << "static taint: " << Dependent->count() << " of " << Index.size()
+         << " instructions may depend on the input"
+         << (Cached ? " (cached in " : " (written to ") << Cache << ")\n";
+  if (TheTraceFilter)
+    TheTraceFilter->intersect(*Dependent);
+  else
+    TheTraceFilter.reset(new TraceSampleFilter(std::move(*Dependent)));
+}
+
+static int runBatchMode(char * const *envp) {
+  wyverse::BatchOptions Opts;
+  Opts.InputFile = InputFile;
+  Opts.ExtraModules.assign(ExtraModules.begin(), ExtraModules.end());
+  Opts.EntryFunc = EntryFunc;
+  if (!FakeArgv0.empty())
+    Opts.ProgramName = FakeArgv0;
+  else
+    Opts.ProgramName = StringRef(InputFile).endswith(".bc") ?
+      InputFile.substr(0, InputFile.length() - 3) : std::string(InputFile);
+  Opts.Envp = envp;
+  if (!NoTraceFile)
+    Opts.TraceFile = TraceFile;
+  Opts.NumThreads = NumThreads;
+  Opts.Seed = CampaignSeed;
+  Opts.CreateActions = createActions;
+  Opts.InputBinding = ExitOnErr(wyverse::HarnessBinding::parse(HarnessInput));
+  Opts.OutputBinding =
+    ExitOnErr(wyverse::HarnessBinding::parse(HarnessOutput));
+  Opts.OutputSize = OutputSize;
+  Opts.Capture = ExitOnErr(wyverse::CaptureRule::parse(CaptureOutput));
+  Opts.Limits.MaxInsts = MaxInsts;
+  Opts.Limits.MaxAllocBytes = MaxAlloc;
+  Opts.Limits.Timeout = RunTimeout;
+
+  if (StaticTaint) {
+    if (TheTaintSources.empty()) {
+      WithColor::error(errs()) << "-static-taint needs a -taint-source\n";
+      return 1;
+    }
+    applyStaticTaint(Opts);
+  }
+  if (TheTVLAEngine && GenerateInputs != wyverse::InputMode::FixedVsRandom) {
+    WithColor::error(errs()) << "the tvla action needs "
+                                "-generate-inputs=fixed-vs-random\n";
+    return 1;
+  }
+  std::unique_ptr<CPAConvergence> Convergence;
+  if (TheCPAEngine && CPACheckPeriod) {
+    if (CPAKnownKey.size() % 2 || !all_of(CPAKnownKey, isHexDigit)) {
+      WithColor::error(errs()) << "-cpa-known-key is not an hex string\n";
+      return 1;
+    }
+    std::string Key = fromHex(CPAKnownKey);
+    Convergence.reset(new CPAConvergence(CPAStopMargin, CPAStopChecks,
+                                         arrayRefFromStringRef(Key)));
+    Opts.CheckPeriod = CPACheckPeriod;
+    // The workers run ahead of the emitted runs: the engine holds their
+    // traces back, so that each ranking is the one of the trace file so far.
+    TheCPAEngine->setCheckPeriod(CPACheckPeriod);
+    Opts.Checkpoint = [&](uint64_t NumRuns) {
+      CPAEngine::Ranking R = TheCPAEngine->rank();
+      bool Settled = Convergence->update(R);
+      Convergence->print(outs(), R);
+      bool Stop = Settled && CPAStopChecks;
+      if (Stop)
+        TheCPAEngine->stop();
+      else
+        TheCPAEngine->passCheckpoint(NumRuns);
+      return Stop;
+    };
+  }
+  if (FaultCampaignOpt && (TheCPAEngine || TheTVLAEngine || TheSNREngine ||
+                           TheLookupTables)) {
+    WithColor::error(errs()) << "a fault campaign runs no analysis action\n";
+    return 1;
+  }
+  // The analysis engines are fed by the actions of the workers, which must
+  // then share the process.
+  bool Analyses = TheCPAEngine || TheTVLAEngine || TheSNREngine ||
+                  TheLookupTables;
+  if (IsolateRuns && Analyses) {
+    WithColor::error(errs()) << "-isolate-runs runs no analysis action\n";
+    return 1;
+  }
+  Opts.Isolate = IsolateRuns.getNumOccurrences()
+                   ? IsolateRuns
+                   : !TheFaultSpecs.empty() && !Analyses;
+  if (GenerateInputs == wyverse::InputMode::None) {
+    Opts.Inputs = readBatchInputs(BatchInputs);
+  } else {
+    if (FixedInput.size() % 2 || !all_of(FixedInput, isHexDigit)) {
+      WithColor::error(errs()) << "-fixed-input is not an hex string\n";
+      return 1;
+    }
+    std::string Fixed = fromHex(FixedInput);
+    Opts.Generator = ExitOnErr(wyverse::InputGenerator::create(
+        GenerateInputs, InputSize, CampaignSeed,
+        arrayRefFromStringRef(Fixed), ReplayFile));
+    Opts.NumRuns = NumRuns;
+    uint64_t Available = Opts.Generator->getNumInputs();
+    if (Opts.NumRuns == 0 || Opts.NumRuns > Available)
+      Opts.NumRuns = Available;
+    if (Opts.NumRuns == ~0ULL) {
+      WithColor::error(errs()) << "-num-runs is required to generate inputs\n";
+      return 1;
+    }
+  }
+
+  if (FaultCampaignOpt) {
+    wyverse::FaultCampaignOptions FOpts;
+    FOpts.Faults = std::move(TheCampaignFaults);
+    FOpts.CheckpointInterval = FaultCheckpointInterval;
+    FOpts.EarlyStop = FaultEarlyStop;
+    FOpts.Dedup = FaultDedup;
+    FOpts.SolveAES = FaultDFA;
+    FOpts.DFAWindow = FaultDFAWindow;
+    FOpts.BudgetFactor = FaultBudget;
+    FOpts.OutputFile = FaultOutput;
+    ExitOnErr(wyverse::runFaultCampaign(Opts, FOpts));
+    return 0;
+  }
+  ExitOnErr(wyverse::runBatch(Opts));
+  if (TheCPAEngine)
+    CPAEngine::printRanking(outs(), TheCPAEngine->rank());
+  if (TheTVLAEngine)
+    ExitOnErr(TheTVLAEngine->report(outs()));
+  if (TheSNREngine) {
+    SNREngine::Result R = TheSNREngine->compute();
+    auto POI = ExitOnErr(TheSNREngine->selectPOI(R, POIFraction,
+                                                 POIThreshold));
+    SNREngine::printSummary(outs(), R, POI);
+    ExitOnErr(TheSNREngine->writePOIFile(POIOutput, R, POI));
+  }
+  if (TheLookupTables) {
+    TheLookupTables->printSummary(outs());
+    ExitOnErr(TheLookupTables->writeFile(TablesOutput));
+  }
+  return 0;
+}
+
+
 //===----------------------------------------------------------------------===//
 // main Driver function
 //
@@ -126,15 +828,10 @@ int main(int argc, char **argv, char * const *envp) {
   cl::ParseCommandLineOptions(argc, argv, "Wyverse interpreter\n");
 
 
+  createAnalysisEngines();
+
   // Create a chain of actions
-  ChainedAction *actionList = new ChainedAction(); // to free up
-  ActionFactory actionFactory;
-  for (unsigned i = 0; i != ActionList.size(); ++i) {
-    const char * actionType = ActionTypeToString(ActionList[i]);
-    Action *action = actionFactory.createAction(actionType);
-    if (action)
-      actionList->addAction(action);
-  }
+  ChainedAction *actionList = createActions(); // to free up
 
   WithColor stringOuts = WithColor(outs(), raw_ostream::GREEN);
   stringOuts << "====== Enabled actions ======\n\n";
@@ -144,6 +841,44 @@ int main(int argc, char **argv, char * const *envp) {
 
   outs() << RegisterAccess << "  register access\n";
 
+  GuestFileSystem &GFS = GuestFileSystem::instance();
+  for (StringRef Spec : PreloadFiles) {
+    StringRef GuestPath, HostPath;
+    std::tie(GuestPath, HostPath) = Spec.split('=');
+    ExitOnErr(GFS.preload(GuestPath, HostPath.empty() ? GuestPath : HostPath));
+  }
+  GFS.setZeroCopy(PreloadZeroCopy);
+
+  if (!BatchInputs.empty() || GenerateInputs != wyverse::InputMode::None)
+    return runBatchMode(envp);
+  if (TheTraceFilter) {
+    WithColor::error(errs(), argv[0]) << "-trace-insts needs batch mode\n";
+    return 1;
+  }
+  if (FaultCampaignOpt) {
+    WithColor::error(errs(), argv[0]) << "-fault-campaign needs batch mode\n";
+    return 1;
+  }
+  if (StaticTaint) {
+    WithColor::error(errs(), argv[0]) << "-static-taint needs batch mode\n";
+    return 1;
+  }
+  // The analyses work on the traces of many runs.
+  for (ActionType A : {cpa, tvla, snr})
+    if (isActionEnabled(A)) {
+      WithColor::error(errs(), argv[0])
+        << "the " << ActionTypeToString(A) << " action needs batch mode\n";
+      return 1;
+    }
+  // Without a run input, an argument source has no default size.
+  if (any_of(TheTaintSources, [](const TaintSource &S) {
+        return S.K == TaintSource::Argument && !S.Size;
+      })) {
+    WithColor::error(errs(), argv[0])
+      << "-taint-source arg:N needs a SIZE outside batch mode\n";
+    return 1;
+  }
+
   LLVMContext Context;
 
   // Load the bitcode...
@@ -153,6 +888,9 @@ int main(int argc, char **argv, char * const *envp) {
   if (!Mod)
     reportError(Err, argv[0]);
 
+  // Numbers the instructions for the faults, as in batch mode.
+  InstructionIndex Index(*Mod);
+
   std::string ErrorMsg;
   EngineBuilder builder(std::move(Owner));
   builder.setErrorStr(&ErrorMsg);
@@ -175,8 +913,10 @@ int main(int argc, char **argv, char * const *envp) {
     std::unique_ptr<Module> XMod = parseIRFile(ExtraModules[i], Err, Context);
     if (!XMod)
       reportError(Err, argv[0]);
+    Index.addModule(*XMod);
     EE->addModule(std::move(XMod));
   }
+  actionList->setInstructionIndex(&Index);
 
   // If the user specifically requested an argv[0] to pass into the program,
   // do it now.